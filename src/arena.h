@@ -0,0 +1,52 @@
+#ifndef TOG_ARENA_H
+#define TOG_ARENA_H
+
+#include <cstddef>
+#include <memory_resource>
+#include <new>
+#include <utility>
+
+namespace tog {
+
+// An arena is a bump allocator for objects that share the same lifetime, such
+// as the objects loaded during a single commit or checkout. Allocations are
+// carved out of large blocks, and all memory is freed at once by clear().
+//
+// Note that the arena does not run destructors; this is the responsibility of
+// whoever creates objects in it.
+class Arena {
+public:
+    explicit Arena(std::size_t initial_size = 64 * 1024)
+        : _resource{initial_size} {}
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* allocate(std::size_t size, std::size_t alignment) {
+        return _resource.allocate(size, alignment);
+    }
+
+    // constructs a T in the arena
+    template <class T, class... Args>
+    T* create(Args&&... args) {
+        return new (allocate(sizeof(T), alignof(T)))
+            T(std::forward<Args>(args)...);
+    }
+
+    // frees all memory allocated from this arena
+    void clear() {
+        _resource.release();
+    }
+
+    // allows using the arena with std::pmr containers
+    std::pmr::memory_resource* resource() {
+        return &_resource;
+    }
+
+private:
+    std::pmr::monotonic_buffer_resource _resource;
+};
+
+}  // namespace tog
+
+#endif  // TOG_ARENA_H
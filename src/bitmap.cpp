@@ -0,0 +1,297 @@
+#include "bitmap.h"
+
+#include <algorithm>
+#include <bit>
+#include <limits>
+
+namespace tog {
+
+namespace {
+
+// the layout of a marker word: bit 0 is the bit of the run, bits 1-32 hold
+// the length of the run, and bits 33-63 the number of literal words
+constexpr std::uint64_t max_run = (std::uint64_t{1} << 32) - 1;
+constexpr std::uint64_t max_literals = (std::uint64_t{1} << 31) - 1;
+
+constexpr std::uint64_t ones = ~std::uint64_t{0};
+
+bool run_bit(std::uint64_t marker) {
+    return marker & 1;
+}
+
+std::uint64_t run_length(std::uint64_t marker) {
+    return (marker >> 1) & max_run;
+}
+
+std::uint64_t literal_count(std::uint64_t marker) {
+    return marker >> 33;
+}
+
+std::uint64_t make_marker(bool bit, std::uint64_t run, std::uint64_t literals) {
+    return std::uint64_t{bit} | (run << 1) | (literals << 33);
+}
+
+}  // namespace
+
+// appends words to a compressed bitmap, merging runs where possible
+class EwahBitmap::Builder {
+public:
+    void add_run(bool bit, std::uint64_t length) {
+        while (length > 0) {
+            auto& marker = current();
+
+            // a run can only be extended if no literals follow it yet
+            if (literal_count(marker) == 0 &&
+                (run_length(marker) == 0 || run_bit(marker) == bit) &&
+                run_length(marker) < max_run) {
+                auto n = std::min(length, max_run - run_length(marker));
+                marker = make_marker(bit, run_length(marker) + n, 0);
+                length -= n;
+            } else {
+                start_marker();
+            }
+        }
+    }
+
+    void add_word(std::uint64_t word) {
+        if (word == 0 || word == ones) {
+            add_run(word == ones, 1);
+            return;
+        }
+
+        if (literal_count(current()) == max_literals) {
+            start_marker();
+        }
+
+        auto& marker = current();
+        marker = make_marker(run_bit(marker), run_length(marker),
+                             literal_count(marker) + 1);
+        _buffer.push_back(word);
+    }
+
+    EwahBitmap finish() {
+        // trailing zeros are implied, so they need not be stored
+        if (!_buffer.empty() && literal_count(_buffer[_marker]) == 0 &&
+            !run_bit(_buffer[_marker])) {
+            _buffer.pop_back();
+        }
+
+        EwahBitmap bitmap;
+        bitmap._buffer = std::move(_buffer);
+
+        return bitmap;
+    }
+
+private:
+    std::uint64_t& current() {
+        if (_buffer.empty()) {
+            start_marker();
+        }
+
+        return _buffer[_marker];
+    }
+
+    void start_marker() {
+        _marker = _buffer.size();
+        _buffer.push_back(0);
+    }
+
+    std::vector<std::uint64_t> _buffer;
+    std::size_t _marker = 0;
+};
+
+// reads the words of a compressed bitmap one run or literal at a time. Past
+// the end, the bitmap reads as an endless run of zeros.
+class EwahBitmap::Cursor {
+public:
+    explicit Cursor(const std::vector<std::uint64_t>& buffer)
+        : _buffer{buffer} {
+        load();
+    }
+
+    bool done() const {
+        return _position >= _buffer.size() && _run == 0 && _literals == 0;
+    }
+
+    // whether the current word is part of a run, and if so, how many words
+    // the run has left
+    bool in_run() const {
+        return _literals == 0 || _run > 0;
+    }
+
+    std::uint64_t run_left() const {
+        return done() ? std::numeric_limits<std::uint64_t>::max() : _run;
+    }
+
+    std::uint64_t word() const {
+        if (_run > 0) {
+            return _bit ? ones : 0;
+        }
+
+        return _literals > 0 ? _buffer[_position] : 0;
+    }
+
+    void skip(std::uint64_t words) {
+        while (words > 0 && !done()) {
+            if (_run > 0) {
+                auto n = std::min(words, _run);
+                _run -= n;
+                words -= n;
+            } else {
+                ++_position;
+                --_literals;
+                --words;
+            }
+
+            if (_run == 0 && _literals == 0) {
+                load();
+            }
+        }
+    }
+
+private:
+    // reads the next marker, skipping empty ones
+    void load() {
+        while (_run == 0 && _literals == 0 && _position < _buffer.size()) {
+            auto marker = _buffer[_position++];
+
+            _bit = run_bit(marker);
+            _run = run_length(marker);
+            _literals = literal_count(marker);
+        }
+    }
+
+    const std::vector<std::uint64_t>& _buffer;
+
+    // the position of the next literal (or marker)
+    std::size_t _position = 0;
+
+    bool _bit = false;
+    std::uint64_t _run = 0;
+    std::uint64_t _literals = 0;
+};
+
+EwahBitmap EwahBitmap::compress(std::span<const std::uint64_t> words) {
+    Builder builder;
+
+    for (auto word : words) {
+        builder.add_word(word);
+    }
+
+    return builder.finish();
+}
+
+std::optional<EwahBitmap> EwahBitmap::from_buffer(
+    std::vector<std::uint64_t> buffer) {
+    // every marker must be followed by as many literals as it announces
+    for (std::size_t position = 0; position < buffer.size();) {
+        auto literals = literal_count(buffer[position]);
+
+        if (literals >= buffer.size() - position) {
+            return std::nullopt;
+        }
+
+        position += literals + 1;
+    }
+
+    EwahBitmap bitmap;
+    bitmap._buffer = std::move(buffer);
+
+    return bitmap;
+}
+
+void EwahBitmap::decompress_into(std::vector<std::uint64_t>& words) const {
+    std::size_t index = 0;
+
+    for (Cursor cursor{_buffer}; !cursor.done();) {
+        auto n = cursor.in_run() ? cursor.run_left() : 1;
+
+        if (words.size() < index + n) {
+            words.resize(index + n);
+        }
+
+        // runs of zeros leave the words untouched
+        if (cursor.word() != 0) {
+            for (std::size_t i = 0; i < n; ++i) {
+                words[index + i] |= cursor.word();
+            }
+        }
+
+        index += n;
+        cursor.skip(n);
+    }
+}
+
+std::vector<std::size_t> EwahBitmap::positions() const {
+    std::vector<std::size_t> positions;
+    std::size_t index = 0;
+
+    for (Cursor cursor{_buffer}; !cursor.done();) {
+        auto n = cursor.in_run() ? cursor.run_left() : 1;
+
+        if (auto word = cursor.word(); word != 0) {
+            for (std::size_t i = 0; i < n; ++i) {
+                for (auto bits = word; bits != 0; bits &= bits - 1) {
+                    positions.push_back((index + i) * 64 +
+                                        std::countr_zero(bits));
+                }
+            }
+        }
+
+        index += n;
+        cursor.skip(n);
+    }
+
+    return positions;
+}
+
+std::size_t EwahBitmap::count() const {
+    std::size_t count = 0;
+
+    for (Cursor cursor{_buffer}; !cursor.done();) {
+        auto n = cursor.in_run() ? cursor.run_left() : 1;
+        count += n * std::popcount(cursor.word());
+        cursor.skip(n);
+    }
+
+    return count;
+}
+
+template <class Op>
+EwahBitmap EwahBitmap::combine(const EwahBitmap& other, Op op) const {
+    Builder builder;
+    Cursor a{_buffer};
+    Cursor b{other._buffer};
+
+    while (!a.done() || !b.done()) {
+        // runs in both bitmaps are combined in one step
+        if (a.in_run() && b.in_run()) {
+            auto n = std::min(a.run_left(), b.run_left());
+            builder.add_run(op(a.word(), b.word()) == ones, n);
+
+            a.skip(n);
+            b.skip(n);
+        } else {
+            builder.add_word(op(a.word(), b.word()));
+
+            a.skip(1);
+            b.skip(1);
+        }
+    }
+
+    return builder.finish();
+}
+
+EwahBitmap EwahBitmap::operator|(const EwahBitmap& other) const {
+    return combine(other, [](auto a, auto b) { return a | b; });
+}
+
+EwahBitmap EwahBitmap::operator&(const EwahBitmap& other) const {
+    return combine(other, [](auto a, auto b) { return a & b; });
+}
+
+EwahBitmap EwahBitmap::and_not(const EwahBitmap& other) const {
+    return combine(other, [](auto a, auto b) { return a & ~b; });
+}
+
+}  // namespace tog
@@ -0,0 +1,92 @@
+#ifndef TOG_BITMAP_H
+#define TOG_BITMAP_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <vector>
+
+namespace tog {
+
+// A fixed-size bitmap whose bits can be set concurrently by several threads,
+// e.g. to mark objects while walking the object graph in parallel.
+class AtomicBitmap {
+public:
+    explicit AtomicBitmap(std::size_t size) : _words((size + 63) / 64) {}
+
+    // sets the given bit, and returns true if it was not set before. Exactly
+    // one of several threads setting the same bit gets true.
+    bool set(std::size_t index) {
+        auto bit = mask(index);
+        return !(_words[index / 64].fetch_or(bit, std::memory_order_relaxed) &
+                 bit);
+    }
+
+    bool test(std::size_t index) const {
+        return _words[index / 64].load(std::memory_order_relaxed) & mask(index);
+    }
+
+private:
+    static std::uint64_t mask(std::size_t index) {
+        return std::uint64_t{1} << (index % 64);
+    }
+
+    std::vector<std::atomic<std::uint64_t>> _words;
+};
+
+// A bitmap compressed with EWAH (enhanced word-aligned hybrid), the format of
+// git's reachability bitmaps. The bitmap is split into 64-bit words, and runs
+// of words that are all zeros or all ones are stored as a single marker word.
+// Each marker holds the bit and length of a run, followed by the number of
+// literal (i.e. mixed) words that are stored verbatim after the marker.
+//
+// Set operations work directly on the compressed words, skipping over runs
+// in one step, so combining the bitmaps of large repositories is cheap.
+class EwahBitmap {
+public:
+    EwahBitmap() = default;
+
+    // compresses the given (uncompressed) bitmap
+    static EwahBitmap compress(std::span<const std::uint64_t> words);
+
+    // restores a bitmap from the words returned by buffer(). Returns
+    // std::nullopt if the words are not a valid compressed bitmap.
+    static std::optional<EwahBitmap> from_buffer(
+        std::vector<std::uint64_t> buffer);
+
+    // sets all bits of this bitmap in the given uncompressed bitmap, which is
+    // enlarged if needed
+    void decompress_into(std::vector<std::uint64_t>& words) const;
+
+    // returns the positions of all set bits, in ascending order
+    std::vector<std::size_t> positions() const;
+
+    // returns the number of set bits
+    std::size_t count() const;
+
+    EwahBitmap operator|(const EwahBitmap& other) const;
+    EwahBitmap operator&(const EwahBitmap& other) const;
+
+    // returns all bits that are set in this bitmap, but not in other
+    EwahBitmap and_not(const EwahBitmap& other) const;
+
+    // the compressed words
+    const std::vector<std::uint64_t>& buffer() const {
+        return _buffer;
+    }
+
+private:
+    class Builder;
+    class Cursor;
+
+    template <class Op>
+    EwahBitmap combine(const EwahBitmap& other, Op op) const;
+
+    std::vector<std::uint64_t> _buffer;
+};
+
+}  // namespace tog
+
+#endif  // TOG_BITMAP_H
@@ -0,0 +1,170 @@
+#include "bitmap_index.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string_view>
+#include <system_error>
+
+#include "file.h"
+
+namespace fs = std::filesystem;
+
+namespace tog {
+
+namespace {
+
+// The file starts with the magic bytes, followed by the number of objects and
+// their ids, and the number of bitmaps. Each bitmap is stored as the position
+// of its commit, the number of compressed words, and the words themselves.
+// All integers are 64 bits wide, in host byte order.
+constexpr std::string_view magic = "TOGBMP01";
+
+void append(std::vector<unsigned char>& out, const void* data,
+            std::size_t size) {
+    auto bytes = static_cast<const unsigned char*>(data);
+    out.insert(out.end(), bytes, bytes + size);
+}
+
+void append(std::vector<unsigned char>& out, std::uint64_t value) {
+    append(out, &value, sizeof(value));
+}
+
+// reads from a loaded index file, checking all bounds
+class Reader {
+public:
+    explicit Reader(const std::vector<unsigned char>& data) : _data{data} {}
+
+    void read(void* out, std::size_t size) {
+        if (size > _data.size() - _position) {
+            throw std::runtime_error{"corrupt bitmap index"};
+        }
+
+        std::memcpy(out, _data.data() + _position, size);
+        _position += size;
+    }
+
+    std::uint64_t read_integer() {
+        std::uint64_t value;
+        read(&value, sizeof(value));
+
+        return value;
+    }
+
+    std::size_t remaining() const {
+        return _data.size() - _position;
+    }
+
+private:
+    const std::vector<unsigned char>& _data;
+    std::size_t _position = 0;
+};
+
+}  // namespace
+
+std::optional<BitmapIndex> BitmapIndex::load(const fs::path& path) {
+    std::vector<unsigned char> data;
+
+    if (auto err = read_file(path, data)) {
+        if (err == std::errc::no_such_file_or_directory) {
+            return std::nullopt;
+        }
+
+        throw std::system_error{err, "unable to read bitmap index"};
+    }
+
+    Reader reader{data};
+    char header[magic.size()];
+    reader.read(header, sizeof(header));
+
+    if (std::string_view{header, sizeof(header)} != magic) {
+        throw std::runtime_error{"corrupt bitmap index"};
+    }
+
+    auto object_count = reader.read_integer();
+
+    if (object_count > reader.remaining() / ObjectId::size) {
+        throw std::runtime_error{"corrupt bitmap index"};
+    }
+
+    std::vector<ObjectId> objects(object_count);
+
+    for (auto& id : objects) {
+        reader.read(id.bytes.data(), id.bytes.size());
+    }
+
+    BitmapIndex index{std::move(objects)};
+
+    for (auto bitmap_count = reader.read_integer(); bitmap_count > 0;
+         --bitmap_count) {
+        auto commit = reader.read_integer();
+        auto word_count = reader.read_integer();
+
+        if (commit >= index.size() ||
+            word_count > reader.remaining() / sizeof(std::uint64_t)) {
+            throw std::runtime_error{"corrupt bitmap index"};
+        }
+
+        std::vector<std::uint64_t> words(word_count);
+        reader.read(words.data(), word_count * sizeof(std::uint64_t));
+
+        auto bitmap = EwahBitmap::from_buffer(std::move(words));
+
+        if (!bitmap) {
+            throw std::runtime_error{"corrupt bitmap index"};
+        }
+
+        index.add(static_cast<std::uint32_t>(commit), std::move(*bitmap));
+    }
+
+    return index;
+}
+
+void BitmapIndex::save(const fs::path& path) const {
+    std::vector<unsigned char> data;
+
+    append(data, magic.data(), magic.size());
+    append(data, _objects.size());
+
+    for (const auto& id : _objects) {
+        append(data, id.bytes.data(), id.bytes.size());
+    }
+
+    // write the bitmaps ordered by commit, so the file is deterministic
+    std::vector<std::uint32_t> commits;
+
+    for (const auto& [commit, bitmap] : _bitmaps) {
+        commits.push_back(commit);
+    }
+
+    std::sort(commits.begin(), commits.end());
+    append(data, commits.size());
+
+    for (auto commit : commits) {
+        const auto& words = _bitmaps.at(commit).buffer();
+
+        append(data, commit);
+        append(data, words.size());
+        append(data, words.data(), words.size() * sizeof(std::uint64_t));
+    }
+
+    auto tmp_path = fs::path{path}.concat(".tmp");
+
+    if (auto err = write_file(tmp_path, data)) {
+        throw std::system_error{err, "unable to write bitmap index"};
+    }
+
+    fs::rename(tmp_path, path);
+}
+
+std::optional<std::uint32_t> BitmapIndex::position(const ObjectId& id) const {
+    auto it = std::lower_bound(_objects.begin(), _objects.end(), id);
+
+    if (it == _objects.end() || *it != id) {
+        return std::nullopt;
+    }
+
+    return static_cast<std::uint32_t>(it - _objects.begin());
+}
+
+}  // namespace tog
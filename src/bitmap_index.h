@@ -0,0 +1,74 @@
+#ifndef TOG_BITMAP_INDEX_H
+#define TOG_BITMAP_INDEX_H
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#include "bitmap.h"
+#include "object.h"
+
+namespace tog {
+
+// The reachability bitmap index, stored in .tog/bitmaps. It assigns every
+// object that existed when the index was written a position (its index in
+// the sorted list of those objects), and stores, for selected commits, a
+// compressed bitmap of the positions of all objects reachable from the
+// commit. The set of objects reachable from one commit but not another can
+// then be computed with bitmap operations, without walking any trees.
+//
+// Objects created after the index was written have no position. Since objects
+// never change, the bitmaps of an index never become wrong, only incomplete.
+class BitmapIndex {
+public:
+    // creates an index (without any bitmaps) over the given objects, which
+    // must be sorted
+    explicit BitmapIndex(std::vector<ObjectId> objects = {})
+        : _objects{std::move(objects)} {}
+
+    // loads the index at the given path. Returns std::nullopt if there is no
+    // index, and throws a std::runtime_error if it is corrupt.
+    static std::optional<BitmapIndex> load(const std::filesystem::path& path);
+
+    // writes the index to the given path, atomically replacing any existing
+    // index
+    void save(const std::filesystem::path& path) const;
+
+    // returns the position of the given object, if it is in the index
+    std::optional<std::uint32_t> position(const ObjectId& id) const;
+
+    const ObjectId& object(std::uint32_t position) const {
+        return _objects[position];
+    }
+
+    // returns the number of objects in the index
+    std::size_t size() const {
+        return _objects.size();
+    }
+
+    // returns the bitmap of the commit at the given position, or nullptr if
+    // the commit has none
+    const EwahBitmap* bitmap(std::uint32_t commit) const {
+        auto it = _bitmaps.find(commit);
+        return it != _bitmaps.end() ? &it->second : nullptr;
+    }
+
+    void add(std::uint32_t commit, EwahBitmap bitmap) {
+        _bitmaps.insert_or_assign(commit, std::move(bitmap));
+    }
+
+    // returns the number of commits with a bitmap
+    std::size_t bitmap_count() const {
+        return _bitmaps.size();
+    }
+
+private:
+    std::vector<ObjectId> _objects;
+    std::unordered_map<std::uint32_t, EwahBitmap> _bitmaps;
+};
+
+}  // namespace tog
+
+#endif  // TOG_BITMAP_INDEX_H
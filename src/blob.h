@@ -1,7 +1,6 @@
 #ifndef TOG_BLOB_H
 #define TOG_BLOB_H
 
-#include <filesystem>
 #include <string>
 #include <vector>
 
@@ -12,10 +11,16 @@ namespace tog {
 // A blob is a sequence of bytes that corresponds to a file in the worktree
 struct Blob : public TogObject {
 public:
-    // Create a blob from file
-    Blob(const std::filesystem::path& path);
+    static constexpr ObjectKind kind = ObjectKind::blob;
+
+    // Create a blob from the given data (i.e. a file's contents)
+    Blob(std::vector<unsigned char>&& data) : _data{std::move(data)} {}
     const std::vector<unsigned char>& serialize();
 
+    std::size_t memory_size() const {
+        return sizeof(Blob) + _data.capacity();
+    }
+
     const std::vector<unsigned char>& data() const {
         return _data;
     }
@@ -1,10 +1,20 @@
 #include "cli.h"
 
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
 #include <filesystem>
+#include <functional>
+#include <iomanip>
 #include <iostream>
 #include <string>
+#include <thread>
 #include <vector>
 
+#include "connection.h"
 #include "repository.h"
 
 namespace fs = std::filesystem;
@@ -13,6 +23,25 @@ namespace tog::cli {
 
 using namespace tog;
 
+bool verbose = false;
+
+// prints the object cache statistics of the given repository in verbose mode
+static void print_stats(const Repository &repo) {
+    if (!verbose) {
+        return;
+    }
+
+    const auto &stats = repo.cache_stats();
+
+    std::cerr << "Object cache: " << stats.hits << " hits, " << stats.misses
+              << " misses, " << stats.evictions << " evictions" << std::endl;
+
+    if (auto fetched = repo.fetched_objects()) {
+        std::cerr << "Fetched " << fetched << " objects from the promisor"
+                  << std::endl;
+    }
+}
+
 tog::Repository load_repository() {
     const auto path = fs::current_path() / ".tog";
 
@@ -23,9 +52,9 @@ tog::Repository load_repository() {
     return Repository{path};
 }
 
-void init() {
+void init(const std::string &object_store) {
     try {
-        Repository::init(fs::current_path());
+        Repository::init(fs::current_path(), object_store);
     } catch (const TogException &err) {
         std::cerr << "Error " << err.what() << std::endl;
     }
@@ -33,24 +62,39 @@ void init() {
     std::cout << "Initialized tog repository" << std::endl;
 }
 
-void commit(const std::string &message) {
+void commit(const std::string &message, std::size_t max_memory) {
     try {
         auto repo = load_repository();
-        auto hash = repo.commit(message);
+        auto hash = repo.commit(message, max_memory);
 
         std::cout << "Created commit " << hash << std::endl;
 
+        if (auto ignored = repo.ignored_entries()) {
+            std::cout << "Skipped " << ignored << " ignored entries"
+                      << std::endl;
+        }
+
+        print_stats(repo);
+
     } catch (const std::exception &e) {
         std::cout << "Error: " << e.what() << std::endl;
     }
 }
 
-void checkout(const std::string &hash) {
+void checkout(const std::string &hash, bool hardlink) {
     try {
         auto repo = load_repository();
-        repo.checkout(hash);
+        repo.checkout(hash, hardlink);
 
-        std::cout << "Checked out commit " << hash << std::endl;
+        // a successful checkout always sets head
+        std::cout << "Checked out commit " << *repo.head() << std::endl;
+
+        if (auto replaced = repo.replaced_files()) {
+            std::cout << "Replaced " << replaced
+                      << " untracked files with the committed ones"
+                      << std::endl;
+        }
+        print_stats(repo);
 
     } catch (const std::exception &e) {
         std::cout << "Error: " << e.what() << std::endl;
@@ -66,29 +110,409 @@ void status() {
 
         std::cout << "On branch main" << std::endl;
 
+        // after fast-import, there can be commits but nothing checked out
         if (main) {
-            std::cout << "Current commit: " << *head << std::endl;
+            std::cout << "Current commit: "
+                      << head.value_or("none (run tog checkout)") << std::endl;
             std::cout << "Latest commit: " << *main << std::endl;
         } else {
             std::cout << "No commits yet" << std::endl;
         }
+
+        if (auto ignored = repo.count_ignored()) {
+            std::cout << "Ignored entries: " << ignored << std::endl;
+        }
+    } catch (const std::exception &e) {
+        std::cout << "Error: " << e.what() << std::endl;
+    }
+}
+
+void gc(long long grace) {
+    try {
+        auto repo = load_repository();
+        auto stats = repo.gc(std::chrono::seconds{grace});
+
+        std::cout << "Removed " << stats.removed << " of " << stats.objects
+                  << " objects, reclaimed " << stats.reclaimed << " bytes"
+                  << std::endl;
+
+        if (stats.recent > 0) {
+            std::cout << "Kept " << stats.recent
+                      << " unreachable objects within the grace period"
+                      << std::endl;
+        }
+
+        if (stats.temporary > 0) {
+            std::cout << "Removed " << stats.temporary
+                      << " temporary files of interrupted commits"
+                      << std::endl;
+        }
+    } catch (const std::exception &e) {
+        std::cout << "Error: " << e.what() << std::endl;
+    }
+}
+
+void fsck(bool incremental) {
+    try {
+        auto repo = load_repository();
+        auto start = std::chrono::steady_clock::now();
+
+        // prints e.g. "Verifying objects: 42% (420/1000), 310.5 MiB/s"
+        auto progress = [&](const FsckProgress &status) {
+            std::chrono::duration<double> elapsed =
+                std::chrono::steady_clock::now() - start;
+            auto percent =
+                status.total ? 100 * status.verified / status.total : 100;
+            auto throughput =
+                status.bytes / std::max(elapsed.count(), 0.001) / (1 << 20);
+
+            std::cerr << "\rVerifying objects: " << percent << "% ("
+                      << status.verified << "/" << status.total << "), "
+                      << std::fixed << std::setprecision(1) << throughput
+                      << " MiB/s" << std::flush;
+        };
+
+        auto report = repo.fsck(incremental, progress);
+        std::cerr << std::endl;
+
+        for (const auto &error : report.errors) {
+            std::cout << "error: " << error << std::endl;
+        }
+
+        std::cout << "Checked " << report.verified << " of " << report.objects
+                  << " objects (" << report.bytes << " bytes)" << std::endl;
+
+        if (report.unreachable > 0) {
+            std::cout << report.unreachable
+                      << " unreachable objects (run tog gc to remove them)"
+                      << std::endl;
+        }
+
+        if (report.errors.empty()) {
+            std::cout << "No errors found" << std::endl;
+        }
+    } catch (const std::exception &e) {
+        std::cout << "Error: " << e.what() << std::endl;
+    }
+}
+
+void bitmaps() {
+    try {
+        auto repo = load_repository();
+        auto stats = repo.write_bitmaps();
+
+        std::cout << "Wrote bitmaps for " << stats.commits << " commits ("
+                  << stats.objects << " objects, " << stats.reachable
+                  << " reachable from refs)" << std::endl;
+    } catch (const std::exception &e) {
+        std::cout << "Error: " << e.what() << std::endl;
+    }
+}
+
+void clone(const std::string &source, const std::string &destination,
+           bool hardlink, bool partial) {
+    try {
+        auto stats =
+            Repository::clone(source, destination, hardlink, partial);
+
+        std::cout << "Cloned " << stats.objects << " objects ("
+                  << stats.hardlinked << " hard-linked, " << stats.reflinked
+                  << " reflinked, " << stats.copied << " copied)"
+                  << std::endl;
+
+        if (stats.head) {
+            std::cout << "Checked out commit " << stats.head->hex()
+                      << std::endl;
+        }
+    } catch (const std::exception &e) {
+        std::cout << "Error: " << e.what() << std::endl;
+    }
+}
+
+// runs fn with a connection to the given remote repository (see push()). A
+// local repository is served by a second thread over a socket pair.
+static void with_remote(const std::string &remote, bool exec,
+                        const std::function<void(Connection &)> &fn) {
+    if (exec) {
+        ChildProcess child{remote};
+        Connection connection{child.out_fd(), child.in_fd()};
+        fn(connection);
+
+        if (child.wait() != 0) {
+            throw TogException{"remote command failed"};
+        }
+
+        return;
+    }
+
+    auto path = fs::path{remote} / ".tog";
+
+    if (!fs::exists(path)) {
+        throw TogException{remote + " is not a tog repository"};
+    }
+
+    Repository server{path};
+    int sockets[2];
+
+    if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets) < 0) {
+        throw TogException{"unable to create socket pair"};
+    }
+
+    FileDescriptor local{sockets[0]};
+    FileDescriptor server_socket{sockets[1]};
+
+    // errors are reported to the client through the connection
+    std::thread thread{[&server, &server_socket] {
+        Connection connection{server_socket.get(), server_socket.get()};
+
+        try {
+            server.serve(connection);
+        } catch (const std::exception &) {
+        }
+
+        server_socket = FileDescriptor{};
+    }};
+
+    try {
+        Connection connection{local.get(), local.get()};
+        fn(connection);
+    } catch (...) {
+        // closing our end unblocks the server thread
+        local = FileDescriptor{};
+        thread.join();
+        throw;
+    }
+
+    thread.join();
+}
+
+void push(const std::string &remote, bool exec) {
+    try {
+        auto repo = load_repository();
+
+        with_remote(remote, exec, [&repo](Connection &connection) {
+            auto stats = repo.push(connection);
+
+            std::cout << "Sent " << stats.transferred << " of "
+                      << stats.candidates << " objects (" << stats.bytes
+                      << " bytes)" << std::endl;
+
+            if (stats.old_main == stats.new_main) {
+                std::cout << "Everything up to date" << std::endl;
+            } else {
+                std::cout << "Updated remote main to "
+                          << stats.new_main->hex() << std::endl;
+            }
+        });
+    } catch (const std::exception &e) {
+        std::cout << "Error: " << e.what() << std::endl;
+    }
+}
+
+void pull(const std::string &remote, bool exec) {
+    try {
+        auto repo = load_repository();
+
+        with_remote(remote, exec, [&repo](Connection &connection) {
+            auto stats = repo.pull(connection);
+
+            std::cout << "Received " << stats.transferred << " of "
+                      << stats.candidates << " objects (" << stats.bytes
+                      << " bytes)" << std::endl;
+
+            if (stats.old_main == stats.new_main) {
+                std::cout << "Already up to date" << std::endl;
+            } else {
+                std::cout << "Updated main to " << stats.new_main->hex()
+                          << std::endl;
+            }
+        });
+    } catch (const std::exception &e) {
+        std::cout << "Error: " << e.what() << std::endl;
+    }
+}
+
+void serve() {
+    // stdout carries the protocol, so errors go to stderr
+    try {
+        auto repo = load_repository();
+        Connection connection{STDIN_FILENO, STDOUT_FILENO};
+
+        repo.serve(connection);
+    } catch (const std::exception &e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+    }
+}
+
+void refs(RefKind kind, const std::string &name, const std::string &commit,
+          bool force, bool remove) {
+    try {
+        auto repo = load_repository();
+        auto kind_name = kind == RefKind::branch ? "branch " : "tag ";
+
+        if (name.empty()) {
+            for (const auto &[ref, target] : repo.refs(kind)) {
+                std::cout << target << " " << ref << std::endl;
+            }
+        } else if (remove) {
+            repo.delete_ref(kind, name);
+            std::cout << "Deleted " << kind_name << name << std::endl;
+        } else {
+            auto created = repo.create_ref(
+                kind, name,
+                commit.empty() ? std::nullopt
+                               : std::optional<std::string>{commit},
+                force);
+            std::cout << (created ? "Created " : "Updated ") << kind_name
+                      << name << std::endl;
+        }
+    } catch (const std::exception &e) {
+        std::cout << "Error: " << e.what() << std::endl;
+    }
+}
+
+void pack_refs() {
+    try {
+        auto repo = load_repository();
+        auto packed = repo.pack_refs();
+
+        std::cout << "Packed " << packed << " refs" << std::endl;
+    } catch (const std::exception &e) {
+        std::cout << "Error: " << e.what() << std::endl;
+    }
+}
+
+void show(const std::string &object) {
+    // stdout carries the file, so errors go to stderr
+    try {
+        auto separator = object.find(':');
+
+        if (separator == std::string::npos) {
+            throw TogException{"expected <commit>:<path>"};
+        }
+
+        auto repo = load_repository();
+        repo.show(object.substr(0, separator), object.substr(separator + 1),
+                  STDOUT_FILENO);
+    } catch (const std::exception &e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+    }
+}
+
+void archive(const std::string &commit, std::string format,
+             const std::string &output) {
+    // stdout may carry the archive, so errors go to stderr
+    auto to_stdout = output == "-";
+
+    try {
+        if (format.empty()) {
+            auto compressed = output.ends_with(".tar.zst") ||
+                              output.ends_with(".tzst");
+            format = compressed ? "tar.zst" : "tar";
+        }
+
+        if (format != "tar" && format != "tar.zst") {
+            throw TogException{"unknown archive format " + format};
+        }
+
+        auto repo = load_repository();
+        FileDescriptor file;
+
+        if (!to_stdout) {
+            file = create_file(output);
+        }
+
+        auto out = to_stdout ? STDOUT_FILENO : file.get();
+
+        try {
+            if (format == "tar") {
+                repo.archive(commit, out);
+            } else {
+                // zstd writes the compressed archive straight to the output
+                // and exits early on errors, which must not kill tog
+                std::signal(SIGPIPE, SIG_IGN);
+                ChildProcess zstd{"zstd -q -c", out};
+
+                repo.archive(commit, zstd.in_fd());
+
+                if (zstd.wait() != 0) {
+                    throw TogException{"zstd failed"};
+                }
+            }
+        } catch (...) {
+            // leave no truncated archive behind
+            if (!to_stdout) {
+                fs::remove(output);
+            }
+
+            throw;
+        }
+    } catch (const std::exception &e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+    }
+}
+
+void fast_import() {
+    try {
+        auto repo = load_repository();
+        Connection input{STDIN_FILENO, STDOUT_FILENO};
+
+        auto stats = repo.fast_import(input, [](std::string_view text) {
+            std::cout << text << std::endl;
+        });
+
+        std::cout << "Imported " << stats.commits << " commits and "
+                  << stats.blobs << " blobs, updated " << stats.refs
+                  << " refs" << std::endl;
+    } catch (const std::exception &e) {
+        std::cout << "Error: " << e.what() << std::endl;
+    }
+}
+
+void fast_export(const std::string &range) {
+    // stdout carries the stream, so errors go to stderr
+    try {
+        auto repo = load_repository();
+        auto stats = repo.fast_export(range, STDOUT_FILENO);
+
+        if (verbose) {
+            std::cerr << "Exported " << stats.commits << " commits and "
+                      << stats.blobs << " blobs" << std::endl;
+        }
+
+        print_stats(repo);
+    } catch (const std::exception &e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+    }
+}
+
+void commit_graph() {
+    try {
+        auto repo = load_repository();
+        auto stats = repo.write_commit_graph();
+
+        std::cout << "Wrote commit graph of " << stats.commits << " commits ("
+                  << stats.computed << " filters computed, " << stats.reused
+                  << " reused)" << std::endl;
     } catch (const std::exception &e) {
         std::cout << "Error: " << e.what() << std::endl;
     }
 }
 
-void log(int history_length) {
+void log(int history_length, const std::string &path) {
     try {
         auto repo = load_repository();
-        auto history = repo.history(history_length);
+        auto history = repo.history(history_length, path);
 
-        if (history.empty()) {
+        if (history.empty() && path.empty()) {
             std::cout << "No commits yet" << std::endl;
         }
 
         for (const auto &hash : history) {
             std::cout << hash << std::endl;
         }
+
+        print_stats(repo);
     } catch (const std::exception &e) {
         std::cout << "Error: " << e.what() << std::endl;
     }
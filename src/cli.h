@@ -8,23 +8,87 @@
 
 namespace tog::cli {
 
+// if set, commands print statistics about their execution
+extern bool verbose;
+
 // helper function to load reposiotries
 tog::Repository load_repository();
 
-// initializes a new tog repository
-void init();
+// initializes a new tog repository, whose objects are kept in the given
+// object store backend
+void init(const std::string &object_store);
 
-// commits the current workdir contents with the given commit message
-void commit(const std::string &message);
+// commits the current workdir contents with the given commit message, holding
+// at most max_memory bytes of file contents in memory at once
+void commit(const std::string &message, std::size_t max_memory);
 
-// restores workdir contents to the commti with the given hash
-void checkout(const std::string &hash);
+// restores workdir contents to the commti with the given hash. If hardlink is
+// set, files are hard-linked to the object store instead of being copied.
+void checkout(const std::string &hash, bool hardlink);
 
 // prints out status information about the current branch/commit
 void status();
 
-// prints the hashes of the last n commits
-void log(int n);
+// removes unreachable objects that are older than the given number of seconds
+void gc(long long grace);
+
+// checks the integrity of the repository. If incremental is set, only objects
+// added since the last successful check are verified.
+void fsck(bool incremental);
+
+// writes the reachability bitmap index
+void bitmaps();
+
+// creates a copy of the repository at source in destination, sharing its
+// objects where possible. hardlink is passed on to checkout. A partial clone
+// fetches files from the source on demand.
+void clone(const std::string &source, const std::string &destination,
+           bool hardlink, bool partial);
+
+// sends the main branch to the given remote repository. If exec is set,
+// remote is a shell command that runs `tog serve` (e.g. over ssh), otherwise
+// it is the path of a local repository.
+void push(const std::string &remote, bool exec);
+
+// fetches the main branch of the given remote repository (see push())
+void pull(const std::string &remote, bool exec);
+
+// serves a push or pull over stdin/stdout
+void serve();
+
+// writes a file (or lists a directory) of a commit to stdout, given as
+// <commit>:<path>
+void show(const std::string &object);
+
+// writes a tar archive of the given commit to output ("-" for stdout), in
+// the given format ("tar" or "tar.zst"). If format is empty, it is inferred
+// from the output's extension, defaulting to "tar".
+void archive(const std::string &commit, std::string format,
+             const std::string &output);
+
+// imports a fast-import stream from stdin
+void fast_import();
+
+// writes the commits of the given range (see Repository::fast_export()) to
+// stdout as a fast-import stream
+void fast_export(const std::string &range);
+
+// writes the commit graph with changed-path filters
+void commit_graph();
+
+// prints the hashes of the last n commits, or of the last n commits that
+// changed the given path if it is not empty
+void log(int n, const std::string &path);
+
+// lists the branches or tags if name is empty, and otherwise creates (or with
+// force, moves) the given branch or tag, pointing to commit (or the current
+// commit if commit is empty). If remove is set, the branch or tag is deleted
+// instead.
+void refs(tog::RefKind kind, const std::string &name,
+          const std::string &commit, bool force, bool remove);
+
+// moves all branches and tags into a single file
+void pack_refs();
 
 }  // namespace tog::cli
 
@@ -5,9 +5,9 @@
 namespace tog {
 
 // TODO fix format in .clang-format
-Commit::Commit(Handle<Tree> tree, std::optional<Handle<Commit>> parent,
+Commit::Commit(ObjectId tree, std::optional<ObjectId> parent,
                std::string message)
-    : _tree{std::move(tree)}, _parent{parent}, _message{std::move(message)} {}
+    : _tree{tree}, _parent{parent}, _message{std::move(message)} {}
 
 const std::vector<unsigned char>& Commit::serialize() {
     // serialize lazily
@@ -18,8 +18,8 @@ const std::vector<unsigned char>& Commit::serialize() {
     // encode as toml
     auto commit_toml = toml::table{{
         {"message", _message},
-        {"tree", _tree.hash()},
-        {"parent", _parent ? _parent->hash() : ""},
+        {"tree", _tree.hex()},
+        {"parent", _parent ? _parent->hex() : ""},
     }};
 
     std::stringstream stream{};
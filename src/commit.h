@@ -5,21 +5,25 @@
 #include <optional>
 #include <string>
 
-#include "handle.h"
 #include "object.h"
-#include "tree.h"
 
 namespace tog {
 
 // A commit represents a single commit in a repository
 class Commit : public TogObject {
 public:
-    Commit(Handle<Tree> tree, std::optional<Handle<Commit>> parent,
-           std::string message);
+    Commit(ObjectId tree, std::optional<ObjectId> parent, std::string message);
+
+    static constexpr ObjectKind kind = ObjectKind::commit;
 
     const std::vector<unsigned char>& serialize();
 
-    Handle<Tree>& tree() {
+    std::size_t memory_size() const {
+        return sizeof(Commit) + _message.capacity() +
+               (_serialized ? _serialized->capacity() : 0);
+    }
+
+    const ObjectId& tree() const {
         return _tree;
     }
 
@@ -27,16 +31,16 @@ public:
         return _message;
     }
 
-    const std::optional<Handle<Commit>>& parent() {
+    const std::optional<ObjectId>& parent() const {
         return _parent;
     }
 
 private:
     // the top-level tree of the commit (i.e. the worktree)
-    Handle<Tree> _tree;
+    ObjectId _tree;
 
     // the preceding commit to this commit (if any)
-    std::optional<Handle<Commit>> _parent;
+    std::optional<ObjectId> _parent;
 
     // the user-specified commit message
     std::string _message;
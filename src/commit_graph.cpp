@@ -0,0 +1,233 @@
+#include "commit_graph.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+
+#include "file.h"
+
+namespace fs = std::filesystem;
+
+namespace tog {
+
+namespace {
+
+// The file starts with the magic bytes, followed by the number of commits and
+// their ids, and one node (parent position, filter size and filter offset)
+// per commit. Then follow the number of filter words and the words
+// themselves. All integers are in host byte order.
+constexpr std::string_view magic = "TOGCGR01";
+
+// the number of filter bits per changed path, and the number of bits set per
+// path, which give a false positive rate of about 1%
+constexpr std::size_t bits_per_path = 10;
+constexpr unsigned hashes_per_path = 7;
+
+void append(std::vector<unsigned char>& out, const void* data,
+            std::size_t size) {
+    auto bytes = static_cast<const unsigned char*>(data);
+    out.insert(out.end(), bytes, bytes + size);
+}
+
+void append(std::vector<unsigned char>& out, std::uint64_t value) {
+    append(out, &value, sizeof(value));
+}
+
+// reads from a loaded graph file, checking all bounds
+class Reader {
+public:
+    explicit Reader(const std::vector<unsigned char>& data) : _data{data} {}
+
+    void read(void* out, std::size_t size) {
+        if (size > _data.size() - _position) {
+            throw std::runtime_error{"corrupt commit graph"};
+        }
+
+        std::memcpy(out, _data.data() + _position, size);
+        _position += size;
+    }
+
+    std::uint64_t read_integer() {
+        std::uint64_t value;
+        read(&value, sizeof(value));
+
+        return value;
+    }
+
+    std::size_t remaining() const {
+        return _data.size() - _position;
+    }
+
+private:
+    const std::vector<unsigned char>& _data;
+    std::size_t _position = 0;
+};
+
+// Derives the bits of a path from two hashes (double hashing). The path is
+// hashed with FNV-1a, the second hash is a mix of the first.
+template <class F>
+void for_each_bit(std::string_view path, std::uint64_t bit_count, F f) {
+    std::uint64_t hash = 0xcbf29ce484222325;
+
+    for (auto c : path) {
+        hash = (hash ^ static_cast<unsigned char>(c)) * 0x100000001b3;
+    }
+
+    auto step = ((hash >> 29) ^ hash) * 0xbf58476d1ce4e5b9 | 1;
+
+    for (unsigned i = 0; i < hashes_per_path; ++i) {
+        f((hash + i * step) % bit_count);
+    }
+}
+
+}  // namespace
+
+CommitGraph::CommitGraph(std::vector<ObjectId> commits)
+    : _commits{std::move(commits)}, _nodes(_commits.size()) {}
+
+std::optional<CommitGraph> CommitGraph::load(const fs::path& path) {
+    std::vector<unsigned char> data;
+
+    if (auto err = read_file(path, data)) {
+        if (err == std::errc::no_such_file_or_directory) {
+            return std::nullopt;
+        }
+
+        throw std::system_error{err, "unable to read commit graph"};
+    }
+
+    Reader reader{data};
+    char header[magic.size()];
+    reader.read(header, sizeof(header));
+
+    if (std::string_view{header, sizeof(header)} != magic) {
+        throw std::runtime_error{"corrupt commit graph"};
+    }
+
+    auto commit_count = reader.read_integer();
+
+    if (commit_count >
+        reader.remaining() / (ObjectId::size + sizeof(Node))) {
+        throw std::runtime_error{"corrupt commit graph"};
+    }
+
+    std::vector<ObjectId> commits(commit_count);
+    reader.read(commits.data(), commit_count * ObjectId::size);
+
+    CommitGraph graph{std::move(commits)};
+    reader.read(graph._nodes.data(), commit_count * sizeof(Node));
+
+    auto word_count = reader.read_integer();
+
+    if (word_count != reader.remaining() / sizeof(std::uint64_t)) {
+        throw std::runtime_error{"corrupt commit graph"};
+    }
+
+    graph._filters.resize(word_count);
+    reader.read(graph._filters.data(), word_count * sizeof(std::uint64_t));
+
+    for (const auto& node : graph._nodes) {
+        if ((node.parent != none && node.parent >= commit_count) ||
+            (node.filter_size != none &&
+             node.filter_offset + node.filter_size > word_count)) {
+            throw std::runtime_error{"corrupt commit graph"};
+        }
+    }
+
+    return graph;
+}
+
+void CommitGraph::save(const fs::path& path) const {
+    std::vector<unsigned char> data;
+
+    append(data, magic.data(), magic.size());
+    append(data, _commits.size());
+    append(data, _commits.data(), _commits.size() * ObjectId::size);
+    append(data, _nodes.data(), _nodes.size() * sizeof(Node));
+    append(data, _filters.size());
+    append(data, _filters.data(), _filters.size() * sizeof(std::uint64_t));
+
+    auto tmp_path = fs::path{path}.concat(".tmp");
+
+    if (auto err = write_file(tmp_path, data)) {
+        throw std::system_error{err, "unable to write commit graph"};
+    }
+
+    fs::rename(tmp_path, path);
+}
+
+std::optional<std::uint32_t> CommitGraph::position(const ObjectId& id) const {
+    auto it = std::lower_bound(_commits.begin(), _commits.end(), id);
+
+    if (it == _commits.end() || *it != id) {
+        return std::nullopt;
+    }
+
+    return static_cast<std::uint32_t>(it - _commits.begin());
+}
+
+std::optional<std::uint32_t> CommitGraph::parent(std::uint32_t commit) const {
+    auto parent = _nodes[commit].parent;
+    return parent != none ? std::optional{parent} : std::nullopt;
+}
+
+std::optional<std::span<const std::uint64_t>> CommitGraph::filter(
+    std::uint32_t commit) const {
+    const auto& node = _nodes[commit];
+
+    if (node.filter_size == none) {
+        return std::nullopt;
+    }
+
+    return std::span{_filters}.subspan(node.filter_offset, node.filter_size);
+}
+
+void CommitGraph::set(std::uint32_t commit, std::optional<std::uint32_t> parent,
+                      std::optional<std::span<const std::uint64_t>> filter) {
+    auto& node = _nodes[commit];
+    node.parent = parent.value_or(none);
+
+    if (filter) {
+        node.filter_size = static_cast<std::uint32_t>(filter->size());
+        node.filter_offset = _filters.size();
+        _filters.insert(_filters.end(), filter->begin(), filter->end());
+    } else {
+        node.filter_size = none;
+    }
+}
+
+bool CommitGraph::may_have_changed(std::uint32_t commit,
+                                   std::string_view path) const {
+    auto words = filter(commit);
+
+    if (!words) {
+        return true;
+    } else if (words->empty()) {
+        // the commit did not change anything
+        return false;
+    }
+
+    bool match = true;
+
+    for_each_bit(path, words->size() * 64, [&](std::uint64_t bit) {
+        match = match && ((*words)[bit / 64] >> (bit % 64) & 1);
+    });
+
+    return match;
+}
+
+std::vector<std::uint64_t> CommitGraph::build_filter(
+    const std::vector<std::string>& paths) {
+    std::vector<std::uint64_t> words((paths.size() * bits_per_path + 63) / 64);
+
+    for (const auto& path : paths) {
+        for_each_bit(path, words.size() * 64, [&](std::uint64_t bit) {
+            words[bit / 64] |= std::uint64_t{1} << (bit % 64);
+        });
+    }
+
+    return words;
+}
+
+}  // namespace tog
@@ -0,0 +1,94 @@
+#ifndef TOG_COMMIT_GRAPH_H
+#define TOG_COMMIT_GRAPH_H
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "object.h"
+
+namespace tog {
+
+// The commit graph, stored in .tog/commit-graph. It lists every commit
+// reachable from the refs when it was written (sorted by id), together with
+// the position of its parent, so histories can be walked without reading any
+// commit objects.
+//
+// For each commit, it also stores a Bloom filter of the paths the commit
+// changed compared to its parent (including the directories containing
+// them). A commit whose filter does not match a path certainly did not change
+// it, so `tog log -- <path>` only needs to compare trees for the few commits
+// that match.
+class CommitGraph {
+public:
+    // commits that changed more paths than this get no filter, i.e. they
+    // match every path
+    static constexpr std::size_t max_changed_paths = 512;
+
+    // creates a graph of the given commits (without parents or filters),
+    // which must be sorted
+    explicit CommitGraph(std::vector<ObjectId> commits = {});
+
+    // loads the graph at the given path. Returns std::nullopt if there is no
+    // graph, and throws a std::runtime_error if it is corrupt.
+    static std::optional<CommitGraph> load(const std::filesystem::path& path);
+
+    // writes the graph to the given path, atomically replacing any existing
+    // graph
+    void save(const std::filesystem::path& path) const;
+
+    // returns the position of the given commit, if it is in the graph
+    std::optional<std::uint32_t> position(const ObjectId& id) const;
+
+    const ObjectId& commit(std::uint32_t position) const {
+        return _commits[position];
+    }
+
+    // returns the number of commits in the graph
+    std::size_t size() const {
+        return _commits.size();
+    }
+
+    // returns the position of the parent of the given commit
+    std::optional<std::uint32_t> parent(std::uint32_t commit) const;
+
+    // returns the filter of the given commit, or std::nullopt if it has none
+    std::optional<std::span<const std::uint64_t>> filter(
+        std::uint32_t commit) const;
+
+    // sets the parent and filter of the given commit
+    void set(std::uint32_t commit, std::optional<std::uint32_t> parent,
+             std::optional<std::span<const std::uint64_t>> filter);
+
+    // returns false if the given commit certainly did not change the given
+    // path (or anything below it)
+    bool may_have_changed(std::uint32_t commit, std::string_view path) const;
+
+    // builds the Bloom filter of the given changed paths
+    static std::vector<std::uint64_t> build_filter(
+        const std::vector<std::string>& paths);
+
+private:
+    static constexpr std::uint32_t none = UINT32_MAX;
+
+    struct Node {
+        std::uint32_t parent = none;
+
+        // the number of words of the commit's filter (none if it has no
+        // filter), and their offset in _filters
+        std::uint32_t filter_size = none;
+        std::uint64_t filter_offset = 0;
+    };
+
+    std::vector<ObjectId> _commits;
+    std::vector<Node> _nodes;
+    std::vector<std::uint64_t> _filters;
+};
+
+}  // namespace tog
+
+#endif  // TOG_COMMIT_GRAPH_H
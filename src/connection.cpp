@@ -0,0 +1,238 @@
+#include "connection.h"
+
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+
+namespace tog {
+
+namespace {
+
+constexpr std::size_t buffer_size = 128 * 1024;
+
+std::system_error last_error(const char* what) {
+    return std::system_error{errno, std::generic_category(), what};
+}
+
+void write_all(int fd, const char* data, std::size_t size) {
+    while (size > 0) {
+        auto n = ::write(fd, data, size);
+
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw last_error("write");
+        }
+
+        data += n;
+        size -= n;
+    }
+}
+
+}  // namespace
+
+Connection::Connection(int in_fd, int out_fd)
+    : _in_fd{in_fd}, _out_fd{out_fd}, _read_buffer(buffer_size) {
+    // a peer that exits early should surface as a write error (EPIPE), not
+    // kill the process
+    std::signal(SIGPIPE, SIG_IGN);
+}
+
+void Connection::write(const void* data, std::size_t size) {
+    auto bytes = static_cast<const char*>(data);
+
+    if (_write_buffer.size() + size > buffer_size) {
+        flush();
+    }
+
+    if (size >= buffer_size) {
+        write_all(_out_fd, bytes, size);
+    } else {
+        _write_buffer.insert(_write_buffer.end(), bytes, bytes + size);
+    }
+}
+
+void Connection::write_line(std::string_view line) {
+    write(line.data(), line.size());
+    write("\n", 1);
+}
+
+void Connection::write_from(int fd, std::uint64_t size) {
+    std::vector<char> buffer(buffer_size);
+
+    while (size > 0) {
+        auto n = ::read(fd, buffer.data(),
+                        std::min<std::uint64_t>(size, buffer.size()));
+
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw last_error("read");
+        } else if (n == 0) {
+            throw std::runtime_error{"file shrank while sending it"};
+        }
+
+        write(buffer.data(), n);
+        size -= n;
+    }
+}
+
+void Connection::flush() {
+    write_all(_out_fd, _write_buffer.data(), _write_buffer.size());
+    _write_buffer.clear();
+}
+
+void Connection::fill() {
+    if (at_end()) {
+        throw std::runtime_error{"connection closed unexpectedly"};
+    }
+}
+
+bool Connection::at_end() {
+    if (_read_position < _read_end) {
+        return false;
+    }
+
+    flush();
+
+    for (;;) {
+        auto n = ::read(_in_fd, _read_buffer.data(), _read_buffer.size());
+
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw last_error("read");
+        } else if (n == 0) {
+            return true;
+        }
+
+        _read_position = 0;
+        _read_end = n;
+        return false;
+    }
+}
+
+std::string Connection::read_line() {
+    std::string line;
+
+    for (;;) {
+        if (_read_position == _read_end) {
+            fill();
+        }
+
+        auto begin = _read_buffer.data() + _read_position;
+        auto end = _read_buffer.data() + _read_end;
+        auto newline = std::find(begin, end, '\n');
+
+        line.append(begin, newline);
+        _read_position += newline - begin;
+
+        if (newline != end) {
+            ++_read_position;
+            return line;
+        }
+    }
+}
+
+void Connection::read(void* data, std::size_t size) {
+    auto bytes = static_cast<char*>(data);
+
+    while (size > 0) {
+        if (_read_position == _read_end) {
+            fill();
+        }
+
+        auto n = std::min(size, _read_end - _read_position);
+        std::memcpy(bytes, _read_buffer.data() + _read_position, n);
+
+        _read_position += n;
+        bytes += n;
+        size -= n;
+    }
+}
+
+void Connection::read_into(int fd, std::uint64_t size) {
+    while (size > 0) {
+        if (_read_position == _read_end) {
+            fill();
+        }
+
+        auto n = std::min<std::uint64_t>(size, _read_end - _read_position);
+        write_all(fd, _read_buffer.data() + _read_position, n);
+
+        _read_position += n;
+        size -= n;
+    }
+}
+
+ChildProcess::ChildProcess(const std::string& command, int stdout_fd) {
+    int stdin_pipe[2];
+    int stdout_pipe[2];
+
+    if (::pipe2(stdin_pipe, O_CLOEXEC) < 0) {
+        throw last_error("pipe");
+    }
+
+    FileDescriptor child_stdin{stdin_pipe[0]};
+    _stdin = FileDescriptor{stdin_pipe[1]};
+    FileDescriptor child_stdout;
+
+    if (stdout_fd < 0) {
+        if (::pipe2(stdout_pipe, O_CLOEXEC) < 0) {
+            throw last_error("pipe");
+        }
+
+        _stdout = FileDescriptor{stdout_pipe[0]};
+        child_stdout = FileDescriptor{stdout_pipe[1]};
+        stdout_fd = child_stdout.get();
+    }
+
+    _pid = ::fork();
+
+    if (_pid < 0) {
+        throw last_error("fork");
+    } else if (_pid == 0) {
+        // dup2 clears O_CLOEXEC on the new descriptors
+        ::dup2(child_stdin.get(), STDIN_FILENO);
+
+        if (stdout_fd != STDOUT_FILENO) {
+            ::dup2(stdout_fd, STDOUT_FILENO);
+        } else {
+            ::fcntl(STDOUT_FILENO, F_SETFD, 0);
+        }
+
+        ::execl("/bin/sh", "sh", "-c", command.c_str(), nullptr);
+        ::_exit(127);
+    }
+}
+
+ChildProcess::~ChildProcess() {
+    if (_pid > 0) {
+        try {
+            wait();
+        } catch (const std::system_error&) {
+        }
+    }
+}
+
+int ChildProcess::wait() {
+    _stdin = FileDescriptor{};
+
+    int status;
+
+    while (::waitpid(_pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            throw last_error("waitpid");
+        }
+    }
+
+    _pid = -1;
+
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+}  // namespace tog
@@ -0,0 +1,106 @@
+#ifndef TOG_CONNECTION_H
+#define TOG_CONNECTION_H
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "file.h"
+
+namespace tog {
+
+// the first line of every sync session, identifying the protocol version
+inline constexpr std::string_view sync_greeting = "tog-sync 1";
+
+// A buffered, bidirectional byte stream between two repositories, e.g. a
+// socket or the stdin/stdout of a `tog serve` process. The sync protocol
+// consists of text lines, some of which are followed by raw object contents.
+// All methods throw a std::runtime_error if the peer goes away.
+class Connection {
+public:
+    // reads from in_fd and writes to out_fd, which may be the same. The file
+    // descriptors are not closed.
+    Connection(int in_fd, int out_fd);
+
+    Connection(const Connection&) = delete;
+    Connection& operator=(const Connection&) = delete;
+
+    // writes the given line (without the trailing newline)
+    void write_line(std::string_view line);
+
+    // writes the given bytes
+    void write(const void* data, std::size_t size);
+
+    // copies size bytes from the given file descriptor
+    void write_from(int fd, std::uint64_t size);
+
+    // sends all buffered data
+    void flush();
+
+    // reads the next line (without the trailing newline). Flushes first, as
+    // the peer may be waiting for our output before it responds.
+    std::string read_line();
+
+    // reads the next size bytes
+    void read(void* data, std::size_t size);
+
+    // copies the next size bytes to the given file descriptor
+    void read_into(int fd, std::uint64_t size);
+
+    // returns true if the peer has closed the stream and all of its data has
+    // been read. Waits for more data otherwise.
+    bool at_end();
+
+private:
+    // refills the (empty) read buffer
+    void fill();
+
+    int _in_fd;
+    int _out_fd;
+
+    std::vector<char> _read_buffer;
+    std::size_t _read_position = 0;
+    std::size_t _read_end = 0;
+
+    std::vector<char> _write_buffer;
+};
+
+// A child process running a shell command, connected through pipes to its
+// stdin and stdout. The process is waited for when the object is destroyed.
+class ChildProcess {
+public:
+    // If stdout_fd is given, the child writes to it directly rather than to a
+    // pipe (and out_fd() is invalid).
+    explicit ChildProcess(const std::string& command, int stdout_fd = -1);
+    ~ChildProcess();
+
+    ChildProcess(const ChildProcess&) = delete;
+    ChildProcess& operator=(const ChildProcess&) = delete;
+
+    // the read end of the child's stdout
+    int out_fd() const {
+        return _stdout.get();
+    }
+
+    // the write end of the child's stdin
+    int in_fd() const {
+        return _stdin.get();
+    }
+
+    // closes the child's stdin and waits for it to exit. Returns its exit
+    // status (or -1 if it was killed by a signal).
+    int wait();
+
+private:
+    pid_t _pid = -1;
+    FileDescriptor _stdin;
+    FileDescriptor _stdout;
+};
+
+}  // namespace tog
+
+#endif  // TOG_CONNECTION_H
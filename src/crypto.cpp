@@ -1,24 +1,45 @@
 #include "crypto.h"
 
 #include <cryptopp/cryptlib.h>
-#include <cryptopp/filters.h>
-#include <cryptopp/hex.h>
 #include <cryptopp/sha.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <system_error>
 
 namespace tog {
 
-std::string sha256(const std::vector<unsigned char> &data) {
+static_assert(CryptoPP::SHA256::DIGESTSIZE == ObjectId::size);
+
+ObjectId sha256(std::span<const unsigned char> data) {
+    ObjectId id;
+    CryptoPP::SHA256{}.CalculateDigest(id.bytes.data(), data.data(),
+                                       data.size());
+
+    return id;
+}
+
+ObjectId sha256(int fd) {
     CryptoPP::SHA256 hash;
-    std::string digest;
+    std::vector<unsigned char> buffer(256 * 1024);
+
+    for (;;) {
+        auto n = ::read(fd, buffer.data(), buffer.size());
+
+        if (n == 0) {
+            break;
+        } else if (n < 0) {
+            if (errno == EINTR) continue;
+            throw std::system_error{errno, std::generic_category(), "read"};
+        }
+
+        hash.Update(buffer.data(), n);
+    }
 
-    // CryptoPP assumes ownership of the created raw pointers, so no
-    // need to delete them.
-    auto sink = new CryptoPP::StringSink(digest);
-    auto hex = new CryptoPP::HexEncoder(sink);
-    auto filter = new CryptoPP::HashFilter(hash, hex);
-    CryptoPP::ArraySource(data.data(), data.size(), true, filter);
+    ObjectId id;
+    hash.Final(id.bytes.data());
 
-    return digest;
+    return id;
 }
 
-}  // namespace tog
\ No newline at end of file
+}  // namespace tog
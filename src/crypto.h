@@ -1,20 +1,26 @@
 #ifndef TOG_CRYPTO_H
 #define TOG_CRYPTO_H
 
-#include <string>
+#include <span>
 #include <vector>
 
+#include "object.h"
+
 namespace tog {
 
 // computes the SHA-256 hash of the given data
-std::string sha256(const std::vector<unsigned char>& data);
+ObjectId sha256(std::span<const unsigned char> data);
+
+// computes the SHA-256 hash of the contents of the given file descriptor,
+// reading it in chunks rather than loading the whole file into memory
+ObjectId sha256(int fd);
 
 // verifies that the given hash signature is valid for the given data
 inline bool verify_sha256(const std::vector<unsigned char>& data,
-                          const std::string& hash) {
+                          const ObjectId& hash) {
     return sha256(data) == hash;
 }
 
 }  // namespace tog
 
-#endif
\ No newline at end of file
+#endif
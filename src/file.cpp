@@ -0,0 +1,260 @@
+#include "file.h"
+
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <stdexcept>
+#include <system_error>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace tog {
+
+namespace {
+
+std::system_error last_error(const char* what) {
+    return std::system_error{errno, std::generic_category(), what};
+}
+
+// errors indicating that copy_file_range is not supported for the given pair
+// of files, in which case we fall back to a buffered copy
+bool unsupported(int error) {
+    return error == EXDEV || error == EINVAL || error == ENOSYS ||
+           error == EOPNOTSUPP || error == EBADF;
+}
+
+void buffered_copy(int in_fd, int out_fd) {
+    std::vector<char> buffer(128 * 1024);
+
+    for (;;) {
+        auto n = ::read(in_fd, buffer.data(), buffer.size());
+
+        if (n == 0) {
+            return;
+        } else if (n < 0) {
+            if (errno == EINTR) continue;
+            throw last_error("read");
+        }
+
+        for (ssize_t written = 0; written < n;) {
+            auto m = ::write(out_fd, buffer.data() + written, n - written);
+
+            if (m < 0) {
+                if (errno == EINTR) continue;
+                throw last_error("write");
+            }
+
+            written += m;
+        }
+    }
+}
+
+}  // namespace
+
+FileDescriptor::~FileDescriptor() {
+    if (_fd >= 0) {
+        ::close(_fd);
+    }
+}
+
+FileDescriptor& FileDescriptor::operator=(FileDescriptor&& other) noexcept {
+    if (this != &other) {
+        if (_fd >= 0) {
+            ::close(_fd);
+        }
+
+        _fd = other.release();
+    }
+
+    return *this;
+}
+
+CopyMethod copy_file(int in_fd, int out_fd) {
+    if (::lseek(in_fd, 0, SEEK_SET) < 0) {
+        throw last_error("lseek");
+    }
+
+    // reflinks share the underlying extents, so no data is copied at all
+    if (::ioctl(out_fd, FICLONE, in_fd) == 0) {
+        return CopyMethod::reflink;
+    }
+
+    struct stat st;
+    if (::fstat(in_fd, &st) != 0) {
+        throw last_error("fstat");
+    }
+
+    // copy_file_range lets the kernel (or the filesystem/storage) move the data
+    // without a round trip through user space. It may copy less than
+    // requested, so loop until EOF.
+    bool copied_any = false;
+
+    for (;;) {
+        auto n = ::copy_file_range(in_fd, nullptr, out_fd, nullptr,
+                                   st.st_size > 0 ? st.st_size : 1 << 30, 0);
+
+        if (n == 0) {
+            return CopyMethod::copy_file_range;
+        } else if (n < 0) {
+            if (errno == EINTR) continue;
+
+            // the file offsets are left untouched by a failed first call, so
+            // it is safe to start over with a buffered copy
+            if (!copied_any && unsupported(errno)) {
+                break;
+            }
+
+            throw last_error("copy_file_range");
+        }
+
+        copied_any = true;
+    }
+
+    buffered_copy(in_fd, out_fd);
+    return CopyMethod::buffered;
+}
+
+void send_file(int in_fd, std::uint64_t offset, std::uint64_t size,
+               int out_fd) {
+    // sendfile fails for some outputs (e.g. files opened with O_APPEND),
+    // which are written through a buffer instead
+    while (size > 0) {
+        off_t position = offset;
+        auto n = ::sendfile(out_fd, in_fd, &position,
+                            std::min<std::uint64_t>(size, 1 << 30));
+
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (unsupported(errno)) break;
+            throw last_error("sendfile");
+        } else if (n == 0) {
+            throw std::runtime_error{"file shrank while sending it"};
+        }
+
+        offset += n;
+        size -= n;
+    }
+
+    std::vector<char> buffer(size > 0 ? 128 * 1024 : 0);
+
+    while (size > 0) {
+        auto n = ::pread(in_fd, buffer.data(),
+                         std::min<std::uint64_t>(size, buffer.size()), offset);
+
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw last_error("read");
+        } else if (n == 0) {
+            throw std::runtime_error{"file shrank while sending it"};
+        }
+
+        write_all(out_fd, buffer.data(), n);
+        offset += n;
+        size -= n;
+    }
+}
+
+void write_all(int fd, const void* data, std::size_t size) {
+    auto bytes = static_cast<const char*>(data);
+
+    while (size > 0) {
+        auto n = ::write(fd, bytes, size);
+
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw last_error("write");
+        }
+
+        bytes += n;
+        size -= n;
+    }
+}
+
+FileDescriptor open_file(const fs::path& path) {
+    return FileDescriptor{::open(path.c_str(), O_RDONLY | O_CLOEXEC)};
+}
+
+FileDescriptor create_file(const fs::path& path) {
+    FileDescriptor fd{
+        ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666)};
+
+    if (!fd) {
+        throw last_error("open");
+    }
+
+    return fd;
+}
+
+std::error_code read_file(const fs::path& path,
+                          std::vector<unsigned char>& data) {
+    FileDescriptor fd{::open(path.c_str(), O_RDONLY | O_CLOEXEC)};
+
+    if (!fd) {
+        return {errno, std::generic_category()};
+    }
+
+    return read_file(fd.get(), data);
+}
+
+std::error_code read_file(int fd, std::vector<unsigned char>& data) {
+    struct stat st;
+
+    if (::fstat(fd, &st) != 0) {
+        return {errno, std::generic_category()};
+    }
+
+    data.resize(st.st_size);
+
+    for (std::size_t offset = 0; offset < data.size();) {
+        auto n = ::read(fd, data.data() + offset, data.size() - offset);
+
+        if (n == 0) {
+            // the file was truncated while reading it
+            data.resize(offset);
+        } else if (n < 0) {
+            if (errno == EINTR) continue;
+            return {errno, std::generic_category()};
+        }
+
+        offset += n;
+    }
+
+    return {};
+}
+
+std::error_code write_file(const fs::path& path,
+                           std::span<const unsigned char> data) {
+    FileDescriptor fd{
+        ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666)};
+
+    if (!fd) {
+        return {errno, std::generic_category()};
+    }
+
+    for (std::size_t offset = 0; offset < data.size();) {
+        auto n = ::write(fd.get(), data.data() + offset, data.size() - offset);
+
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return {errno, std::generic_category()};
+        }
+
+        offset += n;
+    }
+
+    // close may report a deferred write error
+    if (::close(fd.release()) != 0) {
+        return {errno, std::generic_category()};
+    }
+
+    return {};
+}
+
+}  // namespace tog
@@ -0,0 +1,84 @@
+#ifndef TOG_FILE_H
+#define TOG_FILE_H
+
+#include <cstdint>
+#include <filesystem>
+#include <span>
+#include <system_error>
+#include <vector>
+
+namespace tog {
+
+// A file descriptor that is closed when it goes out of scope.
+class FileDescriptor {
+public:
+    FileDescriptor() = default;
+    explicit FileDescriptor(int fd) : _fd{fd} {}
+    ~FileDescriptor();
+
+    FileDescriptor(FileDescriptor&& other) noexcept : _fd{other.release()} {}
+    FileDescriptor& operator=(FileDescriptor&& other) noexcept;
+
+    FileDescriptor(const FileDescriptor&) = delete;
+    FileDescriptor& operator=(const FileDescriptor&) = delete;
+
+    int get() const {
+        return _fd;
+    }
+
+    explicit operator bool() const {
+        return _fd >= 0;
+    }
+
+    // gives up ownership of the file descriptor without closing it
+    int release() {
+        int fd = _fd;
+        _fd = -1;
+        return fd;
+    }
+
+private:
+    int _fd = -1;
+};
+
+// describes how copy_file transferred the data
+enum class CopyMethod { reflink, copy_file_range, buffered };
+
+// copies the entire contents of in_fd (regardless of its offset) into out_fd,
+// which is expected to be an empty file. The data is moved kernel-side if
+// possible: first, the file is reflinked (on filesystems with copy-on-write
+// support such as btrfs or XFS), then copy_file_range is tried, and finally the
+// data is copied through a buffer in user space. Throws a std::system_error if
+// all methods fail.
+CopyMethod copy_file(int in_fd, int out_fd);
+
+// writes size bytes from in_fd, starting at the given offset, to out_fd
+// (e.g. stdout). The data is moved kernel-side with sendfile where possible,
+// and copied through a buffer otherwise. Throws a std::system_error on
+// failure.
+void send_file(int in_fd, std::uint64_t offset, std::uint64_t size,
+               int out_fd);
+
+// writes all of data to the given file descriptor, throwing a
+// std::system_error on failure
+void write_all(int fd, const void* data, std::size_t size);
+
+// opens the given file for reading. Returns an invalid descriptor if the file
+// does not exist.
+FileDescriptor open_file(const std::filesystem::path& path);
+
+// creates (or truncates) the given file for writing
+FileDescriptor create_file(const std::filesystem::path& path);
+
+// reads the entire contents of the given file into data
+std::error_code read_file(const std::filesystem::path& path,
+                          std::vector<unsigned char>& data);
+std::error_code read_file(int fd, std::vector<unsigned char>& data);
+
+// writes data to the given file, which is created or truncated
+std::error_code write_file(const std::filesystem::path& path,
+                           std::span<const unsigned char> data);
+
+}  // namespace tog
+
+#endif  // TOG_FILE_H
@@ -1,8 +1,9 @@
 #ifndef TOG_HANDLE_H
 #define TOG_HANDLE_H
 
-#include <memory>
-#include <string>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
 
 namespace tog {
 
@@ -10,53 +11,35 @@ namespace tog {
 template <class T>
 
 // A handle represents a TogObject that may have not yet been loaded into
-// memory.
+// memory. It is an index into the repository's table of T objects (see
+// object_table.h), so it is trivially copyable and only four bytes large.
+// Handles are only valid until the repository releases its objects at the end
+// of an operation.
 class Handle {
 public:
     Handle() = default;
-    virtual ~Handle() = default;
 
-    // Constructs an unresolved handle to an existing object with a given hash.
-    Handle(std::string hash)
-        : _hash{std::move(hash)}, _dirty{false}, _object{nullptr} {};
+    explicit Handle(std::uint32_t index) : _index{index} {}
 
-    // Constructs a resolved handle to an existing object with a given hash.
-    Handle(std::string hash, std::shared_ptr<T> object, bool dirty)
-        : _hash{std::move(hash)}, _dirty{dirty}, _object{std::move(object)} {};
-
-    void resolve(std::shared_ptr<T> object) {
-        _object = std::move(object);
-        _dirty = false;
+    std::uint32_t index() const {
+        return _index;
     }
 
-    bool dirty() const {
-        return _dirty;
+    bool valid() const {
+        return _index != invalid;
     }
 
-    bool resolved() const {
-        return _object != nullptr;
-    }
-
-    const std::string& hash() const {
-        return _hash;
-    }
-
-    const std::shared_ptr<T>& object() const {
-        return _object;
-    }
+    bool operator==(const Handle&) const = default;
 
 private:
-    // The hash of the object referenced by this handle.
-    std::string _hash;
-
-    // Indicates whether the object referenced by this handle needs to be
-    // persisted on disk.
-    bool _dirty;
+    static constexpr std::uint32_t invalid =
+        std::numeric_limits<std::uint32_t>::max();
 
-    // The object referenced by this handle. This may be nullptr if the handle
-    // is not resolved yet.
-    std::shared_ptr<T> _object;
+    std::uint32_t _index = invalid;
 };
+
+static_assert(std::is_trivially_copyable_v<Handle<void>>);
+
 }  // namespace tog
 
-#endif  // TOG_REF_H
\ No newline at end of file
+#endif  // TOG_HANDLE_H
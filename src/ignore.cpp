@@ -0,0 +1,331 @@
+#include "ignore.h"
+
+#include <algorithm>
+
+#include "file.h"
+#include "scanner.h"
+
+namespace tog {
+
+IgnoreRules::IgnoreRules(std::string_view contents) {
+    while (!contents.empty()) {
+        auto end = contents.find('\n');
+        auto line = contents.substr(0, end);
+        contents.remove_prefix(end == std::string_view::npos ? contents.size()
+                                                             : end + 1);
+
+        auto rule = parse(line);
+
+        if (!rule) {
+            continue;
+        }
+
+        auto index = static_cast<std::uint32_t>(_rules.size());
+        const auto& tokens = rule->tokens;
+
+        if (!rule->anchored && tokens.size() == 1 &&
+            tokens[0].type == Token::Type::literal) {
+            _names[tokens[0].text].push_back(index);
+        } else if (!rule->anchored && tokens.size() == 2 &&
+                   tokens[0].type == Token::Type::star &&
+                   tokens[1].type == Token::Type::literal &&
+                   tokens[1].text.rfind('.') == 0) {
+            _extensions[tokens[1].text].push_back(index);
+        } else {
+            _patterns.push_back(index);
+        }
+
+        _rules.push_back(std::move(*rule));
+    }
+}
+
+std::optional<bool> IgnoreRules::match(std::string_view path,
+                                       std::string_view name,
+                                       bool directory) const {
+    std::int64_t best = -1;
+
+    if (auto it = _names.find(name); it != _names.end()) {
+        find_last(it->second, directory, best);
+    }
+
+    if (auto dot = name.rfind('.'); dot != std::string_view::npos) {
+        if (auto it = _extensions.find(name.substr(dot));
+            it != _extensions.end()) {
+            find_last(it->second, directory, best);
+        }
+    }
+
+    // only rules after the best match so far can change the result
+    for (auto it = _patterns.rbegin();
+         it != _patterns.rend() && static_cast<std::int64_t>(*it) > best;
+         ++it) {
+        const auto& rule = _rules[*it];
+
+        if (rule.directory_only && !directory) {
+            continue;
+        }
+
+        if (match(rule.tokens, 0, rule.anchored ? path : name)) {
+            best = *it;
+            break;
+        }
+    }
+
+    if (best < 0) {
+        return std::nullopt;
+    }
+
+    return !_rules[best].negated;
+}
+
+void IgnoreRules::find_last(const std::vector<std::uint32_t>& indices,
+                            bool directory, std::int64_t& best) const {
+    for (auto it = indices.rbegin(); it != indices.rend(); ++it) {
+        if (!_rules[*it].directory_only || directory) {
+            best = std::max(best, static_cast<std::int64_t>(*it));
+            return;
+        }
+    }
+}
+
+std::optional<IgnoreRules::Rule> IgnoreRules::parse(std::string_view line) {
+    Rule rule;
+
+    if (line.ends_with('\r')) {
+        line.remove_suffix(1);
+    }
+
+    // trailing spaces are ignored, unless they are escaped
+    while (line.ends_with(' ') && !line.ends_with("\\ ")) {
+        line.remove_suffix(1);
+    }
+
+    if (line.empty() || line[0] == '#') {
+        return std::nullopt;
+    }
+
+    if (line[0] == '!') {
+        rule.negated = true;
+        line.remove_prefix(1);
+    }
+
+    if (line.ends_with('/')) {
+        rule.directory_only = true;
+        line.remove_suffix(1);
+    }
+
+    // a separator at the beginning or in the middle anchors the pattern to
+    // the directory of the .togignore file
+    if (line.find('/') != std::string_view::npos) {
+        rule.anchored = true;
+
+        if (line[0] == '/') {
+            line.remove_prefix(1);
+        }
+    }
+
+    if (line.empty()) {
+        return std::nullopt;
+    }
+
+    rule.tokens = compile(line);
+
+    return rule;
+}
+
+std::vector<IgnoreRules::Token> IgnoreRules::compile(std::string_view pattern) {
+    std::vector<Token> tokens;
+
+    auto push = [&tokens](Token::Type type) {
+        tokens.push_back(Token{type});
+        return &tokens.back();
+    };
+
+    auto literal = [&](char c) {
+        if (tokens.empty() || tokens.back().type != Token::Type::literal) {
+            push(Token::Type::literal);
+        }
+
+        tokens.back().text.push_back(c);
+    };
+
+    for (std::size_t i = 0; i < pattern.size(); ++i) {
+        auto c = pattern[i];
+
+        if (c == '\\' && i + 1 < pattern.size()) {
+            literal(pattern[++i]);
+        } else if (c == '?') {
+            push(Token::Type::any);
+        } else if (c == '*') {
+            // ** only has a special meaning as a whole path component
+            bool component = i + 1 < pattern.size() && pattern[i + 1] == '*' &&
+                             (i == 0 || pattern[i - 1] == '/');
+
+            if (component && i > 0 && i + 2 == pattern.size()) {
+                push(Token::Type::rest);
+                break;
+            } else if (component && i + 2 < pattern.size() &&
+                       pattern[i + 2] == '/') {
+                push(Token::Type::directories);
+                i += 2;
+                continue;
+            }
+
+            while (i + 1 < pattern.size() && pattern[i + 1] == '*') {
+                ++i;
+            }
+
+            push(Token::Type::star);
+        } else if (c == '[') {
+            std::bitset<256> set;
+            auto j = i + 1;
+            bool negated = j < pattern.size() &&
+                           (pattern[j] == '!' || pattern[j] == '^');
+
+            if (negated) {
+                ++j;
+            }
+
+            // a ] right after the opening bracket is part of the set
+            for (auto first = j; j < pattern.size(); ++j) {
+                auto from = static_cast<unsigned char>(pattern[j]);
+
+                if (pattern[j] == ']' && j > first) {
+                    break;
+                } else if (pattern[j] == '\\' && j + 1 < pattern.size()) {
+                    from = static_cast<unsigned char>(pattern[++j]);
+                }
+
+                auto to = from;
+
+                if (j + 2 < pattern.size() && pattern[j + 1] == '-' &&
+                    pattern[j + 2] != ']') {
+                    to = static_cast<unsigned char>(pattern[j + 2]);
+                    j += 2;
+                }
+
+                for (unsigned ch = from; ch <= to; ++ch) {
+                    set.set(ch);
+                }
+            }
+
+            // without a closing bracket, [ is just a character
+            if (j >= pattern.size()) {
+                literal(c);
+                continue;
+            }
+
+            push(Token::Type::set)->set = negated ? ~set : set;
+            i = j;
+        } else {
+            literal(c);
+        }
+    }
+
+    return tokens;
+}
+
+bool IgnoreRules::match(const std::vector<Token>& tokens, std::size_t token,
+                        std::string_view text) {
+    for (; token < tokens.size(); ++token) {
+        const auto& current = tokens[token];
+
+        switch (current.type) {
+            case Token::Type::literal:
+                if (!text.starts_with(current.text)) {
+                    return false;
+                }
+
+                text.remove_prefix(current.text.size());
+                break;
+
+            case Token::Type::any:
+            case Token::Type::set:
+                if (text.empty() || text[0] == '/' ||
+                    (current.type == Token::Type::set &&
+                     !current.set[static_cast<unsigned char>(text[0])])) {
+                    return false;
+                }
+
+                text.remove_prefix(1);
+                break;
+
+            case Token::Type::star:
+                // a trailing * matches the rest of the path component
+                if (token + 1 == tokens.size()) {
+                    return text.find('/') == std::string_view::npos;
+                }
+
+                for (std::size_t length = 0;; ++length) {
+                    if (match(tokens, token + 1, text.substr(length))) {
+                        return true;
+                    } else if (length == text.size() || text[length] == '/') {
+                        return false;
+                    }
+                }
+
+            case Token::Type::directories:
+                for (std::size_t offset = 0;;) {
+                    if (match(tokens, token + 1, text.substr(offset))) {
+                        return true;
+                    }
+
+                    offset = text.find('/', offset);
+
+                    if (offset == std::string_view::npos) {
+                        return false;
+                    }
+
+                    ++offset;
+                }
+
+            case Token::Type::rest:
+                return !text.empty();
+        }
+    }
+
+    return text.empty();
+}
+
+void IgnoreMatcher::enter(int directory_fd, std::string_view path) {
+    std::unique_ptr<IgnoreRules> rules;
+
+    if (auto file = open_file_at(directory_fd, ".togignore")) {
+        std::vector<unsigned char> contents;
+
+        if (!read_file(file.get(), contents)) {
+            rules = std::make_unique<IgnoreRules>(std::string_view{
+                reinterpret_cast<const char*>(contents.data()),
+                contents.size()});
+        }
+    }
+
+    if (rules && rules->empty()) {
+        rules.reset();
+    }
+
+    _frames.push_back(Frame{path.size(), std::move(rules)});
+}
+
+void IgnoreMatcher::leave() {
+    _frames.pop_back();
+}
+
+bool IgnoreMatcher::ignored(std::string_view path, std::string_view name,
+                            bool directory) const {
+    // rules in deeper directories take precedence
+    for (auto it = _frames.rbegin(); it != _frames.rend(); ++it) {
+        if (!it->rules) {
+            continue;
+        }
+
+        if (auto result = it->rules->match(path.substr(it->prefix_length),
+                                           name, directory)) {
+            return *result;
+        }
+    }
+
+    return false;
+}
+
+}  // namespace tog
@@ -0,0 +1,134 @@
+#ifndef TOG_IGNORE_H
+#define TOG_IGNORE_H
+
+#include <bitset>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace tog {
+
+// The rules of a single .togignore file. The syntax and semantics follow
+// gitignore: blank lines and lines starting with # are skipped, a leading !
+// negates a pattern, a trailing / only matches directories, and a pattern
+// containing a / is anchored to the directory of the .togignore file, while
+// other patterns match names at any depth. Patterns support *, ?, [...] and
+// **, and \ escapes the next character. If several rules match, the last one
+// wins.
+//
+// Most real-world patterns are plain names ("node_modules") or extensions
+// ("*.o"), so these are looked up in hash tables. Only the remaining patterns
+// are matched one by one, and only those that could override the best match
+// found so far.
+class IgnoreRules {
+public:
+    explicit IgnoreRules(std::string_view contents);
+
+    // matches the entry with the given path (relative to the directory of the
+    // .togignore file) and name. Returns true if the entry is ignored, false
+    // if it is explicitly included by a negated pattern, and std::nullopt if
+    // no rule matches.
+    std::optional<bool> match(std::string_view path, std::string_view name,
+                              bool directory) const;
+
+    bool empty() const {
+        return _rules.empty();
+    }
+
+private:
+    struct Token {
+        enum class Type {
+            literal,      // matches text exactly
+            any,          // ?
+            star,         // *
+            directories,  // **/, i.e. zero or more directories
+            rest,         // trailing /**, i.e. everything inside a directory
+            set,          // [...]
+        };
+
+        Type type;
+        std::string text;
+        std::bitset<256> set;
+    };
+
+    struct Rule {
+        std::vector<Token> tokens;
+        bool negated = false;
+        bool directory_only = false;
+        bool anchored = false;
+    };
+
+    // hashes std::string keys, but allows lookups by std::string_view
+    struct StringHash {
+        using is_transparent = void;
+
+        std::size_t operator()(std::string_view str) const {
+            return std::hash<std::string_view>{}(str);
+        }
+    };
+
+    using RuleIndex =
+        std::unordered_map<std::string, std::vector<std::uint32_t>, StringHash,
+                           std::equal_to<>>;
+
+    // parses a single line, returning std::nullopt for blank lines/comments
+    static std::optional<Rule> parse(std::string_view line);
+    static std::vector<Token> compile(std::string_view pattern);
+
+    static bool match(const std::vector<Token>& tokens, std::size_t token,
+                      std::string_view text);
+
+    // updates best to the last rule in indices that applies to the entry
+    void find_last(const std::vector<std::uint32_t>& indices, bool directory,
+                   std::int64_t& best) const;
+
+    std::vector<Rule> _rules;
+
+    // unanchored rules matching a literal name, keyed by that name
+    RuleIndex _names;
+
+    // unanchored rules of the form *.ext, keyed by ".ext"
+    RuleIndex _extensions;
+
+    // all other rules, in ascending order
+    std::vector<std::uint32_t> _patterns;
+};
+
+// Evaluates the .togignore files of a directory and all of its parents during
+// a worktree scan. The scan calls enter() when it descends into a directory,
+// and leave() when it is done with it. Rules in deeper directories take
+// precedence over those in their parents.
+class IgnoreMatcher {
+public:
+    // loads the .togignore file of the given directory, if any. path is the
+    // directory's path relative to the worktree, which is either empty (for
+    // the worktree itself) or ends in a /.
+    void enter(int directory_fd, std::string_view path);
+    void leave();
+
+    // returns whether the entry with the given path (relative to the
+    // worktree) is ignored. The entry must be in the directory that was
+    // entered last.
+    bool ignored(std::string_view path, std::string_view name,
+                 bool directory) const;
+
+private:
+    struct Frame {
+        // the length of the directory's path, which is stripped from entry
+        // paths before matching
+        std::size_t prefix_length;
+
+        // the directory's rules, or nullptr if it has no .togignore file
+        std::unique_ptr<IgnoreRules> rules;
+    };
+
+    std::vector<Frame> _frames;
+};
+
+}  // namespace tog
+
+#endif  // TOG_IGNORE_H
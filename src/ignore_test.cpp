@@ -0,0 +1,133 @@
+#include "ignore.h"
+
+#include <fcntl.h>
+
+#include <filesystem>
+#include <optional>
+#include <string>
+
+#include "file.h"
+#include "scanner.h"
+#include "test.h"
+
+namespace fs = std::filesystem;
+
+using namespace tog;
+
+namespace {
+
+// matches the entry at the given path (relative to the .togignore file)
+std::optional<bool> match(const IgnoreRules& rules, std::string_view path,
+                          bool directory = false) {
+    auto slash = path.rfind('/');
+    auto name = slash == std::string_view::npos ? path : path.substr(slash + 1);
+
+    return rules.match(path, name, directory);
+}
+
+void test_negation() {
+    IgnoreRules rules{"*.o\n!keep.o\n"};
+
+    TOG_CHECK(match(rules, "a.o") == true);
+    TOG_CHECK(match(rules, "src/b.o") == true);
+    TOG_CHECK(match(rules, "keep.o") == false);
+    TOG_CHECK(match(rules, "src/keep.o") == false);
+    TOG_CHECK(match(rules, "a.c") == std::nullopt);
+}
+
+// of several matching rules, the last one wins, however they are indexed
+void test_last_rule_wins() {
+    IgnoreRules rules{"!debug.log\n*.log\nlogs/*\n!logs/keep*\n"};
+
+    TOG_CHECK(match(rules, "debug.log") == true);
+    TOG_CHECK(match(rules, "logs/a") == true);
+    TOG_CHECK(match(rules, "logs/keep.txt") == false);
+}
+
+void test_directory_only() {
+    IgnoreRules rules{"build/\n!out/\nout\n"};
+
+    TOG_CHECK(match(rules, "build", true) == true);
+    TOG_CHECK(match(rules, "src/build", true) == true);
+    TOG_CHECK(match(rules, "build", false) == std::nullopt);
+
+    // the negated directory rule comes first, so out is ignored either way
+    TOG_CHECK(match(rules, "out", true) == true);
+    TOG_CHECK(match(rules, "out", false) == true);
+}
+
+// a pattern with a slash (other than a trailing one) is anchored to the
+// directory of the .togignore file
+void test_anchoring() {
+    IgnoreRules rules{"/build\ndoc/*.md\n**/tmp\ncache/**\n"};
+
+    TOG_CHECK(match(rules, "build", true) == true);
+    TOG_CHECK(match(rules, "src/build", true) == std::nullopt);
+    TOG_CHECK(match(rules, "doc/a.md") == true);
+    TOG_CHECK(match(rules, "doc/sub/a.md") == std::nullopt);
+    TOG_CHECK(match(rules, "src/doc/a.md") == std::nullopt);
+    TOG_CHECK(match(rules, "tmp", true) == true);
+    TOG_CHECK(match(rules, "a/b/tmp") == true);
+    TOG_CHECK(match(rules, "cache/x/y") == true);
+    TOG_CHECK(match(rules, "cache", true) == std::nullopt);
+}
+
+void test_syntax() {
+    IgnoreRules rules{"# comment\n\n\\#hash\n\\!bang\nfile[0-9].txt\n?.c\n"};
+
+    TOG_CHECK(match(rules, "# comment") == std::nullopt);
+    TOG_CHECK(match(rules, "#hash") == true);
+    TOG_CHECK(match(rules, "!bang") == true);
+    TOG_CHECK(match(rules, "file7.txt") == true);
+    TOG_CHECK(match(rules, "filex.txt") == std::nullopt);
+    TOG_CHECK(match(rules, "a.c") == true);
+    TOG_CHECK(match(rules, "ab.c") == std::nullopt);
+}
+
+// the rules of a subdirectory take precedence over those of its parents,
+// which still apply where the subdirectory has no matching rule
+void test_nested_files() {
+    test::TemporaryDirectory dir;
+    fs::create_directory(dir.path() / "sub");
+
+    auto write = [](const fs::path& path, std::string_view contents) {
+        auto file = create_file(path);
+        write_all(file.get(), contents.data(), contents.size());
+    };
+
+    write(dir.path() / ".togignore", "*.log\nnode_modules/\n");
+    write(dir.path() / "sub" / ".togignore", "!keep.log\n");
+
+    auto root = open_directory(AT_FDCWD, dir.path().c_str());
+    auto sub = open_directory(root.get(), "sub");
+
+    IgnoreMatcher matcher;
+    matcher.enter(root.get(), "");
+
+    TOG_CHECK(matcher.ignored("keep.log", "keep.log", false));
+    TOG_CHECK(matcher.ignored("node_modules", "node_modules", true));
+
+    matcher.enter(sub.get(), "sub/");
+
+    TOG_CHECK(!matcher.ignored("sub/keep.log", "keep.log", false));
+    TOG_CHECK(matcher.ignored("sub/other.log", "other.log", false));
+    TOG_CHECK(matcher.ignored("sub/node_modules", "node_modules", true));
+    TOG_CHECK(!matcher.ignored("sub/main.c", "main.c", false));
+
+    matcher.leave();
+
+    TOG_CHECK(matcher.ignored("keep.log", "keep.log", false));
+}
+
+}  // namespace
+
+int main() {
+    auto passed = test::run("negation", test_negation);
+    passed &= test::run("last rule wins", test_last_rule_wins);
+    passed &= test::run("directory only", test_directory_only);
+    passed &= test::run("anchoring", test_anchoring);
+    passed &= test::run("syntax", test_syntax);
+    passed &= test::run("nested files", test_nested_files);
+
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,645 @@
+#include "io_engine.h"
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <utility>
+
+#include "file.h"
+#include "thread_pool.h"
+
+namespace fs = std::filesystem;
+
+namespace tog {
+
+namespace {
+
+// returns the name of a temporary file next to the given path, which is
+// unique across threads and processes. Leftovers of interrupted writes end in
+// .tmp, so that they can be cleaned up (see ObjectStore::remove_temporary()).
+fs::path temporary_path(const fs::path& path) {
+    static std::atomic<std::uint64_t> counter;
+
+    return fs::path{path}.concat("." + std::to_string(::getpid()) + "-" +
+                                 std::to_string(counter++) + ".tmp");
+}
+
+// Runs completion callbacks, deferring any exception until all operations
+// have finished. Operations still in flight may refer to memory owned by the
+// caller, so wait() must not return early.
+class CallbackRunner {
+public:
+    template <class F>
+    void run(F&& callback) {
+        try {
+            callback();
+        } catch (...) {
+            if (!_error) {
+                _error = std::current_exception();
+            }
+        }
+    }
+
+    void rethrow() {
+        if (auto error = std::exchange(_error, nullptr)) {
+            std::rethrow_exception(error);
+        }
+    }
+
+private:
+    std::exception_ptr _error;
+};
+
+// Executes operations as blocking system calls on a thread pool. This is the
+// fallback for kernels without (usable) io_uring support.
+class ThreadPoolEngine : public IoEngine {
+public:
+    void read(fs::path path, ReadCallback done) override {
+        _queued.push_back([this, path = std::move(path),
+                           done = std::move(done)]() mutable {
+            std::vector<unsigned char> data;
+            auto error = read_file(path, data);
+
+            complete([done = std::move(done), error,
+                      data = std::move(data)]() mutable {
+                done(error, std::move(data));
+            });
+        });
+    }
+
+    void write(fs::path path, std::span<const unsigned char> data,
+               WriteCallback done) override {
+        _queued.push_back(
+            [this, path = std::move(path), data, done = std::move(done)] {
+                auto tmp_path = temporary_path(path);
+                auto error = write_file(tmp_path, data);
+
+                if (!error && ::rename(tmp_path.c_str(), path.c_str()) != 0) {
+                    error = {errno, std::generic_category()};
+                }
+
+                if (error) {
+                    ::unlink(tmp_path.c_str());
+                }
+
+                complete([done, error] { done(error); });
+            });
+    }
+
+    void wait() override {
+        CallbackRunner runner;
+
+        for (;;) {
+            for (auto& operation : _queued) {
+                ++_in_flight;
+                _pool.submit(std::move(operation));
+            }
+
+            _queued.clear();
+
+            if (_in_flight == 0) {
+                break;
+            }
+
+            std::vector<std::function<void()>> completions;
+
+            {
+                std::unique_lock lock{_mutex};
+                _completed.wait(lock, [this] { return !_completions.empty(); });
+                std::swap(completions, _completions);
+            }
+
+            for (auto& completion : completions) {
+                --_in_flight;
+                runner.run(completion);
+            }
+        }
+
+        runner.rethrow();
+    }
+
+    std::string_view name() const override {
+        return "threads";
+    }
+
+private:
+    // hands a completion over to the thread calling wait()
+    void complete(std::function<void()> completion) {
+        {
+            std::lock_guard lock{_mutex};
+            _completions.push_back(std::move(completion));
+        }
+
+        _completed.notify_one();
+    }
+
+    // operations that have not been handed to the pool yet
+    std::vector<std::function<void()>> _queued;
+
+    // number of operations handed to the pool whose callbacks have not run
+    std::size_t _in_flight = 0;
+
+    std::mutex _mutex;
+    std::condition_variable _completed;
+    std::vector<std::function<void()>> _completions;
+
+    // declared last, so that its destructor waits for running operations
+    // before the members above are destroyed. Most of the time, the threads
+    // are blocked on I/O, so use more of them than there are cores.
+    ThreadPool _pool{std::max(16u, 2 * ThreadPool::default_threads())};
+};
+
+// Executes operations through io_uring. Each file operation is a small state
+// machine (open, read/write, close, and rename for writes); whenever one step
+// completes, the next one is submitted, so that up to queue_depth operations
+// are in flight at any time while only one system call is made per batch of
+// submissions.
+class UringEngine : public IoEngine {
+public:
+    // sets up an io_uring instance. Returns nullptr if io_uring (or one of the
+    // operations we need) is not supported by the kernel.
+    static std::unique_ptr<UringEngine> create(unsigned queue_depth);
+
+    ~UringEngine() override;
+
+    void read(fs::path path, ReadCallback done) override {
+        auto operation = std::make_unique<Operation>();
+        operation->path = std::move(path);
+        operation->read_done = std::move(done);
+        _ready.push_back(operation.release());
+    }
+
+    void write(fs::path path, std::span<const unsigned char> data,
+               WriteCallback done) override {
+        auto operation = std::make_unique<Operation>();
+        operation->path = temporary_path(path);
+        operation->target = std::move(path);
+        operation->data = data;
+        operation->write_done = std::move(done);
+        _ready.push_back(operation.release());
+    }
+
+    void wait() override;
+
+    std::string_view name() const override {
+        return "io_uring";
+    }
+
+private:
+    struct Operation {
+        enum class Stage { open, transfer, close, rename };
+
+        Stage stage = Stage::open;
+
+        // the file that is opened, which for writes is a temporary file that
+        // is renamed to target once written
+        fs::path path;
+        fs::path target;
+        int fd = -1;
+
+        // bytes read or written so far
+        std::size_t offset = 0;
+
+        // the data read (for reads) or to be written (for writes)
+        std::vector<unsigned char> buffer;
+        std::span<const unsigned char> data;
+
+        std::error_code error;
+
+        ReadCallback read_done;
+        WriteCallback write_done;
+
+        bool is_read() const {
+            return static_cast<bool>(read_done);
+        }
+    };
+
+    UringEngine() = default;
+
+    // fills in a submission queue entry for the next step of the operation
+    void prepare(Operation& operation);
+
+    // processes the completion of the current step of the operation
+    void advance(std::unique_ptr<Operation> operation, int result,
+                 CallbackRunner& runner);
+
+    // renames a written file into place, or removes it if writing failed
+    void rename(Operation& operation);
+
+    int _ring_fd = -1;
+    unsigned _entries = 0;
+
+    // whether the kernel supports renaming through the ring (since 5.11).
+    // Otherwise, files are renamed synchronously.
+    bool _renameat = false;
+
+    void* _sq_ring = MAP_FAILED;
+    void* _cq_ring = MAP_FAILED;
+    std::size_t _sq_ring_size = 0;
+    std::size_t _cq_ring_size = 0;
+
+    io_uring_sqe* _sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+
+    unsigned* _sq_tail = nullptr;
+    unsigned* _sq_mask = nullptr;
+    unsigned* _sq_array = nullptr;
+
+    unsigned* _cq_head = nullptr;
+    unsigned* _cq_tail = nullptr;
+    unsigned* _cq_mask = nullptr;
+    io_uring_cqe* _cqes = nullptr;
+
+    // operations whose next step still needs to be submitted. Operations are
+    // owned by whichever of this queue or the kernel (as user data) has them.
+    std::deque<Operation*> _ready;
+    unsigned _in_flight = 0;
+
+    // number of prepared entries the kernel has not consumed yet
+    unsigned _unsubmitted = 0;
+};
+
+unsigned* ring_field(void* ring, std::uint32_t offset) {
+    return reinterpret_cast<unsigned*>(static_cast<char*>(ring) + offset);
+}
+
+std::unique_ptr<UringEngine> UringEngine::create(unsigned queue_depth) {
+    std::unique_ptr<UringEngine> engine{new UringEngine};
+
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+
+    engine->_ring_fd = static_cast<int>(
+        ::syscall(__NR_io_uring_setup, queue_depth, &params));
+
+    if (engine->_ring_fd < 0) {
+        return nullptr;
+    }
+
+    // make sure that the kernel supports all operations we need
+    std::vector<unsigned char> probe_buffer(
+        sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op));
+    auto probe = reinterpret_cast<io_uring_probe*>(probe_buffer.data());
+
+    if (::syscall(__NR_io_uring_register, engine->_ring_fd,
+                  IORING_REGISTER_PROBE, probe, 256) < 0) {
+        return nullptr;
+    }
+
+    for (auto opcode : {IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_WRITE,
+                        IORING_OP_CLOSE}) {
+        if (opcode >= probe->ops_len ||
+            !(probe->ops[opcode].flags & IO_URING_OP_SUPPORTED)) {
+            return nullptr;
+        }
+    }
+
+    engine->_renameat =
+        IORING_OP_RENAMEAT < probe->ops_len &&
+        (probe->ops[IORING_OP_RENAMEAT].flags & IO_URING_OP_SUPPORTED);
+
+    // map the submission and completion rings into our address space
+    engine->_entries = params.sq_entries;
+    engine->_sq_ring_size =
+        params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    engine->_cq_ring_size =
+        params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+
+    if (single_mmap) {
+        engine->_sq_ring_size = engine->_cq_ring_size =
+            std::max(engine->_sq_ring_size, engine->_cq_ring_size);
+    }
+
+    engine->_sq_ring = ::mmap(nullptr, engine->_sq_ring_size,
+                              PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                              engine->_ring_fd, IORING_OFF_SQ_RING);
+
+    if (engine->_sq_ring == MAP_FAILED) {
+        return nullptr;
+    }
+
+    if (single_mmap) {
+        engine->_cq_ring = engine->_sq_ring;
+    } else {
+        engine->_cq_ring = ::mmap(
+            nullptr, engine->_cq_ring_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, engine->_ring_fd, IORING_OFF_CQ_RING);
+
+        if (engine->_cq_ring == MAP_FAILED) {
+            return nullptr;
+        }
+    }
+
+    engine->_sqes = static_cast<io_uring_sqe*>(
+        ::mmap(nullptr, params.sq_entries * sizeof(io_uring_sqe),
+               PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+               engine->_ring_fd, IORING_OFF_SQES));
+
+    if (engine->_sqes == MAP_FAILED) {
+        return nullptr;
+    }
+
+    engine->_sq_tail = ring_field(engine->_sq_ring, params.sq_off.tail);
+    engine->_sq_mask = ring_field(engine->_sq_ring, params.sq_off.ring_mask);
+    engine->_sq_array = ring_field(engine->_sq_ring, params.sq_off.array);
+
+    engine->_cq_head = ring_field(engine->_cq_ring, params.cq_off.head);
+    engine->_cq_tail = ring_field(engine->_cq_ring, params.cq_off.tail);
+    engine->_cq_mask = ring_field(engine->_cq_ring, params.cq_off.ring_mask);
+    engine->_cqes = reinterpret_cast<io_uring_cqe*>(
+        static_cast<char*>(engine->_cq_ring) + params.cq_off.cqes);
+
+    return engine;
+}
+
+UringEngine::~UringEngine() {
+    for (auto operation : _ready) {
+        delete operation;
+    }
+
+    if (_sqes != MAP_FAILED) {
+        ::munmap(_sqes, _entries * sizeof(io_uring_sqe));
+    }
+
+    if (_cq_ring != MAP_FAILED && _cq_ring != _sq_ring) {
+        ::munmap(_cq_ring, _cq_ring_size);
+    }
+
+    if (_sq_ring != MAP_FAILED) {
+        ::munmap(_sq_ring, _sq_ring_size);
+    }
+
+    if (_ring_fd >= 0) {
+        ::close(_ring_fd);
+    }
+}
+
+void UringEngine::prepare(Operation& operation) {
+    // we are the only producer, so the tail can be read without
+    // synchronization
+    auto tail = *_sq_tail;
+    auto index = tail & *_sq_mask;
+
+    auto& sqe = _sqes[index];
+    std::memset(&sqe, 0, sizeof(sqe));
+    sqe.user_data = reinterpret_cast<std::uint64_t>(&operation);
+
+    // never transfer more than 1 GiB per request
+    constexpr std::size_t max_transfer = 1 << 30;
+
+    switch (operation.stage) {
+        case Operation::Stage::open:
+            sqe.opcode = IORING_OP_OPENAT;
+            sqe.fd = AT_FDCWD;
+            sqe.addr = reinterpret_cast<std::uint64_t>(operation.path.c_str());
+
+            if (operation.is_read()) {
+                sqe.open_flags = O_RDONLY | O_CLOEXEC;
+            } else {
+                sqe.open_flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+                sqe.len = 0666;
+            }
+            break;
+
+        case Operation::Stage::transfer:
+            sqe.fd = operation.fd;
+            sqe.off = operation.offset;
+
+            if (operation.is_read()) {
+                sqe.opcode = IORING_OP_READ;
+                sqe.addr = reinterpret_cast<std::uint64_t>(
+                    operation.buffer.data() + operation.offset);
+                sqe.len = std::min(operation.buffer.size() - operation.offset,
+                                   max_transfer);
+            } else {
+                sqe.opcode = IORING_OP_WRITE;
+                sqe.addr = reinterpret_cast<std::uint64_t>(
+                    operation.data.data() + operation.offset);
+                sqe.len = std::min(operation.data.size() - operation.offset,
+                                   max_transfer);
+            }
+            break;
+
+        case Operation::Stage::close:
+            sqe.opcode = IORING_OP_CLOSE;
+            sqe.fd = operation.fd;
+            break;
+
+        case Operation::Stage::rename:
+            sqe.opcode = IORING_OP_RENAMEAT;
+            sqe.fd = AT_FDCWD;
+            sqe.addr = reinterpret_cast<std::uint64_t>(operation.path.c_str());
+            sqe.len = static_cast<std::uint32_t>(AT_FDCWD);
+            sqe.addr2 =
+                reinterpret_cast<std::uint64_t>(operation.target.c_str());
+            break;
+    }
+
+    _sq_array[index] = index;
+
+    // publish the entry to the kernel
+    std::atomic_ref<unsigned>{*_sq_tail}.store(tail + 1,
+                                               std::memory_order_release);
+}
+
+void UringEngine::advance(std::unique_ptr<Operation> operation, int result,
+                          CallbackRunner& runner) {
+    using Stage = Operation::Stage;
+
+    auto finish = [&] {
+        if (operation->is_read()) {
+            runner.run([&] {
+                operation->read_done(operation->error,
+                                     std::move(operation->buffer));
+            });
+        } else {
+            runner.run([&] { operation->write_done(operation->error); });
+        }
+    };
+
+    auto retry = result == -EINTR || result == -EAGAIN;
+
+    switch (operation->stage) {
+        case Stage::open: {
+            if (retry) {
+                break;
+            } else if (result < 0) {
+                operation->error = {-result, std::generic_category()};
+                finish();
+                return;
+            }
+
+            operation->fd = result;
+            operation->stage = Stage::transfer;
+
+            if (operation->is_read()) {
+                // fstat only consults the (cached) inode, so it is cheap
+                // enough to do synchronously
+                struct stat st;
+
+                if (::fstat(operation->fd, &st) != 0) {
+                    operation->error = {errno, std::generic_category()};
+                    operation->stage = Stage::close;
+                } else {
+                    operation->buffer.resize(st.st_size);
+                }
+            }
+
+            auto size = operation->is_read() ? operation->buffer.size()
+                                             : operation->data.size();
+
+            if (size == 0) {
+                operation->stage = Stage::close;
+            }
+            break;
+        }
+
+        case Stage::transfer: {
+            if (retry) {
+                break;
+            } else if (result < 0) {
+                operation->error = {-result, std::generic_category()};
+                operation->stage = Stage::close;
+                break;
+            }
+
+            if (operation->is_read() && result == 0) {
+                // the file was truncated while reading it
+                operation->buffer.resize(operation->offset);
+            }
+
+            operation->offset += result;
+
+            auto size = operation->is_read() ? operation->buffer.size()
+                                             : operation->data.size();
+
+            if (operation->offset >= size) {
+                operation->stage = Stage::close;
+            }
+            break;
+        }
+
+        case Stage::close:
+            // Close may report a deferred write error, in which case the
+            // temporary file is removed rather than renamed into place. It is
+            // never retried, as the file is closed even if it was interrupted.
+            if (result < 0 && result != -EINTR && !operation->is_read() &&
+                !operation->error) {
+                operation->error = {-result, std::generic_category()};
+            }
+
+            if (!operation->is_read() && !operation->error && _renameat) {
+                operation->stage = Stage::rename;
+                break;
+            } else if (!operation->is_read()) {
+                rename(*operation);
+            }
+
+            finish();
+            return;
+
+        case Stage::rename:
+            if (retry) {
+                break;
+            } else if (result < 0) {
+                operation->error = {-result, std::generic_category()};
+                ::unlink(operation->path.c_str());
+            }
+
+            finish();
+            return;
+    }
+
+    // operations holding an open file go first, so that the number of open
+    // files stays bounded however many operations are queued
+    if (operation->stage == Stage::open) {
+        _ready.push_back(operation.release());
+    } else {
+        _ready.push_front(operation.release());
+    }
+}
+
+void UringEngine::rename(Operation& operation) {
+    if (!operation.error &&
+        ::rename(operation.path.c_str(), operation.target.c_str()) != 0) {
+        operation.error = {errno, std::generic_category()};
+    }
+
+    if (operation.error) {
+        ::unlink(operation.path.c_str());
+    }
+}
+
+void UringEngine::wait() {
+    CallbackRunner runner;
+
+    while (!_ready.empty() || _in_flight > 0) {
+        // the completion queue is twice as large as the submission queue, so
+        // limiting the operations in flight to the latter rules out overflows
+        while (!_ready.empty() && _in_flight < _entries) {
+            prepare(*_ready.front());
+            _ready.pop_front();
+
+            ++_unsubmitted;
+            ++_in_flight;
+        }
+
+        auto ret = ::syscall(__NR_io_uring_enter, _ring_fd, _unsubmitted, 1,
+                             IORING_ENTER_GETEVENTS, nullptr, 0);
+
+        if (ret >= 0) {
+            _unsubmitted -= static_cast<unsigned>(ret);
+        } else if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            // should not happen with a working ring; there is no way to
+            // recover the operations in flight at this point
+            std::terminate();
+        }
+
+        auto head = *_cq_head;
+        auto tail =
+            std::atomic_ref<unsigned>{*_cq_tail}.load(std::memory_order_acquire);
+
+        for (; head != tail; ++head) {
+            const auto& cqe = _cqes[head & *_cq_mask];
+
+            std::unique_ptr<Operation> operation{
+                reinterpret_cast<Operation*>(cqe.user_data)};
+
+            --_in_flight;
+            advance(std::move(operation), cqe.res, runner);
+        }
+
+        std::atomic_ref<unsigned>{*_cq_head}.store(head,
+                                                   std::memory_order_release);
+    }
+
+    runner.rethrow();
+}
+
+}  // namespace
+
+std::unique_ptr<IoEngine> IoEngine::create(std::string_view backend) {
+    if (backend != "threads") {
+        if (auto engine = UringEngine::create(128)) {
+            return engine;
+        }
+    }
+
+    return std::make_unique<ThreadPoolEngine>();
+}
+
+}  // namespace tog
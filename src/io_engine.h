@@ -0,0 +1,56 @@
+#ifndef TOG_IO_ENGINE_H
+#define TOG_IO_ENGINE_H
+
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <span>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+namespace tog {
+
+// An I/O engine performs whole-file reads and writes in batches. Operations
+// are queued with read() and write(), and executed concurrently once wait() is
+// called. This keeps many requests in flight at once, instead of issuing one
+// blocking system call after another.
+//
+// Completion callbacks are always invoked on the thread calling wait(), one
+// at a time, so they may safely touch state that is not thread-safe. They may
+// also queue further operations, which are executed by the same wait() call.
+class IoEngine {
+public:
+    using ReadCallback =
+        std::function<void(std::error_code, std::vector<unsigned char>)>;
+    using WriteCallback = std::function<void(std::error_code)>;
+
+    virtual ~IoEngine() = default;
+
+    // queues reading the entire file at the given path
+    virtual void read(std::filesystem::path path, ReadCallback done) = 0;
+
+    // queues writing data to the file at the given path. The data is written
+    // to a temporary file in the same directory, which then replaces the file
+    // at path, so that readers never see a partially written file (even after
+    // a crash). The data must stay alive until the callback is invoked.
+    virtual void write(std::filesystem::path path,
+                       std::span<const unsigned char> data,
+                       WriteCallback done) = 0;
+
+    // executes all queued operations and blocks until they (and any
+    // operations queued by their callbacks) have completed
+    virtual void wait() = 0;
+
+    // returns the name of the backend, for diagnostics
+    virtual std::string_view name() const = 0;
+
+    // creates an engine with the given backend: "io_uring", "threads", or
+    // "auto", which uses io_uring if the kernel supports it and falls back to
+    // a thread pool otherwise
+    static std::unique_ptr<IoEngine> create(std::string_view backend = "auto");
+};
+
+}  // namespace tog
+
+#endif  // TOG_IO_ENGINE_H
@@ -0,0 +1,950 @@
+#include "kv_store.h"
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iterator>
+#include <random>
+#include <stdexcept>
+#include <string_view>
+#include <system_error>
+
+#include "crypto.h"
+#include "object_index.h"
+
+namespace fs = std::filesystem;
+
+namespace tog {
+
+namespace {
+
+// The log starts with its magic bytes and a random nonce. The index records
+// the nonce, so an index that belongs to a different log (e.g. one that was
+// replaced by compact()) is detected and rebuilt.
+constexpr std::string_view log_magic = "TOGKVLG1";
+constexpr std::string_view index_magic = "TOGKVIX1";
+constexpr std::uint64_t log_header_size = 16;
+
+constexpr std::uint32_t record_magic = 0x52474f54;
+constexpr std::uint32_t object_record = 0;
+constexpr std::uint32_t tombstone_record = 1;
+
+constexpr std::uint64_t min_capacity = 1024;
+
+// the number of records appended since the sorted index was written that
+// find_prefix() scans before it rewrites the index
+constexpr std::size_t max_unsorted = 65536;
+
+// the log is mapped with room to grow, so it rarely needs to be remapped
+constexpr std::uint64_t min_log_mapping = 64 << 20;
+
+std::system_error last_error(const char* what) {
+    return std::system_error{errno, std::generic_category(), what};
+}
+
+void pwrite_all(int fd, const void* data, std::size_t size,
+                std::uint64_t offset) {
+    auto bytes = static_cast<const char*>(data);
+
+    while (size > 0) {
+        auto n = ::pwrite(fd, bytes, size, offset);
+
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw last_error("write");
+        }
+
+        bytes += n;
+        size -= n;
+        offset += n;
+    }
+}
+
+std::uint64_t random_nonce() {
+    std::random_device device;
+    return (std::uint64_t{device()} << 32) | device();
+}
+
+std::int64_t now() {
+    return std::chrono::system_clock::to_time_t(
+        std::chrono::system_clock::now());
+}
+
+// object ids are uniformly distributed, so their first bytes make for a good
+// hash
+std::uint64_t home(const unsigned char* id) {
+    std::uint64_t hash;
+    std::memcpy(&hash, id, sizeof(hash));
+    return hash;
+}
+
+}  // namespace
+
+// the header preceding every object in the log
+struct KvObjectStore::Record {
+    unsigned char id[ObjectId::size];
+    std::uint64_t size;
+    std::int64_t time;
+    std::uint32_t type;
+    std::uint32_t magic;
+};
+
+struct KvObjectStore::IndexHeader {
+    char magic[8];
+    std::uint64_t nonce;
+    std::uint64_t capacity;
+    std::uint64_t count;
+
+    // the size of the log when the index was last written back
+    std::uint64_t log_size;
+
+    // the bytes of the log taken up by removed objects and tombstones
+    std::uint64_t garbage;
+
+    // set while the index has modifications that were not written back
+    std::uint64_t dirty;
+    std::uint64_t reserved;
+};
+
+struct KvObjectStore::Slot {
+    unsigned char id[ObjectId::size];
+
+    // the offset of the object's record in the log, or 0 for empty slots
+    std::uint64_t offset;
+    std::uint64_t size;
+    std::int64_t time;
+};
+
+KvObjectStore::Mapping::Mapping(int fd, std::size_t size, bool writable)
+    : _size{size} {
+    auto data = ::mmap(nullptr, size,
+                       writable ? PROT_READ | PROT_WRITE : PROT_READ,
+                       MAP_SHARED, fd, 0);
+
+    if (data == MAP_FAILED) {
+        throw last_error("mmap");
+    }
+
+    _data = static_cast<unsigned char*>(data);
+}
+
+KvObjectStore::Mapping::~Mapping() {
+    if (_data) {
+        ::munmap(_data, _size);
+    }
+}
+
+KvObjectStore::Mapping::Mapping(Mapping&& other) noexcept
+    : _data{std::exchange(other._data, nullptr)},
+      _size{std::exchange(other._size, 0)} {}
+
+KvObjectStore::Mapping& KvObjectStore::Mapping::operator=(
+    Mapping&& other) noexcept {
+    if (this != &other) {
+        if (_data) {
+            ::munmap(_data, _size);
+        }
+
+        _data = std::exchange(other._data, nullptr);
+        _size = std::exchange(other._size, 0);
+    }
+
+    return *this;
+}
+
+void KvObjectStore::create(const fs::path& togdir) {
+    auto path = togdir / "objects.log";
+    FileDescriptor log{
+        ::open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666)};
+
+    if (!log) {
+        throw last_error("unable to create objects.log");
+    }
+
+    auto nonce = random_nonce();
+
+    pwrite_all(log.get(), log_magic.data(), log_magic.size(), 0);
+    pwrite_all(log.get(), &nonce, sizeof(nonce), log_magic.size());
+}
+
+KvObjectStore::KvObjectStore(const fs::path& togdir)
+    : _log_path{togdir / "objects.log"},
+      _index_path{togdir / "objects.idx"},
+      _sorted_path{togdir / "objects.sorted"} {
+    // the file formats must not depend on padding
+    static_assert(sizeof(Record) == 56);
+    static_assert(sizeof(IndexHeader) == 64);
+    static_assert(sizeof(Slot) == 56);
+
+    auto lock_path = togdir / "objects.lock";
+    _lock = FileDescriptor{
+        ::open(lock_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666)};
+
+    if (!_lock || ::flock(_lock.get(), LOCK_EX) != 0) {
+        throw last_error("unable to lock the object store");
+    }
+
+    _log = FileDescriptor{::open(_log_path.c_str(), O_RDWR | O_CLOEXEC)};
+
+    if (!_log) {
+        throw last_error("unable to open objects.log");
+    }
+
+    char magic[8];
+    std::uint64_t nonce;
+    struct stat log_status;
+
+    if (::pread(_log.get(), magic, sizeof(magic), 0) != sizeof(magic) ||
+        std::string_view{magic, sizeof(magic)} != log_magic ||
+        ::pread(_log.get(), &nonce, sizeof(nonce), sizeof(magic)) !=
+            sizeof(nonce) ||
+        ::fstat(_log.get(), &log_status) != 0) {
+        throw std::runtime_error{"corrupt object log"};
+    }
+
+    std::uint64_t log_size = log_status.st_size;
+    map_log(log_size);
+
+    // use the existing index if it belongs to this log
+    _index_file = FileDescriptor{::open(_index_path.c_str(), O_RDWR | O_CLOEXEC)};
+    struct stat index_status;
+
+    if (_index_file && ::fstat(_index_file.get(), &index_status) == 0 &&
+        static_cast<std::size_t>(index_status.st_size) >= sizeof(IndexHeader)) {
+        _index_map = Mapping{_index_file.get(),
+                             static_cast<std::size_t>(index_status.st_size),
+                             true};
+        const auto& index = header();
+
+        if (std::string_view{index.magic, sizeof(index.magic)} ==
+                index_magic &&
+            index.nonce == nonce &&
+            sizeof(IndexHeader) + index.capacity * sizeof(Slot) ==
+                static_cast<std::uint64_t>(index_status.st_size)) {
+            if (!index.dirty && index.log_size == log_size) {
+                _log_size = log_size;
+                return;
+            }
+
+            // the process writing the store crashed, so the records written
+            // since the index was last written back need to be verified
+            rebuild_index(index.log_size);
+            return;
+        }
+    }
+
+    rebuild_index(log_header_size);
+}
+
+KvObjectStore::~KvObjectStore() {
+    std::unique_lock lock{_mutex};
+
+    if (!_index_map.data() || !header().dirty) {
+        return;
+    }
+
+    // Write the index back, after the log it refers to. Failed writes may
+    // have left parts of records beyond the end of the log.
+    if (::ftruncate(_log.get(), _log_size) != 0 ||
+        ::fdatasync(_log.get()) != 0) {
+        return;
+    }
+
+    header().log_size = _log_size;
+
+    if (::msync(_index_map.data(), _index_map.size(), MS_SYNC) == 0) {
+        header().dirty = 0;
+        ::msync(_index_map.data(), sizeof(IndexHeader), MS_SYNC);
+    }
+}
+
+KvObjectStore::IndexHeader& KvObjectStore::header() const {
+    return *reinterpret_cast<IndexHeader*>(_index_map.data());
+}
+
+KvObjectStore::Slot* KvObjectStore::slots() const {
+    return reinterpret_cast<Slot*>(_index_map.data() + sizeof(IndexHeader));
+}
+
+KvObjectStore::Slot* KvObjectStore::find(const ObjectId& id) const {
+    auto mask = header().capacity - 1;
+
+    for (auto i = home(id.bytes.data()) & mask;; i = (i + 1) & mask) {
+        auto& slot = slots()[i];
+
+        if (slot.offset == 0) {
+            return nullptr;
+        } else if (std::memcmp(slot.id, id.bytes.data(), ObjectId::size) ==
+                   0) {
+            return &slot;
+        }
+    }
+}
+
+void KvObjectStore::index(const Slot& entry) {
+    // keep the load factor below 70%, so probe sequences stay short
+    if ((header().count + 1) * 10 > header().capacity * 7) {
+        resize_index(header().capacity * 2);
+    }
+
+    auto mask = header().capacity - 1;
+
+    for (auto i = home(entry.id) & mask;; i = (i + 1) & mask) {
+        auto& slot = slots()[i];
+
+        if (slot.offset == 0) {
+            slot = entry;
+            ++header().count;
+            return;
+        } else if (std::memcmp(slot.id, entry.id, ObjectId::size) == 0) {
+            slot = entry;
+            return;
+        }
+    }
+}
+
+void KvObjectStore::unindex(const ObjectId& id) {
+    auto slot = find(id);
+
+    if (!slot) {
+        return;
+    }
+
+    auto mask = header().capacity - 1;
+    std::uint64_t hole = slot - slots();
+
+    // Move back every following entry of the probe sequence whose home slot
+    // does not lie (cyclically) between the hole and the entry itself.
+    for (auto i = (hole + 1) & mask; slots()[i].offset != 0;
+         i = (i + 1) & mask) {
+        auto target = home(slots()[i].id) & mask;
+        auto between = hole <= i ? hole < target && target <= i
+                                 : hole < target || target <= i;
+
+        if (!between) {
+            slots()[hole] = slots()[i];
+            hole = i;
+        }
+    }
+
+    slots()[hole] = Slot{};
+    --header().count;
+}
+
+void KvObjectStore::create_index(const fs::path& path, std::uint64_t capacity,
+                                 std::uint64_t nonce) {
+    FileDescriptor file{
+        ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0666)};
+    auto size = sizeof(IndexHeader) + capacity * sizeof(Slot);
+
+    // the file is zero-filled, i.e. all slots are empty
+    if (!file || ::ftruncate(file.get(), size) != 0) {
+        throw last_error("unable to create objects.idx");
+    }
+
+    _index_map = Mapping{file.get(), size, true};
+    _index_file = std::move(file);
+
+    std::memcpy(header().magic, index_magic.data(), index_magic.size());
+    header().nonce = nonce;
+    header().capacity = capacity;
+    header().dirty = 1;
+}
+
+void KvObjectStore::resize_index(std::uint64_t capacity) {
+    auto old_map = std::move(_index_map);
+    auto old_file = std::move(_index_file);
+
+    const auto& old_header = *reinterpret_cast<IndexHeader*>(old_map.data());
+    auto old_slots =
+        reinterpret_cast<const Slot*>(old_map.data() + sizeof(IndexHeader));
+
+    auto tmp_path = fs::path{_index_path}.concat(".tmp");
+    create_index(tmp_path, capacity, old_header.nonce);
+
+    header().log_size = old_header.log_size;
+    header().garbage = old_header.garbage;
+
+    for (std::uint64_t i = 0; i < old_header.capacity; ++i) {
+        if (old_slots[i].offset != 0) {
+            index(old_slots[i]);
+        }
+    }
+
+    fs::rename(tmp_path, _index_path);
+}
+
+void KvObjectStore::rebuild_index(std::uint64_t verify_from) {
+    std::uint64_t nonce;
+
+    if (::pread(_log.get(), &nonce, sizeof(nonce), log_magic.size()) !=
+        sizeof(nonce)) {
+        throw last_error("unable to read objects.log");
+    }
+
+    // the new index is marked dirty until it is written back, so a crash
+    // while rebuilding it leads to another rebuild
+    auto tmp_path = fs::path{_index_path}.concat(".tmp");
+    create_index(tmp_path, min_capacity, nonce);
+    fs::rename(tmp_path, _index_path);
+
+    struct stat status;
+
+    if (::fstat(_log.get(), &status) != 0) {
+        throw last_error("unable to read objects.log");
+    }
+
+    std::uint64_t end = status.st_size;
+    std::uint64_t offset = log_header_size;
+    map_log(end);
+
+    while (offset + sizeof(Record) <= end) {
+        Record record;
+        std::memcpy(&record, _log_map.data() + offset, sizeof(record));
+
+        if (record.magic != record_magic ||
+            record.size > end - offset - sizeof(Record)) {
+            break;
+        }
+
+        ObjectId id;
+        std::memcpy(id.bytes.data(), record.id, ObjectId::size);
+
+        auto length = sizeof(Record) + record.size;
+
+        if (record.type == object_record) {
+            std::span<const unsigned char> data{
+                _log_map.data() + offset + sizeof(Record), record.size};
+
+            if (offset >= verify_from && sha256(data) != id) {
+                break;
+            }
+
+            if (find(id)) {
+                header().garbage += length;
+            } else {
+                Slot slot{};
+                std::memcpy(slot.id, record.id, ObjectId::size);
+                slot.offset = offset;
+                slot.size = record.size;
+                slot.time = record.time;
+
+                index(slot);
+            }
+        } else if (record.type == tombstone_record) {
+            if (auto slot = find(id)) {
+                header().garbage += sizeof(Record) + slot->size;
+                unindex(id);
+            }
+
+            header().garbage += length;
+        } else {
+            break;
+        }
+
+        offset += length;
+    }
+
+    // drop torn or corrupt records at the end of the log
+    if (offset != end && ::ftruncate(_log.get(), offset) != 0) {
+        throw last_error("unable to truncate objects.log");
+    }
+
+    _log_size = offset;
+}
+
+template <class WriteData>
+std::uint64_t KvObjectStore::append(const ObjectId& id, std::uint32_t type,
+                                    std::uint64_t size,
+                                    WriteData write_data) {
+    mark_dirty();
+
+    Record record{};
+    std::memcpy(record.id, id.bytes.data(), ObjectId::size);
+    record.size = size;
+    record.time = now();
+    record.type = type;
+    record.magic = record_magic;
+
+    // the log only grows once the whole record has been written, so a failed
+    // write is overwritten by the next one
+    auto offset = _log_size;
+    pwrite_all(_log.get(), &record, sizeof(record), offset);
+    write_data(offset + sizeof(Record));
+
+    _log_size = offset + sizeof(Record) + size;
+    map_log(_log_size);
+
+    if (type == object_record) {
+        Slot slot{};
+        std::memcpy(slot.id, record.id, ObjectId::size);
+        slot.offset = offset;
+        slot.size = size;
+        slot.time = record.time;
+
+        index(slot);
+    }
+
+    return offset;
+}
+
+void KvObjectStore::map_log(std::uint64_t size) {
+    if (size <= _log_map.size()) {
+        return;
+    }
+
+    // mapping beyond the end of the file is fine, as long as those pages are
+    // not accessed before the file has grown
+    _log_map = Mapping{_log.get(),
+                       std::max(min_log_mapping, std::bit_ceil(size * 2)),
+                       false};
+}
+
+void KvObjectStore::mark_dirty() {
+    if (!header().dirty) {
+        header().dirty = 1;
+        ::msync(_index_map.data(), sizeof(IndexHeader), MS_SYNC);
+    }
+}
+
+bool KvObjectStore::contains(const ObjectId& id) const {
+    std::shared_lock lock{_mutex};
+    return find(id) != nullptr;
+}
+
+bool KvObjectStore::freshen(const ObjectId& id) {
+    std::unique_lock lock{_mutex};
+    auto slot = find(id);
+
+    if (!slot) {
+        return false;
+    }
+
+    // only the index is updated, as records are never modified. If the index
+    // is rebuilt after a crash, the object falls back to its original time.
+    mark_dirty();
+    slot->time = now();
+
+    return true;
+}
+
+std::optional<ObjectInfo> KvObjectStore::info(const ObjectId& id) const {
+    std::shared_lock lock{_mutex};
+    auto slot = find(id);
+
+    if (!slot) {
+        return std::nullopt;
+    }
+
+    return ObjectInfo{slot->size, static_cast<std::time_t>(slot->time)};
+}
+
+std::error_code KvObjectStore::read(const ObjectId& id,
+                                    std::vector<unsigned char>& data) const {
+    std::shared_lock lock{_mutex};
+    auto slot = find(id);
+
+    if (!slot) {
+        return std::make_error_code(std::errc::no_such_file_or_directory);
+    }
+
+    auto begin = _log_map.data() + slot->offset + sizeof(Record);
+    data.assign(begin, begin + slot->size);
+
+    return {};
+}
+
+std::error_code KvObjectStore::send(const ObjectId& id, int fd) const {
+    std::shared_lock lock{_mutex};
+    auto slot = find(id);
+
+    if (!slot) {
+        return std::make_error_code(std::errc::no_such_file_or_directory);
+    }
+
+    // the object is sent straight from the log's pages in the page cache
+    send_file(_log.get(), slot->offset + sizeof(Record), slot->size, fd);
+    return {};
+}
+
+void KvObjectStore::prefetch(const ObjectId& id) const {
+    std::shared_lock lock{_mutex};
+
+    if (auto slot = find(id)) {
+        ::readahead(_log.get(), slot->offset + sizeof(Record), slot->size);
+    }
+}
+
+void KvObjectStore::read(const ObjectId& id, ReadCallback done) {
+    std::lock_guard lock{_queue_mutex};
+    _queued_reads.emplace_back(id, std::move(done));
+}
+
+void KvObjectStore::write(const ObjectId& id,
+                          std::span<const unsigned char> data,
+                          WriteCallback done) {
+    std::lock_guard lock{_queue_mutex};
+    _queued_writes.push_back({id, data, std::move(done)});
+}
+
+void KvObjectStore::wait() {
+    // callbacks may queue further operations
+    for (;;) {
+        std::vector<std::pair<ObjectId, ReadCallback>> reads;
+        std::vector<QueuedWrite> writes;
+
+        {
+            std::lock_guard lock{_queue_mutex};
+            reads.swap(_queued_reads);
+            writes.swap(_queued_writes);
+        }
+
+        if (reads.empty() && writes.empty()) {
+            return;
+        }
+
+        // all writes of a batch are appended under a single lock
+        std::vector<std::error_code> errors(writes.size());
+
+        {
+            std::unique_lock lock{_mutex};
+
+            for (std::size_t i = 0; i < writes.size(); ++i) {
+                const auto& write = writes[i];
+
+                if (find(write.id)) {
+                    continue;
+                }
+
+                try {
+                    append(write.id, object_record, write.data.size(),
+                           [&](std::uint64_t offset) {
+                               pwrite_all(_log.get(), write.data.data(),
+                                          write.data.size(), offset);
+                           });
+                } catch (const std::system_error& e) {
+                    errors[i] = e.code();
+                }
+            }
+        }
+
+        for (std::size_t i = 0; i < writes.size(); ++i) {
+            writes[i].done(errors[i]);
+        }
+
+        for (auto& [id, done] : reads) {
+            std::vector<unsigned char> data;
+            auto err = read(id, data);
+
+            done(err, std::move(data));
+        }
+    }
+}
+
+void KvObjectStore::write(const ObjectId& id,
+                          std::span<const unsigned char> data) {
+    std::unique_lock lock{_mutex};
+
+    if (find(id)) {
+        return;
+    }
+
+    append(id, object_record, data.size(), [&](std::uint64_t offset) {
+        pwrite_all(_log.get(), data.data(), data.size(), offset);
+    });
+}
+
+void KvObjectStore::write(const ObjectId& id, int fd) {
+    struct stat status;
+
+    if (::fstat(fd, &status) != 0) {
+        throw last_error("fstat");
+    }
+
+    std::uint64_t size = status.st_size;
+    std::unique_lock lock{_mutex};
+
+    if (find(id)) {
+        return;
+    }
+
+    append(id, object_record, size, [&](std::uint64_t offset) {
+        std::vector<char> buffer(1 << 20);
+
+        for (std::uint64_t copied = 0; copied < size;) {
+            auto n = ::pread(fd, buffer.data(),
+                             std::min<std::uint64_t>(buffer.size(),
+                                                     size - copied),
+                             copied);
+
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                throw last_error("read");
+            } else if (n == 0) {
+                throw std::runtime_error{"file shrank while storing it"};
+            }
+
+            pwrite_all(_log.get(), buffer.data(), n, offset + copied);
+            copied += n;
+        }
+    });
+}
+
+void KvObjectStore::insert(const ObjectId& id, const fs::path& path) {
+    {
+        auto file = open_file(path);
+
+        if (!file) {
+            throw last_error("open");
+        }
+
+        write(id, file.get());
+    }
+
+    fs::remove(path);
+}
+
+fs::path KvObjectStore::temporary_path() const {
+    return _log_path.parent_path() /
+           ("objects." + std::to_string(::gettid()) + ".tmp");
+}
+
+std::size_t KvObjectStore::remove_temporary(std::time_t cutoff) {
+    std::size_t removed = 0;
+
+    // the files of temporary_path(), and index files of interrupted resizes
+    for (const auto& entry :
+         fs::directory_iterator{_log_path.parent_path()}) {
+        auto name = entry.path().filename().string();
+        struct stat st;
+
+        if (name.starts_with("objects.") && name.ends_with(".tmp") &&
+            ::lstat(entry.path().c_str(), &st) == 0 && st.st_mtime <= cutoff &&
+            ::unlink(entry.path().c_str()) == 0) {
+            ++removed;
+        }
+    }
+
+    return removed;
+}
+
+std::vector<ObjectId> KvObjectStore::list() const {
+    std::shared_lock lock{_mutex};
+    return sorted_ids();
+}
+
+std::vector<ObjectId> KvObjectStore::find_prefix(std::string_view prefix,
+                                                 std::size_t limit) const {
+    auto range = ObjectId::prefix_range(prefix);
+
+    if (!range) {
+        return {};
+    }
+
+    std::shared_lock lock{_mutex};
+    std::optional<ObjectIndex> sorted;
+
+    try {
+        sorted = ObjectIndex::open(_sorted_path);
+    } catch (const std::exception&) {
+    }
+
+    // an index written for a different log (e.g. before compact()) is
+    // rebuilt
+    if (!sorted || sorted->generation() != header().nonce ||
+        sorted->position() > _log_size) {
+        ObjectIndex::write(_sorted_path, sorted_ids(), header().nonce,
+                           _log_size);
+        sorted = ObjectIndex::open(_sorted_path);
+    }
+
+    std::vector<ObjectId> found;
+    std::vector<ObjectId> appended;
+
+    for (auto offset = sorted->position(); offset < _log_size;) {
+        Record record;
+        std::memcpy(&record, _log_map.data() + offset, sizeof(record));
+
+        if (record.type == object_record) {
+            auto& id = appended.emplace_back();
+            std::memcpy(id.bytes.data(), record.id, ObjectId::size);
+
+            if (range->first <= id && id <= range->second && find(id)) {
+                found.push_back(id);
+            }
+        }
+
+        offset += sizeof(Record) + record.size;
+    }
+
+    // the index may still list removed objects
+    std::size_t indexed = 0;
+
+    for (const auto& id : sorted->find(prefix)) {
+        if (indexed == limit) {
+            break;
+        } else if (find(id)) {
+            found.push_back(id);
+            ++indexed;
+        }
+    }
+
+    std::sort(found.begin(), found.end());
+    found.erase(std::unique(found.begin(), found.end()), found.end());
+    found.resize(std::min(found.size(), limit));
+
+    if (appended.size() > max_unsorted) {
+        std::sort(appended.begin(), appended.end());
+        appended.erase(std::unique(appended.begin(), appended.end()),
+                       appended.end());
+
+        std::vector<ObjectId> ids;
+        ids.reserve(sorted->ids().size() + appended.size());
+        std::set_union(sorted->ids().begin(), sorted->ids().end(),
+                       appended.begin(), appended.end(),
+                       std::back_inserter(ids));
+
+        ObjectIndex::write(_sorted_path, ids, header().nonce, _log_size);
+    }
+
+    return found;
+}
+
+std::vector<ObjectId> KvObjectStore::sorted_ids() const {
+    std::vector<ObjectId> objects;
+
+    objects.reserve(header().count);
+
+    for (std::uint64_t i = 0; i < header().capacity; ++i) {
+        if (slots()[i].offset != 0) {
+            auto& id = objects.emplace_back();
+            std::memcpy(id.bytes.data(), slots()[i].id, ObjectId::size);
+        }
+    }
+
+    std::sort(objects.begin(), objects.end());
+
+    return objects;
+}
+
+bool KvObjectStore::remove(const ObjectId& id) {
+    std::unique_lock lock{_mutex};
+    auto slot = find(id);
+
+    if (!slot) {
+        return false;
+    }
+
+    auto size = slot->size;
+
+    append(id, tombstone_record, 0, [](std::uint64_t) {});
+    unindex(id);
+
+    // the space is reclaimed by compact()
+    header().garbage += 2 * sizeof(Record) + size;
+
+    return true;
+}
+
+void KvObjectStore::compact() {
+    std::unique_lock lock{_mutex};
+
+    // only compact once at least half of the log is garbage, so the cost of
+    // rewriting it is amortized over many removals
+    if (header().garbage * 2 <= _log_size) {
+        return;
+    }
+
+    std::vector<Slot> live;
+    live.reserve(header().count);
+
+    for (std::uint64_t i = 0; i < header().capacity; ++i) {
+        if (slots()[i].offset != 0) {
+            live.push_back(slots()[i]);
+        }
+    }
+
+    // keep the objects in their original order, as objects written together
+    // are likely read together
+    std::sort(live.begin(), live.end(), [](const Slot& a, const Slot& b) {
+        return a.offset < b.offset;
+    });
+
+    auto nonce = random_nonce();
+    auto tmp_log_path = fs::path{_log_path}.concat(".tmp");
+    FileDescriptor log{::open(tmp_log_path.c_str(),
+                              O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0666)};
+
+    if (!log) {
+        throw last_error("unable to create objects.log.tmp");
+    }
+
+    pwrite_all(log.get(), log_magic.data(), log_magic.size(), 0);
+    pwrite_all(log.get(), &nonce, sizeof(nonce), log_magic.size());
+
+    std::uint64_t size = log_header_size;
+
+    for (auto& slot : live) {
+        auto length = sizeof(Record) + slot.size;
+
+        pwrite_all(log.get(), _log_map.data() + slot.offset, length, size);
+        slot.offset = size;
+        size += length;
+    }
+
+    if (::fdatasync(log.get()) != 0) {
+        throw last_error("unable to write objects.log.tmp");
+    }
+
+    auto tmp_index_path = fs::path{_index_path}.concat(".tmp");
+    create_index(tmp_index_path,
+                 std::max(min_capacity, std::bit_ceil(live.size() * 2)),
+                 nonce);
+
+    for (const auto& slot : live) {
+        index(slot);
+    }
+
+    // Once the new log is in place, the old index does not match its nonce
+    // anymore, so a crash before the new index is in place rebuilds it.
+    fs::rename(tmp_log_path, _log_path);
+    fs::rename(tmp_index_path, _index_path);
+
+    _log = std::move(log);
+    _log_size = size;
+    _log_map = Mapping{};
+    map_log(size);
+}
+
+std::optional<std::uintmax_t> KvObjectStore::verify(const ObjectId& id) const {
+    std::shared_lock lock{_mutex};
+    auto slot = find(id);
+
+    if (!slot) {
+        return std::nullopt;
+    }
+
+    Record record;
+    std::memcpy(&record, _log_map.data() + slot->offset, sizeof(record));
+
+    std::span<const unsigned char> data{
+        _log_map.data() + slot->offset + sizeof(Record), slot->size};
+
+    if (record.magic != record_magic || record.size != slot->size ||
+        std::memcmp(record.id, id.bytes.data(), ObjectId::size) != 0 ||
+        sha256(data) != id) {
+        return std::nullopt;
+    }
+
+    return slot->size;
+}
+
+}  // namespace tog
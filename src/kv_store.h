@@ -0,0 +1,181 @@
+#ifndef TOG_KV_STORE_H
+#define TOG_KV_STORE_H
+
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <shared_mutex>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "file.h"
+#include "object_store.h"
+
+namespace tog {
+
+// An object store that keeps all objects in a single file, so that
+// repositories with millions of tiny objects need neither an inode nor a
+// system call per object.
+//
+// Objects are appended to a log (.tog/objects.log), which is memory-mapped
+// for reading. An open-addressing hash table in a second memory-mapped file
+// (.tog/objects.idx) maps object ids to their position in the log. Removing an
+// object appends a tombstone; compact() rewrites the log once most of it is
+// garbage.
+//
+// The index is only written back when the store is closed. If a process
+// crashes before that, the index is marked dirty and rebuilt from the log the
+// next time the store is opened, dropping any torn records at its end. Only
+// one process can open the store at a time.
+//
+// Abbreviated ids are resolved through a sorted ObjectIndex of the objects
+// (.tog/objects.sorted), and a scan of the records appended since it was
+// written. The index is rewritten once many records were appended.
+class KvObjectStore : public ObjectStore {
+public:
+    explicit KvObjectStore(const std::filesystem::path& togdir);
+    ~KvObjectStore() override;
+
+    KvObjectStore(const KvObjectStore&) = delete;
+    KvObjectStore& operator=(const KvObjectStore&) = delete;
+
+    // creates an empty store in the given .tog directory
+    static void create(const std::filesystem::path& togdir);
+
+    bool contains(const ObjectId& id) const override;
+    bool freshen(const ObjectId& id) override;
+    std::optional<ObjectInfo> info(const ObjectId& id) const override;
+
+    std::error_code read(const ObjectId& id,
+                         std::vector<unsigned char>& data) const override;
+    std::error_code send(const ObjectId& id, int fd) const override;
+    void prefetch(const ObjectId& id) const override;
+    void read(const ObjectId& id, ReadCallback done) override;
+    void write(const ObjectId& id, std::span<const unsigned char> data,
+               WriteCallback done) override;
+    void wait() override;
+
+    void write(const ObjectId& id,
+               std::span<const unsigned char> data) override;
+    void write(const ObjectId& id, int fd) override;
+    void insert(const ObjectId& id, const std::filesystem::path& path) override;
+    std::filesystem::path temporary_path() const override;
+
+    std::vector<ObjectId> list() const override;
+    std::vector<ObjectId> find_prefix(std::string_view prefix,
+                                      std::size_t limit) const override;
+    bool remove(const ObjectId& id) override;
+
+    std::size_t remove_temporary(std::time_t cutoff) override;
+
+    void compact() override;
+    std::optional<std::uintmax_t> verify(const ObjectId& id) const override;
+
+private:
+    struct Record;
+    struct IndexHeader;
+    struct Slot;
+
+    // A memory mapping of a file, which is unmapped on destruction
+    class Mapping {
+    public:
+        Mapping() = default;
+        Mapping(int fd, std::size_t size, bool writable);
+        ~Mapping();
+
+        Mapping(Mapping&& other) noexcept;
+        Mapping& operator=(Mapping&& other) noexcept;
+
+        unsigned char* data() const {
+            return _data;
+        }
+
+        std::size_t size() const {
+            return _size;
+        }
+
+    private:
+        unsigned char* _data = nullptr;
+        std::size_t _size = 0;
+    };
+
+    // the following methods must be called with _mutex held (exclusively,
+    // for the ones that modify the store)
+
+    IndexHeader& header() const;
+    Slot* slots() const;
+
+    // returns the slot holding the given object, or nullptr
+    Slot* find(const ObjectId& id) const;
+
+    // returns the ids of all objects, sorted
+    std::vector<ObjectId> sorted_ids() const;
+
+    // adds or replaces the index entry of an object
+    void index(const Slot& slot);
+
+    // removes the index entry of an object, shifting back the entries that
+    // follow it, so that no tombstones are needed
+    void unindex(const ObjectId& id);
+
+    // rewrites the index with the given number of slots
+    void resize_index(std::uint64_t capacity);
+
+    // writes a new, empty index file with the given capacity, and maps it
+    void create_index(const std::filesystem::path& path,
+                      std::uint64_t capacity, std::uint64_t nonce);
+
+    // rebuilds the index by replaying the log. Records from verify_from on
+    // have their hashes verified, and the log is truncated at the first
+    // torn or corrupt record.
+    void rebuild_index(std::uint64_t verify_from);
+
+    // appends a record, whose data is written by write_data at the given
+    // offset, and returns its offset
+    template <class WriteData>
+    std::uint64_t append(const ObjectId& id, std::uint32_t type,
+                         std::uint64_t size, WriteData write_data);
+
+    // maps the log, so that at least size bytes of it are accessible
+    void map_log(std::uint64_t size);
+
+    // marks the index as dirty before its first modification
+    void mark_dirty();
+
+    std::filesystem::path _log_path;
+    std::filesystem::path _index_path;
+
+    // the ObjectIndex used to resolve abbreviated ids. It covers the log up
+    // to its position; the records after that are scanned.
+    std::filesystem::path _sorted_path;
+
+    FileDescriptor _lock;
+    FileDescriptor _log;
+    FileDescriptor _index_file;
+
+    Mapping _log_map;
+    Mapping _index_map;
+
+    // the end of the last complete record in the log
+    std::uint64_t _log_size = 0;
+
+    // guards the log and index. Reads share the lock, writes take it
+    // exclusively.
+    mutable std::shared_mutex _mutex;
+
+    // operations queued for the next wait()
+    struct QueuedWrite {
+        ObjectId id;
+        std::span<const unsigned char> data;
+        WriteCallback done;
+    };
+
+    std::mutex _queue_mutex;
+    std::vector<std::pair<ObjectId, ReadCallback>> _queued_reads;
+    std::vector<QueuedWrite> _queued_writes;
+};
+
+}  // namespace tog
+
+#endif  // TOG_KV_STORE_H
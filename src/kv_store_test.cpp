@@ -0,0 +1,222 @@
+#include "kv_store.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "crypto.h"
+#include "file.h"
+#include "test.h"
+
+namespace fs = std::filesystem;
+
+using namespace tog;
+
+namespace {
+
+// an object with the given contents, named after their hash like in a
+// repository, so that rebuilding the index can verify it
+struct Object {
+    explicit Object(const std::string& contents)
+        : data{contents.begin(), contents.end()}, id{sha256(data)} {}
+
+    std::vector<unsigned char> data;
+    ObjectId id;
+};
+
+bool holds(const KvObjectStore& store, const Object& object) {
+    std::vector<unsigned char> data;
+    return !store.read(object.id, data) && data == object.data;
+}
+
+void test_reopen() {
+    test::TemporaryDirectory dir;
+    KvObjectStore::create(dir.path());
+
+    Object a{"a"};
+    Object b{std::string(100000, 'b')};
+
+    {
+        KvObjectStore store{dir.path()};
+        store.write(a.id, a.data);
+        store.write(b.id, b.data);
+    }
+
+    KvObjectStore store{dir.path()};
+    TOG_CHECK(holds(store, a));
+    TOG_CHECK(holds(store, b));
+    TOG_CHECK(store.list().size() == 2);
+}
+
+// a crash in the middle of an append leaves a partial record at the end of the
+// log, which is dropped when the index is rebuilt
+void test_torn_append() {
+    test::TemporaryDirectory dir;
+    KvObjectStore::create(dir.path());
+
+    Object a{"a"};
+    Object b{"b"};
+    Object c{std::string(1000, 'c')};
+
+    {
+        KvObjectStore store{dir.path()};
+        store.write(a.id, a.data);
+        store.write(b.id, b.data);
+    }
+
+    auto log = dir.path() / "objects.log";
+    auto index = dir.path() / "objects.idx";
+    auto size = fs::file_size(log);
+
+    // the index as written before the crash
+    fs::copy_file(index, dir.path() / "objects.idx.old");
+
+    {
+        KvObjectStore store{dir.path()};
+        store.write(c.id, c.data);
+    }
+
+    fs::resize_file(log, size + 100);
+    fs::rename(dir.path() / "objects.idx.old", index);
+
+    {
+        KvObjectStore store{dir.path()};
+        TOG_CHECK(holds(store, a));
+        TOG_CHECK(holds(store, b));
+        TOG_CHECK(!store.contains(c.id));
+        TOG_CHECK(fs::file_size(log) == size);
+
+        // appending continues where the last complete record ends
+        store.write(c.id, c.data);
+    }
+
+    KvObjectStore store{dir.path()};
+    TOG_CHECK(holds(store, c));
+}
+
+// a complete record whose contents do not match its id (e.g. because the
+// data did not reach the disk) is dropped as well
+void test_corrupt_record() {
+    test::TemporaryDirectory dir;
+    KvObjectStore::create(dir.path());
+
+    Object a{"a"};
+    Object b{std::string(1000, 'b')};
+
+    {
+        KvObjectStore store{dir.path()};
+        store.write(a.id, a.data);
+    }
+
+    auto log = dir.path() / "objects.log";
+    auto index = dir.path() / "objects.idx";
+    auto size = fs::file_size(log);
+
+    fs::copy_file(index, dir.path() / "objects.idx.old");
+
+    {
+        KvObjectStore store{dir.path()};
+        store.write(b.id, b.data);
+    }
+
+    // flip the last byte of b's contents
+    {
+        FileDescriptor file{::open(log.c_str(), O_RDWR | O_CLOEXEC)};
+        unsigned char byte;
+        auto end = static_cast<off_t>(fs::file_size(log)) - 1;
+
+        TOG_CHECK(::pread(file.get(), &byte, 1, end) == 1);
+        byte ^= 0xff;
+        TOG_CHECK(::pwrite(file.get(), &byte, 1, end) == 1);
+    }
+
+    fs::rename(dir.path() / "objects.idx.old", index);
+
+    KvObjectStore store{dir.path()};
+    TOG_CHECK(holds(store, a));
+    TOG_CHECK(!store.contains(b.id));
+    TOG_CHECK(fs::file_size(log) == size);
+}
+
+// without an index, it is rebuilt from the whole log, replaying removals
+void test_missing_index() {
+    test::TemporaryDirectory dir;
+    KvObjectStore::create(dir.path());
+
+    Object a{"a"};
+    Object b{"b"};
+
+    {
+        KvObjectStore store{dir.path()};
+        store.write(a.id, a.data);
+        store.write(b.id, b.data);
+        TOG_CHECK(store.remove(a.id));
+    }
+
+    fs::remove(dir.path() / "objects.idx");
+
+    KvObjectStore store{dir.path()};
+    TOG_CHECK(!store.contains(a.id));
+    TOG_CHECK(holds(store, b));
+}
+
+void test_compact() {
+    test::TemporaryDirectory dir;
+    KvObjectStore::create(dir.path());
+
+    std::vector<Object> objects;
+
+    for (char c = 'a'; c < 'k'; ++c) {
+        objects.emplace_back(std::string(10000, c));
+    }
+
+    auto log = dir.path() / "objects.log";
+
+    {
+        KvObjectStore store{dir.path()};
+
+        for (const auto& object : objects) {
+            store.write(object.id, object.data);
+        }
+
+        auto size = fs::file_size(log);
+
+        for (std::size_t i = 2; i < objects.size(); ++i) {
+            TOG_CHECK(store.remove(objects[i].id));
+        }
+
+        store.compact();
+
+        TOG_CHECK(fs::file_size(log) < size / 4);
+        TOG_CHECK(holds(store, objects[0]));
+        TOG_CHECK(holds(store, objects[1]));
+        TOG_CHECK(!store.contains(objects[2].id));
+
+        // the compacted log is appended to as usual
+        store.write(objects[2].id, objects[2].data);
+    }
+
+    KvObjectStore store{dir.path()};
+    TOG_CHECK(store.list().size() == 3);
+
+    for (std::size_t i = 0; i < 3; ++i) {
+        TOG_CHECK(holds(store, objects[i]));
+    }
+
+    TOG_CHECK(!store.contains(objects[3].id));
+}
+
+}  // namespace
+
+int main() {
+    auto passed = test::run("reopen", test_reopen);
+    passed &= test::run("torn append", test_torn_append);
+    passed &= test::run("corrupt record", test_corrupt_record);
+    passed &= test::run("missing index", test_missing_index);
+    passed &= test::run("compact", test_compact);
+
+    return passed ? 0 : 1;
+}
@@ -12,41 +12,232 @@ int main(int argc, char **argv) {
     // Require exactly one argument (such as "init", "commit", ...)
     app.require_subcommand(1);
 
-    // tog init
+    // tog [-v] <command>
+    app.add_flag("-v,--verbose", tog::cli::verbose,
+                 "Print statistics, such as object cache hits and misses");
+
+    // tog init [--object-store <backend>]
     auto init_cmd = app.add_subcommand(
         "init", "Creates a new repository in the current directory");
-    init_cmd->callback(tog::cli::init);
+    std::string init_object_store{"loose"};
+    init_cmd
+        ->add_option("--object-store", init_object_store,
+                     "Object storage backend (loose or kv)")
+        ->check(CLI::IsMember({"loose", "kv"}));
+    init_cmd->callback(
+        [&init_object_store]() { tog::cli::init(init_object_store); });
 
-    // tog commit [-m <message>]
+    // tog commit [-m <message>] [--max-memory <size>]
     auto commit_cmd = app.add_subcommand("commit", "Creates a new commit");
     std::string commit_message;
+    std::size_t commit_max_memory = tog::Repository::default_max_memory;
     commit_cmd->add_option("-m,--message", commit_message, "Commit message");
-    commit_cmd->callback(
-        [&commit_message]() { tog::cli::commit(commit_message); });
+    commit_cmd
+        ->add_option("--max-memory", commit_max_memory,
+                     "Maximum file contents to hold in memory (e.g. 64MB)")
+        ->transform(CLI::AsSizeValue(false));
+    commit_cmd->callback([&commit_message, &commit_max_memory]() {
+        tog::cli::commit(commit_message, commit_max_memory);
+    });
 
-    // tog checkout <commit>
+    // tog checkout [--hardlink] <commit>
     auto checkout_cmd = app.add_subcommand("checkout", "Checkout a commit");
     std::string checkout_hash;
+    bool checkout_hardlink{false};
 
     // TODO fix formatting in .clang-format
     checkout_cmd->add_option("commit", checkout_hash, "Commit hash")
         ->required();
-    checkout_cmd->callback(
-        [&checkout_hash]() { tog::cli::checkout(checkout_hash); });
+    checkout_cmd->add_flag(
+        "--hardlink", checkout_hardlink,
+        "Hard-link files to the object store (read-only worktrees only)");
+    checkout_cmd->callback([&checkout_hash, &checkout_hardlink]() {
+        tog::cli::checkout(checkout_hash, checkout_hardlink);
+    });
 
     // tog status command
     auto status_cmd =
         app.add_subcommand("status", "Display the current branch/commit");
     status_cmd->callback(tog::cli::status);
 
-    // tog log command
+    // tog log [-n <number>] [-- <path>]
     auto log_cmd = app.add_subcommand("log", "Display the commit history");
     int history_length;
     log_cmd
         ->add_option("-n,--number", history_length,
                      "Number of commits to display")
         ->default_val<int>(10);
-    log_cmd->callback([&history_length]() { tog::cli::log(history_length); });
+    std::string log_path;
+    log_cmd->add_option("path", log_path,
+                        "Only display commits that changed this path");
+    log_cmd->callback([&history_length, &log_path]() {
+        tog::cli::log(history_length, log_path);
+    });
+
+    // tog show <commit>:<path>
+    auto show_cmd = app.add_subcommand(
+        "show", "Write a file of a commit to stdout, without checking it out");
+    std::string show_object;
+    show_cmd->add_option("object", show_object, "<commit>:<path>")
+        ->required();
+    show_cmd->callback([&show_object]() { tog::cli::show(show_object); });
+
+    // tog archive <commit> [--format tar|tar.zst] [-o <file>]
+    auto archive_cmd = app.add_subcommand(
+        "archive", "Write a tar archive of a commit, without checking it out");
+    std::string archive_commit;
+    std::string archive_format;
+    std::string archive_output;
+    archive_cmd->add_option("commit", archive_commit, "Commit to archive")
+        ->required();
+    archive_cmd
+        ->add_option("--format", archive_format,
+                     "Archive format (default: from the output's extension)")
+        ->check(CLI::IsMember({"tar", "tar.zst"}));
+    archive_cmd
+        ->add_option("-o,--output", archive_output,
+                     "Output file, or - for stdout")
+        ->default_val("-");
+    archive_cmd->callback([&archive_commit, &archive_format, &archive_output]() {
+        tog::cli::archive(archive_commit, archive_format, archive_output);
+    });
+
+    // tog fast-import < stream
+    auto fast_import_cmd = app.add_subcommand(
+        "fast-import", "Import commits from a fast-import stream on stdin");
+    fast_import_cmd->callback(tog::cli::fast_import);
+
+    // tog fast-export [<range>]
+    auto fast_export_cmd = app.add_subcommand(
+        "fast-export", "Write commits to stdout as a fast-import stream");
+    std::string fast_export_range;
+    fast_export_cmd->add_option(
+        "range", fast_export_range,
+        "<commit> or <from>..<to> (default: the main branch)");
+    fast_export_cmd->callback(
+        [&fast_export_range]() { tog::cli::fast_export(fast_export_range); });
+
+    // tog gc [--grace <seconds>]
+    auto gc_cmd =
+        app.add_subcommand("gc", "Remove objects not reachable from any ref");
+    long long gc_grace;
+    gc_cmd
+        ->add_option("--grace", gc_grace,
+                     "Keep unreachable objects younger than this (in seconds)")
+        ->default_val<long long>(86400);
+    gc_cmd->callback([&gc_grace]() { tog::cli::gc(gc_grace); });
+
+    // tog fsck [--incremental]
+    auto fsck_cmd =
+        app.add_subcommand("fsck", "Verify the integrity of the repository");
+    bool fsck_incremental{false};
+    fsck_cmd->add_flag(
+        "--incremental", fsck_incremental,
+        "Only verify objects added since the last check without errors");
+    fsck_cmd->callback(
+        [&fsck_incremental]() { tog::cli::fsck(fsck_incremental); });
+
+    // tog bitmaps
+    auto bitmaps_cmd = app.add_subcommand(
+        "bitmaps", "Write a reachability bitmap index to speed up gc");
+    bitmaps_cmd->callback(tog::cli::bitmaps);
+
+    // tog commit-graph
+    auto commit_graph_cmd = app.add_subcommand(
+        "commit-graph", "Write a commit graph to speed up tog log -- <path>");
+    commit_graph_cmd->callback(tog::cli::commit_graph);
+
+    // tog clone [--hardlink] [--partial] <source> <destination>
+    auto clone_cmd = app.add_subcommand(
+        "clone", "Create a copy of a repository, sharing its objects");
+    std::string clone_source;
+    std::string clone_destination;
+    bool clone_hardlink{false};
+    clone_cmd->add_option("source", clone_source, "Path of the repository")
+        ->required();
+    clone_cmd
+        ->add_option("destination", clone_destination, "Path of the copy")
+        ->required();
+    clone_cmd->add_flag(
+        "--hardlink", clone_hardlink,
+        "Hard-link files to the object store (read-only worktrees only)");
+    bool clone_partial{false};
+    clone_cmd->add_flag(
+        "--partial", clone_partial,
+        "Only copy commits and trees, and fetch files from the source when "
+        "they are needed");
+    clone_cmd->callback(
+        [&clone_source, &clone_destination, &clone_hardlink, &clone_partial]() {
+            tog::cli::clone(clone_source, clone_destination, clone_hardlink,
+                            clone_partial);
+        });
+
+    // tog push [--exec] <remote>
+    auto push_cmd = app.add_subcommand(
+        "push", "Send the main branch to another repository");
+    std::string push_remote;
+    bool push_exec{false};
+    push_cmd->add_option("remote", push_remote, "Path of the remote repository")
+        ->required();
+    push_cmd->add_flag("--exec", push_exec,
+                       "Run remote as a shell command serving the repository "
+                       "(e.g. \"ssh host 'cd repo && tog serve'\")");
+    push_cmd->callback([&push_remote, &push_exec]() {
+        tog::cli::push(push_remote, push_exec);
+    });
+
+    // tog pull [--exec] <remote>
+    auto pull_cmd = app.add_subcommand(
+        "pull", "Fetch the main branch of another repository");
+    std::string pull_remote;
+    bool pull_exec{false};
+    pull_cmd->add_option("remote", pull_remote, "Path of the remote repository")
+        ->required();
+    pull_cmd->add_flag("--exec", pull_exec,
+                       "Run remote as a shell command serving the repository");
+    pull_cmd->callback([&pull_remote, &pull_exec]() {
+        tog::cli::pull(pull_remote, pull_exec);
+    });
+
+    // tog serve
+    auto serve_cmd = app.add_subcommand(
+        "serve", "Serve a push or pull over stdin/stdout");
+    serve_cmd->callback(tog::cli::serve);
+
+    // tog branch [-f] [-d] [<name> [<commit>]] and the same for tog tag
+    struct RefOptions {
+        std::string name;
+        std::string commit;
+        bool force{false};
+        bool remove{false};
+    };
+
+    RefOptions branch_options;
+    RefOptions tag_options;
+
+    auto add_ref_command = [&app](const char *name, const char *description,
+                                  tog::RefKind kind, RefOptions &options) {
+        auto cmd = app.add_subcommand(name, description);
+        cmd->add_option("name", options.name, "Name (lists all if omitted)");
+        cmd->add_option("commit", options.commit,
+                        "Commit hash (defaults to the current commit)");
+        cmd->add_flag("-f,--force", options.force, "Move an existing ref");
+        cmd->add_flag("-d,--delete", options.remove, "Delete the ref");
+        cmd->callback([kind, &options]() {
+            tog::cli::refs(kind, options.name, options.commit, options.force,
+                           options.remove);
+        });
+    };
+
+    add_ref_command("branch", "List, create or delete branches",
+                    tog::RefKind::branch, branch_options);
+    add_ref_command("tag", "List, create or delete tags", tog::RefKind::tag,
+                    tag_options);
+
+    // tog pack-refs
+    auto pack_refs_cmd = app.add_subcommand(
+        "pack-refs", "Move all branches and tags into a single file");
+    pack_refs_cmd->callback(tog::cli::pack_refs);
 
     try {
         CLI11_PARSE(app, argc, argv);
@@ -0,0 +1,78 @@
+#include "object.h"
+
+namespace tog {
+
+namespace {
+
+int hex_digit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+}  // namespace
+
+std::optional<ObjectId> ObjectId::from_hex(std::string_view hex) {
+    if (hex.size() != 2 * size) {
+        return std::nullopt;
+    }
+
+    ObjectId id;
+
+    for (std::size_t i = 0; i < size; ++i) {
+        auto high = hex_digit(hex[2 * i]);
+        auto low = hex_digit(hex[2 * i + 1]);
+
+        if (high < 0 || low < 0) {
+            return std::nullopt;
+        }
+
+        id.bytes[i] = static_cast<unsigned char>(high << 4 | low);
+    }
+
+    return id;
+}
+
+std::optional<std::pair<ObjectId, ObjectId>> ObjectId::prefix_range(
+    std::string_view prefix) {
+    if (prefix.size() > 2 * size) {
+        return std::nullopt;
+    }
+
+    // the digits that are not given range from 0 to F
+    ObjectId first;
+    ObjectId last;
+    last.bytes.fill(0xFF);
+
+    for (std::size_t i = 0; i < prefix.size(); ++i) {
+        auto digit = hex_digit(prefix[i]);
+
+        if (digit < 0) {
+            return std::nullopt;
+        }
+
+        auto shift = i % 2 == 0 ? 4 : 0;
+        auto mask = 0xF << shift;
+
+        first.bytes[i / 2] = (first.bytes[i / 2] & ~mask) | digit << shift;
+        last.bytes[i / 2] = (last.bytes[i / 2] & ~mask) | digit << shift;
+    }
+
+    return std::pair{first, last};
+}
+
+std::string ObjectId::hex() const {
+    static constexpr char digits[] = "0123456789ABCDEF";
+
+    std::string hex(2 * size, '0');
+
+    for (std::size_t i = 0; i < size; ++i) {
+        hex[2 * i] = digits[bytes[i] >> 4];
+        hex[2 * i + 1] = digits[bytes[i] & 0xF];
+    }
+
+    return hex;
+}
+
+}  // namespace tog
@@ -1,16 +1,64 @@
 #ifndef TOG_OBJECT_H
 #define TOG_OBJECT_H
 
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 
 namespace tog {
 
+enum class ObjectKind : std::uint8_t { blob, tree, commit };
+
 class TogObject {
 public:
     virtual const std::vector<unsigned char>& serialize() = 0;
+
+    // returns the approximate number of bytes the object occupies in memory
+    virtual std::size_t memory_size() const = 0;
+
     virtual ~TogObject() = default;
 };
 
+// An object id is the SHA-256 hash of an object's serialization. It is kept in
+// binary form in memory; the hex representation is used for object file names
+// and inside serialized objects.
+struct ObjectId {
+    static constexpr std::size_t size = 32;
+
+    std::array<unsigned char, size> bytes{};
+
+    // parses a hex string of 64 characters. Returns std::nullopt if the string
+    // is not a valid object id.
+    static std::optional<ObjectId> from_hex(std::string_view hex);
+
+    // returns the smallest and the largest id whose hex representation starts
+    // with the given prefix (of at most 64 digits, in either case). Returns
+    // std::nullopt if the prefix is not valid hex.
+    static std::optional<std::pair<ObjectId, ObjectId>> prefix_range(
+        std::string_view prefix);
+
+    // returns the (upper case) hex representation of this id
+    std::string hex() const;
+
+    auto operator<=>(const ObjectId&) const = default;
+};
+
+struct ObjectIdHash {
+    std::size_t operator()(const ObjectId& id) const {
+        // object ids are uniformly distributed, so any of their bytes make for
+        // a good hash
+        std::size_t hash;
+        std::memcpy(&hash, id.bytes.data(), sizeof(hash));
+        return hash;
+    }
+};
+
 }  // namespace tog
 
-#endif  // TOG_OBJECT_H
\ No newline at end of file
+#endif  // TOG_OBJECT_H
@@ -0,0 +1,57 @@
+#include "object_cache.h"
+
+namespace tog {
+
+ObjectCache::Slot ObjectCache::admit(ObjectKind kind, std::uint32_t index,
+                                     std::size_t size) {
+    make_room(size);
+
+    Slot slot;
+
+    if (_free_slots.empty()) {
+        slot = static_cast<Slot>(_slots.size());
+        _slots.emplace_back();
+    } else {
+        slot = _free_slots.back();
+        _free_slots.pop_back();
+    }
+
+    _slots[slot] = Entry{size, index, kind, true, true};
+    _stats.size += size;
+
+    return slot;
+}
+
+void ObjectCache::clear() {
+    _slots.clear();
+    _free_slots.clear();
+    _hand = 0;
+    _stats.size = 0;
+}
+
+void ObjectCache::make_room(std::size_t size) {
+    // Two full sweeps are enough to clear all referenced bits and visit every
+    // object once more. Anything still cached after that is in use, in which
+    // case we exceed the budget rather than fail.
+    for (std::size_t steps = 2 * _slots.size();
+         _stats.size + size > _budget && steps > 0; --steps) {
+        _hand = _hand < _slots.size() ? _hand : 0;
+        auto& entry = _slots[_hand];
+
+        if (entry.used) {
+            if (entry.referenced) {
+                entry.referenced = false;
+            } else if (_evictor(entry.kind, entry.index)) {
+                _stats.size -= entry.size;
+                ++_stats.evictions;
+
+                entry.used = false;
+                _free_slots.push_back(static_cast<Slot>(_hand));
+            }
+        }
+
+        ++_hand;
+    }
+}
+
+}  // namespace tog
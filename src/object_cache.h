@@ -0,0 +1,104 @@
+#ifndef TOG_OBJECT_CACHE_H
+#define TOG_OBJECT_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "object.h"
+
+namespace tog {
+
+struct CacheStats {
+    // number of resolutions served from memory
+    std::uint64_t hits = 0;
+
+    // number of resolutions that had to load the object from disk
+    std::uint64_t misses = 0;
+
+    // number of objects dropped from memory to stay within the budget
+    std::uint64_t evictions = 0;
+
+    // bytes currently held by cached objects
+    std::size_t size = 0;
+};
+
+// The object cache keeps track of all objects held in memory by the
+// repository's object tables, and evicts them once their total size exceeds a
+// memory budget. Evicted objects only lose their payload; their handles stay
+// valid, and the object is simply loaded again the next time it is resolved.
+//
+// Eviction follows the CLOCK algorithm, an approximation of LRU: every cached
+// object has a "referenced" bit that is set on access. When looking for an
+// object to evict, the clock hand sweeps over all objects, evicting the first
+// one whose bit is not set and clearing the bits of all others it passes.
+class ObjectCache {
+public:
+    // tries to evict the object at the given index of the table of the given
+    // kind. Returns false if the object cannot be evicted (e.g. because it is
+    // in use).
+    using Evictor = std::function<bool(ObjectKind kind, std::uint32_t index)>;
+
+    // identifies an object in the cache
+    using Slot = std::uint32_t;
+
+    ObjectCache(std::size_t budget, Evictor evictor)
+        : _budget{budget}, _evictor{std::move(evictor)} {}
+
+    // adds an object of the given size to the cache, evicting other objects if
+    // needed. Returns the object's slot, which has to be passed to touch()
+    // whenever the object is accessed.
+    Slot admit(ObjectKind kind, std::uint32_t index, std::size_t size);
+
+    // marks the object in the given slot as recently used
+    void touch(Slot slot) {
+        _slots[slot].referenced = true;
+        ++_stats.hits;
+    }
+
+    // records that an object had to be loaded from disk
+    void miss() {
+        ++_stats.misses;
+    }
+
+    // forgets about all objects, e.g. because they have been freed in bulk
+    void clear();
+
+    std::size_t budget() const {
+        return _budget;
+    }
+
+    void set_budget(std::size_t budget) {
+        _budget = budget;
+    }
+
+    const CacheStats& stats() const {
+        return _stats;
+    }
+
+private:
+    struct Entry {
+        std::size_t size = 0;
+        std::uint32_t index = 0;
+        ObjectKind kind = ObjectKind::blob;
+        bool referenced = false;
+        bool used = false;
+    };
+
+    // evicts objects until at least the given number of bytes are available
+    void make_room(std::size_t size);
+
+    std::size_t _budget;
+    Evictor _evictor;
+
+    std::vector<Entry> _slots;
+    std::vector<Slot> _free_slots;
+    std::size_t _hand = 0;
+
+    CacheStats _stats;
+};
+
+}  // namespace tog
+
+#endif  // TOG_OBJECT_CACHE_H
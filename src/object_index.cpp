@@ -0,0 +1,177 @@
+#include "object_index.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+
+#include "file.h"
+
+namespace fs = std::filesystem;
+
+namespace tog {
+
+namespace {
+
+constexpr std::string_view magic = "TOGOBIX1";
+
+std::system_error last_error(const char* what) {
+    return std::system_error{errno, std::generic_category(), what};
+}
+
+}  // namespace
+
+// All integers are in host byte order. The ids follow the header.
+struct ObjectIndex::Header {
+    char magic[8];
+    std::uint64_t generation;
+    std::uint64_t position;
+    std::uint64_t count;
+    std::uint64_t fanout[256];
+};
+
+ObjectIndex::ObjectIndex(unsigned char* data, std::size_t size)
+    : _data{data}, _size{size} {}
+
+ObjectIndex::~ObjectIndex() {
+    if (_data) {
+        ::munmap(_data, _size);
+    }
+}
+
+ObjectIndex::ObjectIndex(ObjectIndex&& other) noexcept
+    : _data{std::exchange(other._data, nullptr)},
+      _size{std::exchange(other._size, 0)} {}
+
+ObjectIndex& ObjectIndex::operator=(ObjectIndex&& other) noexcept {
+    if (this != &other) {
+        if (_data) {
+            ::munmap(_data, _size);
+        }
+
+        _data = std::exchange(other._data, nullptr);
+        _size = std::exchange(other._size, 0);
+    }
+
+    return *this;
+}
+
+std::optional<ObjectIndex> ObjectIndex::open(const fs::path& path) {
+    auto file = open_file(path);
+
+    if (!file) {
+        if (errno == ENOENT) {
+            return std::nullopt;
+        }
+
+        throw last_error("unable to open object index");
+    }
+
+    struct stat status;
+
+    if (::fstat(file.get(), &status) != 0) {
+        throw last_error("unable to open object index");
+    }
+
+    std::size_t size = status.st_size;
+
+    if (size < sizeof(Header)) {
+        throw std::runtime_error{"corrupt object index"};
+    }
+
+    auto data = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, file.get(), 0);
+
+    if (data == MAP_FAILED) {
+        throw last_error("unable to map object index");
+    }
+
+    ObjectIndex index{static_cast<unsigned char*>(data), size};
+    const auto& header = index.header();
+
+    if (std::string_view{header.magic, sizeof(header.magic)} != magic ||
+        header.count != (size - sizeof(Header)) / ObjectId::size ||
+        header.fanout[255] != header.count) {
+        throw std::runtime_error{"corrupt object index"};
+    }
+
+    return index;
+}
+
+void ObjectIndex::write(const fs::path& path, std::span<const ObjectId> ids,
+                        std::uint64_t generation, std::uint64_t position) {
+    Header header{};
+    std::memcpy(header.magic, magic.data(), magic.size());
+    header.generation = generation;
+    header.position = position;
+    header.count = ids.size();
+
+    for (const auto& id : ids) {
+        ++header.fanout[id.bytes[0]];
+    }
+
+    for (std::size_t i = 1; i < 256; ++i) {
+        header.fanout[i] += header.fanout[i - 1];
+    }
+
+    // the name of the temporary file is unique per thread, as several
+    // threads (or processes) may update the index at once
+    auto tmp_path = fs::path{path}.concat("." + std::to_string(::gettid()) +
+                                          ".tmp");
+
+    {
+        auto file = create_file(tmp_path);
+        write_all(file.get(), &header, sizeof(header));
+        write_all(file.get(), ids.data(), ids.size() * ObjectId::size);
+    }
+
+    fs::rename(tmp_path, path);
+}
+
+const ObjectIndex::Header& ObjectIndex::header() const {
+    return *reinterpret_cast<const Header*>(_data);
+}
+
+std::span<const ObjectId> ObjectIndex::ids() const {
+    static_assert(sizeof(ObjectId) == ObjectId::size);
+
+    return {reinterpret_cast<const ObjectId*>(_data + sizeof(Header)),
+            header().count};
+}
+
+std::span<const ObjectId> ObjectIndex::find(std::string_view prefix) const {
+    auto range = ObjectId::prefix_range(prefix);
+
+    if (!range) {
+        return {};
+    }
+
+    // only the fan-out buckets of the range's first bytes are searched
+    auto [first, last] = *range;
+    auto all = ids();
+    auto begin = first.bytes[0] == 0 ? 0 : header().fanout[first.bytes[0] - 1];
+    auto end = header().fanout[last.bytes[0]];
+
+    auto lower =
+        std::lower_bound(all.begin() + begin, all.begin() + end, first);
+    auto upper = std::upper_bound(lower, all.begin() + end, last);
+
+    return {lower, upper};
+}
+
+std::uint64_t ObjectIndex::generation() const {
+    return header().generation;
+}
+
+std::uint64_t ObjectIndex::position() const {
+    return header().position;
+}
+
+}  // namespace tog
@@ -0,0 +1,70 @@
+#ifndef TOG_OBJECT_INDEX_H
+#define TOG_OBJECT_INDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <string_view>
+
+#include "object.h"
+
+namespace tog {
+
+// A sorted list of object ids, used to resolve abbreviated ids without
+// listing the objects of a store.
+//
+// The file starts with a fan-out table, which holds the number of ids whose
+// first byte is at most 0, 1, ..., 255, followed by the sorted ids. It is
+// memory-mapped, so a lookup only touches the pages of the fan-out table and
+// those visited by a binary search within a single fan-out bucket, even for
+// tens of millions of objects.
+//
+// Stores record how far the index covers them in its generation and position
+// (e.g. a log and the offset in it), and look up objects added since it was
+// written elsewhere.
+class ObjectIndex {
+public:
+    // maps the index at the given path. Returns std::nullopt if there is no
+    // index, and throws a std::runtime_error if it is corrupt.
+    static std::optional<ObjectIndex> open(const std::filesystem::path& path);
+
+    // writes an index of the given (sorted) ids to the given path, atomically
+    // replacing any existing index
+    static void write(const std::filesystem::path& path,
+                      std::span<const ObjectId> ids,
+                      std::uint64_t generation = 0, std::uint64_t position = 0);
+
+    ~ObjectIndex();
+
+    ObjectIndex(ObjectIndex&& other) noexcept;
+    ObjectIndex& operator=(ObjectIndex&& other) noexcept;
+
+    ObjectIndex(const ObjectIndex&) = delete;
+    ObjectIndex& operator=(const ObjectIndex&) = delete;
+
+    // returns all ids, sorted
+    std::span<const ObjectId> ids() const;
+
+    // returns the ids whose hex representation starts with the given prefix,
+    // which must be valid hex
+    std::span<const ObjectId> find(std::string_view prefix) const;
+
+    std::uint64_t generation() const;
+    std::uint64_t position() const;
+
+private:
+    struct Header;
+
+    ObjectIndex(unsigned char* data, std::size_t size);
+
+    const Header& header() const;
+
+    unsigned char* _data = nullptr;
+    std::size_t _size = 0;
+};
+
+}  // namespace tog
+
+#endif  // TOG_OBJECT_INDEX_H
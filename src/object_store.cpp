@@ -0,0 +1,551 @@
+#include "object_store.h"
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <string>
+
+#include "crypto.h"
+#include "file.h"
+#include "kv_store.h"
+#include "object_index.h"
+#include "scanner.h"
+
+namespace fs = std::filesystem;
+
+namespace tog {
+
+namespace {
+
+// the number of journaled ids that are buffered before they are written,
+// and the number of journals and journaled ids that find_prefix() tolerates
+// before it merges them into the index
+constexpr std::size_t journal_batch = 128;
+constexpr std::size_t max_journals = 64;
+constexpr std::size_t max_journaled = 65536;
+
+// Stores every object in a file of its own, named after the object's id. New
+// files are written to a temporary file first and then renamed, so readers
+// never see partially written objects.
+//
+// Abbreviated ids are resolved through an ObjectIndex (objects/index), which
+// lists the objects at the time it was written. Every process appends the ids
+// of the objects it writes to a journal of its own in objects/journal, and
+// holds a shared lock on it while it is open. Updating the index merges all
+// journals into it, and removes those that are no longer locked. The index is
+// rebuilt from a listing of the directory if it is missing, and by gc (so
+// objects that were added by other means, such as hard links, are found from
+// then on).
+class LooseObjectStore : public ObjectStore {
+public:
+    LooseObjectStore(const fs::path& directory, IoEngine& io)
+        : _directory{directory}, _io{io} {}
+
+    ~LooseObjectStore() override {
+        std::lock_guard lock{_journal_mutex};
+        flush_journal();
+    }
+
+    bool contains(const ObjectId& id) const override {
+        return ::access(file(id).c_str(), F_OK) == 0;
+    }
+
+    bool freshen(const ObjectId& id) override {
+        // this also updates the inode change time, which info() reports
+        if (::utimensat(AT_FDCWD, file(id).c_str(), nullptr, 0) == 0) {
+            return true;
+        }
+
+        return errno != ENOENT;
+    }
+
+    std::optional<ObjectInfo> info(const ObjectId& id) const override {
+        struct stat st;
+
+        if (::stat(file(id).c_str(), &st) != 0) {
+            return std::nullopt;
+        }
+
+        // the inode change time cannot be set to the past (unlike the
+        // modification time)
+        return ObjectInfo{static_cast<std::uintmax_t>(st.st_size),
+                          st.st_ctime};
+    }
+
+    std::error_code read(const ObjectId& id,
+                         std::vector<unsigned char>& data) const override {
+        return read_file(file(id), data);
+    }
+
+    std::error_code send(const ObjectId& id, int fd) const override {
+        auto object_file = open_file(file(id));
+        struct stat st;
+
+        if (!object_file || ::fstat(object_file.get(), &st) != 0) {
+            return {errno, std::generic_category()};
+        }
+
+        send_file(object_file.get(), 0, st.st_size, fd);
+        return {};
+    }
+
+    void prefetch(const ObjectId& id) const override {
+        // the readahead is not cancelled when the file is closed
+        if (auto object_file = open_file(file(id))) {
+            ::posix_fadvise(object_file.get(), 0, 0, POSIX_FADV_WILLNEED);
+        }
+    }
+
+    void read(const ObjectId& id, ReadCallback done) override {
+        _io.read(file(id), std::move(done));
+    }
+
+    void write(const ObjectId& id, std::span<const unsigned char> data,
+               WriteCallback done) override {
+        _io.write(file(id), data,
+                  [this, id, done = std::move(done)](std::error_code err) {
+                      if (!err) {
+                          journal(id);
+                      }
+
+                      done(err);
+                  });
+    }
+
+    void wait() override {
+        _io.wait();
+
+        std::lock_guard lock{_journal_mutex};
+        flush_journal();
+    }
+
+    void write(const ObjectId& id,
+               std::span<const unsigned char> data) override {
+        auto tmp_path = temporary_file(id, ::gettid());
+
+        if (auto err = write_file(tmp_path, data)) {
+            ::unlink(tmp_path.c_str());
+            throw std::system_error{err, "unable to write object " + id.hex()};
+        }
+
+        fs::rename(tmp_path, file(id));
+        journal(id);
+    }
+
+    void write(const ObjectId& id, int fd) override {
+        // the name of the temporary file is unique per thread, as the same
+        // file may be written by several threads at once
+        auto tmp_path = temporary_file(id, ::gettid());
+
+        {
+            auto object_file = create_file(tmp_path);
+            copy_file(fd, object_file.get());
+        }
+
+        fs::rename(tmp_path, file(id));
+        journal(id);
+    }
+
+    void insert(const ObjectId& id, const fs::path& path) override {
+        fs::rename(path, file(id));
+        journal(id);
+    }
+
+    fs::path temporary_path() const override {
+        return _directory / ("incoming." + std::to_string(::gettid()) + ".tmp");
+    }
+
+    std::optional<fs::path> path(const ObjectId& id) const override {
+        return file(id);
+    }
+
+    std::vector<ObjectId> list() const override {
+        std::vector<ObjectId> objects;
+        auto directory = open_directory(AT_FDCWD, _directory.c_str());
+        DirectoryReader reader{directory.get()};
+
+        while (auto entry = reader.next()) {
+            if (auto id = ObjectId::from_hex(entry->name)) {
+                objects.push_back(*id);
+            }
+        }
+
+        std::sort(objects.begin(), objects.end());
+
+        return objects;
+    }
+
+    std::vector<ObjectId> find_prefix(std::string_view prefix,
+                                      std::size_t limit) const override {
+        auto range = ObjectId::prefix_range(prefix);
+
+        if (!range) {
+            return {};
+        }
+
+        // The journals are read before the index: journals are only removed
+        // once the index they were merged into is in place.
+        std::vector<ObjectId> found;
+        std::size_t journals = 0;
+        std::size_t journaled = 0;
+
+        for_each_journal([&](int, const std::string&,
+                             const std::vector<ObjectId>& ids) {
+            for (const auto& id : ids) {
+                if (range->first <= id && id <= range->second &&
+                    contains(id)) {
+                    found.push_back(id);
+                }
+            }
+
+            ++journals;
+            journaled += ids.size();
+        });
+
+        auto index = open_index();
+
+        if (!index) {
+            update_index(true);
+            index = open_index();
+        }
+
+        // without an index (e.g. in a read-only directory), all objects are
+        // listed
+        if (!index) {
+            return ObjectStore::find_prefix(prefix, limit);
+        }
+
+        // the index may still list objects that were removed since
+        std::size_t indexed = 0;
+
+        for (const auto& id : index->find(prefix)) {
+            if (indexed == limit) {
+                break;
+            } else if (contains(id)) {
+                found.push_back(id);
+                ++indexed;
+            }
+        }
+
+        std::sort(found.begin(), found.end());
+        found.erase(std::unique(found.begin(), found.end()), found.end());
+        found.resize(std::min(found.size(), limit));
+
+        if (journals > max_journals || journaled > max_journaled) {
+            update_index(false);
+        }
+
+        return found;
+    }
+
+    bool remove(const ObjectId& id) override {
+        return ::unlink(file(id).c_str()) == 0;
+    }
+
+    std::size_t remove_temporary(std::time_t cutoff) override {
+        std::size_t removed = 0;
+        auto directory = open_directory(AT_FDCWD, _directory.c_str());
+        DirectoryReader reader{directory.get()};
+
+        while (auto entry = reader.next()) {
+            struct stat st;
+            std::string name{entry->name};
+
+            if (name.ends_with(".tmp") &&
+                ::fstatat(directory.get(), name.c_str(), &st,
+                          AT_SYMLINK_NOFOLLOW) == 0 &&
+                st.st_mtime <= cutoff &&
+                ::unlinkat(directory.get(), name.c_str(), 0) == 0) {
+                ++removed;
+            }
+        }
+
+        return removed;
+    }
+
+    std::optional<std::uintmax_t> verify(const ObjectId& id) const override {
+        auto path = file(id);
+
+        // avoid updating the access time of every object
+        FileDescriptor object_file{
+            ::open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NOATIME)};
+
+        if (!object_file && errno == EPERM) {
+            object_file = open_file(path);
+        }
+
+        struct stat st;
+
+        if (!object_file || ::fstat(object_file.get(), &st) != 0) {
+            return std::nullopt;
+        }
+
+        ::posix_fadvise(object_file.get(), 0, 0, POSIX_FADV_SEQUENTIAL);
+
+        std::optional<ObjectId> hash;
+
+        try {
+            hash = sha256(object_file.get());
+        } catch (const std::system_error&) {
+        }
+
+        // drop the pages that were just read from the page cache, so that
+        // checking a large repository does not evict everything else from it
+        ::posix_fadvise(object_file.get(), 0, 0, POSIX_FADV_DONTNEED);
+
+        if (hash != id) {
+            return std::nullopt;
+        }
+
+        return static_cast<std::uintmax_t>(st.st_size);
+    }
+
+    void compact() override {
+        update_index(true);
+    }
+
+private:
+    fs::path file(const ObjectId& id) const {
+        return _directory / id.hex();
+    }
+
+    fs::path temporary_file(const ObjectId& id, pid_t tid) const {
+        return _directory / (id.hex() + "." + std::to_string(tid) + ".tmp");
+    }
+
+    fs::path index_path() const {
+        return _directory / "index";
+    }
+
+    fs::path journal_path() const {
+        return _directory / "journal";
+    }
+
+    // returns the index, or std::nullopt if it is missing or corrupt
+    std::optional<ObjectIndex> open_index() const {
+        try {
+            return ObjectIndex::open(index_path());
+        } catch (const std::exception&) {
+            return std::nullopt;
+        }
+    }
+
+    // records that the given object was written
+    void journal(const ObjectId& id) {
+        std::lock_guard lock{_journal_mutex};
+        _journal_buffer.push_back(id);
+
+        if (_journal_buffer.size() >= journal_batch) {
+            flush_journal();
+        }
+    }
+
+    // Appends the buffered ids to this process's journal, which is created
+    // on first use. Must be called with _journal_mutex held. Failures are
+    // ignored: gc rebuilds the index from a listing anyway.
+    void flush_journal() {
+        if (_journal_buffer.empty()) {
+            return;
+        }
+
+        if (!_journal && !_journal_failed) {
+            // The journal is locked before it is moved into the journal
+            // directory, so it is never mistaken for a finished one.
+            std::random_device device;
+            auto name = std::to_string(::getpid()) + "-" +
+                        std::to_string(device()) + std::to_string(device());
+            auto tmp_path = _directory / (name + ".journal.tmp");
+
+            std::error_code err;
+            fs::create_directories(journal_path(), err);
+
+            _journal = FileDescriptor{
+                ::open(tmp_path.c_str(),
+                       O_WRONLY | O_CREAT | O_EXCL | O_APPEND | O_CLOEXEC,
+                       0666)};
+
+            if (!_journal || ::flock(_journal.get(), LOCK_SH) != 0 ||
+                ::rename(tmp_path.c_str(),
+                         (journal_path() / name).c_str()) != 0) {
+                ::unlink(tmp_path.c_str());
+                _journal = FileDescriptor{};
+                _journal_failed = true;
+            }
+        }
+
+        if (_journal) {
+            // a torn write only loses the ids it did not write
+            [[maybe_unused]] auto n =
+                ::write(_journal.get(), _journal_buffer.data(),
+                        _journal_buffer.size() * ObjectId::size);
+        }
+
+        _journal_buffer.clear();
+    }
+
+    // calls f(fd, name, ids) for every journal
+    template <class F>
+    void for_each_journal(F f) const {
+        FileDescriptor directory{::open(journal_path().c_str(),
+                                        O_RDONLY | O_DIRECTORY | O_CLOEXEC)};
+
+        if (!directory) {
+            return;
+        }
+
+        DirectoryReader reader{directory.get()};
+        std::vector<unsigned char> data;
+        std::vector<ObjectId> ids;
+
+        while (auto entry = reader.next()) {
+            std::string name{entry->name};
+            FileDescriptor journal{::openat(directory.get(), name.c_str(),
+                                            O_RDONLY | O_CLOEXEC)};
+
+            // journals may be removed concurrently
+            if (!journal || read_file(journal.get(), data)) {
+                continue;
+            }
+
+            // a torn write at the end of a journal is ignored
+            ids.resize(data.size() / ObjectId::size);
+            std::memcpy(ids.data(), data.data(), ids.size() * ObjectId::size);
+
+            f(journal.get(), name, ids);
+        }
+    }
+
+    // Writes a new index of the objects in the current index (or in the
+    // directory, if full is set or there is no index) and in all journals,
+    // and removes the journals of processes that have closed them. Does
+    // nothing if the directory is not writable.
+    void update_index(bool full) const {
+        std::error_code err;
+        fs::create_directories(journal_path(), err);
+
+        // only one process updates the index at a time, so no journal is
+        // removed before the index it was merged into is in place
+        FileDescriptor lock{::open(journal_path().c_str(),
+                                   O_RDONLY | O_DIRECTORY | O_CLOEXEC)};
+
+        if (!lock || ::flock(lock.get(), LOCK_EX) != 0) {
+            return;
+        }
+
+        std::vector<ObjectId> ids;
+        std::vector<std::string> finished;
+
+        for_each_journal([&](int journal, const std::string& name,
+                             const std::vector<ObjectId>& journaled) {
+            // the journals of running processes are still locked
+            if (::flock(journal, LOCK_EX | LOCK_NB) == 0) {
+                finished.push_back(name);
+            }
+
+            ids.insert(ids.end(), journaled.begin(), journaled.end());
+        });
+
+        std::optional<ObjectIndex> index;
+
+        if (!full) {
+            index = open_index();
+        }
+
+        if (index) {
+            ids.insert(ids.end(), index->ids().begin(), index->ids().end());
+        } else {
+            auto objects = list();
+            ids.insert(ids.end(), objects.begin(), objects.end());
+        }
+
+        std::sort(ids.begin(), ids.end());
+        ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+
+        try {
+            ObjectIndex::write(index_path(), ids);
+        } catch (const std::exception&) {
+            return;
+        }
+
+        for (const auto& name : finished) {
+            ::unlinkat(lock.get(), name.c_str(), 0);
+        }
+    }
+
+    fs::path _directory;
+    IoEngine& _io;
+
+    // the ids of the objects written since the journal was last flushed
+    std::mutex _journal_mutex;
+    std::vector<ObjectId> _journal_buffer;
+    FileDescriptor _journal;
+    bool _journal_failed = false;
+};
+
+}  // namespace
+
+std::error_code ObjectStore::send(const ObjectId& id, int fd) const {
+    std::vector<unsigned char> data;
+
+    if (auto err = read(id, data)) {
+        return err;
+    }
+
+    write_all(fd, data.data(), data.size());
+    return {};
+}
+
+std::vector<ObjectId> ObjectStore::find_prefix(std::string_view prefix,
+                                               std::size_t limit) const {
+    auto range = ObjectId::prefix_range(prefix);
+
+    if (!range) {
+        return {};
+    }
+
+    auto objects = list();
+    auto begin =
+        std::lower_bound(objects.begin(), objects.end(), range->first);
+    auto end = std::upper_bound(begin, objects.end(), range->second);
+
+    return {begin, begin + std::min<std::size_t>(limit, end - begin)};
+}
+
+std::unique_ptr<ObjectStore> ObjectStore::open(const fs::path& togdir,
+                                               std::string_view backend,
+                                               IoEngine& io) {
+    if (backend == "loose") {
+        return loose(togdir / "objects", io);
+    } else if (backend == "kv") {
+        return std::make_unique<KvObjectStore>(togdir);
+    }
+
+    throw std::invalid_argument{"unknown object store: " +
+                                std::string{backend}};
+}
+
+std::unique_ptr<ObjectStore> ObjectStore::loose(const fs::path& directory,
+                                                IoEngine& io) {
+    return std::make_unique<LooseObjectStore>(directory, io);
+}
+
+void ObjectStore::create(const fs::path& togdir, std::string_view backend) {
+    if (backend == "loose") {
+        fs::create_directories(togdir / "objects");
+    } else if (backend == "kv") {
+        KvObjectStore::create(togdir);
+    } else {
+        throw std::invalid_argument{"unknown object store: " +
+                                    std::string{backend}};
+    }
+}
+
+}  // namespace tog
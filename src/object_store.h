@@ -0,0 +1,149 @@
+#ifndef TOG_OBJECT_STORE_H
+#define TOG_OBJECT_STORE_H
+
+#include <ctime>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#include "io_engine.h"
+#include "object.h"
+
+namespace tog {
+
+// metadata about a stored object
+struct ObjectInfo {
+    // the size of the object's serialization, in bytes
+    std::uintmax_t size = 0;
+
+    // the time the object was stored. It is never set to the past, so it can
+    // be used to find objects added since a point in time.
+    std::time_t written = 0;
+};
+
+// The storage backend of a repository's objects. Objects are immutable, so an
+// object is only ever written once (writing it again has no effect), and
+// removed by gc once it is unreachable.
+//
+// Like the IoEngine, stores execute batches of reads and writes: operations
+// queued with read() and write() run once wait() is called, and their
+// callbacks are invoked on the thread calling wait(). Only one thread may queue
+// operations at a time, but all other methods may be called concurrently from
+// several threads.
+class ObjectStore {
+public:
+    using ReadCallback = IoEngine::ReadCallback;
+    using WriteCallback = IoEngine::WriteCallback;
+
+    virtual ~ObjectStore() = default;
+
+    virtual bool contains(const ObjectId& id) const = 0;
+
+    // Resets the time the given object was written (see ObjectInfo) to now,
+    // and returns false if it does not exist. Called when a commit reuses an
+    // existing object, so that gc's grace period covers it until the commit
+    // has updated its refs, as it does for newly written objects.
+    virtual bool freshen(const ObjectId& id) = 0;
+
+    // returns std::nullopt if the object does not exist
+    virtual std::optional<ObjectInfo> info(const ObjectId& id) const = 0;
+
+    // reads the entire serialization of the given object
+    virtual std::error_code read(const ObjectId& id,
+                                 std::vector<unsigned char>& data) const = 0;
+
+    // writes the serialization of the given object to the given file
+    // descriptor, kernel-side where possible (see send_file()), so that large
+    // objects are never loaded into memory. Returns an error if the object
+    // does not exist, and throws a std::system_error if writing fails.
+    virtual std::error_code send(const ObjectId& id, int fd) const;
+
+    // hints that the given object will be read soon, so that the backend can
+    // start reading it into the page cache in the background
+    virtual void prefetch(const ObjectId&) const {}
+
+    // queues reading the given object
+    virtual void read(const ObjectId& id, ReadCallback done) = 0;
+
+    // queues writing the given object. The data must stay alive until the
+    // callback is invoked.
+    virtual void write(const ObjectId& id, std::span<const unsigned char> data,
+                       WriteCallback done) = 0;
+
+    // executes all queued operations
+    virtual void wait() = 0;
+
+    // writes the given object right away, throwing on failure. Unlike the
+    // queued operations, this may be called from any thread.
+    virtual void write(const ObjectId& id,
+                       std::span<const unsigned char> data) = 0;
+
+    // writes the object whose serialization is the contents of the given file
+    // descriptor (regardless of its offset), e.g. a large file that is not
+    // loaded into memory
+    virtual void write(const ObjectId& id, int fd) = 0;
+
+    // adds the object whose serialization is the contents of the given file,
+    // which is moved into the store (or removed once it has been copied)
+    virtual void insert(const ObjectId& id,
+                        const std::filesystem::path& path) = 0;
+
+    // returns a path for a temporary file whose contents are passed to
+    // insert() once their id is known. It is unique per thread, and left over
+    // files are removed by remove_temporary().
+    virtual std::filesystem::path temporary_path() const = 0;
+
+    // returns the path of the object's file, for stores that keep each object
+    // in a file of its own. Such files can be hard-linked or streamed directly.
+    virtual std::optional<std::filesystem::path> path(const ObjectId&) const {
+        return std::nullopt;
+    }
+
+    // returns the ids of all objects, sorted
+    virtual std::vector<ObjectId> list() const = 0;
+
+    // returns (up to limit of) the objects whose hex ids start with the given
+    // prefix, sorted. The default implementation lists all objects; the
+    // backends look them up in an ObjectIndex instead.
+    virtual std::vector<ObjectId> find_prefix(std::string_view prefix,
+                                              std::size_t limit) const;
+
+    // removes the given object. Returns false if it does not exist.
+    virtual bool remove(const ObjectId& id) = 0;
+
+    // removes leftovers of interrupted writes that are older than cutoff, and
+    // returns their number
+    virtual std::size_t remove_temporary(std::time_t cutoff) = 0;
+
+    // reclaims space still held by removed objects, if the store keeps any.
+    // Called by gc after removing objects.
+    virtual void compact() {}
+
+    // verifies that the given object's hash matches its contents, and
+    // returns its size if it does
+    virtual std::optional<std::uintmax_t> verify(const ObjectId& id) const = 0;
+
+    // opens the object store of the repository at togdir with the given
+    // backend: "loose" stores every object in a file of its own in
+    // togdir/objects, "kv" stores all objects in a single log file indexed by
+    // a memory-mapped hash table (see KvObjectStore)
+    static std::unique_ptr<ObjectStore> open(const std::filesystem::path& togdir,
+                                             std::string_view backend,
+                                             IoEngine& io);
+
+    // opens a directory of loose objects, e.g. an alternate object directory
+    static std::unique_ptr<ObjectStore> loose(
+        const std::filesystem::path& directory, IoEngine& io);
+
+    // creates an empty store with the given backend
+    static void create(const std::filesystem::path& togdir,
+                       std::string_view backend);
+};
+
+}  // namespace tog
+
+#endif  // TOG_OBJECT_STORE_H
@@ -0,0 +1,194 @@
+#ifndef TOG_OBJECT_TABLE_H
+#define TOG_OBJECT_TABLE_H
+
+#include <cstdint>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "arena.h"
+#include "handle.h"
+#include "object.h"
+#include "object_cache.h"
+
+namespace tog {
+
+// An object table stores all objects of type T that the repository knows about
+// during an operation. Entries are addressed by Handle<T>s and looked up by
+// object id through an open-addressing hash index, so that neither the entries
+// nor the index need per-object heap allocations. The objects themselves are
+// allocated in an arena.
+template <class T>
+class ObjectTable {
+public:
+    struct Entry {
+        ObjectId id;
+
+        // indicates whether the object needs to be persisted on disk
+        bool dirty = false;
+
+        // the object itself, or nullptr if it has not been loaded yet (or has
+        // been evicted from the cache)
+        T* object = nullptr;
+
+        // the number of active Pins, which keep the object from being evicted
+        std::uint32_t pins = 0;
+
+        // the object's slot in the repository's object cache
+        ObjectCache::Slot cache_slot = 0;
+    };
+
+    explicit ObjectTable(Arena& arena) : _arena{&arena} {}
+
+    ObjectTable(const ObjectTable&) = delete;
+    ObjectTable& operator=(const ObjectTable&) = delete;
+
+    ~ObjectTable() {
+        clear();
+    }
+
+    // returns the handle of the object with the given id, if it is in the table
+    std::optional<Handle<T>> find(const ObjectId& id) const {
+        if (_slots.empty()) {
+            return std::nullopt;
+        }
+
+        for (auto slot = first_slot(id);; slot = next_slot(slot)) {
+            auto index = _slots[slot];
+
+            if (index == empty) {
+                return std::nullopt;
+            } else if (_entries[index].id == id) {
+                return Handle<T>{index};
+            }
+        }
+    }
+
+    // returns the handle of the object with the given id, adding an unresolved
+    // entry if the table does not contain it yet
+    Handle<T> insert(const ObjectId& id) {
+        if (auto handle = find(id)) {
+            return *handle;
+        }
+
+        // keep the load factor at or below 1/2
+        if (2 * (_entries.size() + 1) > _slots.size()) {
+            rehash(_slots.empty() ? 1024 : 2 * _slots.size());
+        }
+
+        auto index = static_cast<std::uint32_t>(_entries.size());
+        _entries.push_back(Entry{id});
+        place(index);
+
+        return Handle<T>{index};
+    }
+
+    Entry& operator[](Handle<T> handle) {
+        return _entries[handle.index()];
+    }
+
+    // constructs the object of the given (unresolved) entry in the arena
+    template <class... Args>
+    T& emplace(Handle<T> handle, Args&&... args) {
+        auto& entry = (*this)[handle];
+        entry.object = _arena->create<T>(std::forward<Args>(args)...);
+
+        return *entry.object;
+    }
+
+    // destroys the object of the given entry to free up memory. The entry
+    // itself (and thus its handle) remains valid.
+    void evict(Handle<T> handle) {
+        auto& entry = (*this)[handle];
+        entry.object->~T();
+        entry.object = nullptr;
+    }
+
+    std::size_t size() const {
+        return _entries.size();
+    }
+
+    auto begin() {
+        return _entries.begin();
+    }
+
+    auto end() {
+        return _entries.end();
+    }
+
+    // destroys all objects and removes all entries. This invalidates all
+    // handles. The arena memory is not freed; this is up to the arena's owner.
+    void clear() {
+        for (auto& entry : _entries) {
+            if (entry.object) {
+                entry.object->~T();
+            }
+        }
+
+        _entries.clear();
+        _slots.clear();
+    }
+
+private:
+    static constexpr std::uint32_t empty = ~std::uint32_t{0};
+
+    std::size_t first_slot(const ObjectId& id) const {
+        return ObjectIdHash{}(id) & (_slots.size() - 1);
+    }
+
+    std::size_t next_slot(std::size_t slot) const {
+        return (slot + 1) & (_slots.size() - 1);
+    }
+
+    void place(std::uint32_t index) {
+        auto slot = first_slot(_entries[index].id);
+
+        while (_slots[slot] != empty) {
+            slot = next_slot(slot);
+        }
+
+        _slots[slot] = index;
+    }
+
+    void rehash(std::size_t slot_count) {
+        _slots.assign(slot_count, empty);
+
+        for (std::uint32_t index = 0; index < _entries.size(); ++index) {
+            place(index);
+        }
+    }
+
+    Arena* _arena;
+
+    std::vector<Entry> _entries;
+
+    // the hash index; each slot holds an index into _entries (or empty).
+    // The number of slots is always a power of two.
+    std::vector<std::uint32_t> _slots;
+};
+
+// A pin keeps an object from being evicted from the object cache while it is in
+// scope, so that references to the object stay valid.
+template <class T>
+class Pin {
+public:
+    Pin(ObjectTable<T>& table, Handle<T> handle)
+        : _table{table}, _handle{handle} {
+        ++_table[_handle].pins;
+    }
+
+    ~Pin() {
+        --_table[_handle].pins;
+    }
+
+    Pin(const Pin&) = delete;
+    Pin& operator=(const Pin&) = delete;
+
+private:
+    ObjectTable<T>& _table;
+    Handle<T> _handle;
+};
+
+}  // namespace tog
+
+#endif  // TOG_OBJECT_TABLE_H
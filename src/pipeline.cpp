@@ -0,0 +1,25 @@
+#include "pipeline.h"
+
+#include <algorithm>
+
+namespace tog {
+
+void MemoryBudget::acquire(std::size_t bytes) {
+    std::unique_lock lock{_mutex};
+    _released.wait(lock,
+                   [&] { return _used == 0 || _used + bytes <= _limit; });
+
+    _used += bytes;
+    _peak = std::max(_peak, _used);
+}
+
+void MemoryBudget::release(std::size_t bytes) {
+    {
+        std::lock_guard lock{_mutex};
+        _used -= bytes;
+    }
+
+    _released.notify_all();
+}
+
+}  // namespace tog
@@ -0,0 +1,144 @@
+#ifndef TOG_PIPELINE_H
+#define TOG_PIPELINE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+namespace tog {
+
+// A queue connecting two stages of a pipeline. push() blocks while the queue
+// is full, so a fast stage cannot run arbitrarily far ahead of the next one
+// (backpressure), and pop() blocks while it is empty. Once the producing stage
+// calls close(), pop() returns the remaining items, and std::nullopt after
+// that.
+template <class T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(std::size_t capacity) : _capacity{capacity} {}
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    void push(T item) {
+        {
+            std::unique_lock lock{_mutex};
+            _not_full.wait(lock, [this] { return _items.size() < _capacity; });
+            _items.push_back(std::move(item));
+        }
+
+        _not_empty.notify_one();
+    }
+
+    std::optional<T> pop() {
+        std::unique_lock lock{_mutex};
+        _not_empty.wait(lock, [this] { return !_items.empty() || _closed; });
+
+        return take();
+    }
+
+    // returns an item if one is available right away
+    std::optional<T> try_pop() {
+        std::lock_guard lock{_mutex};
+        return take();
+    }
+
+    void close() {
+        {
+            std::lock_guard lock{_mutex};
+            _closed = true;
+        }
+
+        _not_empty.notify_all();
+    }
+
+private:
+    // removes the first item. Must be called with the mutex held.
+    std::optional<T> take() {
+        if (_items.empty()) {
+            return std::nullopt;
+        }
+
+        std::optional<T> item{std::move(_items.front())};
+        _items.pop_front();
+        _not_full.notify_one();
+
+        return item;
+    }
+
+    std::mutex _mutex;
+    std::condition_variable _not_full;
+    std::condition_variable _not_empty;
+
+    std::deque<T> _items;
+    std::size_t _capacity;
+    bool _closed = false;
+};
+
+// Limits the number of bytes a pipeline holds in memory. A stage acquires
+// bytes before loading data, and the stage that is done with the data
+// releases them. acquire() blocks while the limit would be exceeded. A single
+// request larger than the limit is admitted once nothing else is in flight,
+// so it cannot block forever.
+class MemoryBudget {
+public:
+    explicit MemoryBudget(std::size_t limit) : _limit{limit} {}
+
+    void acquire(std::size_t bytes);
+    void release(std::size_t bytes);
+
+    // returns the largest number of bytes that were in flight at once
+    std::size_t peak() const {
+        std::lock_guard lock{_mutex};
+        return _peak;
+    }
+
+private:
+    mutable std::mutex _mutex;
+    std::condition_variable _released;
+
+    std::size_t _limit;
+    std::size_t _used = 0;
+    std::size_t _peak = 0;
+};
+
+// Records the first exception thrown by any of a set of worker threads, so
+// that it can be rethrown on the thread that started them. Workers check
+// failed() to skip the remaining work.
+class FirstError {
+public:
+    void set(std::exception_ptr exception) {
+        std::lock_guard lock{_mutex};
+
+        if (!_error) {
+            _error = exception;
+            _failed = true;
+        }
+    }
+
+    bool failed() const {
+        return _failed;
+    }
+
+    // rethrows the recorded exception, if any. Must only be called once all
+    // workers are done.
+    void rethrow() const {
+        if (_error) {
+            std::rethrow_exception(_error);
+        }
+    }
+
+private:
+    std::mutex _mutex;
+    std::exception_ptr _error;
+    std::atomic<bool> _failed = false;
+};
+
+}  // namespace tog
+
+#endif  // TOG_PIPELINE_H
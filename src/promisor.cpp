@@ -0,0 +1,126 @@
+#include "promisor.h"
+
+#include <fcntl.h>
+
+#include <optional>
+#include <stdexcept>
+#include <string_view>
+
+#include "connection.h"
+#include "file.h"
+#include "scanner.h"
+
+namespace tog {
+
+namespace {
+
+class DirectoryPromisor : public Promisor {
+public:
+    explicit DirectoryPromisor(const std::filesystem::path& path)
+        : _path{path} {}
+
+    void fetch(const std::vector<ObjectId>& ids,
+               const Receiver& receive) override {
+        auto directory = open_directory(AT_FDCWD, _path.c_str());
+
+        for (const auto& id : ids) {
+            auto hex = id.hex();
+            FileDescriptor file{
+                ::openat(directory.get(), hex.c_str(), O_RDONLY | O_CLOEXEC)};
+
+            if (file) {
+                receive(id, [&file](int fd) { copy_file(file.get(), fd); });
+            }
+        }
+    }
+
+private:
+    std::filesystem::path _path;
+};
+
+// Fetches are sent as `want <n>`, followed by n object ids (one per line).
+// The helper answers every id with either `object <id> <size>` followed by
+// the object's contents, or `missing <id>`, and ends the batch with `done`.
+// The session ends with `end`.
+class CommandPromisor : public Promisor {
+public:
+    explicit CommandPromisor(const std::string& command) : _command{command} {}
+
+    ~CommandPromisor() override {
+        // the helper exits once the session ends
+        if (_connection) {
+            try {
+                _connection->write_line("end");
+                _connection->flush();
+            } catch (const std::exception&) {
+            }
+        }
+    }
+
+    void fetch(const std::vector<ObjectId>& ids,
+               const Receiver& receive) override {
+        if (!_process) {
+            _process.emplace(_command);
+            _connection.emplace(_process->out_fd(), _process->in_fd());
+
+            _connection->write_line(sync_greeting);
+            _connection->write_line("fetch");
+        }
+
+        _connection->write_line("want " + std::to_string(ids.size()));
+
+        for (const auto& id : ids) {
+            _connection->write_line(id.hex());
+        }
+
+        for (;;) {
+            auto line = _connection->read_line();
+
+            if (line == "done") {
+                return;
+            } else if (line.starts_with("missing ")) {
+                continue;
+            } else if (!line.starts_with("object ")) {
+                throw std::runtime_error{"unexpected response from promisor: " +
+                                         line};
+            }
+
+            std::string_view header{line};
+            header.remove_prefix(7);
+
+            auto separator = header.find(' ');
+            auto id = ObjectId::from_hex(header.substr(0, separator));
+
+            if (!id || separator == std::string_view::npos) {
+                throw std::runtime_error{"invalid object header: " + line};
+            }
+
+            auto size = std::stoull(std::string{header.substr(separator + 1)});
+
+            receive(*id, [this, size](int fd) {
+                _connection->read_into(fd, size);
+            });
+        }
+    }
+
+private:
+    std::string _command;
+
+    // the connection must be destroyed before the process, which waits for
+    // the helper to exit
+    std::optional<ChildProcess> _process;
+    std::optional<Connection> _connection;
+};
+
+}  // namespace
+
+std::unique_ptr<Promisor> Promisor::directory(
+    const std::filesystem::path& path) {
+    return std::make_unique<DirectoryPromisor>(path);
+}
+
+std::unique_ptr<Promisor> Promisor::command(const std::string& command) {
+    return std::make_unique<CommandPromisor>(command);
+}
+
+}  // namespace tog
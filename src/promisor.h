@@ -0,0 +1,46 @@
+#ifndef TOG_PROMISOR_H
+#define TOG_PROMISOR_H
+
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "object.h"
+
+namespace tog {
+
+// A promisor is the backing store of a partial repository, i.e. one that
+// does not hold every object locally. Objects missing from the object store
+// are fetched from the promisor on demand, in batches.
+class Promisor {
+public:
+    // writes the contents of a fetched object to the given file descriptor
+    using Copy = std::function<void(int fd)>;
+
+    // called for every object that was fetched
+    using Receiver = std::function<void(const ObjectId& id, const Copy& copy)>;
+
+    virtual ~Promisor() = default;
+
+    // fetches the given objects in one batch, calling receive for each of
+    // them (in any order). Objects the promisor does not have are skipped.
+    virtual void fetch(const std::vector<ObjectId>& ids,
+                       const Receiver& receive) = 0;
+
+    // creates a promisor reading objects from the given directory, e.g. the
+    // object store of a complete repository on a shared filesystem
+    static std::unique_ptr<Promisor> directory(
+        const std::filesystem::path& path);
+
+    // creates a promisor fetching objects from a helper process, which is
+    // started with the given shell command on the first fetch. The helper
+    // speaks the fetch request of the sync protocol on its stdin/stdout, so
+    // it can be `tog serve` in a complete repository (e.g. over ssh).
+    static std::unique_ptr<Promisor> command(const std::string& command);
+};
+
+}  // namespace tog
+
+#endif  // TOG_PROMISOR_H
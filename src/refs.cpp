@@ -0,0 +1,493 @@
+#include "refs.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <system_error>
+
+#include "file.h"
+
+namespace fs = std::filesystem;
+
+namespace tog {
+
+namespace {
+
+constexpr std::string_view packed_header = "# tog packed-refs\n";
+constexpr std::size_t hex_size = 2 * ObjectId::size;
+
+// a line of packed-refs: the target's hex id, a space and the ref's name
+struct PackedRef {
+    std::string_view name;
+    ObjectId target;
+};
+
+PackedRef parse_packed_ref(std::string_view line) {
+    auto target = ObjectId::from_hex(line.substr(0, hex_size));
+
+    if (!target || line.size() < hex_size + 2 || line[hex_size] != ' ') {
+        throw std::runtime_error{"corrupt packed-refs"};
+    }
+
+    return {line.substr(hex_size + 1), *target};
+}
+
+// A read-only mapping of packed-refs, which is empty if the file does not
+// exist. The file is only ever replaced as a whole, so the mapping stays
+// consistent while it is in use.
+class PackedRefs {
+public:
+    explicit PackedRefs(const fs::path& path) {
+        auto file = open_file(path);
+        struct stat status;
+
+        if (!file) {
+            if (errno == ENOENT) {
+                return;
+            }
+
+            throw std::system_error{errno, std::generic_category(),
+                                    "unable to open " + path.string()};
+        }
+
+        if (::fstat(file.get(), &status) != 0) {
+            throw std::system_error{errno, std::generic_category(),
+                                    "unable to read " + path.string()};
+        } else if (status.st_size == 0) {
+            return;
+        }
+
+        auto data = ::mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE,
+                           file.get(), 0);
+
+        if (data == MAP_FAILED) {
+            throw std::system_error{errno, std::generic_category(),
+                                    "unable to map " + path.string()};
+        }
+
+        _data = {static_cast<const char*>(data),
+                 static_cast<std::size_t>(status.st_size)};
+
+        if (!_data.starts_with(packed_header) || !_data.ends_with('\n')) {
+            ::munmap(const_cast<char*>(_data.data()), _data.size());
+            throw std::runtime_error{"corrupt packed-refs"};
+        }
+    }
+
+    ~PackedRefs() {
+        if (!_data.empty()) {
+            ::munmap(const_cast<char*>(_data.data()), _data.size());
+        }
+    }
+
+    PackedRefs(const PackedRefs&) = delete;
+    PackedRefs& operator=(const PackedRefs&) = delete;
+
+    // binary searches the lines, which are sorted by name
+    std::optional<ObjectId> find(std::string_view name) const {
+        if (_data.empty()) {
+            return std::nullopt;
+        }
+
+        auto low = packed_header.size();
+        auto high = _data.size();
+
+        // low and high always point to the start of a line
+        while (low < high) {
+            auto middle = low + (high - low) / 2;
+            auto start = _data.rfind('\n', middle - 1) + 1;
+            auto end = _data.find('\n', start);
+            auto ref = parse_packed_ref(_data.substr(start, end - start));
+
+            if (ref.name == name) {
+                return ref.target;
+            } else if (ref.name < name) {
+                low = end + 1;
+            } else {
+                high = start;
+            }
+        }
+
+        return std::nullopt;
+    }
+
+    // calls f(ref) for every ref, in order
+    template <class F>
+    void for_each(F f) const {
+        for (std::size_t start = packed_header.size(); start < _data.size();) {
+            auto end = _data.find('\n', start);
+
+            f(parse_packed_ref(_data.substr(start, end - start)));
+            start = end + 1;
+        }
+    }
+
+private:
+    std::string_view _data;
+};
+
+// A lock on a ref (or packed-refs), which is held by exclusively creating
+// path.lock. The new contents are written to the lock file, which then
+// replaces the locked file. The lock file is removed if the update is not
+// committed.
+class LockFile {
+public:
+    explicit LockFile(const fs::path& path)
+        : _path{path}, _lock_path{fs::path{path}.concat(".lock")} {
+        _file = FileDescriptor{
+            ::open(_lock_path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+                   0666)};
+
+        if (!_file) {
+            if (errno == EEXIST) {
+                throw std::runtime_error{"unable to lock " + _path.string() +
+                                         " (" + _lock_path.string() +
+                                         " exists)"};
+            }
+
+            throw std::system_error{errno, std::generic_category(),
+                                    "unable to create " + _lock_path.string()};
+        }
+    }
+
+    ~LockFile() {
+        if (!_done) {
+            ::unlink(_lock_path.c_str());
+        }
+    }
+
+    LockFile(const LockFile&) = delete;
+    LockFile& operator=(const LockFile&) = delete;
+
+    void write(std::string_view contents) {
+        while (!contents.empty()) {
+            auto n = ::write(_file.get(), contents.data(), contents.size());
+
+            if (n < 0 && errno == EINTR) {
+                continue;
+            } else if (n < 0) {
+                throw std::system_error{errno, std::generic_category(),
+                                        "unable to write " +
+                                            _lock_path.string()};
+            }
+
+            contents.remove_prefix(n);
+        }
+
+        // the contents must be on disk before the rename makes them visible
+        if (::fsync(_file.get()) != 0) {
+            throw std::system_error{errno, std::generic_category(),
+                                    "unable to write " + _lock_path.string()};
+        }
+    }
+
+    // replaces the locked file with the lock file
+    void commit() {
+        fs::rename(_lock_path, _path);
+        _done = true;
+    }
+
+    // removes the locked file, and then the lock
+    void remove() {
+        if (::unlink(_path.c_str()) != 0 && errno != ENOENT) {
+            throw std::system_error{errno, std::generic_category(),
+                                    "unable to remove " + _path.string()};
+        }
+
+        ::unlink(_lock_path.c_str());
+        _done = true;
+    }
+
+private:
+    fs::path _path;
+    fs::path _lock_path;
+    FileDescriptor _file;
+    bool _done = false;
+};
+
+// Reads a loose ref. Returns std::nullopt if there is no loose ref, and an
+// empty target if the ref is unborn.
+std::optional<std::optional<ObjectId>> read_loose(const fs::path& path) {
+    std::vector<unsigned char> bytes;
+
+    if (auto err = read_file(path, bytes)) {
+        if (err == std::errc::no_such_file_or_directory ||
+            err == std::errc::not_a_directory ||
+            err == std::errc::is_a_directory) {
+            return std::nullopt;
+        }
+
+        throw std::system_error{err, "unable to read ref " + path.string()};
+    }
+
+    std::string_view contents{reinterpret_cast<const char*>(bytes.data()),
+                              bytes.size()};
+
+    if (contents.ends_with('\n')) {
+        contents.remove_suffix(1);
+    }
+
+    if (contents.empty()) {
+        return std::optional<ObjectId>{};
+    }
+
+    auto target = ObjectId::from_hex(contents);
+
+    if (!target) {
+        throw std::runtime_error{"corrupt ref " + path.string()};
+    }
+
+    return target;
+}
+
+}  // namespace
+
+std::string_view ref_prefix(RefKind kind) {
+    return kind == RefKind::branch ? "branches/" : "tags/";
+}
+
+void RefTransaction::update(std::string name,
+                            const std::optional<ObjectId>& target) {
+    _updates.push_back({std::move(name), target});
+}
+
+void RefTransaction::update(std::string name,
+                            const std::optional<ObjectId>& target,
+                            const std::optional<ObjectId>& expected) {
+    _updates.push_back({std::move(name), target, true, expected});
+}
+
+RefStore::RefStore(const fs::path& togdir)
+    : _refs_path{togdir / "refs"}, _packed_path{togdir / "packed-refs"} {}
+
+std::optional<ObjectId> RefStore::read(std::string_view name) const {
+    if (auto loose = read_loose(_refs_path / name)) {
+        return *loose;
+    }
+
+    return PackedRefs{_packed_path}.find(name);
+}
+
+template <class F>
+void RefStore::for_each_loose(const fs::path& directory, F f) const {
+    if (!fs::is_directory(directory)) {
+        return;
+    }
+
+    for (const auto& entry : fs::recursive_directory_iterator(directory)) {
+        auto name = entry.path().lexically_relative(_refs_path).generic_string();
+
+        // skip lock files of updates in progress
+        if (!entry.is_regular_file() || name == head_ref ||
+            name.ends_with(".lock")) {
+            continue;
+        }
+
+        if (auto target = read_loose(entry.path())) {
+            f(name, *target);
+        }
+    }
+}
+
+std::vector<std::pair<std::string, ObjectId>> RefStore::list(
+    std::string_view prefix) const {
+    std::map<std::string, ObjectId, std::less<>> refs;
+
+    PackedRefs{_packed_path}.for_each([&](const PackedRef& ref) {
+        if (ref.name.starts_with(prefix)) {
+            refs.emplace(ref.name, ref.target);
+        }
+    });
+
+    // loose refs override packed ones. Only the directory holding the
+    // prefix needs to be searched.
+    auto directory = _refs_path / prefix.substr(0, prefix.rfind('/') + 1);
+
+    for_each_loose(directory, [&](const std::string& name,
+                                  const std::optional<ObjectId>& target) {
+        if (!name.starts_with(prefix)) {
+            return;
+        } else if (target) {
+            refs.insert_or_assign(name, *target);
+        } else {
+            refs.erase(name);
+        }
+    });
+
+    return {refs.begin(), refs.end()};
+}
+
+void RefStore::commit(const RefTransaction& transaction) {
+    auto updates = transaction._updates;
+
+    std::sort(updates.begin(), updates.end(),
+              [](const auto& a, const auto& b) { return a.name < b.name; });
+
+    // Lock all refs before checking any of them, so that no other writer can
+    // change them in between. Locks are taken in order of name.
+    std::vector<std::unique_ptr<LockFile>> locks;
+
+    for (std::size_t i = 0; i < updates.size(); ++i) {
+        const auto& name = updates[i].name;
+
+        if (i > 0 && updates[i - 1].name == name) {
+            throw std::runtime_error{"ref " + name + " is updated twice"};
+        }
+
+        auto path = _refs_path / name;
+        fs::create_directories(path.parent_path());
+
+        locks.push_back(std::make_unique<LockFile>(path));
+    }
+
+    for (const auto& update : updates) {
+        if (update.verify && read(update.name) != update.expected) {
+            throw std::runtime_error{"ref " + update.name +
+                                     " was updated concurrently"};
+        }
+    }
+
+    // Deleting a packed ref requires rewriting packed-refs. It is locked
+    // for any deletion, so pack() cannot move a deleted loose ref into it
+    // concurrently.
+    std::unique_ptr<LockFile> packed_lock;
+
+    auto deletes = std::any_of(updates.begin(), updates.end(),
+                               [](const auto& u) { return !u.target; });
+
+    if (deletes) {
+        packed_lock = std::make_unique<LockFile>(_packed_path);
+    }
+
+    PackedRefs packed{_packed_path};
+
+    auto deletes_packed =
+        deletes && std::any_of(updates.begin(), updates.end(),
+                               [&](const auto& u) {
+                                   return !u.target && packed.find(u.name);
+                               });
+
+    if (!deletes_packed) {
+        packed_lock.reset();
+    } else {
+        std::string contents{packed_header};
+
+        packed.for_each([&](const PackedRef& ref) {
+            auto update = std::lower_bound(
+                updates.begin(), updates.end(), ref.name,
+                [](const auto& u, std::string_view name) {
+                    return u.name < name;
+                });
+
+            if (update == updates.end() || update->name != ref.name ||
+                update->target) {
+                contents += ref.target.hex() + " ";
+                contents += ref.name;
+                contents += '\n';
+            }
+        });
+
+        packed_lock->write(contents);
+    }
+
+    for (std::size_t i = 0; i < updates.size(); ++i) {
+        if (updates[i].target) {
+            locks[i]->write(updates[i].target->hex() + "\n");
+        }
+    }
+
+    // Everything has been written, so the renames below only fail if the
+    // filesystem does. Deleted refs are removed from packed-refs first, so
+    // that their old value never shows through.
+    if (packed_lock) {
+        packed_lock->commit();
+    }
+
+    for (std::size_t i = 0; i < updates.size(); ++i) {
+        if (updates[i].target) {
+            locks[i]->commit();
+        } else {
+            locks[i]->remove();
+        }
+    }
+}
+
+std::size_t RefStore::pack() {
+    LockFile packed_lock{_packed_path};
+    std::map<std::string, ObjectId, std::less<>> refs;
+    std::vector<std::pair<std::string, ObjectId>> loose;
+
+    PackedRefs{_packed_path}.for_each([&](const PackedRef& ref) {
+        refs.emplace(ref.name, ref.target);
+    });
+
+    // unborn refs stay loose
+    for_each_loose(_refs_path, [&](const std::string& name,
+                                   const std::optional<ObjectId>& target) {
+        if (target) {
+            refs.insert_or_assign(name, *target);
+            loose.emplace_back(name, *target);
+        }
+    });
+
+    std::string contents{packed_header};
+
+    for (const auto& [name, target] : refs) {
+        contents += target.hex() + " " + name + "\n";
+    }
+
+    packed_lock.write(contents);
+    packed_lock.commit();
+
+    // The loose refs are redundant now, unless they were updated in the
+    // meantime. Refs locked by another writer are left alone.
+    for (const auto& [name, target] : loose) {
+        try {
+            LockFile lock{_refs_path / name};
+
+            if (read_loose(_refs_path / name) ==
+                std::optional<std::optional<ObjectId>>{target}) {
+                lock.remove();
+            }
+        } catch (const std::runtime_error&) {
+        }
+    }
+
+    return loose.size();
+}
+
+bool RefStore::valid_name(std::string_view name) {
+    if (name.empty()) {
+        return false;
+    }
+
+    for (std::size_t start = 0; start <= name.size();) {
+        auto end = std::min(name.find('/', start), name.size());
+        auto component = name.substr(start, end - start);
+
+        if (component.empty() || component.starts_with('.') ||
+            component.ends_with(".lock")) {
+            return false;
+        }
+
+        for (auto c : component) {
+            if (static_cast<unsigned char>(c) <= ' ' || c == '\x7f' ||
+                std::string_view{"~^:?*[\\"}.find(c) != std::string_view::npos) {
+                return false;
+            }
+        }
+
+        start = end + 1;
+    }
+
+    return true;
+}
+
+}  // namespace tog
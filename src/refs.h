@@ -0,0 +1,104 @@
+#ifndef TOG_REFS_H
+#define TOG_REFS_H
+
+#include <cstddef>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "object.h"
+
+namespace tog {
+
+// the names of the refs pointing to the checked-out commit and to the latest
+// commit of the main branch, relative to .tog/refs
+inline constexpr std::string_view head_ref = "head";
+inline constexpr std::string_view main_ref = "branches/main";
+
+// the kinds of named refs, which are kept in .tog/refs/branches and
+// .tog/refs/tags
+enum class RefKind { branch, tag };
+
+// returns the prefix of the names of all refs of the given kind, e.g. "tags/"
+std::string_view ref_prefix(RefKind kind);
+
+// A set of ref updates that are applied together by RefStore::commit()
+class RefTransaction {
+public:
+    // points the given ref to target, or deletes it if target is std::nullopt
+    void update(std::string name, const std::optional<ObjectId>& target);
+
+    // like update(), but fails unless the ref currently points to expected
+    // (or does not exist, if expected is std::nullopt)
+    void update(std::string name, const std::optional<ObjectId>& target,
+                const std::optional<ObjectId>& expected);
+
+private:
+    friend class RefStore;
+
+    struct Update {
+        std::string name;
+        std::optional<ObjectId> target;
+
+        bool verify = false;
+        std::optional<ObjectId> expected;
+    };
+
+    std::vector<Update> _updates;
+};
+
+// Stores the refs of a repository, i.e. the names of commits.
+//
+// Most refs (e.g. thousands of tags) are kept in a single file,
+// .tog/packed-refs, which holds one line per ref, sorted by name, so a ref is
+// found by binary search. A ref can be overridden by a loose ref, a file of
+// its own in .tog/refs, which is where updates are written. pack() moves the
+// loose refs into packed-refs.
+//
+// Updates write the new refs to lock files (created exclusively, so
+// concurrent writers fail rather than overwrite each other) and then rename
+// them into place, so readers never see a partially written ref.
+class RefStore {
+public:
+    explicit RefStore(const std::filesystem::path& togdir);
+
+    // returns the target of the given ref, or std::nullopt if it does not
+    // exist (or is unborn, like the main branch of a new repository)
+    std::optional<ObjectId> read(std::string_view name) const;
+
+    // returns all refs whose name starts with the given prefix, sorted by
+    // name. The head ref is not included.
+    std::vector<std::pair<std::string, ObjectId>> list(
+        std::string_view prefix = {}) const;
+
+    // applies all updates of the transaction, or none of them if any ref is
+    // locked by another writer or does not have its expected value. Throws a
+    // std::runtime_error in that case.
+    void commit(const RefTransaction& transaction);
+
+    // moves all loose refs (except head) into packed-refs and returns their
+    // number
+    std::size_t pack();
+
+    // returns true if the given name can be used for a ref, i.e. it consists
+    // of non-empty components separated by slashes, which do not start with a
+    // dot or end with ".lock", and it contains no whitespace, control or
+    // special characters
+    static bool valid_name(std::string_view name);
+
+private:
+    // calls f(name, target) for every loose ref below the given directory.
+    // Unborn refs have an empty target.
+    template <class F>
+    void for_each_loose(const std::filesystem::path& directory, F f) const;
+
+    std::filesystem::path _refs_path;
+    std::filesystem::path _packed_path;
+};
+
+}  // namespace tog
+
+#endif  // TOG_REFS_H
@@ -0,0 +1,188 @@
+#include "refs.h"
+
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+
+#include "crypto.h"
+#include "file.h"
+#include "test.h"
+
+namespace fs = std::filesystem;
+
+using namespace tog;
+
+namespace {
+
+ObjectId commit_id(int n) {
+    auto contents = "commit " + std::to_string(n);
+    return sha256({reinterpret_cast<const unsigned char*>(contents.data()),
+                   contents.size()});
+}
+
+// returns the name of the tag for n, padded so that names sort like numbers
+std::string tag(int n) {
+    auto digits = std::to_string(n);
+    return "tags/v" + std::string(4 - digits.size(), '0') + digits;
+}
+
+// returns whether the given transaction fails
+bool fails(RefStore& refs, const RefTransaction& transaction) {
+    try {
+        refs.commit(transaction);
+    } catch (const std::runtime_error&) {
+        return true;
+    }
+
+    return false;
+}
+
+bool has_lock_files(const fs::path& directory) {
+    for (const auto& entry : fs::recursive_directory_iterator(directory)) {
+        if (entry.path().extension() == ".lock") {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// every packed ref is found by binary search, and names that are missing,
+// including ones sorting before the first or after the last line, are not
+void test_packed_lookup() {
+    test::TemporaryDirectory dir;
+    RefStore refs{dir.path()};
+
+    RefTransaction transaction;
+
+    for (int i = 1; i < 1000; i += 2) {
+        transaction.update(tag(i), commit_id(i));
+    }
+
+    refs.commit(transaction);
+    TOG_CHECK(refs.pack() == 500);
+    TOG_CHECK(fs::is_empty(dir.path() / "refs" / "tags"));
+
+    for (int i = 0; i <= 1000; ++i) {
+        auto target = refs.read(tag(i));
+        TOG_CHECK(i % 2 == 1 ? target == commit_id(i) : !target);
+    }
+
+    TOG_CHECK(!refs.read("tags/a"));
+    TOG_CHECK(!refs.read("tags/z"));
+    TOG_CHECK(!refs.read("branches/v0001"));
+
+    auto listed = refs.list("tags/");
+    TOG_CHECK(listed.size() == 500);
+    TOG_CHECK(listed.front().first == tag(1));
+    TOG_CHECK(listed.back().first == tag(999));
+}
+
+// loose refs override packed ones, and deleting a packed ref rewrites
+// packed-refs
+void test_packed_updates() {
+    test::TemporaryDirectory dir;
+    RefStore refs{dir.path()};
+
+    RefTransaction create;
+    create.update(tag(1), commit_id(1));
+    create.update(tag(2), commit_id(2));
+    refs.commit(create);
+    refs.pack();
+
+    RefTransaction update;
+    update.update(tag(1), commit_id(3), commit_id(1));
+    update.update(tag(2), std::nullopt);
+    refs.commit(update);
+
+    TOG_CHECK(refs.read(tag(1)) == commit_id(3));
+    TOG_CHECK(!refs.read(tag(2)));
+    TOG_CHECK(refs.list("tags/").size() == 1);
+
+    // packing again leaves no trace of the deleted ref
+    refs.pack();
+    TOG_CHECK(refs.read(tag(1)) == commit_id(3));
+    TOG_CHECK(!refs.read(tag(2)));
+}
+
+// a ref locked by another writer fails the whole transaction, without
+// changing any of its refs or leaving lock files behind
+void test_locked_ref() {
+    test::TemporaryDirectory dir;
+    RefStore refs{dir.path()};
+
+    RefTransaction create;
+    create.update(tag(1), commit_id(1));
+    create.update(tag(2), commit_id(2));
+    refs.commit(create);
+
+    auto lock = dir.path() / "refs" / (tag(2) + ".lock");
+    create_file(lock);
+
+    RefTransaction update;
+    update.update(tag(1), commit_id(3));
+    update.update(tag(2), commit_id(4));
+    TOG_CHECK(fails(refs, update));
+
+    TOG_CHECK(refs.read(tag(1)) == commit_id(1));
+    TOG_CHECK(refs.read(tag(2)) == commit_id(2));
+
+    // only the other writer's lock remains
+    fs::remove(lock);
+    TOG_CHECK(!has_lock_files(dir.path() / "refs"));
+
+    refs.commit(update);
+    TOG_CHECK(refs.read(tag(2)) == commit_id(4));
+}
+
+// a ref that does not have its expected value fails the transaction
+void test_expected_value() {
+    test::TemporaryDirectory dir;
+    RefStore refs{dir.path()};
+
+    RefTransaction create;
+    create.update(tag(1), commit_id(1));
+    refs.commit(create);
+
+    RefTransaction stale;
+    stale.update(tag(1), commit_id(3), commit_id(2));
+    stale.update(tag(2), commit_id(3));
+    TOG_CHECK(fails(refs, stale));
+
+    // a ref expected not to exist
+    RefTransaction exists;
+    exists.update(tag(1), commit_id(3), std::nullopt);
+    TOG_CHECK(fails(refs, exists));
+
+    RefTransaction twice;
+    twice.update(tag(2), commit_id(1));
+    twice.update(tag(2), commit_id(2));
+    TOG_CHECK(fails(refs, twice));
+
+    TOG_CHECK(refs.read(tag(1)) == commit_id(1));
+    TOG_CHECK(!refs.read(tag(2)));
+    TOG_CHECK(!has_lock_files(dir.path() / "refs"));
+}
+
+void test_valid_names() {
+    TOG_CHECK(RefStore::valid_name("main"));
+    TOG_CHECK(RefStore::valid_name("release/1.0"));
+    TOG_CHECK(!RefStore::valid_name(""));
+    TOG_CHECK(!RefStore::valid_name("a//b"));
+    TOG_CHECK(!RefStore::valid_name("a/"));
+    TOG_CHECK(!RefStore::valid_name(".hidden"));
+    TOG_CHECK(!RefStore::valid_name("a.lock"));
+    TOG_CHECK(!RefStore::valid_name("with space"));
+}
+
+}  // namespace
+
+int main() {
+    auto passed = test::run("packed lookup", test_packed_lookup);
+    passed &= test::run("packed updates", test_packed_updates);
+    passed &= test::run("locked ref", test_locked_ref);
+    passed &= test::run("expected value", test_expected_value);
+    passed &= test::run("valid names", test_valid_names);
+
+    return passed ? 0 : 1;
+}
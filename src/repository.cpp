@@ -1,12 +1,39 @@
 #include "repository.h"
 
+#include <fcntl.h>
+#include <sys/stat.h>
 #include <tomlplusplus/toml.h>
-
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <charconv>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <iterator>
 #include <iostream>
-
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "bitmap.h"
+#include "bitmap_index.h"
+#include "commit_graph.h"
 #include "blob.h"
 #include "commit.h"
+#include "connection.h"
 #include "crypto.h"
+#include "file.h"
+#include "io_engine.h"
+#include "pipeline.h"
+#include "promisor.h"
+#include "scanner.h"
+#include "tar.h"
+#include "thread_pool.h"
 #include "handle.h"
 #include "tree.h"
 
@@ -14,7 +41,7 @@ namespace fs = std::filesystem;
 
 namespace tog {
 
-void Repository::init(const fs::path& path) {
+void Repository::init(const fs::path& path, std::string_view object_store) {
     auto togdir_path = path / ".tog";
 
     // Check if .tog directory exists
@@ -24,13 +51,20 @@ void Repository::init(const fs::path& path) {
     }
 
     // Create repository directories
-    fs::create_directories(togdir_path / "objects");
     fs::create_directories(togdir_path / "refs" / "branches");
 
+    try {
+        ObjectStore::create(togdir_path, object_store);
+    } catch (const std::invalid_argument& err) {
+        fs::remove_all(togdir_path);
+        throw TogException{err.what()};
+    }
+
     // Create default config file
     auto config = toml::table{{
         {"version", "0.0.0-alpha"},
         {"worktree", ".."},
+        {"object_store", object_store},
     }};
 
     std::ofstream config_file{togdir_path / "config.toml"};
@@ -42,7 +76,7 @@ void Repository::init(const fs::path& path) {
 }
 
 Repository::Repository(const fs::path& togdir_path)
-    : _togdir_path{togdir_path} {
+    : _togdir_path{togdir_path}, _refs{togdir_path} {
     auto config_path = togdir_path / "config.toml";
     toml::table config;
 
@@ -61,367 +95,3818 @@ Repository::Repository(const fs::path& togdir_path)
         this->_worktree_path = fs::canonical(togdir_path / *rel_worktree_path);
     }
 
-    _head = load_ref(togdir_path / "refs" / "head");
-    _main = load_ref(togdir_path / "refs" / "branches" / "main");
-}
+    _cache.set_budget(config["cache_size"].value_or(default_cache_size));
+    _io = IoEngine::create(config["io_engine"].value_or("auto"));
 
-std::string Repository::commit(const std::string& message) {
-    // cannot commit if head is not at the latest commit of the main branch
-    // (which is the only branch for now). In git, this is known as "detached
-    // head".
-    if (_head && (_head->hash() != _main->hash())) {
-        throw TogException{"not at latest commit of current branch"};
+    try {
+        _store = ObjectStore::open(
+            togdir_path, config["object_store"].value_or("loose"), *_io);
+    } catch (const std::invalid_argument& err) {
+        throw TogException{err.what()};
     }
 
-    auto tree_handle = add_directory(_worktree_path);
-    auto commit =
-        register_object(std::make_unique<Commit>(tree_handle, _head, message));
-
-    // Update refs (by copy)
-    _head = commit;
-    _main = commit;
+    // alternate object directories, relative to .tog unless absolute
+    if (auto alternates = config["alternates"].as_array()) {
+        for (const auto& alternate : *alternates) {
+            auto path = alternate.value<std::string>();
 
-    // TODO unify persist-loops once I have a better understanding of templates
-    auto objects_path = _togdir_path / "objects";
+            if (!path) {
+                throw TogException{"alternates must be a list of paths"};
+            }
 
-    // persist commit
-    if (commit.dirty()) {
-        auto bytes = commit.object()->serialize();
+            _alternates.push_back(ObjectStore::loose(togdir_path / *path, *_io));
+        }
+    }
 
-        std::ofstream file{objects_path / commit.hash(), std::ios_base::binary};
-        file.write(reinterpret_cast<char*>(bytes.data()), bytes.size());
+    // the backing store of a partial repository
+    if (auto directory = config["promisor"]["directory"].value<std::string>()) {
+        _promisor = Promisor::directory(togdir_path / *directory);
+    } else if (auto command =
+                   config["promisor"]["command"].value<std::string>()) {
+        _promisor = Promisor::command(*command);
     }
 
-    // persist blob objects
-    for (const auto& [hash, handle] : _blobs) {
-        if (handle.dirty()) {
-            auto bytes = handle.object()->serialize();
+    auto load_ref = [this](std::string_view name) {
+        auto commit = _refs.read(name);
+
+        if (commit && !has_object(*commit)) {
+            throw TogException{"ref " + std::string{name} +
+                               " points to non-existent commit " +
+                               commit->hex()};
+        }
+
+        return commit;
+    };
+
+    _head = load_ref(head_ref);
+    _main = load_ref(main_ref);
+}
+
+template <>
+Blob Repository::parse(std::vector<unsigned char>&& bytes, const ObjectId&) {
+    // TODO this works, because blobs are not yet compressed. Revisit this when
+    // we have compression.
+    return Blob{std::move(bytes)};
+}
+
+template <>
+Tree Repository::parse(std::vector<unsigned char>&& bytes, const ObjectId& id) {
+    // TODO error management; what if object is not a tree?
+    auto deserialized = toml::parse(std::string_view{
+        reinterpret_cast<const char*>(bytes.data()), bytes.size()});
+
+    std::vector<Tree::Entry> entries;
 
-            std::ofstream file{objects_path / hash, std::ios_base::binary};
-            file.write(reinterpret_cast<char*>(bytes.data()), bytes.size());
+    auto parse_entries = [&](const char* key, Tree::Kind kind) {
+        auto table = deserialized[key].as_table();
+
+        if (!table) {
+            throw TogException{"corrupt tree object " + id.hex()};
+        }
+
+        for (const auto& [name, value] : *table) {
+            auto entry_id =
+                ObjectId::from_hex(value.value_or(std::string_view{}));
+
+            if (!entry_id) {
+                throw TogException{"corrupt tree object " + id.hex()};
+            }
+
+            entries.push_back({_names.intern(name), kind, *entry_id});
         }
+    };
+
+    if (deserialized.contains("shards")) {
+        parse_entries("shards", Tree::Kind::shard);
+    } else {
+        parse_entries("blobs", Tree::Kind::blob);
+        parse_entries("trees", Tree::Kind::tree);
     }
 
-    // persist commit objects
-    for (const auto& [hash, handle] : _trees) {
-        if (handle.dirty()) {
-            auto bytes = handle.object()->serialize();
+    return Tree{_names, std::move(entries)};
+}
+
+template <>
+Commit Repository::parse(std::vector<unsigned char>&& bytes,
+                         const ObjectId& id) {
+    // TODO error management; what if object is not a commit?
+    auto deserialized = toml::parse(std::string_view{
+        reinterpret_cast<const char*>(bytes.data()), bytes.size()});
+
+    // parse tree
+    auto tree =
+        ObjectId::from_hex(deserialized["tree"].value_or(std::string_view{}));
+
+    if (!tree) {
+        throw TogException{"corrupt commit object " + id.hex()};
+    }
+
+    // parse parent
+    auto parent_hash = deserialized["parent"].value_or(std::string_view{});
+    std::optional<ObjectId> parent;
 
-            std::ofstream file{objects_path / hash, std::ios_base::binary};
-            file.write(reinterpret_cast<char*>(bytes.data()), bytes.size());
+    if (!parent_hash.empty()) {
+        parent = ObjectId::from_hex(parent_hash);
+
+        if (!parent) {
+            throw TogException{"corrupt commit object " + id.hex()};
         }
     }
 
-    // persist refs
-    persist_ref(_togdir_path / "refs" / "head", _head);
-    persist_ref(_togdir_path / "refs" / "branches" / "main", _main);
+    // parse message
+    auto message = deserialized["message"].value<std::string>();
 
-    return commit.hash();
+    return Commit{*tree, parent, message.value_or("")};
 }
 
-void Repository::checkout(const std::string& hash) {
-    auto commit = Handle<Commit>{hash};
-    resolve(commit);
+template <class T>
+T& Repository::resolve(Handle<T> handle) {
+    auto& table = objects<T>();
+
+    if (auto object = table[handle].object) {
+        _cache.touch(table[handle].cache_slot);
+        return *object;
+    }
+
+    _cache.miss();
 
-    // clear working directory (except .tog)
-    for (const auto& entry : fs::directory_iterator(_worktree_path)) {
-        if (entry.path().filename() != ".tog") {
-            fs::remove_all(entry.path());
+    std::vector<unsigned char> bytes;
+
+    if (auto err = read_object(table[handle].id, bytes)) {
+        if (err == std::errc::no_such_file_or_directory) {
+            throw TogException{"object not found"};
         }
+
+        throw std::system_error{err, "unable to read object"};
     }
 
-    auto tree = commit.object()->tree();
-    resolve(tree);
-    restoreTree(tree, _worktree_path);
+    return add_loaded(handle, std::move(bytes));
+}
+
+template <class T>
+T& Repository::add_loaded(Handle<T> handle, std::vector<unsigned char>&& bytes) {
+    auto& table = objects<T>();
 
-    _head = commit;
-    persist_ref(_togdir_path / "refs" / "head", _head);
+    auto& object =
+        table.emplace(handle, parse<T>(std::move(bytes), table[handle].id));
+    table[handle].cache_slot =
+        _cache.admit(T::kind, handle.index(), object.memory_size());
+
+    return object;
 }
 
-std::vector<std::string> Repository::history(int n) {
-    std::vector<std::string> commits;
+template <class T>
+void Repository::prefetch(const std::vector<Handle<T>>& handles) {
+    // in a partial repository, fetch all missing objects in one batch first
+    if (_promisor) {
+        std::vector<ObjectId> ids;
 
-    std::optional<Handle<Commit>> current = _head;
+        for (auto handle : handles) {
+            if (!objects<T>()[handle].object) {
+                ids.push_back(objects<T>()[handle].id);
+            }
+        }
+
+        fetch_missing(ids);
+    }
 
-    for (int i = 0; i < n; ++i) {
-        if (!current) {
-            return commits;
+    for (auto handle : handles) {
+        if (objects<T>()[handle].object) {
+            continue;
         }
 
-        commits.push_back(current->hash());
-        resolve(*current);
-        current = (current->object()->parent());
+        _cache.miss();
+
+        const auto& id = objects<T>()[handle].id;
+
+        store_for(id).read(id, [this, handle](std::error_code err,
+                                              std::vector<unsigned char> bytes) {
+            // errors are reported when the object is resolved
+            if (!err && !objects<T>()[handle].object) {
+                add_loaded(handle, std::move(bytes));
+            }
+        });
     }
 
-    return commits;
+    _store->wait();
+
+    for (const auto& alternate : _alternates) {
+        alternate->wait();
+    }
 }
 
-void Repository::resolve(Handle<Blob>& blob) {
-    if (blob.resolved()) {
-        return;
+template <class T>
+Handle<T> Repository::register_object(T object) {
+    auto id = sha256(object.serialize());
+    auto handle = this->handle<T>(id);
+    auto& table = objects<T>();
+
+    if (!table[handle].object) {
+        // If the object store (or an alternate object directory) holds the
+        // object, it is already persisted (and freshened, so that gc keeps
+        // it). Otherwise, mark it as dirty to persist it later.
+        table[handle].dirty = !freshen_object(id);
+
+        auto& registered = table.emplace(handle, std::move(object));
+        table[handle].cache_slot =
+            _cache.admit(T::kind, handle.index(), registered.memory_size());
     }
 
-    auto hash = blob.hash();
-    auto path = _togdir_path / "objects" / hash;
+    return handle;
+}
+
+template <class T>
+void Repository::persist(typename ObjectTable<T>::Entry& entry) {
+    _store->write(entry.id, entry.object->serialize());
 
-    if (!fs::exists(path)) {
-        throw TogException{"object not found"};
+    entry.dirty = false;
+}
+
+template <class T>
+bool Repository::evict(Handle<T> handle) {
+    auto& entry = objects<T>()[handle];
+
+    if (entry.pins > 0) {
+        return false;
+    }
+
+    // new objects are written to disk early rather than being kept in memory,
+    // so they can be loaded again later
+    if (entry.dirty) {
+        persist<T>(entry);
+    }
+
+    objects<T>().evict(handle);
+
+    return true;
+}
+
+bool Repository::evict(ObjectKind kind, std::uint32_t index) {
+    switch (kind) {
+        case ObjectKind::blob:
+            return evict(Handle<Blob>{index});
+        case ObjectKind::tree:
+            return evict(Handle<Tree>{index});
+        default:
+            return evict(Handle<Commit>{index});
     }
+}
 
-    // cache for future resolutions
-    if (!_blobs.contains(hash)) {
-        // Explicitly copy hash/object to avoid dangling references
-        _blobs.emplace(std::string{hash}, Handle<Blob>{blob});
+// a regular file in the worktree, which the commit pipeline turns into a blob
+struct Repository::FileTask {
+    // the directory containing the file, which is kept open until all of its
+    // files have been processed
+    std::shared_ptr<FileDescriptor> directory;
+
+    // the file's path relative to the worktree (for error messages), with
+    // the file's name starting at name_offset
+    std::string path;
+    std::size_t name_offset;
+
+    // receives the id of the file's blob
+    ObjectId* id;
+};
+
+// a new blob, waiting to be written by the commit pipeline
+struct Repository::WriteTask {
+    ObjectId id;
+    std::vector<unsigned char> data;
+
+    // the number of bytes acquired from the pipeline's memory budget
+    std::size_t reserved;
+};
+
+// a scanned directory, whose tree is built once all of its files have been
+// hashed
+struct Repository::PendingDirectory {
+    // the directory's entries. The ids are filled in when the tree is built.
+    std::vector<Tree::Entry> entries;
+
+    // the ids of the blob entries, in order. They are written concurrently by
+    // the pipeline, which is safe since deque never moves its elements.
+    std::deque<ObjectId> file_ids;
+
+    // the tree entries, in order
+    std::vector<std::unique_ptr<PendingDirectory>> directories;
+};
+
+// the queues and shared state of the commit pipeline
+struct Repository::Pipeline {
+    explicit Pipeline(std::size_t max_memory) : memory{max_memory} {}
+
+    BoundedQueue<FileTask> files{128};
+    BoundedQueue<WriteTask> writes{64};
+    MemoryBudget memory;
+
+    // the first error that occurs in any stage. The remaining work is
+    // skipped, but the queues are still drained so no stage blocks.
+    FirstError error;
+};
+
+std::string Repository::commit(const std::string& message,
+                               std::size_t max_memory) {
+    // cannot commit if head is not at the latest commit of the main branch
+    // (which is the only branch for now). In git, this is known as "detached
+    // head". This includes repositories whose main branch was imported
+    // without checking it out.
+    if (_head != _main) {
+        throw TogException{"not at latest commit of current branch"};
     }
 
-    auto& cached = _blobs.at(hash);
+    // Blobs are created by a pipeline: this thread scans the worktree, a pool
+    // of threads reads and hashes the files it finds, and another thread
+    // writes new blobs to disk. The stages are connected by bounded queues,
+    // and file contents count against max_memory until they are written, so
+    // memory usage does not depend on the size of the change.
+    Pipeline pipeline{max_memory};
+    PendingDirectory root;
+
+    _ignored = 0;
+
+    {
+        ThreadPool hashers;
+        ThreadPool writer{1};
+
+        for (std::size_t i = 0; i < hashers.size(); ++i) {
+            hashers.submit([&] { hash_files(pipeline); });
+        }
+
+        writer.submit([&] { write_blobs(pipeline); });
+
+        try {
+            auto worktree = std::make_shared<FileDescriptor>(
+                open_directory(AT_FDCWD, _worktree_path.c_str()));
+            std::string path;
 
-    if (!cached.resolved()) {
-        // TODO error management; what if object is not a blob?
+            scan_directory(worktree, path, root, pipeline);
+        } catch (...) {
+            pipeline.error.set(std::current_exception());
+        }
 
-        // TODO using the blob constructor works, because blobs are not yet
-        // compressed. Revisit this when we have compression.
-        cached.resolve(std::make_shared<Blob>(path));
+        pipeline.files.close();
+        hashers.wait();
+        pipeline.writes.close();
+        writer.wait();
     }
 
-    // copy assignment operator
-    blob = cached;
+    pipeline.error.rethrow();
+
+    // trees are built bottom-up, now that all blob ids are known
+    auto tree = finish_directory(root);
+    auto commit = register_object(Commit{id(tree), _head, message});
+    auto commit_id = id(commit);
+
+    // persist all new trees and the commit in one batch
+    persist_new_objects();
+
+    // update both refs at once, unless another commit got there first
+    RefTransaction refs;
+    refs.update(std::string{head_ref}, commit_id, _head);
+    refs.update(std::string{main_ref}, commit_id, _main);
+
+    _refs.commit(refs);
+
+    _head = commit_id;
+    _main = commit_id;
+
+    release();
+
+    return commit_id.hex();
 }
 
-void Repository::resolve(Handle<Tree>& tree) {
-    if (tree.resolved()) {
-        return;
+void Repository::persist_new_objects() {
+    bool failed = false;
+
+    auto persist_all = [&]<class T>(ObjectTable<T>& table) {
+        for (auto& entry : table) {
+            if (entry.dirty) {
+                _store->write(entry.id, entry.object->serialize(),
+                              [&entry, &failed](std::error_code err) {
+                                  entry.dirty = false;
+                                  failed = failed || bool(err);
+                              });
+            }
+        }
+    };
+
+    persist_all(_blobs);
+    persist_all(_trees);
+    persist_all(_commits);
+
+    _store->wait();
+
+    if (failed) {
+        throw TogException{"unable to write objects"};
     }
+}
 
-    auto hash = tree.hash();
-    auto path = _togdir_path / "objects" / hash;
+void Repository::checkout(const std::string& hash, bool hardlink) {
+    auto commit_id = resolve_name(hash);
 
-    if (!fs::exists(path)) {
-        throw TogException{"object not found"};
+    if (!commit_id) {
+        throw TogException{"commit does not exist"};
+    }
+
+    auto tree = handle<Tree>(resolve(handle<Commit>(*commit_id)).tree());
+
+    // In a partial repository, fetch all missing files in one batch rather
+    // than one at a time. This happens before the worktree is touched, so
+    // that it stays intact if the promisor fails.
+    if (_promisor) {
+        std::vector<ObjectId> blobs;
+        collect_blobs(tree, blobs);
+        fetch_missing(blobs);
+
+        // the promisor skips objects it does not have either
+        for (const auto& blob : blobs) {
+            if (!has_object(blob)) {
+                throw TogException{"unable to fetch object " + blob.hex()};
+            }
+        }
+    }
+
+    // only the files of the current commit are removed, so that untracked
+    // and ignored files (e.g. build outputs) survive the checkout
+    if (_head) {
+        remove_tree(handle<Tree>(resolve(handle<Commit>(*_head)).tree()),
+                    _worktree_path);
     }
 
-    // cache for future resolutions
-    if (!_trees.contains(hash)) {
-        // Explicitly copy hash/object to avoid dangling references
-        _trees.emplace(std::string{hash}, Handle<Tree>{tree});
+    // the trees are walked on this thread, while the files are restored on
+    // all cores
+    ThreadPool pool;
+    FirstError error;
+    std::atomic<std::size_t> replaced = 0;
+
+    restoreTree(tree, _worktree_path, hardlink, pool, error, replaced);
+
+    pool.wait();
+    _replaced = replaced;
+    error.rethrow();
+
+    RefTransaction refs;
+    refs.update(std::string{head_ref}, commit_id);
+
+    _refs.commit(refs);
+    _head = commit_id;
+
+    release();
+}
+
+CloneStats Repository::clone(const fs::path& source,
+                             const fs::path& destination, bool hardlink,
+                             bool partial) {
+    CloneStats stats;
+
+    if (fs::exists(destination) && !fs::is_empty(destination)) {
+        throw TogException{destination.string() + " is not empty"};
     }
 
-    auto& cached = _trees.at(hash);
+    std::optional<Repository> copy;
+
+    {
+        // The origin is closed before the clone is checked out, as a partial
+        // clone may need to open it again to fetch files.
+        Repository origin{source / ".tog"};
+        auto config = toml::parse_file(
+            (origin._togdir_path / "config.toml").string());
+        std::string backend = config["object_store"].value_or("loose");
+
+        init(destination, backend);
+
+        // The configuration is copied as well. Relative alternates would
+        // resolve against the clone's .tog, so they are made absolute.
+        if (auto alternates = config["alternates"].as_array()) {
+            toml::array absolute;
+
+            for (const auto& alternate : *alternates) {
+                auto path = fs::absolute(origin._togdir_path /
+                                         alternate.value_or(std::string{}));
+                absolute.push_back(path.lexically_normal().string());
+            }
+
+            config.insert_or_assign("alternates", std::move(absolute));
+        }
+
+        // Files missing from a partial clone are read from the origin's
+        // object directory, or fetched through `tog serve` if the origin does
+        // not keep its objects in files of their own.
+        if (partial) {
+            auto origin_path = fs::absolute(origin._togdir_path);
+            toml::table promisor;
+
+            if (backend == "loose") {
+                promisor.insert(
+                    "directory",
+                    (origin_path / "objects").lexically_normal().string());
+            } else {
+                auto quote = [](const fs::path& path) {
+                    std::string quoted = "'";
+
+                    for (auto c : path.string()) {
+                        quoted += c == '\'' ? std::string{"'\\''"}
+                                            : std::string(1, c);
+                    }
+
+                    return quoted + "'";
+                };
+
+                promisor.insert(
+                    "command",
+                    "cd " + quote(origin_path.parent_path()) + " && " +
+                        quote(fs::read_symlink("/proc/self/exe")) + " serve");
+            }
+
+            config.insert_or_assign("promisor", std::move(promisor));
+        }
+
+        std::ofstream{destination / ".tog" / "config.toml"}
+            << config << std::endl;
+
+        copy.emplace(destination / ".tog");
+
+        // a partial clone only gets the commits and trees, and fetches files
+        // from the source when they are needed
+        auto objects = partial ? origin.commits_and_trees(origin.ref_targets())
+                               : origin._store->list();
+
+        stats.objects = objects.size();
+
+        ThreadPool pool;
+        FirstError error;
+        std::atomic<std::size_t> hardlinked = 0;
+        std::atomic<std::size_t> reflinked = 0;
+        std::atomic<std::size_t> copied = 0;
+
+        // Objects are immutable, so objects kept in files of their own are
+        // hard-linked where possible. Otherwise, they are copied between the
+        // stores.
+        auto link = [&](const ObjectId& id) {
+            const auto& from = origin.store_for(id);
+            auto from_path = from.path(id);
+            auto to_path = copy->_store->path(id);
+
+            if (from_path && to_path) {
+                if (::link(from_path->c_str(), to_path->c_str()) == 0) {
+                    ++hardlinked;
+                    return;
+                }
+
+                auto in = open_file(*from_path);
+
+                if (!in) {
+                    throw TogException{"unable to clone object " + id.hex()};
+                }
+
+                // copied through a temporary file, so that an interrupted
+                // clone does not leave a truncated object behind. Its name is
+                // unique per thread, like those of the store's own writes.
+                auto tmp_path = *to_path;
+                tmp_path.concat("." + std::to_string(::gettid()) + ".tmp");
+                CopyMethod method;
+
+                try {
+                    auto out = create_file(tmp_path);
+                    method = copy_file(in.get(), out.get());
+                } catch (...) {
+                    ::unlink(tmp_path.c_str());
+                    throw;
+                }
+
+                copy->_store->insert(id, tmp_path);
+
+                if (method == CopyMethod::reflink) {
+                    ++reflinked;
+                } else {
+                    ++copied;
+                }
+
+                return;
+            }
 
-    if (!cached.resolved()) {
-        // TODO error management; what if object is not a tree?
+            if (from_path) {
+                auto in = open_file(*from_path);
 
-        // load commit from disk
-        auto deserialized = toml::parse_file(path.string());
+                if (!in) {
+                    throw TogException{"unable to clone object " + id.hex()};
+                }
 
-        // parse blobs
-        std::unordered_map<std::string, Handle<Blob>> blobs;
+                copy->_store->write(id, in.get());
+            } else {
+                std::vector<unsigned char> bytes;
 
-        for (const auto& [key, value] : *deserialized["blobs"].as_table()) {
-            std::string blob_hash{value.value_or("")};
+                if (from.read(id, bytes)) {
+                    throw TogException{"unable to clone object " + id.hex()};
+                }
 
-            if (blob_hash.empty()) {
-                throw TogException{"corrupt tree object " + hash};
+                copy->_store->write(id, bytes);
             }
 
-            blobs.emplace(key, Handle<Blob>{blob_hash});
+            ++copied;
+        };
+
+        for (std::size_t begin = 0; begin < objects.size();
+             begin += batch_size) {
+            auto end = std::min(begin + batch_size, objects.size());
+
+            pool.submit([&, begin, end] {
+                for (auto i = begin; i < end && !error.failed(); ++i) {
+                    try {
+                        link(objects[i]);
+                    } catch (...) {
+                        error.set(std::current_exception());
+                    }
+                }
+            });
         }
 
-        // parse trees
-        std::unordered_map<std::string, Handle<Tree>> trees;
+        pool.wait();
+        error.rethrow();
 
-        for (const auto& [key, value] : *deserialized["trees"].as_table()) {
-            std::string tree_hash{value.value_or("")};
+        stats.hardlinked = hardlinked;
+        stats.reflinked = reflinked;
+        stats.copied = copied;
 
-            if (tree_hash.empty()) {
-                throw TogException{"corrupt tree object " + hash};
+        // The bitmap index and the commit graph are only ever replaced as a
+        // whole, so they can be shared. The bitmaps of a partial clone would
+        // cover missing objects.
+        std::vector<std::pair<fs::path, fs::path>> indexes{
+            {origin.commit_graph_path(), copy->commit_graph_path()}};
+
+        if (!partial) {
+            indexes.emplace_back(origin.bitmaps_path(), copy->bitmaps_path());
+        }
+
+        for (const auto& [from, to] : indexes) {
+            if (!fs::exists(from)) {
+                continue;
             }
 
-            trees.emplace(key, Handle<Tree>{tree_hash});
+            std::error_code err;
+            fs::create_hard_link(from, to, err);
+
+            if (err) {
+                fs::copy_file(from, to);
+            }
+        }
+
+        // all branches and tags are copied in one transaction
+        RefTransaction refs;
+
+        for (const auto& [name, target] : origin._refs.list()) {
+            refs.update(name, target);
         }
 
-        cached.resolve(
-            std::make_shared<Tree>(std::move(blobs), std::move(trees)));
+        copy->_refs.commit(refs);
+        copy->_main = origin._main;
+    }
+
+    if (copy->_main) {
+        copy->checkout(copy->_main->hex(), hardlink);
+        stats.head = copy->_main;
     }
 
-    // copy assignment operator
-    tree = cached;
+    return stats;
 }
 
-void Repository::resolve(Handle<Commit>& commit) {
-    if (commit.resolved()) {
-        return;
+std::vector<ObjectId> Repository::commits_and_trees(
+    const std::vector<ObjectId>& commits) {
+    std::unordered_set<ObjectId, ObjectIdHash> found;
+    std::vector<ObjectId> pending;
+
+    auto read = [this](const ObjectId& id) {
+        std::vector<unsigned char> bytes;
+
+        if (read_object(id, bytes)) {
+            throw TogException{"object " + id.hex() + " not found"};
+        }
+
+        return bytes;
+    };
+
+    for (const auto& commit : commits) {
+        for (std::optional<ObjectId> current = commit;
+             current && found.insert(*current).second;) {
+            auto parsed = parse<Commit>(read(*current), *current);
+
+            if (found.insert(parsed.tree()).second) {
+                pending.push_back(parsed.tree());
+            }
+
+            current = parsed.parent();
+        }
     }
 
-    auto hash = commit.hash();
-    auto path = _togdir_path / "objects" / hash;
+    while (!pending.empty()) {
+        auto id = pending.back();
+        pending.pop_back();
+
+        auto bytes = read(id);
+        auto valid = Tree::visit_ids(
+            {reinterpret_cast<const char*>(bytes.data()), bytes.size()},
+            [&](Tree::Kind kind, const ObjectId& child) {
+                if (kind != Tree::Kind::blob && found.insert(child).second) {
+                    pending.push_back(child);
+                }
+            });
+
+        if (!valid) {
+            throw TogException{"corrupt tree object " + id.hex()};
+        }
+    }
 
-    if (!fs::exists(path)) {
-        throw TogException{"commit does not exist"};
+    std::vector<ObjectId> objects{found.begin(), found.end()};
+    std::sort(objects.begin(), objects.end());
+
+    return objects;
+}
+
+namespace {
+
+// removes leading and trailing slashes from a path within a commit
+std::string_view trim_slashes(std::string_view path) {
+    while (path.starts_with('/')) {
+        path.remove_prefix(1);
     }
 
-    // cache for future resolutions
-    if (!_commits.contains(hash)) {
-        // Explicitly copy hash/object to avoid dangling references
-        _commits.emplace(std::string{hash}, Handle<Commit>{commit});
+    while (path.ends_with('/')) {
+        path.remove_suffix(1);
     }
 
-    auto& cached = _commits.at(hash);
+    return path;
+}
+
+}  // namespace
 
-    if (!cached.resolved()) {
-        // TODO error management; what if object is not a commit?
+std::vector<std::string> Repository::history(int n, std::string_view path) {
+    std::vector<std::string> commits;
+    path = trim_slashes(path);
 
-        // load commit from disk
-        auto deserialized = toml::parse_file(path.string());
+    // the commit graph provides the parents (and changed-path filters) of
+    // all commits it covers, without reading them
+    auto graph = CommitGraph::load(commit_graph_path());
+    std::optional<ObjectId> current = _head;
 
-        // parse tree
-        auto tree_hash = deserialized["tree"].value<std::string>();
-        auto tree = Handle<Tree>{*tree_hash};
+    for (std::size_t walked = 1;
+         current && commits.size() < static_cast<std::size_t>(n); ++walked) {
+        auto position = graph ? graph->position(*current) : std::nullopt;
+        std::optional<ObjectId> parent;
 
-        // parse parent
-        auto parent_hash = deserialized["parent"].value<std::string>();
-        std::optional<Handle<Commit>> parent;
+        if (position) {
+            if (auto parent_position = graph->parent(*position)) {
+                parent = graph->commit(*parent_position);
+            }
+        } else {
+            parent = resolve(handle<Commit>(*current)).parent();
+        }
 
-        if (parent_hash && !parent_hash->empty()) {
-            parent = Handle<Commit>{*parent_hash};
+        // most commits are ruled out by their filter, without loading trees
+        if (path.empty() ||
+            ((!position || graph->may_have_changed(*position, path)) &&
+             changes_path(*current, parent, path))) {
+            commits.push_back(current->hex());
         }
 
-        // parse message
-        auto message = deserialized["message"].value<std::string>();
+        current = parent;
 
-        cached.resolve(
-            std::make_shared<Commit>(tree, parent, message.value_or("")));
+        if (walked % 1024 == 0) {
+            release();
+        }
     }
 
-    // copy assignment operator
-    commit = cached;
-}
+    release();
 
-void Repository::restoreTree(Handle<Tree>& tree, const fs::path& path) {
-    resolve(tree);
+    return commits;
+}
 
-    // Create the directory if it doesn't exist
-    fs::create_directories(path);
+bool Repository::changes_path(const ObjectId& commit,
+                              const std::optional<ObjectId>& parent,
+                              std::string_view path) {
+    auto entry = find_path(resolve(handle<Commit>(commit)).tree(), path);
+    auto parent_entry =
+        parent ? find_path(resolve(handle<Commit>(*parent)).tree(), path)
+               : std::nullopt;
 
-    // Populate the directory with files
-    for (auto& [name, blob] : tree.object()->blobs()) {
-        restoreBlob(blob, path / name);
+    if (!entry || !parent_entry) {
+        return entry.has_value() != parent_entry.has_value();
     }
 
-    // Populate the directory with subdirectories
-    for (auto& [name, sub_tree] : tree.object()->trees()) {
-        restoreTree(sub_tree, path / name);
-    }
+    return entry->kind != parent_entry->kind || entry->id != parent_entry->id;
 }
 
-void Repository::restoreBlob(Handle<Blob>& blob, const fs::path& path) {
-    resolve(blob);
-    const auto& data = blob.object()->data();
+void Repository::show(std::string_view commit, std::string_view path,
+                      int fd) {
+    auto commit_id = resolve_name(commit);
 
-    std::ofstream stream{path, std::ios::out | std::ios::binary};
-    stream.write(reinterpret_cast<const char*>(data.data()), data.size());
-}
+    if (!commit_id) {
+        throw TogException{"commit does not exist"};
+    }
 
-Handle<Blob>& Repository::add_file(const fs::path& file_path) {
-    return register_object(std::make_unique<Blob>(file_path));
-}
+    path = trim_slashes(path);
 
-Handle<Tree>& Repository::add_directory(const fs::path& directory_path) {
-    std::unordered_map<std::string, Handle<Blob>> files;
-    std::unordered_map<std::string, Handle<Tree>> directories;
+    // only the trees along the path are loaded
+    auto tree = resolve(handle<Commit>(*commit_id)).tree();
+    auto entry = find_path(tree, path);
 
-    for (const auto& entry : fs::directory_iterator(directory_path)) {
-        if (entry.is_directory()) {
-            // skip togdir
-            if (entry.path().filename() == ".tog") {
-                continue;
+    if (!path.empty() && !entry) {
+        throw TogException{"path does not exist: " + std::string{path}};
+    }
+
+    if (path.empty() || entry->kind == Tree::Kind::tree) {
+        std::vector<Tree::Entry> entries;
+        collect_entries(path.empty() ? tree : entry->id, entries);
+
+        std::vector<std::string> names;
+
+        for (const auto& child : entries) {
+            auto& name = names.emplace_back(_names.get(child.name));
+
+            if (child.kind == Tree::Kind::tree) {
+                name.push_back('/');
             }
+        }
+
+        std::sort(names.begin(), names.end());
+        std::string listing;
 
-            directories.emplace(entry.path().filename(),
-                                add_directory(entry.path()));
-        } else if (entry.is_regular_file()) {
-            files.emplace(entry.path().filename().string(),
-                          add_file(entry.path()));
+        for (const auto& name : names) {
+            listing.append(name).push_back('\n');
         }
+
+        release();
+        write_all(fd, listing.data(), listing.size());
+        return;
     }
 
-    return register_object(
-        std::make_unique<Tree>(std::move(files), std::move(directories)));
+    release();
+
+    // a partial repository fetches the file from its promisor first
+    fetch_missing({entry->id});
+
+    if (auto err = store_for(entry->id).send(entry->id, fd)) {
+        throw TogException{"unable to read object " + entry->id.hex()};
+    }
 }
 
-Handle<Blob>& Repository::register_object(std::unique_ptr<Blob> blob) {
-    auto bytes = blob->serialize();
-    auto hash = sha256(bytes);
+ArchiveStats Repository::archive(std::string_view commit, int fd) {
+    auto commit_id = resolve_name(commit);
+
+    if (!commit_id) {
+        throw TogException{"commit does not exist"};
+    }
+
+    ArchiveStats stats;
+    auto tree = resolve(handle<Commit>(*commit_id)).tree();
+
+    // all entries get the time of the archive, as tog does not record
+    // modification times
+    TarWriter tar{fd, std::time(nullptr)};
+    std::string path;
 
-    if (!_blobs.contains(hash)) {
-        // If there is a matching file in .tog/objects/ the blob is already
-        // persisted. Otherwise, mark it as dirty to persist it later.
-        auto dirty = !fs::exists(_togdir_path / "objects" / hash);
-        _blobs.emplace(hash, Handle<Blob>{hash, std::move(blob), dirty});
+    {
+        ThreadPool pool;
+        archive_tree(tree, path, tar, pool, stats);
+        tar.finish();
     }
 
-    return _blobs.at(hash);
+    release();
+
+    return stats;
 }
 
-Handle<Tree>& Repository::register_object(std::unique_ptr<Tree> tree) {
-    auto bytes = tree->serialize();
-    auto hash = sha256(bytes);
+std::vector<ObjectId> Repository::ref_targets() {
+    std::vector<ObjectId> targets;
+
+    if (_head) {
+        targets.push_back(*_head);
+    }
 
-    if (!_trees.contains(hash)) {
-        auto dirty = !fs::exists(_togdir_path / "objects" / hash);
-        _trees.emplace(hash, Handle<Tree>{hash, std::move(tree), dirty});
+    for (const auto& [name, target] : _refs.list()) {
+        targets.push_back(target);
     }
 
-    return _trees.at(hash);
+    // many tags may point to the same commit
+    std::sort(targets.begin(), targets.end());
+    targets.erase(std::unique(targets.begin(), targets.end()), targets.end());
+
+    return targets;
 }
 
-Handle<Commit>& Repository::register_object(std::unique_ptr<Commit> commit) {
-    auto bytes = commit->serialize();
-    auto hash = sha256(bytes);
+std::vector<std::pair<std::string, std::string>> Repository::refs(
+    RefKind kind) const {
+    auto prefix = ref_prefix(kind);
+    std::vector<std::pair<std::string, std::string>> refs;
 
-    if (!_commits.contains(hash)) {
-        auto dirty = !fs::exists(_togdir_path / "objects" / hash);
-        _commits.emplace(hash, Handle<Commit>{hash, std::move(commit), dirty});
+    for (const auto& [name, target] : _refs.list(prefix)) {
+        refs.emplace_back(name.substr(prefix.size()), target.hex());
     }
 
-    return _commits.at(hash);
+    return refs;
 }
 
-std::optional<Handle<Commit>> Repository::load_ref(const fs::path& path) {
-    std::ifstream stream{path};
+std::optional<ObjectId> Repository::resolve_name(std::string_view name) {
+    if (name == head_ref) {
+        return _head;
+    }
 
-    if (!stream) {
-        throw TogException{"Unable to load ref " + path.string()};
+    // refs take precedence over abbreviated ids
+    if (RefStore::valid_name(name)) {
+        for (auto kind : {RefKind::branch, RefKind::tag}) {
+            auto ref = std::string{ref_prefix(kind)} + std::string{name};
+
+            if (auto target = _refs.read(ref)) {
+                return target;
+            }
+        }
     }
 
-    std::string hash;
-    std::getline(stream, hash);
+    if (auto id = ObjectId::from_hex(name)) {
+        return has_object(*id) ? id : std::nullopt;
+    }
 
-    if (hash.empty()) {
+    if (name.size() < min_prefix_length) {
         return std::nullopt;
     }
 
-    if (!fs::exists(_togdir_path / "objects" / hash)) {
-        throw TogException{"ref " + path.string() +
-                           " points to non-existent commit " + hash};
+    // a few candidates are looked up, to report them if there are several
+    constexpr std::size_t max_candidates = 5;
+    std::vector<ObjectId> found;
+
+    auto find = [&](const ObjectStore& store) {
+        auto matches = store.find_prefix(name, max_candidates + 1);
+        found.insert(found.end(), matches.begin(), matches.end());
+    };
+
+    find(*_store);
+
+    for (const auto& alternate : _alternates) {
+        find(*alternate);
+    }
+
+    std::sort(found.begin(), found.end());
+    found.erase(std::unique(found.begin(), found.end()), found.end());
+
+    if (found.size() <= 1) {
+        return found.empty() ? std::nullopt : std::optional{found.front()};
     }
 
-    auto commit = Handle<Commit>{hash};
+    std::string candidates;
+
+    for (std::size_t i = 0; i < found.size() && i < max_candidates; ++i) {
+        candidates += (i > 0 ? ", " : "") + found[i].hex().substr(0, 16);
+    }
 
-    return std::optional<Handle<Commit>>{std::move(commit)};
+    throw TogException{"ambiguous object id " + std::string{name} +
+                       " (matches " + candidates +
+                       (found.size() > max_candidates ? ", ...)" : ")")};
 }
 
-void Repository::persist_ref(const fs::path& path,
-                             const std::optional<Handle<Commit>>& commit) {
-    std::ofstream stream{path, std::ofstream::trunc};
+bool Repository::create_ref(RefKind kind, const std::string& name,
+                            const std::optional<std::string>& commit,
+                            bool force) {
+    auto ref = std::string{ref_prefix(kind)} + name;
+    auto kind_name = kind == RefKind::branch ? "branch " : "tag ";
 
-    if (!stream) {
-        throw TogException{"Unable to save ref " + path.string()};
+    if (!RefStore::valid_name(name)) {
+        throw TogException{"invalid " + std::string{kind_name} + "name: " +
+                           name};
+    }
+
+    auto target = commit ? resolve_name(*commit) : _head;
+
+    if (!target || !has_object(*target)) {
+        throw TogException{"commit does not exist"};
+    }
+
+    auto current = _refs.read(ref);
+
+    if (current && !force) {
+        throw TogException{kind_name + name + " already exists"};
+    }
+
+    // fails if the ref was changed since it was read
+    RefTransaction refs;
+    refs.update(ref, target, current);
+
+    _refs.commit(refs);
+
+    if (ref == main_ref) {
+        _main = target;
+    }
+
+    return !current;
+}
+
+void Repository::delete_ref(RefKind kind, const std::string& name) {
+    auto ref = std::string{ref_prefix(kind)} + name;
+    auto kind_name = kind == RefKind::branch ? "branch " : "tag ";
+
+    if (ref == main_ref) {
+        throw TogException{"the main branch cannot be deleted"};
+    }
+
+    auto current = _refs.read(ref);
+
+    if (!current) {
+        throw TogException{kind_name + name + " does not exist"};
     }
 
-    if (commit) {
-        stream << commit->hash() << std::endl;
+    RefTransaction refs;
+    refs.update(ref, std::nullopt, current);
+
+    _refs.commit(refs);
+}
+
+std::size_t Repository::pack_refs() {
+    return _refs.pack();
+}
+
+void Repository::mark_reachable(
+    const std::vector<ObjectId>& objects, AtomicBitmap& marks, ThreadPool& pool,
+    const std::function<bool(std::size_t index)>& expand,
+    const std::function<void(const std::string& message)>& problem) {
+    FirstError error;
+    std::function<void(ObjectKind, std::size_t)> visit;
+
+    // marks the given object, and visits it if it has not been marked yet
+    auto follow = [&](ObjectKind kind, const ObjectId& id,
+                      const ObjectId* referrer) {
+        auto it = std::lower_bound(objects.begin(), objects.end(), id);
+
+        if (it == objects.end() || *it != id) {
+            // Like git, objects in alternate object directories are assumed
+            // to be complete, i.e. everything they reference is there as
+            // well, so they are not walked.
+            if (!_alternates.empty() && has_object(id)) {
+                return;
+            }
+
+            // in a partial repository, missing objects are expected, as
+            // they can be fetched from the promisor
+            if (_promisor) {
+                return;
+            }
+
+            problem("missing object " + id.hex() + ", referenced by " +
+                    (referrer ? referrer->hex() : std::string{"a ref"}));
+            return;
+        }
+
+        auto index = static_cast<std::size_t>(it - objects.begin());
+
+        // blobs are not read, as they do not reference anything
+        if (marks.set(index) && kind != ObjectKind::blob && expand(index)) {
+            visit(kind, index);
+        }
+    };
+
+    // reads and parses the given commit or tree in a task of its own, so
+    // many objects are loaded concurrently
+    visit = [&](ObjectKind kind, std::size_t index) {
+        pool.submit([&, kind, index] {
+            if (error.failed()) {
+                return;
+            }
+
+            const auto& id = objects[index];
+
+            try {
+                std::vector<unsigned char> bytes;
+
+                if (_store->read(id, bytes)) {
+                    problem("unable to read object " + id.hex());
+                    return;
+                }
+
+                if (kind == ObjectKind::commit) {
+                    std::optional<Commit> commit;
+
+                    try {
+                        commit = parse<Commit>(std::move(bytes), id);
+                    } catch (const std::exception&) {
+                        problem("corrupt commit object " + id.hex());
+                        return;
+                    }
+
+                    follow(ObjectKind::tree, commit->tree(), &id);
+
+                    if (commit->parent()) {
+                        follow(ObjectKind::commit, *commit->parent(), &id);
+                    }
+
+                    return;
+                }
+
+                auto valid = Tree::visit_ids(
+                    {reinterpret_cast<const char*>(bytes.data()), bytes.size()},
+                    [&](Tree::Kind kind, const ObjectId& child) {
+                        follow(kind == Tree::Kind::blob ? ObjectKind::blob
+                                                        : ObjectKind::tree,
+                               child, &id);
+                    });
+
+                if (!valid) {
+                    problem("corrupt tree object " + id.hex());
+                }
+            } catch (...) {
+                error.set(std::current_exception());
+            }
+        });
+    };
+
+    for (const auto& target : ref_targets()) {
+        follow(ObjectKind::commit, target, nullptr);
     }
+
+    pool.wait();
+    error.rethrow();
+}
+
+GcStats Repository::gc(std::chrono::seconds grace) {
+    GcStats stats;
+
+    auto objects = _store->list();
+
+    stats.objects = objects.size();
+
+    // mark all objects reachable from the refs. A single missing or corrupt
+    // object could hide any number of reachable objects, so collecting
+    // garbage is not safe in that case.
+    AtomicBitmap marks{objects.size()};
+    ThreadPool pool{std::max(16u, 2 * ThreadPool::default_threads())};
+
+    auto abort = [](const std::string& message) {
+        throw TogException{message + ", not collecting garbage"};
+    };
+
+    // with a bitmap index, only the commits created since it was written
+    // need to be walked
+    if (auto index = BitmapIndex::load(bitmaps_path())) {
+        for (const auto& id : reachable_objects(*index, ref_targets(), {})) {
+            auto it = std::lower_bound(objects.begin(), objects.end(), id);
+
+            if (it == objects.end() || *it != id) {
+                // objects in alternate object directories are not collected,
+                // and objects of partial repositories may be missing
+                if (_promisor || has_object(id)) {
+                    continue;
+                }
+
+                abort("missing object " + id.hex());
+            }
+
+            marks.set(it - objects.begin());
+        }
+    } else {
+        mark_reachable(
+            objects, marks, pool, [](std::size_t) { return true; }, abort);
+    }
+
+    // Sweep all unmarked objects, unless they were modified within the grace
+    // period. Those may have been written by a commit that is still running,
+    // and will be referenced once it updates its refs.
+    auto cutoff = std::chrono::system_clock::to_time_t(
+        std::chrono::system_clock::now() - grace);
+
+    std::atomic<std::size_t> removed = 0;
+    std::atomic<std::size_t> recent = 0;
+    std::atomic<std::uintmax_t> reclaimed = 0;
+
+    // removes the given object if it is old enough
+    auto sweep = [&](const ObjectId& id) {
+        auto info = _store->info(id);
+
+        if (!info) {
+            return false;
+        } else if (info->written > cutoff) {
+            ++recent;
+            return false;
+        } else if (!_store->remove(id)) {
+            return false;
+        }
+
+        reclaimed += info->size;
+        return true;
+    };
+
+    for (std::size_t begin = 0; begin < objects.size(); begin += batch_size) {
+        pool.submit([&, begin] {
+            auto end = std::min(begin + batch_size, objects.size());
+
+            for (auto index = begin; index < end; ++index) {
+                if (!marks.test(index) && sweep(objects[index])) {
+                    ++removed;
+                }
+            }
+        });
+    }
+
+    pool.wait();
+
+    stats.removed = removed;
+    stats.recent = recent;
+
+    // temporary files are left behind by interrupted commits
+    stats.temporary = _store->remove_temporary(cutoff);
+    stats.reclaimed = reclaimed;
+
+    _store->compact();
+
+    return stats;
+}
+
+Repository::Reachable Repository::reachable(
+    const BitmapIndex& index, const std::vector<ObjectId>& commits) {
+    std::vector<std::uint64_t> bits((index.size() + 63) / 64);
+    std::unordered_set<ObjectId, ObjectIdHash> unindexed;
+
+    // marks the given object, and returns true if it was not marked yet
+    auto mark = [&](const ObjectId& id) {
+        if (auto position = index.position(id)) {
+            auto& word = bits[*position / 64];
+            auto bit = std::uint64_t{1} << (*position % 64);
+
+            if (word & bit) {
+                return false;
+            }
+
+            word |= bit;
+            return true;
+        }
+
+        return unindexed.insert(id).second;
+    };
+
+    auto read = [this](const ObjectId& id) {
+        std::vector<unsigned char> bytes;
+
+        if (read_object(id, bytes)) {
+            throw TogException{"object " + id.hex() + " not found"};
+        }
+
+        return bytes;
+    };
+
+    // First, follow the commit histories until reaching a commit with a
+    // bitmap, which covers everything reachable from it. Only the trees of
+    // the commits before that need to be walked.
+    std::vector<ObjectId> pending;
+
+    for (const auto& commit : commits) {
+        for (std::optional<ObjectId> current = commit; current && mark(*current);) {
+            auto position = index.position(*current);
+
+            if (auto bitmap = position ? index.bitmap(*position) : nullptr) {
+                bitmap->decompress_into(bits);
+                break;
+            }
+
+            auto parsed = parse<Commit>(read(*current), *current);
+
+            if (mark(parsed.tree())) {
+                pending.push_back(parsed.tree());
+            }
+
+            current = parsed.parent();
+        }
+    }
+
+    // then walk the trees, skipping everything already covered by a bitmap
+    while (!pending.empty()) {
+        auto id = pending.back();
+        pending.pop_back();
+
+        auto bytes = read(id);
+        auto valid = Tree::visit_ids(
+            {reinterpret_cast<const char*>(bytes.data()), bytes.size()},
+            [&](Tree::Kind kind, const ObjectId& child) {
+                if (mark(child) && kind != Tree::Kind::blob) {
+                    pending.push_back(child);
+                }
+            });
+
+        if (!valid) {
+            throw TogException{"corrupt tree object " + id.hex()};
+        }
+    }
+
+    Reachable result{EwahBitmap::compress(bits),
+                     {unindexed.begin(), unindexed.end()}};
+    std::sort(result.unindexed.begin(), result.unindexed.end());
+
+    return result;
+}
+
+std::vector<ObjectId> Repository::reachable_objects(
+    const BitmapIndex& index, const std::vector<ObjectId>& from,
+    const std::vector<ObjectId>& exclude) {
+    auto included = reachable(index, from);
+    auto excluded = reachable(index, exclude);
+
+    std::vector<ObjectId> objects;
+
+    for (auto position : included.indexed.and_not(excluded.indexed).positions()) {
+        objects.push_back(index.object(position));
+    }
+
+    std::set_difference(included.unindexed.begin(), included.unindexed.end(),
+                        excluded.unindexed.begin(), excluded.unindexed.end(),
+                        std::back_inserter(objects));
+
+    return objects;
+}
+
+std::vector<ObjectId> Repository::reachable_objects(
+    const std::vector<ObjectId>& from, const std::vector<ObjectId>& exclude) {
+    // without a bitmap index, all objects are walked
+    auto index = BitmapIndex::load(bitmaps_path()).value_or(BitmapIndex{});
+
+    return reachable_objects(index, from, exclude);
+}
+
+std::optional<EwahBitmap> Repository::translate_bitmap(
+    const BitmapIndex& from, const BitmapIndex& to, const ObjectId& commit) {
+    auto position = from.position(commit);
+    auto bitmap = position ? from.bitmap(*position) : nullptr;
+
+    if (!bitmap) {
+        return std::nullopt;
+    }
+
+    std::vector<std::uint64_t> bits((to.size() + 63) / 64);
+
+    for (auto old_position : bitmap->positions()) {
+        auto new_position = to.position(from.object(old_position));
+
+        if (!new_position) {
+            return std::nullopt;
+        }
+
+        bits[*new_position / 64] |= std::uint64_t{1} << (*new_position % 64);
+    }
+
+    return EwahBitmap::compress(bits);
+}
+
+BitmapStats Repository::write_bitmaps() {
+    BitmapStats stats;
+
+    // the bitmaps of the previous index (if any) remain valid, and are
+    // reused rather than computed again
+    auto previous = BitmapIndex::load(bitmaps_path()).value_or(BitmapIndex{});
+    auto objects = _store->list();
+
+    // Reachable objects in alternate object directories are indexed as well,
+    // so that the bitmaps cover everything a push may need to send.
+    if (!_alternates.empty()) {
+        auto reach = reachable(previous, ref_targets());
+
+        for (auto position : reach.indexed.positions()) {
+            objects.push_back(previous.object(position));
+        }
+
+        objects.insert(objects.end(), reach.unindexed.begin(),
+                       reach.unindexed.end());
+
+        std::sort(objects.begin(), objects.end());
+        objects.erase(std::unique(objects.begin(), objects.end()),
+                      objects.end());
+    }
+
+    BitmapIndex index{std::move(objects)};
+
+    // Select the ref targets, and every bitmap_interval-th commit of their
+    // histories. Commits are counted from the root, so that the same commits
+    // are selected as the history grows.
+    std::vector<ObjectId> selected;
+
+    for (const auto& target : ref_targets()) {
+        std::vector<ObjectId> history;
+
+        for (std::optional<ObjectId> current = target; current;) {
+            history.push_back(*current);
+            current = resolve(handle<Commit>(*current)).parent();
+        }
+
+        for (std::size_t i = 0; i < history.size(); ++i) {
+            auto depth = history.size() - 1 - i;
+
+            if (i == 0 || depth % bitmap_interval == 0) {
+                selected.push_back(history[i]);
+            }
+        }
+
+        release();
+    }
+
+    // Build the bitmaps oldest first, so that each one only needs to walk
+    // the trees of the commits since the previous one.
+    std::reverse(selected.begin(), selected.end());
+
+    for (const auto& commit : selected) {
+        auto position = index.position(commit);
+
+        if (!position || index.bitmap(*position)) {
+            continue;
+        }
+
+        if (auto bitmap = translate_bitmap(previous, index, commit)) {
+            index.add(*position, std::move(*bitmap));
+            continue;
+        }
+
+        auto reach = reachable(index, {commit});
+
+        // objects created while building the index cannot be represented,
+        // and an incomplete bitmap would be wrong
+        if (!reach.unindexed.empty()) {
+            continue;
+        }
+
+        index.add(*position, std::move(reach.indexed));
+    }
+
+    index.save(bitmaps_path());
+
+    stats.objects = index.size();
+    stats.commits = index.bitmap_count();
+    stats.reachable = reachable_objects(index, ref_targets(), {}).size();
+
+    return stats;
+}
+
+CommitGraphStats Repository::write_commit_graph() {
+    CommitGraphStats stats;
+
+    // the filters of the previous graph (if any) remain valid, and are
+    // reused rather than computed again
+    auto previous =
+        CommitGraph::load(commit_graph_path()).value_or(CommitGraph{});
+
+    // collect the parents of all commits reachable from the refs
+    std::unordered_map<ObjectId, std::optional<ObjectId>, ObjectIdHash> parents;
+
+    for (const auto& target : ref_targets()) {
+        for (std::optional<ObjectId> current = target;
+             current && !parents.contains(*current);) {
+            std::optional<ObjectId> parent;
+
+            if (auto position = previous.position(*current)) {
+                if (auto parent_position = previous.parent(*position)) {
+                    parent = previous.commit(*parent_position);
+                }
+            } else {
+                parent = resolve(handle<Commit>(*current)).parent();
+            }
+
+            parents.emplace(*current, parent);
+            current = parent;
+        }
+
+        release();
+    }
+
+    std::vector<ObjectId> commits;
+    commits.reserve(parents.size());
+
+    for (const auto& [commit, parent] : parents) {
+        commits.push_back(commit);
+    }
+
+    std::sort(commits.begin(), commits.end());
+    CommitGraph graph{std::move(commits)};
+
+    std::vector<std::string> changed;
+    std::string path;
+
+    for (std::uint32_t position = 0; position < graph.size(); ++position) {
+        const auto& commit = graph.commit(position);
+        const auto& parent = parents.at(commit);
+        auto parent_position = parent ? graph.position(*parent) : std::nullopt;
+
+        if (auto previous_position = previous.position(commit)) {
+            graph.set(position, parent_position,
+                      previous.filter(*previous_position));
+            ++stats.reused;
+            continue;
+        }
+
+        std::optional<ObjectId> parent_tree;
+
+        if (parent) {
+            parent_tree = resolve(handle<Commit>(*parent)).tree();
+        }
+
+        changed.clear();
+
+        if (diff_trees(parent_tree, resolve(handle<Commit>(commit)).tree(),
+                       path, changed)) {
+            graph.set(position, parent_position,
+                      CommitGraph::build_filter(changed));
+        } else {
+            graph.set(position, parent_position, std::nullopt);
+            ++stats.unfiltered;
+        }
+
+        if (++stats.computed % 1024 == 0) {
+            release();
+        }
+    }
+
+    release();
+    graph.save(commit_graph_path());
+
+    stats.commits = graph.size();
+
+    return stats;
+}
+
+FsckReport Repository::fsck(
+    bool incremental, const std::function<void(const FsckProgress&)>& progress) {
+    FsckReport report;
+    auto start = std::chrono::system_clock::to_time_t(
+        std::chrono::system_clock::now());
+
+    auto objects = _store->list();
+
+    report.objects = objects.size();
+
+    ThreadPool pool;
+    std::mutex mutex;
+
+    auto problem = [&](const std::string& message) {
+        std::lock_guard lock{mutex};
+        report.errors.push_back(message);
+    };
+
+    // in incremental mode, only objects created since the last clean run are
+    // checked
+    std::vector<char> fresh(objects.size(), true);
+    auto since = incremental ? load_fsck_time() : std::nullopt;
+
+    if (since) {
+        for (std::size_t begin = 0; begin < objects.size();
+             begin += batch_size) {
+            pool.submit([&, begin] {
+                auto end = std::min(begin + batch_size, objects.size());
+
+                for (auto index = begin; index < end; ++index) {
+                    auto info = _store->info(objects[index]);
+                    fresh[index] = !info || info->written >= *since;
+                }
+            });
+        }
+
+        pool.wait();
+    }
+
+    // verify the hashes of all (fresh) objects
+    FsckProgress status;
+    status.total = std::count(fresh.begin(), fresh.end(), true);
+
+    std::atomic<std::size_t> verified = 0;
+    std::atomic<std::uintmax_t> bytes = 0;
+    std::condition_variable finished;
+
+    for (std::size_t begin = 0; begin < objects.size(); begin += batch_size) {
+        pool.submit([&, begin] {
+            auto end = std::min(begin + batch_size, objects.size());
+
+            for (auto index = begin; index < end; ++index) {
+                if (!fresh[index]) {
+                    continue;
+                }
+
+                const auto& id = objects[index];
+                auto size = _store->verify(id);
+
+                if (!size) {
+                    problem("hash mismatch in object " + id.hex());
+                }
+
+                bytes += size.value_or(0);
+
+                if (++verified == status.total) {
+                    std::lock_guard lock{mutex};
+                    finished.notify_all();
+                }
+            }
+        });
+    }
+
+    // report the progress while the objects are verified
+    {
+        std::unique_lock lock{mutex};
+
+        while (!finished.wait_for(lock, std::chrono::milliseconds{500}, [&] {
+            return verified == status.total;
+        })) {
+            status.verified = verified;
+            status.bytes = bytes;
+
+            lock.unlock();
+            progress(status);
+            lock.lock();
+        }
+    }
+
+    pool.wait();
+
+    status.verified = verified;
+    status.bytes = bytes;
+    progress(status);
+
+    report.verified = status.verified;
+    report.bytes = status.bytes;
+
+    // check that all objects reachable from the refs exist and are well-formed.
+    // Objects that were checked by a previous run are not read again, as
+    // objects never change.
+    AtomicBitmap marks{objects.size()};
+
+    mark_reachable(
+        objects, marks, pool, [&](std::size_t index) { return fresh[index]; },
+        problem);
+
+    if (!since) {
+        for (std::size_t index = 0; index < objects.size(); ++index) {
+            report.unreachable += !marks.test(index);
+        }
+    }
+
+    if (report.errors.empty()) {
+        persist_fsck_time(start);
+    }
+
+    std::sort(report.errors.begin(), report.errors.end());
+
+    return report;
+}
+
+namespace {
+
+// optional refs are sent as their hash, or "-" if they are empty
+std::string ref_to_string(const std::optional<ObjectId>& ref) {
+    return ref ? ref->hex() : "-";
+}
+
+std::optional<ObjectId> ref_from_string(std::string_view string) {
+    if (string == "-") {
+        return std::nullopt;
+    }
+
+    auto id = ObjectId::from_hex(string);
+
+    if (!id) {
+        throw TogException{"invalid ref in sync protocol: " +
+                           std::string{string}};
+    }
+
+    return id;
+}
+
+// returns the rest of line after the given prefix, or std::nullopt if line
+// does not start with it
+std::optional<std::string_view> strip_prefix(std::string_view line,
+                                             std::string_view prefix) {
+    if (!line.starts_with(prefix)) {
+        return std::nullopt;
+    }
+
+    return line.substr(prefix.size());
+}
+
+// sends the given object, preceded by its header. Objects kept in files of
+// their own are streamed rather than loaded into memory. Returns the object's
+// size, or std::nullopt if it is missing.
+std::optional<std::uintmax_t> send_object(Connection& connection,
+                                          const ObjectStore& store,
+                                          const ObjectId& id) {
+    if (auto path = store.path(id)) {
+        auto file = open_file(*path);
+        struct stat status;
+
+        if (!file || ::fstat(file.get(), &status) < 0) {
+            return std::nullopt;
+        }
+
+        connection.write_line("object " + id.hex() + " " +
+                              std::to_string(status.st_size));
+        connection.write_from(file.get(), status.st_size);
+
+        return status.st_size;
+    }
+
+    std::vector<unsigned char> bytes;
+
+    if (store.read(id, bytes)) {
+        return std::nullopt;
+    }
+
+    connection.write_line("object " + id.hex() + " " +
+                          std::to_string(bytes.size()));
+    connection.write(bytes.data(), bytes.size());
+
+    return bytes.size();
+}
+
+// throws if line is an error reported by the peer
+void check_remote_error(std::string_view line) {
+    if (auto message = strip_prefix(line, "error ")) {
+        throw TogException{"remote: " + std::string{*message}};
+    }
+}
+
+}  // namespace
+
+SyncStats Repository::push(Connection& connection) {
+    SyncStats stats;
+
+    connection.write_line(sync_greeting);
+    connection.write_line("push");
+
+    auto line = connection.read_line();
+    check_remote_error(line);
+
+    auto remote_main = strip_prefix(line, "main ");
+
+    if (!remote_main) {
+        throw TogException{"unexpected response from remote: " + line};
+    }
+
+    stats.old_main = ref_from_string(*remote_main);
+
+    // the remote branch can only be fast-forwarded if we have all of its
+    // commits
+    auto error = [&](const std::string& message) {
+        connection.write_line("error " + message);
+        connection.flush();
+        throw TogException{message};
+    };
+
+    if (!_main) {
+        error("nothing to push, the local main branch has no commits");
+    }
+
+    if (stats.old_main && (!has_object(*stats.old_main) ||
+                           !is_ancestor(*stats.old_main, *_main))) {
+        error("the remote main branch has commits that are not in the "
+              "local one, pull them first");
+    }
+
+    send_objects(connection, stats.old_main, *_main, stats);
+    stats.new_main = _main;
+
+    return stats;
+}
+
+SyncStats Repository::pull(Connection& connection) {
+    SyncStats stats;
+    auto at_latest = _head == _main;
+
+    connection.write_line(sync_greeting);
+    connection.write_line("pull " + ref_to_string(_main));
+
+    receive_objects(connection, stats);
+
+    if (at_latest && _main && _head != _main) {
+        checkout(_main->hex());
+    }
+
+    return stats;
+}
+
+void Repository::serve(Connection& connection) {
+    try {
+        if (connection.read_line() != sync_greeting) {
+            throw TogException{"unsupported sync protocol version"};
+        }
+
+        auto request = connection.read_line();
+        SyncStats stats;
+
+        if (request == "push") {
+            // like git's receive.denyCurrentBranch, the branch checked out in
+            // the worktree is not moved under it, which would leave head
+            // behind and block further commits here
+            if (_main && _head == _main) {
+                throw TogException{
+                    "the main branch is checked out in the remote worktree, "
+                    "pull from it instead"};
+            }
+
+            connection.write_line("main " + ref_to_string(_main));
+            receive_objects(connection, stats);
+        } else if (auto local_main = strip_prefix(request, "pull ")) {
+            auto peer_main = ref_from_string(*local_main);
+
+            if (!_main) {
+                throw TogException{"the main branch has no commits"};
+            }
+
+            if (peer_main &&
+                (!has_object(*peer_main) || !is_ancestor(*peer_main, *_main))) {
+                throw TogException{
+                    "the pulling main branch has commits that are not in "
+                    "the served one"};
+            }
+
+            send_objects(connection, peer_main, *_main, stats);
+        } else if (request == "fetch") {
+            serve_objects(connection);
+        } else {
+            throw TogException{"unknown sync request: " + request};
+        }
+
+        connection.flush();
+    } catch (const std::exception& e) {
+        // let the peer know why the session ends, if it is still listening
+        try {
+            connection.write_line("error " + std::string{e.what()});
+            connection.flush();
+        } catch (const std::exception&) {
+        }
+
+        throw;
+    }
+}
+
+namespace {
+
+// returns the tog ref for a ref of a fast-import stream, e.g. "branches/main"
+// for "refs/heads/main" (or just "main"), or std::nullopt if it is invalid.
+// Names without a refs/ prefix are refs of the given kind.
+std::optional<std::string> import_ref_name(std::string_view name,
+                                           RefKind kind = RefKind::branch) {
+    if (auto tag = strip_prefix(name, "refs/tags/")) {
+        kind = RefKind::tag;
+        name = *tag;
+    } else if (auto branch = strip_prefix(name, "refs/heads/")) {
+        kind = RefKind::branch;
+        name = *branch;
+    }
+
+    if (!RefStore::valid_name(name)) {
+        return std::nullopt;
+    }
+
+    return std::string{ref_prefix(kind)} + std::string{name};
+}
+
+std::string import_ref(std::string_view name, RefKind kind = RefKind::branch) {
+    auto ref = import_ref_name(name, kind);
+
+    if (!ref) {
+        throw TogException{"invalid ref in fast-import stream: " +
+                           std::string{name}};
+    }
+
+    return *ref;
+}
+
+// parses a decimal number of a fast-import command
+std::uint64_t import_number(std::string_view string, std::string_view line) {
+    std::uint64_t value;
+    auto end = string.data() + string.size();
+    auto [ptr, err] = std::from_chars(string.data(), end, value);
+
+    if (err != std::errc{} || ptr != end || string.empty()) {
+        throw TogException{"invalid fast-import command: " +
+                           std::string{line}};
+    }
+
+    return value;
+}
+
+// parses a mark, e.g. ":42"
+std::uint64_t import_mark(std::string_view mark) {
+    if (!mark.starts_with(':')) {
+        throw TogException{"invalid mark: " + std::string{mark}};
+    }
+
+    return import_number(mark.substr(1), mark);
+}
+
+// returns the size of the contents announced by a "data <size>" line
+std::uint64_t import_data_size(std::string_view line) {
+    auto size = strip_prefix(line, "data ");
+
+    if (!size) {
+        throw TogException{"expected data in fast-import stream, got: " +
+                           std::string{line}};
+    }
+
+    return import_number(*size, line);
+}
+
+// Returns a path of a fast-import stream, which is quoted (with C-style
+// escapes) if it contains special characters. Throws if the path is empty or
+// has components that tog cannot check out.
+std::string import_path(std::string_view quoted) {
+    std::string path;
+
+    if (!quoted.starts_with('"')) {
+        path = quoted;
+    } else if (quoted.size() < 2 || !quoted.ends_with('"')) {
+        throw TogException{"invalid path: " + std::string{quoted}};
+    } else {
+        auto rest = quoted.substr(1, quoted.size() - 2);
+
+        for (std::size_t i = 0; i < rest.size(); ++i) {
+            if (rest[i] != '\\') {
+                path.push_back(rest[i]);
+                continue;
+            } else if (++i == rest.size()) {
+                throw TogException{"invalid path: " + std::string{quoted}};
+            }
+
+            // pairs of escape characters and the characters they stand for
+            constexpr std::string_view escapes =
+                "a\ab\bf\fn\nr\rt\tv\v\"\"\\\\";
+            auto escape = escapes.find(rest[i]);
+
+            if (escape != std::string_view::npos && escape % 2 == 0) {
+                path.push_back(escapes[escape + 1]);
+            } else if (i + 2 < rest.size() && rest[i] >= '0' &&
+                       rest[i] <= '3' && rest[i + 1] >= '0' &&
+                       rest[i + 1] <= '7' && rest[i + 2] >= '0' &&
+                       rest[i + 2] <= '7') {
+                // an octal escape of a byte, e.g. of UTF-8 names
+                path.push_back(static_cast<char>((rest[i] - '0') * 64 +
+                                                 (rest[i + 1] - '0') * 8 +
+                                                 (rest[i + 2] - '0')));
+                i += 2;
+            } else {
+                throw TogException{"invalid path: " + std::string{quoted}};
+            }
+        }
+    }
+
+    for (std::size_t begin = 0; begin <= path.size();) {
+        auto end = std::min(path.find('/', begin), path.size());
+        auto name = std::string_view{path}.substr(begin, end - begin);
+
+        if (name.empty() || name == "." || name == ".." || name == ".tog" ||
+            name.find('\0') != std::string_view::npos) {
+            throw TogException{"invalid path: " + std::string{quoted}};
+        }
+
+        begin = end + 1;
+    }
+
+    return path;
+}
+
+// quotes a path for a fast-import stream if it contains special characters,
+// as import_path() expects
+std::string export_path(std::string_view path) {
+    auto special = [](unsigned char c) {
+        return c < 0x20 || c == 0x7f || c == '"' || c == '\\';
+    };
+
+    if (std::none_of(path.begin(), path.end(), special)) {
+        return std::string{path};
+    }
+
+    std::string quoted = "\"";
+
+    for (unsigned char c : path) {
+        if (c == '"' || c == '\\') {
+            quoted.push_back('\\');
+            quoted.push_back(c);
+        } else if (c == '\n') {
+            quoted.append("\\n");
+        } else if (c == '\t') {
+            quoted.append("\\t");
+        } else if (special(c)) {
+            char escape[5];
+            std::snprintf(escape, sizeof(escape), "\\%03o", c);
+            quoted.append(escape);
+        } else {
+            quoted.push_back(c);
+        }
+    }
+
+    quoted.push_back('"');
+    return quoted;
+}
+
+}  // namespace
+
+// a directory of the tree that fast_import() builds in memory
+struct Repository::ImportDirectory {
+    struct Entry {
+        Tree::Kind kind;
+
+        // the blob, or the subtree as it was before it was modified
+        ObjectId id;
+
+        // the subtree, once a change reached it
+        std::unique_ptr<ImportDirectory> directory;
+    };
+
+    // the directory's tree, or std::nullopt if it was modified since it was
+    // last written
+    std::optional<ObjectId> tree;
+
+    // the entries of unmodified directories are loaded when a change reaches
+    // them
+    bool loaded = false;
+    std::unordered_map<NameId, Entry> entries;
+};
+
+// the state of fast_import()
+struct Repository::Import {
+    // a ref updated by the stream
+    struct Ref {
+        // the ref's target before the import, at the last checkpoint, and
+        // now
+        std::optional<ObjectId> initial;
+        std::optional<ObjectId> committed;
+        std::optional<ObjectId> target;
+    };
+
+    explicit Import(Connection& input) : input{input} {}
+
+    // returns the next line, or std::nullopt at the end of the stream
+    std::optional<std::string> next_line() {
+        if (pending) {
+            return std::exchange(pending, std::nullopt);
+        } else if (input.at_end()) {
+            return std::nullopt;
+        }
+
+        return input.read_line();
+    }
+
+    std::string require_line() {
+        auto line = next_line();
+
+        if (!line) {
+            throw TogException{"unexpected end of fast-import stream"};
+        }
+
+        return std::move(*line);
+    }
+
+    // returns the given ref, reading its current target on first use
+    Ref& ref(const RefStore& store, const std::string& name) {
+        auto [it, inserted] = refs.try_emplace(name);
+
+        if (inserted) {
+            it->second.target = it->second.committed = it->second.initial =
+                store.read(name);
+        }
+
+        return it->second;
+    }
+
+    Connection& input;
+
+    // a line that was read ahead, which is processed next
+    std::optional<std::string> pending;
+
+    std::unordered_map<std::uint64_t, ObjectId> marks;
+    std::map<std::string, Ref> refs;
+
+    // the tree of the last imported commit. The next commit starts from it
+    // if it is that commit's child, which is the common case.
+    ImportDirectory root;
+    std::optional<ObjectId> root_commit;
+
+    ImportStats stats;
+};
+
+ImportStats Repository::fast_import(
+    Connection& input,
+    const std::function<void(std::string_view text)>& progress) {
+    Import import{input};
+
+    while (auto line = import.next_line()) {
+        if (line->empty() || line->starts_with('#')) {
+            continue;
+        } else if (*line == "blob") {
+            import_blob(import);
+        } else if (auto ref = strip_prefix(*line, "commit ")) {
+            import_commit(import, *ref);
+        } else if (auto ref = strip_prefix(*line, "reset ")) {
+            import_reset(import, *ref);
+        } else if (auto name = strip_prefix(*line, "tag ")) {
+            import_tag(import, *name);
+        } else if (auto text = strip_prefix(*line, "progress ")) {
+            progress(*text);
+        } else if (*line == "checkpoint") {
+            finish_import(import);
+        } else if (*line == "done") {
+            break;
+        } else {
+            throw TogException{"unsupported fast-import command: " + *line};
+        }
+    }
+
+    finish_import(import);
+    release();
+
+    for (const auto& [name, ref] : import.refs) {
+        import.stats.refs += ref.target != ref.initial;
+    }
+
+    return import.stats;
+}
+
+std::optional<std::string> Repository::import_field(Import& import,
+                                                    std::string_view keyword) {
+    auto line = import.next_line();
+
+    if (line && line->starts_with(keyword)) {
+        return line->substr(keyword.size());
+    }
+
+    import.pending = std::move(line);
+    return std::nullopt;
+}
+
+void Repository::import_blob(Import& import) {
+    auto mark = import_field(import, "mark ");
+    import_field(import, "original-oid ");
+
+    auto id = import_data(import, import.require_line());
+
+    if (mark) {
+        import.marks[import_mark(*mark)] = id;
+    }
+
+    ++import.stats.blobs;
+}
+
+void Repository::import_commit(Import& import, std::string_view ref_name) {
+    auto& ref = import.ref(_refs, import_ref(ref_name));
+    auto parent = ref.target;
+
+    std::optional<std::uint64_t> mark;
+    std::optional<std::string> message;
+    bool changed = false;
+
+    while (auto line = import.next_line()) {
+        if (line->empty() || line->starts_with("author ") ||
+            line->starts_with("committer ") ||
+            line->starts_with("original-oid ") ||
+            line->starts_with("encoding ")) {
+            // tog commits record neither authors nor times
+            continue;
+        } else if (auto value = strip_prefix(*line, "mark ")) {
+            mark = import_mark(*value);
+        } else if (line->starts_with("data ")) {
+            message.emplace(import_data_size(*line), '\0');
+            import.input.read(message->data(), message->size());
+        } else if (auto from = strip_prefix(*line, "from ")) {
+            if (changed) {
+                throw TogException{"from must precede the changes of a commit"};
+            }
+
+            parent = import_commitish(import, *from);
+        } else if (line->starts_with("merge ")) {
+            throw TogException{
+                "merge commits are not supported, as tog commits have a "
+                "single parent"};
+        } else if (*line == "deleteall" || line->starts_with("M ") ||
+                   line->starts_with("D ")) {
+            // the in-memory tree is reused if it belongs to the parent
+            if (!changed && import.root_commit != parent) {
+                import.root = ImportDirectory{};
+
+                if (parent) {
+                    import.root.tree = resolve(handle<Commit>(*parent)).tree();
+                }
+
+                import.root_commit = parent;
+            }
+
+            changed = true;
+            import_change(import, *line);
+        } else if (line->starts_with("C ") || line->starts_with("R ") ||
+                   line->starts_with("N ")) {
+            throw TogException{"unsupported fast-import command: " + *line};
+        } else {
+            // the commit ends at the next command
+            import.pending = std::move(line);
+            break;
+        }
+    }
+
+    if (!message) {
+        throw TogException{"commit without message in fast-import stream"};
+    }
+
+    // a commit without changes has its parent's tree
+    if (!changed && import.root_commit != parent) {
+        import.root = ImportDirectory{};
+
+        if (parent) {
+            import.root.tree = resolve(handle<Commit>(*parent)).tree();
+        }
+    }
+
+    auto tree = write_import_directory(import.root);
+
+    if (!tree) {
+        tree = id(build_tree({}));
+    }
+
+    auto commit =
+        id(register_object(Commit{*tree, parent, std::move(*message)}));
+
+    import.root_commit = commit;
+    ref.target = commit;
+
+    if (mark) {
+        import.marks[*mark] = commit;
+    }
+
+    // the in-memory tree only holds ids, so all objects can be released
+    if (++import.stats.commits % import_batch_size == 0) {
+        persist_new_objects();
+        release();
+    }
+}
+
+void Repository::import_reset(Import& import, std::string_view ref_name) {
+    auto& ref = import.ref(_refs, import_ref(ref_name));
+    auto from = import_field(import, "from ");
+
+    // without from, the next commit on the ref has no parent
+    ref.target = from ? std::optional{import_commitish(import, *from)}
+                      : std::nullopt;
+}
+
+void Repository::import_tag(Import& import, std::string_view name) {
+    auto& ref = import.ref(_refs, import_ref(name, RefKind::tag));
+    auto from = import_field(import, "from ");
+
+    if (!from) {
+        throw TogException{"tag without from in fast-import stream"};
+    }
+
+    ref.target = import_commitish(import, *from);
+
+    import_field(import, "original-oid ");
+    import_field(import, "tagger ");
+
+    // tog tags are plain refs, so the tag message is dropped
+    auto size = import_data_size(import.require_line());
+    std::string message(size, '\0');
+    import.input.read(message.data(), message.size());
+}
+
+ObjectId Repository::import_commitish(Import& import, std::string_view name) {
+    if (name.starts_with(':')) {
+        auto it = import.marks.find(import_mark(name));
+
+        if (it == import.marks.end()) {
+            throw TogException{"unknown mark " + std::string{name}};
+        }
+
+        return it->second;
+    }
+
+    // git exports use "<ref>^0" to refer to the commit a ref points to
+    if (name.ends_with("^0")) {
+        name.remove_suffix(2);
+    }
+
+    // refs updated by the stream take precedence over the repository's refs
+    if (auto ref = import_ref_name(name)) {
+        auto it = import.refs.find(*ref);
+
+        if (it != import.refs.end() && it->second.target) {
+            return *it->second.target;
+        }
+    }
+
+    auto short_name = name;
+
+    for (auto prefix : {"refs/heads/", "refs/tags/"}) {
+        if (auto rest = strip_prefix(name, prefix)) {
+            short_name = *rest;
+        }
+    }
+
+    auto commit = resolve_name(short_name);
+
+    if (!commit) {
+        throw TogException{"commit does not exist: " + std::string{name}};
+    }
+
+    return *commit;
+}
+
+ObjectId Repository::import_data(Import& import, std::string_view line) {
+    auto size = import_data_size(line);
+
+    if (size < streaming_threshold) {
+        std::vector<unsigned char> data(size);
+        import.input.read(data.data(), data.size());
+
+        return id(register_object(Blob{std::move(data)}));
+    }
+
+    // large contents are spooled to a temporary file in the object store
+    // (which gc cleans up after a crash), which is then hashed and moved into
+    // the store, so they are never held in memory
+    auto tmp_path = _store->temporary_path();
+
+    try {
+        {
+            auto file = create_file(tmp_path);
+            import.input.read_into(file.get(), size);
+        }
+
+        auto id = sha256(open_file(tmp_path).get());
+
+        if (freshen_object(id)) {
+            fs::remove(tmp_path);
+        } else {
+            _store->insert(id, tmp_path);
+        }
+
+        return id;
+    } catch (...) {
+        std::error_code err;
+        fs::remove(tmp_path, err);
+
+        throw;
+    }
+}
+
+void Repository::import_change(Import& import, std::string_view change) {
+    if (change == "deleteall") {
+        import.root = ImportDirectory{};
+        return;
+    }
+
+    auto kind = Tree::Kind::blob;
+    std::optional<ObjectId> id;
+    std::string path;
+
+    if (auto modify = strip_prefix(change, "M ")) {
+        // M <mode> <dataref> <path>
+        auto mode_end = modify->find(' ');
+        auto ref_end = modify->find(' ', mode_end + 1);
+
+        if (ref_end == std::string_view::npos) {
+            throw TogException{"invalid fast-import command: " +
+                               std::string{change}};
+        }
+
+        // tog does not record file modes, so executables become plain files
+        auto mode = modify->substr(0, mode_end);
+        auto ref = modify->substr(mode_end + 1, ref_end - mode_end - 1);
+        path = import_path(modify->substr(ref_end + 1));
+
+        if (mode == "040000" || mode == "40000") {
+            kind = Tree::Kind::tree;
+        } else if (mode != "100644" && mode != "644" && mode != "100755" &&
+                   mode != "755") {
+            throw TogException{"unsupported file mode " + std::string{mode} +
+                               " for " + path};
+        }
+
+        if (ref == "inline" && kind == Tree::Kind::blob) {
+            id = import_data(import, import.require_line());
+            ++import.stats.blobs;
+        } else if (ref.starts_with(':')) {
+            auto it = import.marks.find(import_mark(ref));
+
+            if (it == import.marks.end()) {
+                throw TogException{"unknown mark " + std::string{ref}};
+            }
+
+            id = it->second;
+        } else {
+            id = ObjectId::from_hex(ref);
+
+            if (!id || !freshen_object(*id)) {
+                throw TogException{"object does not exist: " +
+                                   std::string{ref}};
+            }
+        }
+    } else {
+        path = import_path(change.substr(2));
+    }
+
+    // walk to the path's directory, creating the missing directories unless
+    // the path is being deleted
+    std::vector<ImportDirectory*> directories{&import.root};
+    std::size_t begin = 0;
+
+    for (auto end = path.find('/'); end != std::string::npos;
+         begin = end + 1, end = path.find('/', begin)) {
+        auto& directory = *directories.back();
+        load_import_directory(directory);
+
+        auto name = _names.intern(std::string_view{path}.substr(begin,
+                                                                end - begin));
+        auto it = directory.entries.find(name);
+
+        if (it == directory.entries.end() ||
+            it->second.kind != Tree::Kind::tree) {
+            if (!id) {
+                return;
+            }
+
+            // a file in the way is replaced
+            it = directory.entries
+                     .insert_or_assign(
+                         name, ImportDirectory::Entry{
+                                   Tree::Kind::tree, {},
+                                   std::make_unique<ImportDirectory>()})
+                     .first;
+        } else if (!it->second.directory) {
+            it->second.directory = std::make_unique<ImportDirectory>();
+            it->second.directory->tree = it->second.id;
+        }
+
+        directories.push_back(it->second.directory.get());
+    }
+
+    auto& directory = *directories.back();
+    load_import_directory(directory);
+
+    auto name = _names.intern(std::string_view{path}.substr(begin));
+
+    if (id) {
+        directory.entries.insert_or_assign(
+            name, ImportDirectory::Entry{kind, *id, nullptr});
+    } else if (directory.entries.erase(name) == 0) {
+        return;
+    }
+
+    // the directories along the path need to be written again
+    for (auto parent : directories) {
+        parent->tree.reset();
+    }
+}
+
+void Repository::load_import_directory(ImportDirectory& directory) {
+    if (directory.loaded) {
+        return;
+    }
+
+    if (directory.tree) {
+        std::vector<Tree::Entry> entries;
+        collect_entries(*directory.tree, entries);
+
+        for (const auto& entry : entries) {
+            directory.entries.emplace(
+                entry.name,
+                ImportDirectory::Entry{entry.kind, entry.id, nullptr});
+        }
+    }
+
+    directory.loaded = true;
+}
+
+std::optional<ObjectId> Repository::write_import_directory(
+    ImportDirectory& directory) {
+    if (directory.tree) {
+        return directory.tree;
+    }
+
+    std::vector<Tree::Entry> entries;
+
+    for (auto it = directory.entries.begin(); it != directory.entries.end();) {
+        auto& [name, entry] = *it;
+
+        if (entry.directory) {
+            auto tree = write_import_directory(*entry.directory);
+
+            // as in git, directories without files are dropped
+            if (!tree) {
+                it = directory.entries.erase(it);
+                continue;
+            }
+
+            entry.id = *tree;
+        }
+
+        entries.push_back({name, entry.kind, entry.id});
+        ++it;
+    }
+
+    if (entries.empty()) {
+        return std::nullopt;
+    }
+
+    directory.tree = id(build_tree(std::move(entries)));
+    return directory.tree;
+}
+
+void Repository::finish_import(Import& import) {
+    persist_new_objects();
+
+    RefTransaction refs;
+
+    for (const auto& [name, ref] : import.refs) {
+        if (ref.target == ref.committed) {
+            continue;
+        } else if (name == main_ref && !ref.target) {
+            throw TogException{"the main branch cannot be deleted"};
+        }
+
+        // fails if the ref was changed by someone else during the import
+        refs.update(name, ref.target, ref.committed);
+    }
+
+    _refs.commit(refs);
+
+    for (auto& [name, ref] : import.refs) {
+        ref.committed = ref.target;
+
+        if (name == main_ref) {
+            _main = ref.target;
+        }
+    }
+}
+
+ExportStats Repository::fast_export(std::string_view range, int fd) {
+    auto separator = range.find("..");
+    auto from_name = separator == std::string_view::npos
+                         ? std::string_view{}
+                         : range.substr(0, separator);
+    auto to_name = separator == std::string_view::npos
+                       ? range
+                       : range.substr(separator + 2);
+
+    auto resolve_commit = [this](std::string_view name) {
+        auto commit = resolve_name(name.empty() ? "main" : name);
+
+        if (!commit) {
+            throw TogException{"commit does not exist: " + std::string{name}};
+        }
+
+        return *commit;
+    };
+
+    auto to = resolve_commit(to_name);
+    std::optional<ObjectId> from;
+
+    if (separator != std::string_view::npos) {
+        from = resolve_commit(from_name);
+    }
+
+    // the commits go to the branch or tag that was named, and to the main
+    // branch otherwise
+    std::string ref = "refs/heads/main";
+
+    if (!to_name.empty() && to_name != head_ref &&
+        RefStore::valid_name(to_name)) {
+        auto name = std::string{to_name};
+
+        if (_refs.read(std::string{ref_prefix(RefKind::branch)} + name)) {
+            ref = "refs/heads/" + name;
+        } else if (_refs.read(std::string{ref_prefix(RefKind::tag)} + name)) {
+            ref = "refs/tags/" + name;
+        }
+    }
+
+    // the commit graph provides the parents of the commits it covers,
+    // without reading them
+    auto graph = CommitGraph::load(commit_graph_path());
+
+    auto parent_of = [&](const ObjectId& commit) -> std::optional<ObjectId> {
+        if (auto position = graph ? graph->position(commit) : std::nullopt) {
+            auto parent = graph->parent(*position);
+            return parent ? std::optional{graph->commit(*parent)}
+                          : std::nullopt;
+        }
+
+        return resolve(handle<Commit>(commit)).parent();
+    };
+
+    // the commits to export, newest first. Only their ids are kept in memory.
+    std::vector<ObjectId> commits;
+    std::unordered_map<ObjectId, std::size_t, ObjectIdHash> positions;
+
+    for (std::optional<ObjectId> current = to; current;
+         current = parent_of(*current)) {
+        if (from) {
+            positions.emplace(*current, commits.size());
+        }
+
+        commits.push_back(*current);
+
+        if (commits.size() % 1024 == 0) {
+            release();
+        }
+    }
+
+    // the history of from is excluded, up to where it meets that of to
+    std::size_t walked = 0;
+
+    for (auto current = from; current; current = parent_of(*current)) {
+        if (auto it = positions.find(*current); it != positions.end()) {
+            commits.resize(it->second);
+            break;
+        }
+
+        if (++walked % 1024 == 0) {
+            release();
+        }
+    }
+
+    positions = {};
+
+    ExportStats stats;
+    std::string buffer;
+
+    auto flush = [&] {
+        write_all(fd, buffer.data(), buffer.size());
+        buffer.clear();
+    };
+
+    // blobs and commits share one sequence of marks. Only the marks of the
+    // blobs are remembered, so that each blob is written once.
+    std::unordered_map<ObjectId, std::uint64_t, ObjectIdHash> blob_marks;
+    std::uint64_t next_mark = 1;
+    std::optional<std::uint64_t> parent_mark;
+    std::string path;
+
+    for (auto it = commits.rbegin(); it != commits.rend(); ++it) {
+        const auto& commit = resolve(handle<Commit>(*it));
+        auto tree = commit.tree();
+        auto parent = commit.parent();
+        auto message = commit.message();
+
+        std::optional<ObjectId> parent_tree;
+
+        if (parent) {
+            parent_tree = resolve(handle<Commit>(*parent)).tree();
+        }
+
+        // The trees are compared twice, so that the changes need not be held
+        // in memory: first, the new blobs are written, as they must precede
+        // the commit. The second pass finds the trees in the object cache.
+        diff_trees(parent_tree, tree, path, false,
+                   [&](const std::string&, const Tree::Entry*,
+                       const Tree::Entry* entry) {
+                       if (!entry || entry->kind != Tree::Kind::blob ||
+                           blob_marks.contains(entry->id)) {
+                           return true;
+                       }
+
+                       // a partial repository fetches the blob first
+                       fetch_missing({entry->id});
+
+                       const auto& store = store_for(entry->id);
+                       auto info = store.info(entry->id);
+
+                       if (!info) {
+                           throw TogException{"unable to read object " +
+                                              entry->id.hex()};
+                       }
+
+                       blob_marks.emplace(entry->id, next_mark);
+
+                       buffer.append("blob\nmark :")
+                           .append(std::to_string(next_mark++))
+                           .append("\ndata ")
+                           .append(std::to_string(info->size))
+                           .append("\n");
+
+                       // the contents are sent kernel-side
+                       flush();
+
+                       if (store.send(entry->id, fd)) {
+                           throw TogException{"unable to read object " +
+                                              entry->id.hex()};
+                       }
+
+                       buffer.push_back('\n');
+                       return true;
+                   });
+
+        // a root commit must not continue the ref's existing history
+        if (it == commits.rbegin() && !parent) {
+            buffer.append("reset ").append(ref).append("\n");
+        }
+
+        // tog does not record authors or times, but git requires a committer
+        auto mark = next_mark++;
+
+        buffer.append("commit ")
+            .append(ref)
+            .append("\nmark :")
+            .append(std::to_string(mark))
+            .append("\ncommitter tog <tog> 0 +0000\ndata ")
+            .append(std::to_string(message.size()))
+            .append("\n")
+            .append(message)
+            .append("\n");
+
+        if (parent) {
+            auto name = parent_mark ? ":" + std::to_string(*parent_mark)
+                                    : parent->hex();
+            buffer.append("from ").append(name).append("\n");
+        }
+
+        diff_trees(parent_tree, tree, path, false,
+                   [&](const std::string& changed, const Tree::Entry*,
+                       const Tree::Entry* entry) {
+                       if (!entry) {
+                           buffer.append("D ")
+                               .append(export_path(changed))
+                               .append("\n");
+                       } else if (entry->kind == Tree::Kind::blob) {
+                           buffer.append("M 100644 :")
+                               .append(std::to_string(
+                                   blob_marks.at(entry->id)))
+                               .append(" ")
+                               .append(export_path(changed))
+                               .append("\n");
+                       }
+
+                       if (buffer.size() >= export_buffer_size) {
+                           flush();
+                       }
+
+                       return true;
+                   });
+
+        buffer.push_back('\n');
+        parent_mark = mark;
+
+        if (++stats.commits % 1024 == 0) {
+            release();
+        }
+    }
+
+    flush();
+    release();
+
+    stats.blobs = blob_marks.size();
+
+    return stats;
+}
+
+void Repository::send_objects(Connection& connection,
+                              const std::optional<ObjectId>& old_main,
+                              const ObjectId& new_main, SyncStats& stats) {
+    std::vector<ObjectId> exclude;
+
+    if (old_main) {
+        exclude.push_back(*old_main);
+    }
+
+    auto objects = reachable_objects({new_main}, exclude);
+    stats.candidates = objects.size();
+
+    for (std::size_t begin = 0; begin < objects.size();
+         begin += sync_batch_size) {
+        auto end = std::min(begin + sync_batch_size, objects.size());
+
+        connection.write_line("check " + std::to_string(end - begin));
+
+        for (auto i = begin; i < end; ++i) {
+            connection.write_line(objects[i].hex());
+        }
+
+        // one character per object, 1 if the receiver has it
+        auto answer = connection.read_line();
+        check_remote_error(answer);
+
+        if (answer.size() != end - begin) {
+            throw TogException{"unexpected response from remote: " + answer};
+        }
+
+        for (auto i = begin; i < end; ++i) {
+            if (answer[i - begin] == '1') {
+                continue;
+            }
+
+            fetch_missing({objects[i]});
+
+            auto size =
+                send_object(connection, store_for(objects[i]), objects[i]);
+
+            if (!size) {
+                throw TogException{"object " + objects[i].hex() +
+                                   " not found"};
+            }
+
+            ++stats.transferred;
+            stats.bytes += *size;
+        }
+    }
+
+    connection.write_line("update " + ref_to_string(old_main) + " " +
+                          new_main.hex());
+
+    auto answer = connection.read_line();
+    check_remote_error(answer);
+
+    if (answer != "ok") {
+        throw TogException{"unexpected response from remote: " + answer};
+    }
+
+    stats.old_main = old_main;
+    stats.new_main = new_main;
+}
+
+void Repository::receive_objects(Connection& connection, SyncStats& stats) {
+    for (;;) {
+        auto line = connection.read_line();
+        check_remote_error(line);
+
+        if (auto count = strip_prefix(line, "check ")) {
+            auto n = std::stoull(std::string{*count});
+            std::string answer;
+
+            for (std::uint64_t i = 0; i < n; ++i) {
+                auto id = ObjectId::from_hex(connection.read_line());
+                answer += id && has_object(*id) ? '1' : '0';
+            }
+
+            connection.write_line(answer);
+        } else if (auto object = strip_prefix(line, "object ")) {
+            auto separator = object->find(' ');
+            auto id = ObjectId::from_hex(object->substr(0, separator));
+
+            if (!id || separator == std::string_view::npos) {
+                throw TogException{"invalid object header: " + line};
+            }
+
+            auto size = std::stoull(std::string{object->substr(separator + 1)});
+            store_object(*id, [&connection, size](int fd) {
+                connection.read_into(fd, size);
+            });
+
+            ++stats.transferred;
+            stats.bytes += size;
+        } else if (auto update = strip_prefix(line, "update ")) {
+            auto separator = update->find(' ');
+
+            if (separator == std::string_view::npos) {
+                throw TogException{"invalid update request: " + line};
+            }
+
+            stats.old_main = ref_from_string(update->substr(0, separator));
+            stats.new_main = ref_from_string(update->substr(separator + 1));
+
+            if (!stats.new_main) {
+                throw TogException{"invalid update request: " + line};
+            }
+
+            // Walking the new commits resolves their commits and trees, and
+            // the blobs are checked as well, so the branch never points to an
+            // incomplete history (e.g. after a truncated push).
+            std::vector<ObjectId> exclude;
+
+            if (stats.old_main) {
+                exclude.push_back(*stats.old_main);
+            }
+
+            auto objects = reachable_objects({*stats.new_main}, exclude);
+            stats.candidates = objects.size();
+
+            for (const auto& id : objects) {
+                if (!has_object(id)) {
+                    throw TogException{"object " + id.hex() +
+                                       " was not received"};
+                }
+            }
+
+            // the sender checks this as well, but must not be trusted to
+            if (stats.old_main &&
+                !is_ancestor(*stats.old_main, *stats.new_main)) {
+                throw TogException{
+                    "the new main branch does not contain the old one"};
+            }
+
+            update_main(stats.old_main, *stats.new_main);
+
+            connection.write_line("ok");
+            connection.flush();
+            return;
+        } else {
+            throw TogException{"unexpected message from remote: " + line};
+        }
+    }
+}
+
+void Repository::serve_objects(Connection& connection) {
+    for (auto line = connection.read_line(); line != "end";
+         line = connection.read_line()) {
+        auto count = strip_prefix(line, "want ");
+
+        if (!count) {
+            throw TogException{"unexpected message from remote: " + line};
+        }
+
+        std::vector<ObjectId> ids;
+
+        for (auto n = std::stoull(std::string{*count}); n > 0; --n) {
+            auto line = connection.read_line();
+            auto id = ObjectId::from_hex(line);
+
+            if (!id) {
+                throw TogException{"invalid object id: " + line};
+            }
+
+            ids.push_back(*id);
+        }
+
+        // a partial repository can pass requests on to its own promisor
+        fetch_missing(ids);
+
+        for (const auto& id : ids) {
+            if (!send_object(connection, store_for(id), id)) {
+                connection.write_line("missing " + id.hex());
+            }
+        }
+
+        connection.write_line("done");
+    }
+}
+
+void Repository::store_object(const ObjectId& id,
+                              const std::function<void(int fd)>& copy) {
+    // write to a temporary file first, so that an interrupted transfer does
+    // not leave a truncated object behind. It is placed next to the object's
+    // file (if the store keeps one), so it can be renamed into place.
+    auto tmp_path = _store->path(id).value_or(_togdir_path / id.hex());
+    tmp_path.concat("." + std::to_string(::getpid()) + ".tmp");
+
+    {
+        auto file = create_file(tmp_path);
+        copy(file.get());
+    }
+
+    if (sha256(open_file(tmp_path).get()) != id) {
+        fs::remove(tmp_path);
+        throw TogException{"received corrupt object " + id.hex()};
+    }
+
+    _store->insert(id, tmp_path);
+}
+
+void Repository::fetch_missing(const std::vector<ObjectId>& ids) {
+    if (!_promisor) {
+        return;
+    }
+
+    std::vector<ObjectId> missing;
+
+    for (const auto& id : ids) {
+        if (!has_object(id)) {
+            missing.push_back(id);
+        }
+    }
+
+    if (missing.empty()) {
+        return;
+    }
+
+    _promisor->fetch(missing, [this](const ObjectId& id,
+                                     const Promisor::Copy& copy) {
+        store_object(id, copy);
+        ++_fetched;
+    });
+}
+
+std::error_code Repository::read_object(const ObjectId& id,
+                                        std::vector<unsigned char>& bytes) {
+    auto err = store_for(id).read(id, bytes);
+
+    if (err == std::errc::no_such_file_or_directory && _promisor) {
+        fetch_missing({id});
+        err = store_for(id).read(id, bytes);
+    }
+
+    return err;
+}
+
+void Repository::collect_blobs(Handle<Tree> handle,
+                               std::vector<ObjectId>& blobs) {
+    Pin<Tree> pin{_trees, handle};
+    const auto& tree = resolve(handle);
+
+    std::vector<Handle<Tree>> sub_trees;
+
+    for (const auto& entry : tree.entries()) {
+        if (entry.kind == Tree::Kind::blob) {
+            blobs.push_back(entry.id);
+        } else {
+            sub_trees.push_back(this->handle<Tree>(entry.id));
+        }
+    }
+
+    prefetch(sub_trees);
+
+    for (auto sub_tree : sub_trees) {
+        collect_blobs(sub_tree, blobs);
+    }
+}
+
+bool Repository::is_ancestor(const ObjectId& ancestor,
+                             const ObjectId& descendant) {
+    auto found = false;
+
+    for (std::optional<ObjectId> current = descendant; current && !found;) {
+        found = *current == ancestor;
+        current = resolve(handle<Commit>(*current)).parent();
+    }
+
+    release();
+
+    return found;
+}
+
+void Repository::update_main(const std::optional<ObjectId>& expected,
+                             const ObjectId& new_main) {
+    RefTransaction refs;
+    refs.update(std::string{main_ref}, new_main, expected);
+
+    _refs.commit(refs);
+    _main = new_main;
+}
+
+std::optional<std::time_t> Repository::load_fsck_time() {
+    std::ifstream stream{_togdir_path / "fsck"};
+    std::time_t time;
+
+    if (!(stream >> time)) {
+        return std::nullopt;
+    }
+
+    return time;
+}
+
+void Repository::persist_fsck_time(std::time_t time) {
+    std::ofstream stream{_togdir_path / "fsck", std::ofstream::trunc};
+
+    if (!stream) {
+        throw TogException{"Unable to save fsck state"};
+    }
+
+    stream << time << std::endl;
+}
+
+void Repository::release() {
+    _cache.clear();
+    _blobs.clear();
+    _trees.clear();
+    _commits.clear();
+    _arena.clear();
+}
+
+namespace {
+
+// restores a file from the given blob object
+// Restores a file from the given object file, and returns true if it
+// replaced an untracked file at its path. Checkout keeps untracked files, but
+// not where the commit has a file of its own.
+bool restore_file(const fs::path& object_path, const fs::path& path,
+                  bool hardlink) {
+    auto replaced = false;
+
+    if (hardlink) {
+        std::error_code err;
+        fs::create_hard_link(object_path, path, err);
+
+        // an untracked file in the way is replaced by the committed one
+        if (err == std::errc::file_exists) {
+            fs::remove(path);
+            replaced = true;
+            fs::create_hard_link(object_path, path, err);
+        }
+
+        // The link shares the object's inode, so it is made read-only:
+        // writing to the file fails rather than corrupting the object.
+        // Otherwise, e.g. if the worktree is on another filesystem or the
+        // object belongs to a read-only alternate, the file is copied.
+        if (!err) {
+            fs::permissions(path,
+                            fs::perms::owner_read | fs::perms::group_read |
+                                fs::perms::others_read,
+                            err);
+
+            if (!err) {
+                return replaced;
+            }
+
+            fs::remove(path);
+        } else if (err == std::errc::no_such_file_or_directory) {
+            throw TogException{"object not found"};
+        }
+    }
+
+    auto object_file = open_file(object_path);
+
+    if (!object_file) {
+        throw TogException{"object not found"};
+    }
+
+    FileDescriptor file{::open(path.c_str(),
+                               O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666)};
+
+    if (!file && errno == EEXIST) {
+        fs::remove(path);
+        replaced = true;
+    }
+
+    if (!file) {
+        file = create_file(path);
+    }
+
+    copy_file(object_file.get(), file.get());
+
+    return replaced;
+}
+
+}  // namespace
+
+void Repository::remove_tree(Handle<Tree> handle, const fs::path& path) {
+    Pin<Tree> pin{_trees, handle};
+    const auto& tree = resolve(handle);
+
+    std::vector<Handle<Tree>> sub_trees;
+
+    for (const auto& entry : tree.entries()) {
+        if (entry.kind != Tree::Kind::blob) {
+            sub_trees.push_back(this->handle<Tree>(entry.id));
+        }
+    }
+
+    prefetch(sub_trees);
+
+    for (const auto& entry : tree.entries()) {
+        auto entry_path = path / tree.name(entry);
+        std::error_code err;
+
+        // files the user already deleted are skipped
+        if (entry.kind == Tree::Kind::blob) {
+            fs::remove(entry_path, err);
+        } else if (entry.kind == Tree::Kind::tree) {
+            if (fs::is_directory(fs::symlink_status(entry_path))) {
+                remove_tree(this->handle<Tree>(entry.id), entry_path);
+
+                // directories still holding untracked files are kept
+                fs::remove(entry_path, err);
+            }
+        } else {
+            remove_tree(this->handle<Tree>(entry.id), path);
+        }
+    }
+}
+
+void Repository::restoreTree(Handle<Tree> handle, const fs::path& path,
+                             bool hardlink, ThreadPool& pool,
+                             FirstError& error,
+                             std::atomic<std::size_t>& replaced) {
+    if (error.failed()) {
+        return;
+    }
+
+    // keep the tree in memory while its entries are restored
+    Pin<Tree> pin{_trees, handle};
+    const auto& tree = resolve(handle);
+
+    // load all subtrees in one batch, rather than one at a time
+    std::vector<Handle<Tree>> sub_trees;
+
+    for (const auto& entry : tree.entries()) {
+        if (entry.kind != Tree::Kind::blob) {
+            sub_trees.push_back(this->handle<Tree>(entry.id));
+        }
+    }
+
+    prefetch(sub_trees);
+
+    // Create the directory if it doesn't exist
+    fs::create_directories(path);
+
+    // Populate the directory with files and subdirectories
+    for (const auto& entry : tree.entries()) {
+        auto entry_path = path / tree.name(entry);
+
+        if (entry.kind == Tree::Kind::blob) {
+            restoreBlob(entry.id, entry_path, hardlink, pool, error,
+                        replaced);
+        } else if (entry.kind == Tree::Kind::tree) {
+            restoreTree(this->handle<Tree>(entry.id), entry_path, hardlink,
+                        pool, error, replaced);
+        } else {
+            // shards hold a part of this directory's entries
+            restoreTree(this->handle<Tree>(entry.id), path, hardlink, pool,
+                        error, replaced);
+        }
+    }
+}
+
+void Repository::restoreBlob(const ObjectId& blob, const fs::path& path,
+                             bool hardlink, ThreadPool& pool,
+                             FirstError& error,
+                             std::atomic<std::size_t>& replaced) {
+    // blobs are stored raw (i.e. uncompressed), so an object file can be
+    // materialized directly without loading the blob into memory
+    pool.submit([&store = store_for(blob), blob, path, hardlink, &error,
+                 &replaced] {
+        if (error.failed()) {
+            return;
+        }
+
+        try {
+            if (auto object_path = store.path(blob)) {
+                replaced += restore_file(*object_path, path, hardlink);
+                return;
+            }
+
+            // an untracked file at the path is replaced, as in restore_file()
+            std::vector<unsigned char> data;
+            std::error_code err;
+            replaced += fs::remove(path, err);
+
+            if (store.read(blob, data) || write_file(path, data)) {
+                throw TogException{"unable to restore " + path.string()};
+            }
+        } catch (...) {
+            error.set(std::current_exception());
+        }
+    });
+}
+
+void Repository::scan_directory(const std::shared_ptr<FileDescriptor>& directory,
+                                std::string& path, PendingDirectory& pending,
+                                Pipeline& pipeline) {
+    DirectoryReader reader{directory->get()};
+    auto length = path.size();
+
+    _ignore.enter(directory->get(), path);
+
+    while (auto entry = reader.next()) {
+        auto is_directory = entry->type == DirectoryEntry::Type::directory;
+
+        // skip togdir
+        if (is_directory && entry->name == ".tog") {
+            continue;
+        }
+
+        // the commit is going to fail anyway
+        if (pipeline.error.failed()) {
+            break;
+        }
+
+        path.append(entry->name);
+
+        // ignored directories are skipped without descending into them
+        if (_ignore.ignored(path, entry->name, is_directory)) {
+            ++_ignored;
+        } else if (is_directory) {
+            // names returned by the reader are null-terminated
+            auto sub_directory = std::make_shared<FileDescriptor>(
+                open_directory(directory->get(), entry->name.data()));
+
+            pending.entries.push_back(
+                {_names.intern(entry->name), Tree::Kind::tree, {}});
+
+            auto& child = *pending.directories.emplace_back(
+                std::make_unique<PendingDirectory>());
+
+            path.push_back('/');
+            scan_directory(sub_directory, path, child, pipeline);
+        } else if (entry->type == DirectoryEntry::Type::file) {
+            pending.entries.push_back(
+                {_names.intern(entry->name), Tree::Kind::blob, {}});
+
+            auto& id = pending.file_ids.emplace_back();
+            pipeline.files.push(FileTask{directory, path, length, &id});
+        }
+
+        path.resize(length);
+    }
+
+    _ignore.leave();
+}
+
+void Repository::hash_files(Pipeline& pipeline) {
+    while (auto task = pipeline.files.pop()) {
+        if (pipeline.error.failed()) {
+            continue;
+        }
+
+        try {
+            *task->id = hash_file(*task, pipeline);
+        } catch (...) {
+            pipeline.error.set(std::current_exception());
+        }
+    }
+}
+
+ObjectId Repository::hash_file(const FileTask& task, Pipeline& pipeline) {
+    auto file = open_file_at(task.directory->get(),
+                             task.path.c_str() + task.name_offset);
+    struct stat st;
+
+    if (!file || ::fstat(file.get(), &st) != 0) {
+        throw TogException{"unable to read " + task.path};
+    }
+
+    auto size = static_cast<std::size_t>(st.st_size);
+
+    if (size < streaming_threshold) {
+        pipeline.memory.acquire(size);
+
+        std::vector<unsigned char> data;
+
+        if (read_file(file.get(), data)) {
+            pipeline.memory.release(size);
+            throw TogException{"unable to read " + task.path};
+        }
+
+        // blobs are stored raw, so their id is the hash of the file contents
+        auto id = sha256(data);
+
+        if (freshen_object(id)) {
+            pipeline.memory.release(size);
+        } else {
+            pipeline.writes.push(WriteTask{id, std::move(data), size});
+        }
+
+        return id;
+    }
+
+    // large files are hashed while streaming them from disk, so their
+    // contents are never buffered in memory
+    auto id = sha256(file.get());
+
+    if (freshen_object(id)) {
+        return id;
+    }
+
+    // A new file is copied kernel-side into a temporary file in the object
+    // store, and the copy is hashed again: if the file changed after the
+    // first pass, the object is stored under the id of what was copied.
+    auto tmp_path = _store->temporary_path();
+
+    try {
+        {
+            auto copy = create_file(tmp_path);
+            copy_file(file.get(), copy.get());
+        }
+
+        id = sha256(open_file(tmp_path).get());
+
+        if (freshen_object(id)) {
+            fs::remove(tmp_path);
+        } else {
+            _store->insert(id, tmp_path);
+        }
+
+        return id;
+    } catch (...) {
+        std::error_code err;
+        fs::remove(tmp_path, err);
+
+        throw;
+    }
+}
+
+void Repository::write_blobs(Pipeline& pipeline) {
+    // the same content may appear in several files
+    std::unordered_set<ObjectId, ObjectIdHash> written;
+
+    std::vector<WriteTask> batch;
+    batch.reserve(write_batch_size);
+
+    while (auto task = pipeline.writes.pop()) {
+        // submit all blobs that are ready in one batch
+        batch.push_back(std::move(*task));
+
+        while (batch.size() < write_batch_size) {
+            if (auto next = pipeline.writes.try_pop()) {
+                batch.push_back(std::move(*next));
+            } else {
+                break;
+            }
+        }
+
+        try {
+            for (const auto& write : batch) {
+                if (pipeline.error.failed() ||
+                    !written.insert(write.id).second) {
+                    continue;
+                }
+
+                _store->write(write.id, write.data,
+                              [&pipeline](std::error_code err) {
+                                  if (err) {
+                                      pipeline.error.set(std::make_exception_ptr(
+                                          TogException{
+                                              "unable to write objects"}));
+                                  }
+                              });
+            }
+
+            _store->wait();
+        } catch (...) {
+            pipeline.error.set(std::current_exception());
+        }
+
+        for (const auto& write : batch) {
+            pipeline.memory.release(write.reserved);
+        }
+
+        batch.clear();
+    }
+}
+
+Handle<Tree> Repository::finish_directory(PendingDirectory& pending) {
+    auto file_id = pending.file_ids.begin();
+    auto directory = pending.directories.begin();
+
+    for (auto& entry : pending.entries) {
+        if (entry.kind == Tree::Kind::blob) {
+            entry.id = *file_id++;
+        } else {
+            // free each subdirectory's pending state once its tree is built
+            auto sub_directory = std::move(*directory++);
+            entry.id = id(finish_directory(*sub_directory));
+        }
+    }
+
+    return build_tree(std::move(pending.entries));
+}
+
+Handle<Tree> Repository::build_tree(std::vector<Tree::Entry>&& entries,
+                                    unsigned depth) {
+    if (entries.size() <= Tree::shard_threshold ||
+        depth == Tree::max_shard_depth) {
+        return register_object(Tree{_names, std::move(entries)});
+    }
+
+    std::array<std::vector<Tree::Entry>, 16> shards;
+
+    for (const auto& entry : entries) {
+        shards[Tree::shard(_names.get(entry.name), depth)].push_back(entry);
+    }
+
+    entries.clear();
+    entries.shrink_to_fit();
+
+    std::vector<Tree::Entry> nodes;
+
+    for (unsigned shard = 0; shard < shards.size(); ++shard) {
+        if (!shards[shard].empty()) {
+            nodes.push_back(
+                {_names.intern(Tree::shard_name(shard)), Tree::Kind::shard,
+                 id(build_tree(std::move(shards[shard]), depth + 1))});
+        }
+    }
+
+    return register_object(Tree{_names, std::move(nodes)});
+}
+
+std::optional<Tree::Entry> Repository::find_entry(Handle<Tree> handle,
+                                                  std::string_view name) {
+    for (unsigned depth = 0;; ++depth) {
+        const auto& tree = resolve(handle);
+
+        if (!tree.sharded()) {
+            auto entry = tree.find(name);
+            return entry ? std::optional<Tree::Entry>{*entry} : std::nullopt;
+        }
+
+        // only descend into the shard that can hold the entry
+        auto shard = tree.find(Tree::shard_name(Tree::shard(name, depth)));
+
+        if (!shard) {
+            return std::nullopt;
+        }
+
+        handle = this->handle<Tree>(shard->id);
+    }
+}
+
+std::optional<Tree::Entry> Repository::find_path(const ObjectId& tree,
+                                                 std::string_view path) {
+    std::optional<Tree::Entry> entry;
+    auto directory = tree;
+
+    while (!path.empty()) {
+        auto slash = path.find('/');
+        auto name = path.substr(0, slash);
+
+        if (entry && entry->kind != Tree::Kind::tree) {
+            return std::nullopt;
+        } else if (entry) {
+            directory = entry->id;
+        }
+
+        entry = find_entry(handle<Tree>(directory), name);
+
+        if (!entry) {
+            return std::nullopt;
+        }
+
+        path = slash == std::string_view::npos ? std::string_view{}
+                                               : path.substr(slash + 1);
+    }
+
+    return entry;
+}
+
+bool Repository::diff_trees(const std::optional<ObjectId>& a,
+                            const std::optional<ObjectId>& b,
+                            std::string& path,
+                            std::vector<std::string>& changed) {
+    return diff_trees(a, b, path, true,
+                      [&changed](const std::string& path, const Tree::Entry*,
+                                 const Tree::Entry*) {
+                          changed.push_back(path);
+                          return changed.size() <=
+                                 CommitGraph::max_changed_paths;
+                      });
+}
+
+bool Repository::diff_trees(const std::optional<ObjectId>& a,
+                            const std::optional<ObjectId>& b,
+                            std::string& path, bool removed_contents,
+                            const DiffVisitor& visit) {
+    if (a == b) {
+        return true;
+    }
+
+    // the entries are copied, as resolved trees may be evicted while
+    // descending into subtrees
+    std::vector<Tree::Entry> entries_a;
+    std::vector<Tree::Entry> entries_b;
+
+    if (a) {
+        entries_a = resolve(handle<Tree>(*a)).entries();
+    }
+
+    if (b) {
+        entries_b = resolve(handle<Tree>(*b)).entries();
+    }
+
+    auto sharded = [](const std::vector<Tree::Entry>& entries) {
+        return entries.empty() || entries.front().kind == Tree::Kind::shard;
+    };
+
+    // Trees sharded at the same level are compared shard by shard, so equal
+    // shards are skipped. Otherwise, the entries of all shards are compared.
+    if (sharded(entries_a) && sharded(entries_b)) {
+        auto it_a = entries_a.begin();
+        auto it_b = entries_b.begin();
+
+        while (it_a != entries_a.end() || it_b != entries_b.end()) {
+            std::optional<ObjectId> shard_a;
+            std::optional<ObjectId> shard_b;
+
+            if (it_b == entries_b.end() ||
+                (it_a != entries_a.end() &&
+                 _names.get(it_a->name) < _names.get(it_b->name))) {
+                shard_a = (it_a++)->id;
+            } else if (it_a == entries_a.end() ||
+                       _names.get(it_b->name) < _names.get(it_a->name)) {
+                shard_b = (it_b++)->id;
+            } else {
+                shard_a = (it_a++)->id;
+                shard_b = (it_b++)->id;
+            }
+
+            if (!diff_trees(shard_a, shard_b, path, removed_contents,
+                            visit)) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    auto flatten = [this](std::vector<Tree::Entry>& entries) {
+        if (entries.empty() || entries.front().kind != Tree::Kind::shard) {
+            return;
+        }
+
+        std::vector<Tree::Entry> flat;
+
+        for (const auto& shard : entries) {
+            collect_entries(shard.id, flat);
+        }
+
+        std::sort(flat.begin(), flat.end(),
+                  [this](const auto& x, const auto& y) {
+                      return _names.get(x.name) < _names.get(y.name);
+                  });
+
+        entries = std::move(flat);
+    };
+
+    flatten(entries_a);
+    flatten(entries_b);
+
+    auto it_a = entries_a.begin();
+    auto it_b = entries_b.begin();
+    auto length = path.size();
+
+    while (it_a != entries_a.end() || it_b != entries_b.end()) {
+        const Tree::Entry* entry_a = nullptr;
+        const Tree::Entry* entry_b = nullptr;
+
+        if (it_b == entries_b.end() ||
+            (it_a != entries_a.end() &&
+             _names.get(it_a->name) < _names.get(it_b->name))) {
+            entry_a = &*it_a++;
+        } else if (it_a == entries_a.end() ||
+                   _names.get(it_b->name) < _names.get(it_a->name)) {
+            entry_b = &*it_b++;
+        } else {
+            entry_a = &*it_a++;
+            entry_b = &*it_b++;
+        }
+
+        if (entry_a && entry_b && entry_a->kind == entry_b->kind &&
+            entry_a->id == entry_b->id) {
+            continue;
+        }
+
+        path.append(_names.get(entry_a ? entry_a->name : entry_b->name));
+
+        if (!visit(path, entry_a, entry_b)) {
+            path.resize(length);
+            return false;
+        }
+
+        // a subdirectory that was added, removed or changed is compared
+        // entry by entry
+        auto subtree = [](const Tree::Entry* entry) {
+            return entry && entry->kind == Tree::Kind::tree
+                       ? std::optional<ObjectId>{entry->id}
+                       : std::nullopt;
+        };
+        auto tree_a = subtree(entry_a);
+        auto tree_b = subtree(entry_b);
+
+        if (tree_b || (tree_a && removed_contents)) {
+            path.push_back('/');
+
+            if (!diff_trees(tree_a, tree_b, path, removed_contents, visit)) {
+                path.resize(length);
+                return false;
+            }
+        }
+
+        path.resize(length);
+    }
+
+    return true;
+}
+
+void Repository::collect_entries(const ObjectId& tree,
+                                 std::vector<Tree::Entry>& entries) {
+    auto tree_entries = resolve(handle<Tree>(tree)).entries();
+
+    for (const auto& entry : tree_entries) {
+        if (entry.kind == Tree::Kind::shard) {
+            collect_entries(entry.id, entries);
+        } else {
+            entries.push_back(entry);
+        }
+    }
+}
+
+void Repository::archive_tree(const ObjectId& tree, std::string& path,
+                              TarWriter& tar, ThreadPool& pool,
+                              ArchiveStats& stats) {
+    // the number of files read ahead of the one being archived
+    constexpr std::size_t prefetch_window = 64;
+
+    std::vector<Tree::Entry> entries;
+    collect_entries(tree, entries);
+
+    // the entries of sharded trees are ordered by their shards
+    std::sort(entries.begin(), entries.end(),
+              [this](const Tree::Entry& a, const Tree::Entry& b) {
+                  return _names.get(a.name) < _names.get(b.name);
+              });
+
+    std::vector<ObjectId> blobs;
+
+    for (const auto& entry : entries) {
+        if (entry.kind == Tree::Kind::blob) {
+            blobs.push_back(entry.id);
+        }
+    }
+
+    // a partial repository fetches the directory's files in one batch
+    fetch_missing(blobs);
+
+    std::size_t archived = 0;
+    std::size_t prefetched = 0;
+    auto length = path.size();
+
+    for (const auto& entry : entries) {
+        path.append(_names.get(entry.name));
+
+        if (entry.kind == Tree::Kind::tree) {
+            tar.directory(path);
+
+            // the trees walked so far are not needed anymore, as their
+            // entries have been collected
+            if (++stats.directories % 1024 == 0) {
+                release();
+            }
+
+            path.push_back('/');
+            archive_tree(entry.id, path, tar, pool, stats);
+        } else {
+            for (; prefetched < std::min(blobs.size(),
+                                         archived + prefetch_window);
+                 ++prefetched) {
+                const auto& store = store_for(blobs[prefetched]);
+                pool.submit([&store, id = blobs[prefetched]] {
+                    store.prefetch(id);
+                });
+            }
+
+            ++archived;
+
+            const auto& store = store_for(entry.id);
+            auto info = store.info(entry.id);
+
+            if (!info) {
+                throw TogException{"unable to read object " + entry.id.hex()};
+            }
+
+            tar.file(path, info->size, [&](int out) {
+                if (store.send(entry.id, out)) {
+                    throw TogException{"unable to read object " +
+                                       entry.id.hex()};
+                }
+            });
+
+            ++stats.files;
+            stats.bytes += info->size;
+        }
+
+        path.resize(length);
+    }
+}
+
+std::size_t Repository::count_ignored(int directory_fd, std::string& path) {
+    std::size_t ignored = 0;
+    DirectoryReader reader{directory_fd};
+    auto length = path.size();
+
+    _ignore.enter(directory_fd, path);
+
+    while (auto entry = reader.next()) {
+        auto directory = entry->type == DirectoryEntry::Type::directory;
+
+        if (directory && entry->name == ".tog") {
+            continue;
+        }
+
+        path.append(entry->name);
+
+        if (_ignore.ignored(path, entry->name, directory)) {
+            ++ignored;
+        } else if (directory) {
+            path.push_back('/');
+            auto sub_directory =
+                open_directory(directory_fd, entry->name.data());
+
+            ignored += count_ignored(sub_directory.get(), path);
+        }
+
+        path.resize(length);
+    }
+
+    _ignore.leave();
+
+    return ignored;
+}
+
+std::size_t Repository::count_ignored() {
+    auto worktree = open_directory(AT_FDCWD, _worktree_path.c_str());
+    std::string path;
+
+    return count_ignored(worktree.get(), path);
+}
+
+ObjectStore& Repository::store_for(const ObjectId& id) const {
+    if (_alternates.empty() || _store->contains(id)) {
+        return *_store;
+    }
+
+    for (const auto& alternate : _alternates) {
+        if (alternate->contains(id)) {
+            return *alternate;
+        }
+    }
+
+    return *_store;
 }
 
-}  // namespace tog
\ No newline at end of file
+}  // namespace tog
@@ -1,14 +1,35 @@
 #ifndef TOG_REPOSITORY_H
 #define TOG_REPOSITORY_H
 
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
 #include <exception>
 #include <filesystem>
+#include <functional>
 #include <memory>
+#include <optional>
 #include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
 
+#include "arena.h"
+#include "bitmap.h"
 #include "blob.h"
 #include "commit.h"
+#include "file.h"
 #include "handle.h"
+#include "ignore.h"
+#include "io_engine.h"
+#include "object.h"
+#include "object_cache.h"
+#include "object_store.h"
+#include "object_table.h"
+#include "promisor.h"
+#include "refs.h"
+#include "string_pool.h"
 #include "tree.h"
 
 namespace tog {
@@ -24,62 +45,676 @@ private:
     const std::string message;
 };
 
+// the result of Repository::gc()
+struct GcStats {
+    // the number of objects in the object store before collecting garbage
+    std::size_t objects = 0;
+
+    // the number of unreachable objects that were removed
+    std::size_t removed = 0;
+
+    // the number of unreachable objects that were kept, because they are
+    // younger than the grace period
+    std::size_t recent = 0;
+
+    // the number of temporary files of interrupted commits that were removed
+    std::size_t temporary = 0;
+
+    // the number of bytes freed
+    std::uintmax_t reclaimed = 0;
+};
+
+// the result of Repository::fsck()
+struct FsckReport {
+    // the number of objects in the object store
+    std::size_t objects = 0;
+
+    // the number of objects whose hash was verified, and their total size
+    std::size_t verified = 0;
+    std::uintmax_t bytes = 0;
+
+    // the number of objects not reachable from any ref (only determined for
+    // full checks)
+    std::size_t unreachable = 0;
+
+    // descriptions of all problems found, e.g. corrupt or missing objects
+    std::vector<std::string> errors;
+};
+
+// the progress of verifying object hashes in Repository::fsck()
+struct FsckProgress {
+    std::size_t verified = 0;
+    std::size_t total = 0;
+    std::uintmax_t bytes = 0;
+};
+
+// the result of Repository::write_bitmaps()
+struct BitmapStats {
+    // the number of objects in the index
+    std::size_t objects = 0;
+
+    // the number of commits with a bitmap
+    std::size_t commits = 0;
+
+    // the number of objects reachable from the refs
+    std::size_t reachable = 0;
+};
+
+// the result of Repository::write_commit_graph()
+struct CommitGraphStats {
+    // the number of commits in the graph
+    std::size_t commits = 0;
+
+    // the number of changed-path filters computed by diffing trees, and
+    // reused from the previous graph
+    std::size_t computed = 0;
+    std::size_t reused = 0;
+
+    // the number of commits that changed too many paths to get a filter
+    std::size_t unfiltered = 0;
+};
+
+// the result of Repository::push() and Repository::pull()
+struct SyncStats {
+    // the number of objects reachable from the new main branch but not from
+    // the old one, i.e. that the receiving repository may be missing
+    std::size_t candidates = 0;
+
+    // the number of objects that were actually missing and transferred, and
+    // their total size
+    std::size_t transferred = 0;
+    std::uintmax_t bytes = 0;
+
+    // the receiving repository's main branch before and after the sync
+    std::optional<ObjectId> old_main;
+    std::optional<ObjectId> new_main;
+};
+
+// the result of Repository::clone()
+struct CloneStats {
+    // the number of objects in the source repository
+    std::size_t objects = 0;
+
+    // how the objects were transferred to the clone
+    std::size_t hardlinked = 0;
+    std::size_t reflinked = 0;
+    std::size_t copied = 0;
+
+    // the checked out commit (if any)
+    std::optional<ObjectId> head;
+};
+
+// the result of Repository::archive()
+struct ArchiveStats {
+    // the number of files and directories in the archive
+    std::size_t files = 0;
+    std::size_t directories = 0;
+
+    // the total size of the files
+    std::uintmax_t bytes = 0;
+};
+
+// the result of Repository::fast_import()
+struct ImportStats {
+    // the number of commits and blobs in the stream
+    std::size_t commits = 0;
+    std::size_t blobs = 0;
+
+    // the number of branches and tags that were created or updated
+    std::size_t refs = 0;
+};
+
+// the result of Repository::fast_export()
+struct ExportStats {
+    // the number of commits and (distinct) blobs in the stream
+    std::size_t commits = 0;
+    std::size_t blobs = 0;
+};
+
+class BitmapIndex;
+class CommitGraph;
+class Connection;
+class FirstError;
+class TarWriter;
+class ThreadPool;
+
 class Repository {
 public:
     Repository(const std::filesystem::path& togdir_path);
 
+    // the default limit for the file contents a commit holds in memory at
+    // once, in bytes
+    static constexpr std::size_t default_max_memory = 256 * 1024 * 1024;
+
     // commits the current worktree contents with the given commit message and
-    // returns the commit object's hash
-    std::string commit(const std::string& message);
+    // returns the commit object's hash. At most max_memory bytes of file
+    // contents are held in memory at once (except for single files that are
+    // larger than that).
+    std::string commit(const std::string& message,
+                       std::size_t max_memory = default_max_memory);
 
-    // restores the worktree to the state captured by the given commit
-    void checkout(const std::string& hash);
+    // restores the worktree to the state captured by the given commit (see
+    // resolve_name()). Untracked files are kept, unless the commit has a file
+    // at their path (see replaced_files()). If hardlink is set, files are hard-linked to the object
+    // store instead of being copied, and made read-only, as writing to such a
+    // file would corrupt the object. This is meant for worktrees that are
+    // never modified (such as CI checkouts).
+    void checkout(const std::string& hash, bool hardlink = false);
 
     // returns the current branch's last n commit hashes in
-    // reverse-chronological order (newest first).
-    std::vector<std::string> history(int n);
+    // reverse-chronological order (newest first). If path is not empty, only
+    // commits that changed the file or directory at that path (relative to
+    // the worktree) are included.
+    std::vector<std::string> history(int n, std::string_view path = {});
 
-    // Initialized a new repository in the given directory.
-    static void init(const std::filesystem::path& path);
+    // Writes the file at the given path in the given commit (see
+    // resolve_name()) to fd, without checking the commit out: only the trees
+    // along the path are loaded, and the file is sent kernel-side from the
+    // object store. For a directory, the names of its entries are written
+    // instead, one per line (with a trailing slash for subdirectories).
+    void show(std::string_view commit, std::string_view path, int fd);
+
+    // Writes a tar archive of the given commit's tree (see resolve_name()) to
+    // fd, without checking it out. Trees are walked one directory at a time,
+    // and files are sent kernel-side from the object store while the next
+    // ones are read ahead in the background.
+    ArchiveStats archive(std::string_view commit, int fd);
+
+    // Reads a stream of blobs, commits, resets and tags in the fast-import
+    // format (see README) and adds them to the repository, without touching
+    // the worktree or head. Trees are built in memory from the changes each
+    // commit lists, and only the directories it modified are written again.
+    // The branches and tags are updated at checkpoints and at the end of the
+    // stream. progress is called with the text of progress commands.
+    ImportStats fast_import(
+        Connection& input,
+        const std::function<void(std::string_view text)>& progress);
+
+    // Writes the commits of the given range to fd as a fast-import stream,
+    // oldest first. The range is a commit (for its whole history) or
+    // <from>..<to> (for the commits after from up to to, where either side
+    // defaults to the main branch). Each commit lists only the paths that
+    // changed since its parent, found by comparing their trees, and each
+    // blob is written once, before the first commit that refers to it. The
+    // first commit of a range names its parent by its tog id, which only a
+    // tog repository that has that commit can resolve.
+    ExportStats fast_export(std::string_view range, int fd);
+
+    // removes all objects that are not reachable from any ref, unless they
+    // were modified within the given grace period (as they may belong to a
+    // commit that is still in progress)
+    GcStats gc(std::chrono::seconds grace);
+
+    // verifies the hashes of all objects on all cores, and checks that all
+    // objects reachable from the refs exist and are well-formed. In
+    // incremental mode, only objects added since the last check that found
+    // no errors are verified. progress is called periodically while hashes
+    // are verified.
+    FsckReport fsck(bool incremental,
+                    const std::function<void(const FsckProgress&)>& progress);
+
+    // writes a new reachability bitmap index (see BitmapIndex), with bitmaps
+    // for the targets of all refs and every bitmap_interval-th commit of
+    // their histories
+    BitmapStats write_bitmaps();
+
+    // writes a new commit graph (see CommitGraph) of all commits reachable
+    // from the refs
+    CommitGraphStats write_commit_graph();
+
+    // returns all objects reachable from the given commits, but not from the
+    // commits in exclude. If there is a bitmap index, only the commits created
+    // since it was written need to be walked.
+    std::vector<ObjectId> reachable_objects(
+        const std::vector<ObjectId>& from,
+        const std::vector<ObjectId>& exclude = {});
+
+    // sends the commits of the main branch that the repository on the other
+    // end of the connection (see serve()) is missing, and fast-forwards its
+    // main branch. Fails if the remote main branch has commits that are not
+    // in the local one.
+    SyncStats push(Connection& connection);
+
+    // fetches the commits of the remote main branch that are missing locally,
+    // and fast-forwards the local main branch. If the worktree was at the
+    // latest commit, the new latest commit is checked out.
+    SyncStats pull(Connection& connection);
+
+    // handles a push or pull from the repository on the other end of the
+    // connection
+    void serve(Connection& connection);
+
+    // creates a copy of the repository at source in the (empty or
+    // non-existent) directory destination, and checks out the latest commit
+    // of its main branch. Objects are immutable, so they are hard-linked to
+    // the source's object store where possible, and reflinked or copied
+    // otherwise (e.g. across filesystems). hardlink is passed to checkout().
+    // A partial clone only gets the commits and trees, and fetches files from
+    // the source's object store when they are needed (see Promisor).
+    static CloneStats clone(const std::filesystem::path& source,
+                            const std::filesystem::path& destination,
+                            bool hardlink = false, bool partial = false);
+
+    // Initialized a new repository in the given directory, whose objects are
+    // kept in the given ObjectStore backend ("loose" or "kv").
+    static void init(const std::filesystem::path& path,
+                     std::string_view object_store = "loose");
 
     std::optional<std::string> head() const {
-        return _head ? std::optional<std::string>{_head->hash()} : std::nullopt;
+        return _head ? std::optional<std::string>{_head->hex()} : std::nullopt;
     }
 
     std::optional<std::string> main() const {
-        return _main ? std::optional<std::string>{_main->hash()} : std::nullopt;
+        return _main ? std::optional<std::string>{_main->hex()} : std::nullopt;
+    }
+
+    // the minimum number of hex digits of an abbreviated object id
+    static constexpr std::size_t min_prefix_length = 4;
+
+    // Returns the object with the given name: head, a branch, a tag, or an
+    // object id, which may be abbreviated to a unique prefix. Returns
+    // std::nullopt if there is no such object, and throws a TogException if
+    // an abbreviated id matches several objects.
+    std::optional<ObjectId> resolve_name(std::string_view name);
+
+    // returns the branches or tags (without their prefix) and the commits they
+    // point to, sorted by name
+    std::vector<std::pair<std::string, std::string>> refs(RefKind kind) const;
+
+    // points the given branch or tag to the given commit (see
+    // resolve_name()), or to the checked-out commit if commit is empty. Fails
+    // if the ref exists already, unless force is set. Returns false if an
+    // existing ref was moved rather than a new one created.
+    bool create_ref(RefKind kind, const std::string& name,
+                    const std::optional<std::string>& commit, bool force);
+
+    // deletes the given branch or tag. The main branch cannot be deleted.
+    void delete_ref(RefKind kind, const std::string& name);
+
+    // moves all branches and tags into .tog/packed-refs, so that they are
+    // stored in a single file, and returns their number
+    std::size_t pack_refs();
+
+    // returns the number of worktree entries skipped by the last commit
+    // because they match a .togignore pattern. Ignored directories count as a
+    // single entry.
+    std::size_t ignored_entries() const {
+        return _ignored;
+    }
+
+    // scans the worktree and returns the number of entries that would be
+    // skipped by a commit
+    std::size_t count_ignored();
+
+    // returns the number of objects fetched from the promisor of a partial
+    // repository
+    std::size_t fetched_objects() const {
+        return _fetched;
+    }
+
+    // returns the number of untracked files that the last checkout replaced
+    // with the committed files at their paths
+    std::size_t replaced_files() const {
+        return _replaced;
+    }
+
+    // returns statistics about the in-memory object cache
+    const CacheStats& cache_stats() const {
+        return _cache.stats();
     }
 
 private:
-    // add_<object> loads an object from the given path, creates an object
-    // from it and adds it to the repository.
-    // TODO: Unify these methods once I have better understanding of templates
-    Handle<Blob>& add_file(const std::filesystem::path& file_path);
-    Handle<Tree>& add_directory(const std::filesystem::path& directory_path);
+    // the default memory budget of the object cache, in bytes. It can be
+    // changed with the cache_size setting in .tog/config.toml.
+    static constexpr std::size_t default_cache_size = 256 * 1024 * 1024;
+
+    // the state of the commit pipeline, see commit()
+    struct FileTask;
+    struct WriteTask;
+    struct PendingDirectory;
+    struct Pipeline;
+
+    // the state of fast_import()
+    struct ImportDirectory;
+    struct Import;
+
+    // the number of imported commits after which all objects are written and
+    // released
+    static constexpr std::size_t import_batch_size = 1024;
+
+    // the amount of fast-export output that is buffered before writing it
+    static constexpr std::size_t export_buffer_size = 64 * 1024;
+
+    // the maximum number of blobs written in one batch of I/O requests
+    static constexpr std::size_t write_batch_size = 64;
+
+    // scans the given directory, queueing its files for hashing. Files and
+    // directories are opened relative to their parent directory's file
+    // descriptor, so no paths need to be built. path is the directory's path
+    // relative to the worktree (empty or ending in a /), which is used to
+    // match .togignore patterns.
+    void scan_directory(const std::shared_ptr<FileDescriptor>& directory,
+                        std::string& path, PendingDirectory& pending,
+                        Pipeline& pipeline);
+
+    // pipeline stages run by worker threads: hash_files() reads and hashes
+    // queued files, write_blobs() writes new blobs to disk
+    void hash_files(Pipeline& pipeline);
+    void write_blobs(Pipeline& pipeline);
+
+    // returns the blob id of the given file, queueing the blob for writing if
+    // it is new
+    ObjectId hash_file(const FileTask& task, Pipeline& pipeline);
+
+    // creates the tree of a scanned directory (and its subdirectories) once
+    // all of its files have been hashed
+    Handle<Tree> finish_directory(PendingDirectory& pending);
+
+    // fast-import commands, which read the rest of the command (after the
+    // given first line) from the input
+    void import_blob(Import& import);
+    void import_commit(Import& import, std::string_view ref);
+    void import_reset(Import& import, std::string_view ref);
+    void import_tag(Import& import, std::string_view name);
+
+    // reads the line following a command, and returns the rest of it after
+    // the given keyword (or std::nullopt, putting the line back)
+    std::optional<std::string> import_field(Import& import,
+                                            std::string_view keyword);
+
+    // reads the contents announced by the given "data <size>" line into a
+    // blob, spooling large contents to a temporary file
+    ObjectId import_data(Import& import, std::string_view line);
+
+    // resolves the commit given in a from command: a mark, a ref updated by
+    // the stream, or any name accepted by resolve_name()
+    ObjectId import_commitish(Import& import, std::string_view name);
+
+    // applies an M or D command of the current commit to the in-memory tree
+    void import_change(Import& import, std::string_view change);
+
+    // loads the entries of a directory of the in-memory tree, if needed
+    void load_import_directory(ImportDirectory& directory);
+
+    // writes the modified directories of the in-memory tree, and returns the
+    // directory's tree (or std::nullopt if it is empty)
+    std::optional<ObjectId> write_import_directory(ImportDirectory& directory);
+
+    // writes all new objects and points the refs to their imported commits
+    void finish_import(Import& import);
+
+    // writes all new (dirty) objects in one batch
+    void persist_new_objects();
+
+    // creates the tree for a directory with the given entries, splitting it
+    // into shards if it has too many entries. depth is the trie level of the
+    // tree, i.e. the number of hash digits already used for sharding.
+    Handle<Tree> build_tree(std::vector<Tree::Entry>&& entries,
+                            unsigned depth = 0);
+
+    // returns the entry with the given name in the given tree. For sharded
+    // trees, only the shards on the path to the entry are loaded.
+    std::optional<Tree::Entry> find_entry(Handle<Tree> tree,
+                                          std::string_view name);
+
+    // returns the entry at the given path (relative to the given tree), e.g.
+    // "src/main.cpp"
+    std::optional<Tree::Entry> find_path(const ObjectId& tree,
+                                         std::string_view path);
+
+    // called by diff_trees() with the path of an entry that differs between
+    // the trees, and the entry in either tree (nullptr if it is missing).
+    // Returns false to stop the diff.
+    using DiffVisitor = std::function<bool(
+        const std::string& path, const Tree::Entry* a, const Tree::Entry* b)>;
+
+    // Calls visit for all entries (including subdirectories) that differ
+    // between the trees a and b, prefixed with path, parents before their
+    // contents. A missing tree is treated as empty. Subtrees and shards with
+    // equal ids are skipped without loading them, and the contents of
+    // removed subdirectories are only visited if removed_contents is set.
+    // Returns false if visit stopped the diff.
+    bool diff_trees(const std::optional<ObjectId>& a,
+                    const std::optional<ObjectId>& b, std::string& path,
+                    bool removed_contents, const DiffVisitor& visit);
+
+    // Appends the paths of all entries that differ between the trees a and b
+    // to changed (see above). Returns false (and stops) once changed holds
+    // more than CommitGraph::max_changed_paths paths.
+    bool diff_trees(const std::optional<ObjectId>& a,
+                    const std::optional<ObjectId>& b, std::string& path,
+                    std::vector<std::string>& changed);
+
+    // appends all entries of the given tree to entries, descending into its
+    // shards
+    void collect_entries(const ObjectId& tree,
+                         std::vector<Tree::Entry>& entries);
+
+    // adds the entries of the given tree to the archive, prefixed with path,
+    // reading the files ahead on the given pool
+    void archive_tree(const ObjectId& tree, std::string& path, TarWriter& tar,
+                      ThreadPool& pool, ArchiveStats& stats);
+
+    // returns true if the given commit changed the entry at the given path,
+    // compared to its parent
+    bool changes_path(const ObjectId& commit,
+                      const std::optional<ObjectId>& parent,
+                      std::string_view path);
+
+    // counts the ignored entries in the given directory, without descending
+    // into ignored directories
+    std::size_t count_ignored(int directory_fd, std::string& path);
+
+    // files of at least this size are streamed into the object store rather
+    // than being loaded into memory
+    static constexpr std::uintmax_t streaming_threshold = 4 * 1024 * 1024;
 
     // register_object will move the given object into the repository's object
-    // store and return a (resolved) handle to it. Note that this handle may not
-    // refer to the same (as in "identical") object as the one passed in.
-    // TODO: Unify these methods once I have better understanding of templates
-    Handle<Blob>& register_object(std::unique_ptr<Blob> blob);
-    Handle<Tree>& register_object(std::unique_ptr<Tree> tree);
-    Handle<Commit>& register_object(std::unique_ptr<Commit> commit);
-
-    // Resolves the given handle. If the hash is not found in the repository,
-    // an exception is thrown. Note that the returned handle may not be the
-    // same as the one passed in.
-    void resolve(Handle<Blob>& blob);
-    void resolve(Handle<Tree>& tree);
-    void resolve(Handle<Commit>& commit);
-
-    // recursively restores the contents of the given tree at the given path.
-    void restoreTree(Handle<Tree>& tree, const std::filesystem::path& path);
-    void restoreBlob(Handle<Blob>& blob, const std::filesystem::path& path);
-
-    // load/store refs from .tog/refs
-    std::optional<Handle<Commit>> load_ref(const std::filesystem::path& path);
-    void persist_ref(const std::filesystem::path& path,
-                     const std::optional<Handle<Commit>>& commit);
+    // table and return a (resolved) handle to it. If the table already holds
+    // an object with the same hash, the given object is discarded.
+    template <class T>
+    Handle<T> register_object(T object);
+
+    // Resolves the given handle, i.e. loads the object from disk if it is not
+    // in memory yet. If the object is not found in the repository, an
+    // exception is thrown. The returned reference stays valid until the
+    // repository's objects are released.
+    template <class T>
+    T& resolve(Handle<T> handle);
+
+    // writes the object of the given (dirty) entry to disk
+    template <class T>
+    void persist(typename ObjectTable<T>::Entry& entry);
+
+    // evicts the object referenced by the given handle from memory, if it is
+    // not pinned. Called by the object cache when it exceeds its budget.
+    template <class T>
+    bool evict(Handle<T> handle);
+    bool evict(ObjectKind kind, std::uint32_t index);
+
+    // deserializes the object with the given id from its serialization
+    template <class T>
+    T parse(std::vector<unsigned char>&& bytes, const ObjectId& id);
+
+    // parses an object that has been read from disk and adds it to the
+    // object table
+    template <class T>
+    T& add_loaded(Handle<T> handle, std::vector<unsigned char>&& bytes);
+
+    // loads the given objects from disk in a single batch of I/O requests, so
+    // that subsequent resolutions are served from memory
+    template <class T>
+    void prefetch(const std::vector<Handle<T>>& handles);
+
+    // returns a handle to the object with the given id. The object is not
+    // resolved, and is not checked for existence.
+    template <class T>
+    Handle<T> handle(const ObjectId& id) {
+        return objects<T>().insert(id);
+    }
+
+    // returns the id of the object referenced by the given handle
+    template <class T>
+    const ObjectId& id(Handle<T> handle) {
+        return objects<T>()[handle].id;
+    }
+
+    // returns the table holding all objects of type T
+    template <class T>
+    ObjectTable<T>& objects() {
+        if constexpr (std::is_same_v<T, Blob>) {
+            return _blobs;
+        } else if constexpr (std::is_same_v<T, Tree>) {
+            return _trees;
+        } else {
+            return _commits;
+        }
+    }
+
+    // frees all objects at once at the end of an operation. This invalidates
+    // all handles.
+    void release();
+
+    // removes the files of the given tree from the given path, along with
+    // the directories that become empty. Untracked files are kept.
+    void remove_tree(Handle<Tree> tree, const std::filesystem::path& path);
+
+    // recursively restores the contents of the given tree at the given path,
+    // hard-linking files if hardlink is set (see checkout()). Files are
+    // restored by tasks on the given pool, which record the first failure in
+    // error, and count the untracked files they replace in replaced.
+    void restoreTree(Handle<Tree> tree, const std::filesystem::path& path,
+                     bool hardlink, ThreadPool& pool, FirstError& error,
+                     std::atomic<std::size_t>& replaced);
+    void restoreBlob(const ObjectId& blob, const std::filesystem::path& path,
+                     bool hardlink, ThreadPool& pool, FirstError& error,
+                     std::atomic<std::size_t>& replaced);
+
+    // returns the store holding the object with the given id: the
+    // repository's own store or, if the object is missing there, one of the
+    // alternate object directories. Returns the repository's own store for
+    // missing objects.
+    ObjectStore& store_for(const ObjectId& id) const;
+
+    // returns true if the object is present locally or in an alternate
+    // object directory
+    bool has_object(const ObjectId& id) const {
+        return store_for(id).contains(id);
+    }
+
+    // like has_object(), but for an object that a commit reuses: resets the
+    // time it was written, so that a concurrent gc keeps it (see
+    // ObjectStore::freshen()). Alternate object directories are not
+    // collected by this repository's gc, so their objects are left alone.
+    bool freshen_object(const ObjectId& id) {
+        return _store->freshen(id) || has_object(id);
+    }
+
+    // fetches the given objects from the promisor in one batch, unless they
+    // are present already. Does nothing if there is no promisor.
+    void fetch_missing(const std::vector<ObjectId>& ids);
+
+    // reads the given object, fetching it from the promisor if it is missing
+    std::error_code read_object(const ObjectId& id,
+                                std::vector<unsigned char>& bytes);
+
+    // returns all commits and trees reachable from the given commits, sorted
+    std::vector<ObjectId> commits_and_trees(
+        const std::vector<ObjectId>& commits);
+
+    // appends the ids of all blobs in the given tree and its subtrees
+    void collect_blobs(Handle<Tree> tree, std::vector<ObjectId>& blobs);
+
+    // returns the commits that head and all branches and tags point to
+    std::vector<ObjectId> ref_targets();
+
+    // the number of objects checked by a single task in gc and fsck
+    static constexpr std::size_t batch_size = 4096;
+
+    // Marks all objects reachable from the refs in the given bitmap, which is
+    // indexed by position in objects (a sorted list of all objects). Commits
+    // and trees are read and parsed concurrently on the given pool. Only
+    // objects for which expand() returns true are read; the others (and
+    // anything only reachable through them) are assumed to be intact. Missing
+    // and corrupt objects are reported to problem(), which is called
+    // concurrently and may throw to abort the walk.
+    void mark_reachable(
+        const std::vector<ObjectId>& objects, AtomicBitmap& marks,
+        ThreadPool& pool, const std::function<bool(std::size_t index)>& expand,
+        const std::function<void(const std::string& message)>& problem);
+
+    // the interval (in commits) of bitmaps in the bitmap index
+    static constexpr std::size_t bitmap_interval = 100;
+
+    std::filesystem::path bitmaps_path() const {
+        return _togdir_path / "bitmaps";
+    }
+
+    std::filesystem::path commit_graph_path() const {
+        return _togdir_path / "commit-graph";
+    }
+
+    // the objects reachable from a set of commits
+    struct Reachable {
+        // the positions of all objects in the bitmap index
+        EwahBitmap indexed;
+
+        // objects that are not in the bitmap index, sorted
+        std::vector<ObjectId> unindexed;
+    };
+
+    // computes the objects reachable from the given commits, starting from
+    // the bitmaps of the given index wherever possible
+    Reachable reachable(const BitmapIndex& index,
+                        const std::vector<ObjectId>& commits);
+
+    std::vector<ObjectId> reachable_objects(
+        const BitmapIndex& index, const std::vector<ObjectId>& from,
+        const std::vector<ObjectId>& exclude);
+
+    // converts the bitmap of the given commit in one index to the positions
+    // of another index. Returns std::nullopt if the commit has no bitmap in
+    // the first index, or it references objects missing from the second.
+    std::optional<EwahBitmap> translate_bitmap(const BitmapIndex& from,
+                                               const BitmapIndex& to,
+                                               const ObjectId& commit);
+
+    // the number of object ids checked for existence in one round trip of the
+    // sync protocol
+    static constexpr std::size_t sync_batch_size = 1024;
+
+    // Sends the objects reachable from new_main but not from old_main (the
+    // receiver's main branch) that the receiver is missing, then asks it to
+    // fast-forward its main branch. The objects are checked in batches, each
+    // followed by the contents of the missing ones.
+    void send_objects(Connection& connection,
+                      const std::optional<ObjectId>& old_main,
+                      const ObjectId& new_main, SyncStats& stats);
+
+    // the receiving side of send_objects()
+    void receive_objects(Connection& connection, SyncStats& stats);
+
+    // answers fetch requests of a promisor (see Promisor::command())
+    void serve_objects(Connection& connection);
+
+    // writes an object received from a remote repository or promisor to the
+    // object store, after verifying its hash. copy writes the object's
+    // contents to the given file descriptor.
+    void store_object(const ObjectId& id,
+                      const std::function<void(int fd)>& copy);
+
+    // returns true if ancestor is descendant or one of its ancestors
+    bool is_ancestor(const ObjectId& ancestor, const ObjectId& descendant);
+
+    // atomically points the main branch to new_main, if it still points to
+    // expected. Concurrent updates are serialized through a lock file (see
+    // RefStore).
+    void update_main(const std::optional<ObjectId>& expected,
+                     const ObjectId& new_main);
+
+    // load/store the start time of the last fsck that found no errors
+    std::optional<std::time_t> load_fsck_time();
+    void persist_fsck_time(std::time_t time);
 
     // togdir_path is the path to the .tog, _worktree_path is the path to the
     // directory tracked by this repository. Currently, the worktree is always
@@ -87,18 +722,62 @@ private:
     std::filesystem::path _togdir_path;
     std::filesystem::path _worktree_path;
 
-    // lazily stores handles to objects in the repository
-    // TODO: Unify to single object store once I have better understanding of
-    // templates
-    std::unordered_map<std::string, Handle<Blob>> _blobs;
-    std::unordered_map<std::string, Handle<Tree>> _trees;
-    std::unordered_map<std::string, Handle<Commit>> _commits;
+    // stores head, the branches and the tags
+    RefStore _refs;
+
+    // the backing store of a partial repository (see the promisor setting in
+    // .tog/config.toml), if any
+    std::unique_ptr<Promisor> _promisor;
+
+    // the number of objects fetched from the promisor
+    std::size_t _fetched = 0;
+
+    // interns the entry names of all trees
+    StringPool _names;
+
+    // backs all objects loaded or created during an operation (such as a
+    // commit or checkout), so they can be freed in bulk afterwards
+    Arena _arena;
+
+    // lazily stores objects in the repository
+    ObjectTable<Blob> _blobs{_arena};
+    ObjectTable<Tree> _trees{_arena};
+    ObjectTable<Commit> _commits{_arena};
+
+    // tracks the memory used by the objects above, and evicts objects once
+    // it exceeds its budget
+    ObjectCache _cache{default_cache_size,
+                       [this](ObjectKind kind, std::uint32_t index) {
+                           return evict(kind, index);
+                       }};
+
+    // executes batches of object reads and writes
+    std::unique_ptr<IoEngine> _io;
+
+    // stores the repository's objects (see the object_store setting in
+    // .tog/config.toml)
+    std::unique_ptr<ObjectStore> _store;
+
+    // read-only object directories shared with other repositories, which are
+    // consulted for objects missing from _store (see the alternates setting
+    // in .tog/config.toml)
+    std::vector<std::unique_ptr<ObjectStore>> _alternates;
+
+    // evaluates .togignore files while scanning the worktree
+    IgnoreMatcher _ignore;
+
+    // the number of entries skipped by the last commit
+    std::size_t _ignored = 0;
+
+    // the number of untracked files replaced by the last checkout
+    std::size_t _replaced = 0;
 
     // stores the currently checked-out commit (if any)
-    std::optional<Handle<Commit>> _head;
+    std::optional<ObjectId> _head;
 
-    // stores the latest commit on the main branch (currently the only branch)
-    std::optional<Handle<Commit>> _main;
+    // stores the latest commit on the main branch, the branch that commits
+    // advance
+    std::optional<ObjectId> _main;
 };
 
 }  // namespace tog
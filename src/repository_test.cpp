@@ -0,0 +1,408 @@
+#include "repository.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <functional>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "connection.h"
+#include "file.h"
+#include "test.h"
+#include "tree.h"
+
+namespace fs = std::filesystem;
+
+using namespace tog;
+
+namespace {
+
+// a repository in a temporary directory. Each operation opens it anew, like
+// the command line interface does, so that no state is carried over in
+// memory.
+class TestRepository {
+public:
+    TestRepository() {
+        Repository::init(_dir.path());
+    }
+
+    const fs::path& worktree() const {
+        return _dir.path();
+    }
+
+    Repository open() const {
+        return Repository{_dir.path() / ".tog"};
+    }
+
+    std::string commit(const std::string& message) {
+        return open().commit(message);
+    }
+
+    // returns the fast-export stream of the given range
+    std::string fast_export(const std::string& range) const {
+        auto path = _dir.path() / ".tog" / "export";
+
+        {
+            auto file = create_file(path);
+            open().fast_export(range, file.get());
+        }
+
+        std::vector<unsigned char> data;
+        read_file(path, data);
+        fs::remove(path);
+
+        return {data.begin(), data.end()};
+    }
+
+    // imports the given fast-import stream
+    void fast_import(const std::string& stream) const {
+        auto path = _dir.path() / ".tog" / "import";
+        write_file(path, {reinterpret_cast<const unsigned char*>(stream.data()),
+                          stream.size()});
+
+        {
+            auto file = open_file(path);
+            Connection input{file.get(), file.get()};
+            open().fast_import(input, [](std::string_view) {});
+        }
+
+        fs::remove(path);
+    }
+
+    // serves the given sync session (the peer's side of it), and returns
+    // whether it succeeded
+    bool serve(const std::string& session) const {
+        auto input = _dir.path() / ".tog" / "session";
+        auto output = _dir.path() / ".tog" / "response";
+        write_file(input, {reinterpret_cast<const unsigned char*>(
+                               session.data()),
+                           session.size()});
+
+        auto in = open_file(input);
+        auto out = create_file(output);
+        Connection connection{in.get(), out.get()};
+
+        try {
+            open().serve(connection);
+        } catch (const TogException&) {
+            return false;
+        }
+
+        return true;
+    }
+
+    // returns the contents of all objects for which keep returns true, as
+    // sent by a push
+    std::string objects(
+        const std::function<bool(const std::string&)>& keep) const {
+        std::string objects;
+
+        for (const auto& entry :
+             fs::directory_iterator{_dir.path() / ".tog" / "objects"}) {
+            auto name = entry.path().filename().string();
+            std::vector<unsigned char> data;
+
+            if (name.size() != 64 || read_file(entry.path(), data)) {
+                continue;
+            }
+
+            std::string contents{data.begin(), data.end()};
+
+            if (keep(contents)) {
+                objects += "object " + name + " " +
+                           std::to_string(contents.size()) + "\n" + contents;
+            }
+        }
+
+        return objects;
+    }
+
+private:
+    test::TemporaryDirectory _dir;
+};
+
+void write(const fs::path& path, std::string_view contents) {
+    auto file = create_file(path);
+    write_all(file.get(), contents.data(), contents.size());
+}
+
+// returns the contents of the file at the given path in the given commit, or
+// std::nullopt if there is none
+std::optional<std::string> show(Repository& repository, const fs::path& output,
+                                const std::string& commit,
+                                const std::string& path) {
+    {
+        auto file = create_file(output);
+
+        try {
+            repository.show(commit, path, file.get());
+        } catch (const TogException&) {
+            return std::nullopt;
+        }
+    }
+
+    std::vector<unsigned char> data;
+    read_file(output, data);
+
+    return std::string{data.begin(), data.end()};
+}
+
+// returns n file names that fall into the given shard of a sharded tree
+std::vector<std::string> names_in_shard(unsigned shard, std::size_t n) {
+    std::vector<std::string> names;
+
+    for (std::size_t i = 0; names.size() < n; ++i) {
+        auto name = "file" + std::to_string(i);
+
+        if (Tree::shard(name, 0) == shard) {
+            names.push_back(std::move(name));
+        }
+    }
+
+    return names;
+}
+
+// returns the M and D lines of a fast-export stream
+std::vector<std::string> changes(const std::string& stream) {
+    std::vector<std::string> lines;
+    std::istringstream input{stream};
+
+    for (std::string line; std::getline(input, line);) {
+        if (line.starts_with("M ")) {
+            // drop the mode and the blob's mark
+            lines.push_back("M " + line.substr(line.rfind(' ') + 1));
+        } else if (line.starts_with("D ")) {
+            lines.push_back(line);
+        }
+    }
+
+    return lines;
+}
+
+// Shards are paired by their name, not by the order in which the names were
+// first seen: when the second tree has a shard the first one lacks, only the
+// entries that actually changed are reported.
+void test_sharded_diff() {
+    TestRepository repo;
+    fs::create_directory(repo.worktree() / "big");
+
+    for (const auto& name : names_in_shard(15, Tree::shard_threshold + 1)) {
+        write(repo.worktree() / "big" / name, name);
+    }
+
+    auto first = repo.commit("first");
+
+    auto added = names_in_shard(0, 1).front();
+    write(repo.worktree() / "big" / added, added);
+    auto second = repo.commit("second");
+
+    fs::remove(repo.worktree() / "big" / added);
+    auto third = repo.commit("third");
+
+    TOG_CHECK(changes(repo.fast_export(first + ".." + second)) ==
+              std::vector<std::string>{"M big/" + added});
+    TOG_CHECK(changes(repo.fast_export(second + ".." + third)) ==
+              std::vector<std::string>{"D big/" + added});
+}
+
+// A directory that grows past the shard threshold is split into shards, and
+// one that shrinks below it is flat again. Either way, every entry is found
+// by its path, and only the entries that changed are reported.
+void test_shard_threshold() {
+    TestRepository repo;
+    auto big = repo.worktree() / "big";
+    fs::create_directory(big);
+
+    std::vector<std::string> names;
+
+    for (std::size_t i = 0; i <= Tree::shard_threshold; ++i) {
+        names.push_back("file" + std::to_string(i));
+    }
+
+    for (std::size_t i = 0; i < Tree::shard_threshold; ++i) {
+        write(big / names[i], names[i]);
+    }
+
+    auto flat = repo.commit("flat");
+
+    write(big / names.back(), names.back());
+    fs::create_directory(big / "dir");
+    write(big / "dir" / "inner", "inner");
+    auto sharded = repo.commit("sharded");
+
+    fs::remove(big / names[0]);
+    fs::remove(big / names[1]);
+    fs::remove_all(big / "dir");
+    auto shrunk = repo.commit("shrunk");
+
+    auto repository = repo.open();
+    auto output = repo.worktree() / ".tog" / "show";
+
+    // the removed and added names, and a sample of the others (looking up
+    // every name would take long, as each lookup starts from the commit)
+    std::vector<std::size_t> sample{0, 1, names.size() - 1};
+
+    for (std::size_t i = 2; i < names.size(); i += 97) {
+        sample.push_back(i);
+    }
+
+    for (auto i : sample) {
+        auto path = "big/" + names[i];
+        auto contents = std::optional<std::string>{names[i]};
+
+        TOG_CHECK(show(repository, output, flat, path) ==
+                  (i < Tree::shard_threshold ? contents : std::nullopt));
+        TOG_CHECK(show(repository, output, sharded, path) == contents);
+        TOG_CHECK(show(repository, output, shrunk, path) ==
+                  (i > 1 ? contents : std::nullopt));
+    }
+
+    TOG_CHECK(show(repository, output, sharded, "big/dir/inner") == "inner");
+    TOG_CHECK(!show(repository, output, shrunk, "big/dir/inner"));
+    TOG_CHECK(!show(repository, output, sharded, "big/missing"));
+    TOG_CHECK(!show(repository, output, sharded, "big/file1/inner"));
+
+    // a directory lists one entry per line
+    auto listing = show(repository, output, sharded, "big");
+    TOG_CHECK(listing && std::count(listing->begin(), listing->end(), '\n') ==
+                             static_cast<long>(names.size() + 1));
+
+    TOG_CHECK(repository.history(10, "big/" + names.back()) ==
+              std::vector<std::string>{sharded});
+    TOG_CHECK(repository.history(10, "big/" + names[0]) ==
+              (std::vector<std::string>{shrunk, flat}));
+    TOG_CHECK(repository.history(10, "big/" + names[2]) ==
+              std::vector<std::string>{flat});
+
+    TOG_CHECK(changes(repo.fast_export(flat + ".." + sharded)) ==
+              (std::vector<std::string>{"M big/dir/inner",
+                                        "M big/" + names.back()}));
+    TOG_CHECK(changes(repo.fast_export(sharded + ".." + shrunk)) ==
+              (std::vector<std::string>{"D big/dir", "D big/" + names[0],
+                                        "D big/" + names[1]}));
+}
+
+// exporting a history and importing it into an empty repository recreates the
+// same commits, including a directory whose shards change
+void test_export_round_trip() {
+    TestRepository repo;
+    fs::create_directory(repo.worktree() / "src");
+
+    write(repo.worktree() / "README", "tog");
+    write(repo.worktree() / "src" / "main.cpp", "int main() {}");
+    repo.commit("small");
+
+    // (empty directories are not exported)
+    fs::create_directory(repo.worktree() / "src" / "big");
+
+    auto names = names_in_shard(15, Tree::shard_threshold + 1);
+
+    for (const auto& name : names) {
+        write(repo.worktree() / "src" / "big" / name, name);
+    }
+
+    repo.commit("sharded");
+
+    auto added = names_in_shard(0, 1).front();
+    write(repo.worktree() / "src" / "big" / added, added);
+    write(repo.worktree() / "README", "tog, again");
+    repo.commit("new shard");
+
+    fs::remove(repo.worktree() / "src" / "big" / added);
+    fs::remove(repo.worktree() / "src" / "main.cpp");
+    repo.commit("removed shard");
+
+    for (std::size_t i = 0; i < 10; ++i) {
+        fs::remove(repo.worktree() / "src" / "big" / names[i]);
+    }
+
+    repo.commit("unsharded");
+
+    TestRepository copy;
+    copy.fast_import(repo.fast_export("main"));
+
+    TOG_CHECK(copy.open().main() == repo.open().main());
+}
+
+std::string push_session(const std::string& objects,
+                         const std::optional<std::string>& old_main,
+                         const std::string& new_main) {
+    return std::string{sync_greeting} + "\npush\n" + objects + "update " +
+           old_main.value_or("-") + " " + new_main + "\n";
+}
+
+// the receiving side of a push checks that all objects have arrived and that
+// the main branch is only fast-forwarded, without trusting the sender
+void test_receive_push() {
+    TestRepository local;
+    write(local.worktree() / "file", "contents");
+    auto first = local.commit("first");
+
+    TestRepository remote;
+    auto all = [](const std::string&) { return true; };
+
+    TOG_CHECK(!remote.serve(push_session(
+        local.objects([](const std::string& contents) {
+            return contents != "contents";
+        }),
+        std::nullopt, first)));
+    TOG_CHECK(!remote.open().main());
+
+    TOG_CHECK(remote.serve(push_session(local.objects(all), std::nullopt,
+                                        first)));
+    TOG_CHECK(remote.open().main() == first);
+
+    // a commit that does not continue the remote main branch
+    TestRepository other;
+    write(other.worktree() / "other", "other");
+    auto unrelated = other.commit("unrelated");
+
+    TOG_CHECK(!remote.serve(push_session(other.objects(all), first,
+                                         unrelated)));
+    TOG_CHECK(remote.open().main() == first);
+}
+
+// checkout keeps untracked files, except where the commit has a file, which
+// replaces the untracked one (also when hard-linking it)
+void test_checkout_untracked() {
+    for (auto hardlink : {false, true}) {
+        TestRepository repo;
+        auto file = repo.worktree() / "file";
+
+        write(file, "committed");
+        auto first = repo.commit("first");
+
+        fs::remove(file);
+        repo.commit("second");
+
+        write(file, "untracked");
+        write(repo.worktree() / "other", "untracked");
+
+        auto repository = repo.open();
+        repository.checkout(first, hardlink);
+
+        std::vector<unsigned char> data;
+        TOG_CHECK(!read_file(file, data));
+        TOG_CHECK(std::string(data.begin(), data.end()) == "committed");
+        TOG_CHECK(fs::exists(repo.worktree() / "other"));
+        TOG_CHECK(repository.replaced_files() == 1);
+
+        // nothing is in the way the second time
+        repository.checkout(first, hardlink);
+        TOG_CHECK(repository.replaced_files() == 0);
+    }
+}
+
+}  // namespace
+
+int main() {
+    auto passed = test::run("sharded diff", test_sharded_diff);
+    passed &= test::run("shard threshold", test_shard_threshold);
+    passed &= test::run("export round trip", test_export_round_trip);
+    passed &= test::run("receive push", test_receive_push);
+    passed &= test::run("checkout untracked", test_checkout_untracked);
+
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,108 @@
+#include "scanner.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <system_error>
+
+namespace tog {
+
+namespace {
+
+// the record layout returned by getdents64, which glibc does not expose
+struct linux_dirent64 {
+    std::uint64_t d_ino;
+    std::int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+constexpr std::size_t buffer_size = 64 * 1024;
+
+}  // namespace
+
+DirectoryReader::DirectoryReader(int directory_fd)
+    : _fd{directory_fd}, _buffer{new char[buffer_size]} {}
+
+std::optional<DirectoryEntry> DirectoryReader::next() {
+    for (;;) {
+        if (_position >= _size) {
+            auto n = ::syscall(SYS_getdents64, _fd, _buffer.get(), buffer_size);
+
+            if (n < 0) {
+                throw std::system_error{errno, std::generic_category(),
+                                        "getdents64"};
+            } else if (n == 0) {
+                return std::nullopt;
+            }
+
+            _position = 0;
+            _size = static_cast<std::size_t>(n);
+        }
+
+        auto record =
+            reinterpret_cast<linux_dirent64*>(_buffer.get() + _position);
+        _position += record->d_reclen;
+
+        std::string_view name{record->d_name};
+
+        if (name == "." || name == "..") {
+            continue;
+        }
+
+        auto type = DirectoryEntry::Type::other;
+
+        switch (record->d_type) {
+            case DT_REG:
+                type = DirectoryEntry::Type::file;
+                break;
+
+            case DT_DIR:
+                type = DirectoryEntry::Type::directory;
+                break;
+
+            case DT_LNK:
+            case DT_UNKNOWN: {
+                // only ask for the type, which is cheap to answer
+                struct statx stx;
+
+                if (::statx(_fd, record->d_name, AT_STATX_DONT_SYNC,
+                            STATX_TYPE, &stx) == 0) {
+                    if (S_ISREG(stx.stx_mode)) {
+                        type = DirectoryEntry::Type::file;
+                    } else if (S_ISDIR(stx.stx_mode)) {
+                        type = DirectoryEntry::Type::directory;
+                    }
+                }
+                break;
+            }
+        }
+
+        return DirectoryEntry{name, type};
+    }
+}
+
+FileDescriptor open_directory(int parent_fd, const char* name) {
+    FileDescriptor fd{
+        ::openat(parent_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC)};
+
+    if (!fd) {
+        throw std::system_error{errno, std::generic_category(),
+                                std::string{"unable to open "} + name};
+    }
+
+    return fd;
+}
+
+FileDescriptor open_file_at(int directory_fd, const char* name) {
+    return FileDescriptor{::openat(directory_fd, name, O_RDONLY | O_CLOEXEC)};
+}
+
+}  // namespace tog
@@ -0,0 +1,55 @@
+#ifndef TOG_SCANNER_H
+#define TOG_SCANNER_H
+
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <string_view>
+
+#include "file.h"
+
+namespace tog {
+
+// A directory entry as reported by DirectoryReader
+struct DirectoryEntry {
+    enum class Type { file, directory, other };
+
+    // the entry's name, which is only valid until the next call to next()
+    std::string_view name;
+
+    Type type;
+};
+
+// Lists the entries of a directory. The directory is given as a file
+// descriptor, and entries are read in large batches with getdents64. The entry
+// type is taken from d_type where the filesystem provides it, so that only
+// symlinks and entries of unknown type need an additional statx call.
+// Symlinks are followed, i.e. a symlink to a directory is reported as a
+// directory.
+class DirectoryReader {
+public:
+    explicit DirectoryReader(int directory_fd);
+
+    // returns the next entry (skipping "." and ".."), or std::nullopt once all
+    // entries have been read
+    std::optional<DirectoryEntry> next();
+
+private:
+    int _fd;
+
+    std::unique_ptr<char[]> _buffer;
+    std::size_t _position = 0;
+    std::size_t _size = 0;
+};
+
+// opens the directory with the given name inside the directory referred to by
+// parent_fd (which may be AT_FDCWD). Throws a std::system_error on failure.
+FileDescriptor open_directory(int parent_fd, const char* name);
+
+// opens the file with the given name inside the given directory for reading.
+// Returns an invalid descriptor if the file does not exist.
+FileDescriptor open_file_at(int directory_fd, const char* name);
+
+}  // namespace tog
+
+#endif  // TOG_SCANNER_H
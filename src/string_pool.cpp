@@ -0,0 +1,22 @@
+#include "string_pool.h"
+
+#include <cstring>
+
+namespace tog {
+
+NameId StringPool::intern(std::string_view str) {
+    if (auto it = _ids.find(str); it != _ids.end()) {
+        return it->second;
+    }
+
+    auto data = static_cast<char*>(_storage.allocate(str.size(), 1));
+    std::memcpy(data, str.data(), str.size());
+
+    auto id = static_cast<NameId>(_strings.size());
+    auto& stored = _strings.emplace_back(data, str.size());
+    _ids.emplace(stored, id);
+
+    return id;
+}
+
+}  // namespace tog
@@ -0,0 +1,52 @@
+#ifndef TOG_STRING_POOL_H
+#define TOG_STRING_POOL_H
+
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "arena.h"
+
+namespace tog {
+
+// identifies a string in a StringPool
+using NameId = std::uint32_t;
+
+// A string pool stores each distinct string only once, and identifies it by a
+// small integer id. It is used for tree entry names, which repeat a lot across
+// the directories of a repository (think "CMakeLists.txt" or "index.js").
+// Interned strings are never freed, so views returned by get() stay valid for
+// the lifetime of the pool.
+class StringPool {
+public:
+    StringPool() = default;
+
+    StringPool(const StringPool&) = delete;
+    StringPool& operator=(const StringPool&) = delete;
+
+    // returns the id of the given string, adding it to the pool if needed
+    NameId intern(std::string_view str);
+
+    std::string_view get(NameId id) const {
+        return _strings[id];
+    }
+
+    std::size_t size() const {
+        return _strings.size();
+    }
+
+private:
+    // backs the characters of all interned strings
+    Arena _storage;
+
+    // maps ids to strings
+    std::vector<std::string_view> _strings;
+
+    // maps strings to ids
+    std::unordered_map<std::string_view, NameId> _ids;
+};
+
+}  // namespace tog
+
+#endif  // TOG_STRING_POOL_H
@@ -0,0 +1,147 @@
+#include "tar.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "file.h"
+
+namespace tog {
+
+namespace {
+
+// the ustar header block
+struct Header {
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char checksum[8];
+    char type;
+    char linkname[100];
+    char magic[6];
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+    char padding[12];
+};
+
+// the largest size that fits the 11 octal digits of the size field
+constexpr std::uint64_t max_ustar_size = 077777777777;
+
+// writes value as a zero-padded octal number filling all but the last byte
+// of the given field, which is left as NUL
+template <std::size_t N>
+void octal(char (&field)[N], std::uint64_t value) {
+    std::snprintf(field, N, "%0*llo", static_cast<int>(N - 1),
+                  static_cast<unsigned long long>(value));
+}
+
+// appends a pax record, which is prefixed with its own length in decimal
+void pax_record(std::string& records, std::string_view key,
+                std::string_view value) {
+    auto length = key.size() + value.size() + 3;
+    auto prefix = std::to_string(length);
+
+    // the length includes its own digits, which may add another digit
+    length += prefix.size();
+
+    if (std::to_string(length).size() != prefix.size()) {
+        ++length;
+    }
+
+    records.append(std::to_string(length))
+        .append(" ")
+        .append(key)
+        .append("=")
+        .append(value)
+        .append("\n");
+}
+
+}  // namespace
+
+TarWriter::TarWriter(int fd, std::time_t mtime) : _fd{fd}, _mtime{mtime} {
+    static_assert(sizeof(Header) == block_size);
+}
+
+void TarWriter::directory(std::string_view path) {
+    header(std::string{path} + "/", '5', 0);
+}
+
+void TarWriter::file(std::string_view path, std::uint64_t size,
+                     const std::function<void(int fd)>& write_data) {
+    header(path, '0', size);
+
+    flush();
+    write_data(_fd);
+
+    // the contents are padded to a full block
+    _buffer.append((block_size - size % block_size) % block_size, '\0');
+}
+
+void TarWriter::finish() {
+    _buffer.append(2 * block_size, '\0');
+    flush();
+}
+
+void TarWriter::header(std::string_view path, char type, std::uint64_t size) {
+    auto long_path = path.size() > sizeof(Header::name);
+    auto large = size > max_ustar_size;
+
+    if (long_path || large) {
+        std::string records;
+
+        if (long_path) {
+            pax_record(records, "path", path);
+        }
+
+        if (large) {
+            pax_record(records, "size", std::to_string(size));
+        }
+
+        // the extended header applies to the entry that follows it
+        header("././@PaxHeader", 'x', records.size());
+        _buffer.append(records);
+        _buffer.append((block_size - records.size() % block_size) % block_size,
+                       '\0');
+    }
+
+    Header block{};
+    std::memcpy(block.name, path.data(),
+                std::min(path.size(), sizeof(block.name)));
+    octal(block.mode, type == '5' ? 0755 : 0644);
+    octal(block.uid, 0);
+    octal(block.gid, 0);
+    octal(block.size, large ? 0 : size);
+    octal(block.mtime, static_cast<std::uint64_t>(_mtime));
+    block.type = type;
+    std::memcpy(block.magic, "ustar", 6);
+    std::memcpy(block.version, "00", 2);
+
+    // the checksum is computed with the checksum field set to spaces
+    std::memset(block.checksum, ' ', sizeof(block.checksum));
+
+    unsigned checksum = 0;
+
+    for (auto byte : std::string_view{reinterpret_cast<const char*>(&block),
+                                      sizeof(block)}) {
+        checksum += static_cast<unsigned char>(byte);
+    }
+
+    std::snprintf(block.checksum, sizeof(block.checksum), "%06o", checksum);
+    block.checksum[7] = ' ';
+
+    _buffer.append(reinterpret_cast<const char*>(&block), sizeof(block));
+}
+
+void TarWriter::flush() {
+    write_all(_fd, _buffer.data(), _buffer.size());
+    _buffer.clear();
+}
+
+}  // namespace tog
@@ -0,0 +1,52 @@
+#ifndef TOG_TAR_H
+#define TOG_TAR_H
+
+#include <cstdint>
+#include <ctime>
+#include <functional>
+#include <string>
+#include <string_view>
+
+namespace tog {
+
+// Writes a tar archive in the POSIX (pax) format to a file descriptor, e.g. a
+// file, a pipe or stdout. Entries use ustar headers; paths longer than 100
+// bytes and files of 8 GiB or more get an extended header.
+//
+// Headers and padding are buffered and written together, while file contents
+// are written to the descriptor directly, so that they can be copied
+// kernel-side (see send_file()).
+class TarWriter {
+public:
+    // all entries get the given modification time
+    TarWriter(int fd, std::time_t mtime);
+
+    // adds a directory, given without a trailing slash
+    void directory(std::string_view path);
+
+    // adds a file of the given size, whose contents are written to the
+    // descriptor by write_data, which must write exactly size bytes
+    void file(std::string_view path, std::uint64_t size,
+              const std::function<void(int fd)>& write_data);
+
+    // writes the end-of-archive marker
+    void finish();
+
+private:
+    static constexpr std::size_t block_size = 512;
+
+    // buffers the header of an entry, preceded by an extended header if the
+    // path or size do not fit
+    void header(std::string_view path, char type, std::uint64_t size);
+
+    // writes the buffered headers and padding
+    void flush();
+
+    int _fd;
+    std::time_t _mtime;
+    std::string _buffer;
+};
+
+}  // namespace tog
+
+#endif  // TOG_TAR_H
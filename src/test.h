@@ -0,0 +1,75 @@
+#ifndef TOG_TEST_H
+#define TOG_TEST_H
+
+#include <stdlib.h>
+
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+// A minimal harness for the tests next to the sources (src/*_test.cpp). Each
+// test is an executable whose main() runs its cases with run(), and which is
+// registered with ctest in CMakeLists.txt.
+
+// fails the current test case if the condition does not hold
+#define TOG_CHECK(condition)                                              \
+    ((condition) ? void()                                                 \
+                 : throw ::tog::test::Failure{std::string{__FILE__} + ":" + \
+                                              std::to_string(__LINE__) +  \
+                                              ": " #condition})
+
+namespace tog::test {
+
+struct Failure : std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+// a temporary directory, which is removed with its contents
+class TemporaryDirectory {
+public:
+    TemporaryDirectory() {
+        auto pattern =
+            (std::filesystem::temp_directory_path() / "tog-test.XXXXXX")
+                .string();
+
+        if (!::mkdtemp(pattern.data())) {
+            throw std::runtime_error{"unable to create a temporary directory"};
+        }
+
+        _path = pattern;
+    }
+
+    ~TemporaryDirectory() {
+        std::error_code err;
+        std::filesystem::remove_all(_path, err);
+    }
+
+    TemporaryDirectory(const TemporaryDirectory&) = delete;
+    TemporaryDirectory& operator=(const TemporaryDirectory&) = delete;
+
+    const std::filesystem::path& path() const {
+        return _path;
+    }
+
+private:
+    std::filesystem::path _path;
+};
+
+// runs a test case and reports its result. Returns false if it failed.
+inline bool run(const char* name, const std::function<void()>& test) {
+    try {
+        test();
+    } catch (const std::exception& e) {
+        std::cout << "FAIL " << name << ": " << e.what() << std::endl;
+        return false;
+    }
+
+    std::cout << "ok   " << name << std::endl;
+    return true;
+}
+
+}  // namespace tog::test
+
+#endif  // TOG_TEST_H
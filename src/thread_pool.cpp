@@ -0,0 +1,72 @@
+#include "thread_pool.h"
+
+namespace tog {
+
+ThreadPool::ThreadPool(unsigned threads) {
+    _threads.reserve(threads);
+
+    for (unsigned i = 0; i < threads; ++i) {
+        _threads.emplace_back([this] { run(); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    wait();
+
+    {
+        std::lock_guard lock{_mutex};
+        _stopping = true;
+    }
+
+    _task_available.notify_all();
+
+    for (auto& thread : _threads) {
+        thread.join();
+    }
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    {
+        std::lock_guard lock{_mutex};
+        _tasks.push(std::move(task));
+        ++_pending;
+    }
+
+    _task_available.notify_one();
+}
+
+void ThreadPool::wait() {
+    std::unique_lock lock{_mutex};
+    _idle.wait(lock, [this] { return _pending == 0; });
+}
+
+void ThreadPool::run() {
+    for (;;) {
+        std::function<void()> task;
+
+        {
+            std::unique_lock lock{_mutex};
+            _task_available.wait(
+                lock, [this] { return _stopping || !_tasks.empty(); });
+
+            if (_tasks.empty()) {
+                return;
+            }
+
+            task = std::move(_tasks.front());
+            _tasks.pop();
+        }
+
+        task();
+
+        {
+            std::lock_guard lock{_mutex};
+
+            if (--_pending == 0) {
+                _idle.notify_all();
+            }
+        }
+    }
+}
+
+}  // namespace tog
@@ -0,0 +1,62 @@
+#ifndef TOG_THREAD_POOL_H
+#define TOG_THREAD_POOL_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace tog {
+
+// A fixed set of worker threads executing tasks from a shared queue.
+class ThreadPool {
+public:
+    // creates a pool with the given number of threads (by default, one per
+    // core)
+    explicit ThreadPool(unsigned threads = default_threads());
+
+    // waits for all tasks to finish and stops the worker threads
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // queues a task for execution on one of the worker threads. Tasks must
+    // not throw.
+    void submit(std::function<void()> task);
+
+    // blocks until all submitted tasks have finished
+    void wait();
+
+    std::size_t size() const {
+        return _threads.size();
+    }
+
+    static unsigned default_threads() {
+        auto cores = std::thread::hardware_concurrency();
+        return cores > 0 ? cores : 1;
+    }
+
+private:
+    void run();
+
+    std::vector<std::thread> _threads;
+
+    std::mutex _mutex;
+    std::condition_variable _task_available;
+    std::condition_variable _idle;
+
+    std::queue<std::function<void()>> _tasks;
+
+    // number of tasks that are queued or running
+    std::size_t _pending = 0;
+
+    bool _stopping = false;
+};
+
+}  // namespace tog
+
+#endif  // TOG_THREAD_POOL_H
@@ -2,15 +2,125 @@
 
 #include <tomlplusplus/toml.h>
 
+#include <algorithm>
 #include <sstream>
+#include <string>
 
 using namespace tog;
 
 namespace tog {
 
-Tree::Tree(std::unordered_map<std::string, Handle<Blob>> &&blobs,
-           std::unordered_map<std::string, Handle<Tree>> &&trees)
-    : _blobs{std::move(blobs)}, _trees{std::move(trees)} {}
+namespace {
+
+bool is_bare_key_character(char c) {
+    return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') ||
+           (c >= '0' && c <= '9') || c == '-' || c == '_';
+}
+
+// TOML keys are printed bare if possible, and in double quotes otherwise.
+// Appends the key to out and returns true, unless the key needs escaping.
+bool append_key(std::string_view key, std::string &out) {
+    if (key.empty()) {
+        return false;
+    }
+
+    bool bare = true;
+
+    for (char c : key) {
+        if (c < 0x20 || c > 0x7E || c == '"' || c == '\\') {
+            return false;
+        }
+
+        bare = bare && is_bare_key_character(c);
+    }
+
+    if (bare) {
+        out.append(key);
+    } else {
+        out.push_back('"');
+        out.append(key);
+        out.push_back('"');
+    }
+
+    return true;
+}
+
+}  // namespace
+
+Tree::Tree(const StringPool &names, std::vector<Entry> &&entries)
+    : _names{&names}, _entries{std::move(entries)} {
+    std::sort(_entries.begin(), _entries.end(),
+              [this](const Entry &a, const Entry &b) {
+                  return name(a) < name(b);
+              });
+}
+
+unsigned Tree::shard(std::string_view name, unsigned depth) {
+    // FNV-1a, which is cheap and spreads similar names (such as
+    // "part-00001", "part-00002", ...) evenly over the shards
+    std::uint64_t hash = 0xcbf29ce484222325;
+
+    for (char c : name) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 0x100000001b3;
+    }
+
+    return (hash >> (60 - 4 * depth)) & 0xf;
+}
+
+bool Tree::visit_ids(
+    std::string_view serialized,
+    const std::function<void(Kind kind, const ObjectId &id)> &visit) {
+    // every entry is a line of the form <key> = 'HEX', and the key may be
+    // quoted, so the id is taken from the end of the line
+    constexpr auto value_size = ObjectId::size * 2 + 2;
+    std::optional<Kind> kind;
+
+    while (!serialized.empty()) {
+        auto end = serialized.find('\n');
+        auto line = serialized.substr(0, end);
+        serialized.remove_prefix(end == std::string_view::npos ? serialized.size()
+                                                               : end + 1);
+
+        if (line.empty()) {
+            continue;
+        } else if (line == "[blobs]") {
+            kind = Kind::blob;
+        } else if (line == "[trees]") {
+            kind = Kind::tree;
+        } else if (line == "[shards]") {
+            kind = Kind::shard;
+        } else {
+            if (!kind || line.size() < value_size ||
+                line[line.size() - value_size] != '\'' || line.back() != '\'') {
+                return false;
+            }
+
+            auto id = ObjectId::from_hex(
+                line.substr(line.size() - value_size + 1, ObjectId::size * 2));
+
+            if (!id) {
+                return false;
+            }
+
+            visit(*kind, *id);
+        }
+    }
+
+    return true;
+}
+
+const Tree::Entry *Tree::find(std::string_view name) const {
+    auto it = std::lower_bound(
+        _entries.begin(), _entries.end(), name,
+        [this](const Entry &a, std::string_view b) { return this->name(a) < b; });
+
+    if (it == _entries.end() || this->name(*it) != name) {
+        return nullptr;
+    }
+
+    return &*it;
+}
 
 const std::vector<unsigned char> &Tree::serialize() {
     // serialize lazily
@@ -18,15 +128,64 @@ const std::vector<unsigned char> &Tree::serialize() {
         return *_serialized;
     }
 
-    // encode as toml
-    auto blobs_toml = toml::table();
-    for (const auto &[name, blob] : _blobs) {
-        blobs_toml.insert(name, blob.hash());
+    // Trees are encoded as toml, with one table per entry kind. Since the
+    // entries are already sorted, the common case of plain entry names is
+    // written out directly, in the exact format toml++ would produce.
+    std::string tree_str;
+    tree_str.reserve(32 + _entries.size() * (ObjectId::size * 2 + 24));
+
+    // appends all entries of the given kind, unless a name needs escaping
+    auto append_entries = [&](Kind kind) {
+        for (const auto &entry : _entries) {
+            if (entry.kind != kind) {
+                continue;
+            }
+
+            tree_str.push_back('\n');
+
+            if (!append_key(name(entry), tree_str)) {
+                return false;
+            }
+
+            tree_str.append(" = '");
+            tree_str.append(entry.id.hex());
+            tree_str.push_back('\'');
+        }
+
+        return true;
+    };
+
+    bool complete;
+
+    // sharded trees only have a table of shards, whose names never need
+    // escaping
+    if (sharded()) {
+        tree_str.append("[shards]");
+        complete = append_entries(Kind::shard);
+    } else {
+        tree_str.append("[blobs]");
+        complete = append_entries(Kind::blob);
+        tree_str.append("\n\n[trees]");
+        complete = complete && append_entries(Kind::tree);
+    }
+
+    if (!complete) {
+        serialize_toml();
+        return *_serialized;
     }
 
+    _serialized.emplace(tree_str.begin(), tree_str.end());
+
+    return *_serialized;
+}
+
+void Tree::serialize_toml() {
+    auto blobs_toml = toml::table();
     auto trees_toml = toml::table();
-    for (const auto &[name, tree] : _trees) {
-        trees_toml.insert(name, tree.hash());
+
+    for (const auto &entry : _entries) {
+        auto &table = entry.kind == Kind::blob ? blobs_toml : trees_toml;
+        table.insert(std::string{name(entry)}, entry.id.hex());
     }
 
     auto tree_toml = toml::table{{
@@ -40,8 +199,6 @@ const std::vector<unsigned char> &Tree::serialize() {
 
     std::string tree_str = stream.str();
     _serialized.emplace(tree_str.begin(), tree_str.end());
-
-    return *_serialized;
 }
 
 }  // namespace tog
@@ -1,38 +1,107 @@
 #ifndef TOG_TREE_H
 #define TOG_TREE_H
 
-#include <string>
-#include <unordered_map>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string_view>
+#include <vector>
 
-#include "blob.h"
-#include "handle.h"
 #include "object.h"
+#include "string_pool.h"
 
 namespace tog {
 
+// A tree lists the files and subdirectories of a directory.
+//
+// Directories with more than shard_threshold entries are split into a hash
+// array mapped trie: the entries are distributed over up to 16 shards by a hex
+// digit of their name's hash, and shards that are still too large are split
+// again by the next digit. The directory's tree then only holds shard entries,
+// named after their digit, which point to the trees holding the actual
+// entries. This way, changing a single entry only rewrites the small trees on
+// its path, and looking up an entry only needs to load those trees.
 class Tree : public TogObject {
 public:
-    Tree(std::unordered_map<std::string, Handle<Blob>> &&blobs,
-         std::unordered_map<std::string, Handle<Tree>> &&trees);
+    enum class Kind : std::uint8_t { blob, tree, shard };
+
+    // a single file (blob) or subdirectory (tree) in the tree, or a shard of
+    // a sharded tree
+    struct Entry {
+        NameId name;
+        Kind kind;
+        ObjectId id;
+    };
+
+    // creates a tree from the given entries, whose names are stored in the
+    // given pool. The entries do not need to be sorted.
+    Tree(const StringPool &names, std::vector<Entry> &&entries);
+
+    static constexpr ObjectKind kind = ObjectKind::tree;
+
+    // trees with more entries than this are split into shards
+    static constexpr std::size_t shard_threshold = 4096;
+
+    // each level of sharding consumes one hex digit of the 64-bit name hash
+    static constexpr unsigned max_shard_depth = 16;
+
+    // returns the shard (0-15) that holds the entry with the given name at the
+    // given depth of the trie
+    static unsigned shard(std::string_view name, unsigned depth);
+
+    // returns the entry name used for the given shard
+    static std::string_view shard_name(unsigned shard) {
+        return std::string_view{"0123456789abcdef"}.substr(shard, 1);
+    }
 
     const std::vector<unsigned char> &serialize();
 
-    std::unordered_map<std::string, Handle<Blob>> &blobs() {
-        return _blobs;
+    std::size_t memory_size() const {
+        return sizeof(Tree) + _entries.capacity() * sizeof(Entry) +
+               (_serialized ? _serialized->capacity() : 0);
     }
 
-    std::unordered_map<std::string, Handle<Tree>> &trees() {
-        return _trees;
+    // returns all entries, sorted by name
+    const std::vector<Entry> &entries() const {
+        return _entries;
+    }
+
+    std::string_view name(const Entry &entry) const {
+        return _names->get(entry.name);
+    }
+
+    // returns the entry with the given name, or nullptr if there is none.
+    // In sharded trees, entries are named after their shard.
+    const Entry *find(std::string_view name) const;
+
+    // calls visit(kind, id) for every entry of a serialized tree, without
+    // parsing (or even unescaping) the entry names. This is much cheaper than
+    // deserializing the tree when only the referenced objects are of interest.
+    // Returns false if the tree is malformed.
+    static bool visit_ids(
+        std::string_view serialized,
+        const std::function<void(Kind kind, const ObjectId &id)> &visit);
+
+    // returns whether the tree consists of shards, rather than blobs and trees
+    bool sharded() const {
+        return !_entries.empty() && _entries.front().kind == Kind::shard;
     }
 
 private:
+    // serializes the tree through toml++, which handles quoting and escaping
+    // of arbitrary entry names
+    void serialize_toml();
+
     // cached serialized tree, for lazy serialization
     std::optional<std::vector<unsigned char>> _serialized;
 
-    std::unordered_map<std::string, Handle<Blob>> _blobs;
-    std::unordered_map<std::string, Handle<Tree>> _trees;
+    // the pool holding the entry names
+    const StringPool *_names;
+
+    // the tree's entries, sorted by name to allow for binary search
+    std::vector<Entry> _entries;
 };
 
 }  // namespace tog
 
-#endif  // TOG_TREE_H
\ No newline at end of file
+#endif  // TOG_TREE_H